@@ -29,6 +29,7 @@ file(GLOB_RECURSE netwarp_SRC
      "${NETWARP_SOURCE_DIR}/utils/*.*"
      "${NETWARP_SOURCE_DIR}/include/*.*"
      "${NETWARP_SOURCE_DIR}/src/*.*"
+     "${NETWARP_SOURCE_DIR}/tools/*.*"
    )
 
 foreach(_current_file IN LISTS netwarp_SRC)
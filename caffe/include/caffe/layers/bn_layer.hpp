@@ -10,7 +10,17 @@
 namespace caffe {
 /**
  * @brief Batch normalization the input blob along the channel axis while
- *        averaging over the spatial axes.
+ *        averaging over the spatial axes. With bn_param.layout = NHWC the
+ *        blob is channels-last, (num, height, width, channels).
+ *        When frozen or in the TEST phase, Forward_cpu applies the stored
+ *        statistics as one per-channel affine transform, in a single pass
+ *        on bn_param.num_threads threads. In training, the batch statistics
+ *        take one more pass, and Backward_cpu two (the gradient sums, then
+ *        the input gradient). The activation-sized buffers are only
+ *        allocated for the batch statistics of training, so with fixed
+ *        statistics the layer needs O(channels) scratch.
+ *        With bn_param.relu the output is also rectified, as by a following
+ *        in-place ReLU layer, in the same pass.
  *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
@@ -28,6 +38,9 @@ class BNLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
+  /// @brief Number of elements of the internal buffers, for memory reports.
+  int scratch_count() const;
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -40,10 +53,17 @@ class BNLayer : public Layer<Dtype> {
 
   void AverageAllExceptChannel(const Dtype* input, Dtype* output);
   void BroadcastChannel(const Dtype* input, Dtype* output);
+  // Sizes the broadcast buffers of the GPU training pass
+  void ReshapeBroadcast();
+  // Scale and shift of the fixed statistics into affine_, on the GPU
+  void FixedAffine_gpu();
 
   bool frozen_;
   Dtype bn_momentum_;
   Dtype bn_eps_;
+  Layout layout_;
+  int num_threads_;
+  bool relu_;
 
   int num_;
   int channels_;
@@ -57,6 +77,9 @@ class BNLayer : public Layer<Dtype> {
   Blob<Dtype> x_norm_;
   Blob<Dtype> x_inv_std_;
 
+  // Per-channel scale and shift, or gradient sums
+  Blob<Dtype> affine_;
+
   Blob<Dtype> spatial_sum_multiplier_;
   Blob<Dtype> batch_sum_multiplier_;
 };
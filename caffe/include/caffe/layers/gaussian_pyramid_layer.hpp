@@ -0,0 +1,67 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_GAUSSIAN_PYRAMID_LAYER_HPP_
+#define CAFFE_GAUSSIAN_PYRAMID_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Pyramid of 2x decimations of the bottom, one top per level, as
+ *        computed by caffe_cpu_pyramid2: every pixel of level l + 1 is the
+ *        mean of a 2x2 block of level l, whose size is halved (rounded
+ *        down). The first top is the bottom decimated once.
+ *
+ * interp_param.layout selects NCHW or NHWC blobs and
+ * interp_param.num_threads the CPU threads.
+ */
+template <typename Dtype>
+class GaussianPyramidLayer : public Layer<Dtype> {
+ public:
+  explicit GaussianPyramidLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "GaussianPyramid"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Spatial size of level l, 0 being the bottom
+  inline int level_height(const int l) const { return height_ >> l; }
+  inline int level_width(const int l) const { return width_ >> l; }
+
+  Layout layout_;
+  int num_threads_;
+  // Gradients of the levels, the top diff plus that of the next level
+  Blob<Dtype> level_diff_[2];
+
+  int num_;
+  int channels_;
+  int height_;
+  int width_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_GAUSSIAN_PYRAMID_LAYER_HPP_
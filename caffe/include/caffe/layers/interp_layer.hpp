@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/interp.hpp"
 
 namespace caffe {
 /**
@@ -13,6 +14,15 @@ namespace caffe {
  *        The target size is specified in terms of pixels. 
  *        The start and end pixels of the input are mapped to the start
  *        and end pixels of the output.
+ *        With interp_param.layout = NHWC the bottom and top blobs are
+ *        channels-last, (num, height, width, channels).
+ *        With interp_param.storage = FP16 or BF16, Forward_cpu reads a
+ *        16-bit copy of the bottom blob, and Forward_gpu runs Forward_cpu.
+ *        Forward_cpu and Backward_cpu run on interp_param.num_threads
+ *        threads with interpolation tables computed in Reshape.
+ *        With interp_param.pyramid, a shrinking layer builds the Gaussian
+ *        pyramid of the bottom up to the level picked by the area ratio
+ *        and interpolates from that level.
  */
 template <typename Dtype>
 class InterpLayer : public Layer<Dtype> {
@@ -37,12 +47,40 @@ class InterpLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  void Forward_cpu_half(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Forward_cpu_pyramid(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_cpu_pyramid(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom);
+  void Forward_gpu_pyramid(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_gpu_pyramid(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom);
+  // Computes the input and output sizes and the tables from interp_param.
+  void Reshape_sizes(const vector<Blob<Dtype>*>& bottom);
   
   int num_, channels_;
   int height_in_, width_in_;
   int height_out_, width_out_;
   int pad_beg_, pad_end_;
   int height_in_eff_, width_in_eff_;
+  Layout layout_;
+  StoragePrecision storage_;
+  shared_ptr<SyncedMemory> bottom_half_;
+  int num_threads_;
+  // Interpolation tables of the current input (or pyramid level) and
+  // output sizes
+  Interp2Tables<Dtype> tables_;
+  // Pyramid level interpolated from, 0 being the bottom, and the levels
+  // 1..level_ (one image after the other with NHWC) with their gradients
+  bool pyramid_;
+  int level_;
+  Blob<Dtype> pyramid_levels_;
+  inline int level_height(const int l) const { return height_in_ >> l; }
+  inline int level_width(const int l) const { return width_in_ >> l; }
+  // Offset of level l in pyramid_levels_ (in an image with NHWC)
+  int level_offset(const int l) const;
 };
 
 }  // namespace caffe
@@ -0,0 +1,82 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_INTERP_SOFTMAX_LAYER_HPP_
+#define CAFFE_INTERP_SOFTMAX_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/interp_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Output layer of a segmentation net: bi-linear upsampling of the
+ *        logits as the Interp layer, followed by the softmax over the
+ *        channels and the label of the highest probability.
+ *
+ * The output is computed in bands of rows that stay in cache, so the
+ * upsampled logits are never stored. interp_param gives the output size
+ * as for the Interp layer (NCHW and FP32 storage only);
+ * interp_softmax_param selects the tops, the probabilities
+ * (num, channels, height, width) and/or the labels (num, 1, height, width),
+ * and whether the probabilities are added to the previous contents of
+ * their top, for ensembling over tiles or a mirrored pass.
+ * This is an inference layer: it has no gradient and no GPU
+ * implementation, and its setup fails in GPU mode, where the Interp and
+ * Softmax layers are used instead.
+ */
+template <typename Dtype>
+class InterpSoftmaxLayer : public InterpLayer<Dtype> {
+ public:
+  explicit InterpSoftmaxLayer(const LayerParameter& param)
+      : InterpLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "InterpSoftmax"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return -1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    NOT_IMPLEMENTED;
+  }
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    NOT_IMPLEMENTED;
+  }
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    NOT_IMPLEMENTED;
+  }
+  // Computes the (n, band) tasks [begin, end); prob or label is NULL if
+  // the layer does not output it.
+  void Forward_cpu_bands(const Dtype* bottom_data, Dtype* prob,
+      Dtype* label, const int begin, const int end);
+
+  bool output_prob_;
+  bool output_label_;
+  bool accumulate_;
+  bool mirror_;
+  // Output rows of a band, whose logits fill about 256 KB
+  int band_rows_;
+  int bands_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INTERP_SOFTMAX_LAYER_HPP_
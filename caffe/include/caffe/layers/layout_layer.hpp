@@ -0,0 +1,57 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_LAYOUT_LAYER_HPP_
+#define CAFFE_LAYOUT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Converts a 4-D blob between the NCHW and the channels-last (NHWC)
+ *        layout. layout_param.layout is the layout of the top blob; the
+ *        bottom blob is taken to have the other one.
+ */
+template <typename Dtype>
+class LayoutLayer : public Layer<Dtype> {
+ public:
+  explicit LayoutLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "Layout"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  Layout layout_;
+  int num_;
+  // Every image of the bottom blob is a rows_ x cols_ matrix that is
+  // transposed into the top blob: channels x (height * width) for NCHW to
+  // NHWC and (height * width) x channels for NHWC to NCHW.
+  int rows_;
+  int cols_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_LAYOUT_LAYER_HPP_
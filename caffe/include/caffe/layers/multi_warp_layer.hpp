@@ -0,0 +1,128 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_MULTI_WARP_LAYER_HPP_
+#define CAFFE_MULTI_WARP_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Weighted sum of K previous frames warped to the current one:
+ *        top = [w_cur * cur +] sum_k w_k * warp(prev_k, flow_k).
+ *
+ * Bottoms: optionally cur and w_cur, then a (prev_k, flow_k, w_k) triple
+ * per previous frame, so 3K or 3K + 2 blobs. This replaces K Warp layers
+ * and their Eltwise PROD and SUM layers; every source is read once and the
+ * output plane stays in cache while the K frames are accumulated into it.
+ * The features and the weights are NCHW blobs of the same shape; the K
+ * flows are (num, 2, flow_height, flow_width) blobs of the same shape and
+ * are used as by the Warp layer, with the outliers, flow_scale and
+ * num_threads of warp_param.
+ */
+template <typename Dtype>
+class MultiWarpLayer : public Layer<Dtype> {
+ public:
+  explicit MultiWarpLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "MultiWarp"; }
+  virtual inline int MinBottomBlobs() const { return 3; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Indices of cur and w_cur, if has_cur_, and of the previous frame,
+  // flow and weight k among the bottoms. Layers that order their bottoms
+  // differently override them.
+  virtual inline int cur_bottom() const { return 0; }
+  virtual inline int w_cur_bottom() const { return 1; }
+  virtual inline int prev_bottom(const int k) const {
+    return (has_cur_ ? 2 : 0) + 3 * k;
+  }
+  virtual inline int flow_bottom(const int k) const {
+    return prev_bottom(k) + 1;
+  }
+  virtual inline int weight_bottom(const int k) const {
+    return prev_bottom(k) + 2;
+  }
+  // Shapes the sampling plans and warped_, which lean inference leaves
+  // empty.
+  void Reshape_buffers();
+  // Builds the sampling plans of the K flows.
+  void Plan_cpu(const vector<Blob<Dtype>*>& bottom);
+  // Builds the sampling plans for the (k, n, h) rows [begin, end).
+  void Plan_cpu_rows(const Dtype* const* flows, int* plan_offset,
+      Dtype* plan_weight, Dtype* plan_theta, const int begin, const int end);
+  // Warps the K frames of the (n, c) planes [begin, end) into warped with
+  // the sampling plans and, if top_data is not NULL, accumulates them into
+  // the output plane while it is in cache.
+  void Forward_cpu_planes(const Dtype* cur, const Dtype* w_cur,
+      const Dtype* const* prevs, const Dtype* const* weights, Dtype* warped,
+      Dtype* top_data, const int begin, const int end);
+  // Lean inference of the (n, h) rows [begin, end): the K plans of a row
+  // are built on the fly and the warped rows only live in a row buffer.
+  void Forward_cpu_lean_rows(const Dtype* cur, const Dtype* w_cur,
+      const Dtype* const* prevs, const Dtype* const* flows,
+      const Dtype* const* weights, Dtype* top_data, const int begin,
+      const int end);
+  // Gradients of prev_k and of flow_k at the image size from warped_diff_
+  // for the threads [begin, end) of threads, each owning a range of (n, c)
+  // planes; thread t > 0 accumulates the flow gradient into its part of
+  // flow_diff_partial. prev_diff and flow_diff may be NULL.
+  void Backward_cpu_thread(const int k, const Dtype* prev, Dtype* prev_diff,
+      Dtype* flow_diff, Dtype* flow_diff_partial, const int threads,
+      const int begin, const int end);
+
+  WarpParameter_WarpType outliers_;
+  int num_threads_;
+  // TEST phase: the plans and warped_ are only built if Backward is called
+  bool lean_;
+  // Whether the first two bottoms are cur and w_cur
+  bool has_cur_;
+  // Number of previous frames
+  int frames_;
+  // Sampling plans of the CPU path, (K, num, ...), see caffe_cpu_warp_plan
+  Blob<int> plan_offset_;
+  Blob<Dtype> plan_weight_;
+  Blob<Dtype> plan_theta_;
+  // warp(prev_k, flow_k) of the K frames, for the gradients of the w_k
+  Blob<Dtype> warped_;
+  // w_k * top_diff, the gradient of warp(prev_k, flow_k)
+  Blob<Dtype> warped_diff_;
+  // Flow gradient at the image size when the flows are resampled
+  Blob<Dtype> flow_diff_full_;
+  // Flow gradient of the backward threads other than the first
+  Blob<Dtype> flow_diff_partial_;
+
+  int num_;
+  int channels_;
+  int height_;
+  int width_;
+  int flow_height_;
+  int flow_width_;
+  Dtype flow_scale_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_MULTI_WARP_LAYER_HPP_
@@ -0,0 +1,52 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_NETWARP_COMBINE_LAYER_HPP_
+#define CAFFE_NETWARP_COMBINE_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/multi_warp_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Combines the features of the current frame with the warped
+ *        features of the previous frame in one pass:
+ *        top = w_cur * cur + w_prev * warp(prev, flow).
+ *
+ * Bottoms: cur, prev, flow, w_cur and w_prev. This is the Warp layer
+ * followed by two Eltwise PROD and an Eltwise SUM, without the intermediate
+ * blobs. cur, prev, w_cur and w_prev are NCHW blobs of the same shape; the
+ * flow is (num, 2, flow_height, flow_width) and is used as by the Warp
+ * layer, with the outliers, flow_scale and num_threads of warp_param.
+ *
+ * This is the MultiWarp layer with one previous frame and the bottoms in
+ * the order of the NetWarp prototxts.
+ */
+template <typename Dtype>
+class NetWarpCombineLayer : public MultiWarpLayer<Dtype> {
+ public:
+  explicit NetWarpCombineLayer(const LayerParameter& param)
+      : MultiWarpLayer<Dtype>(param) {}
+
+  virtual inline const char* type() const { return "NetWarpCombine"; }
+  virtual inline int ExactNumBottomBlobs() const { return 5; }
+
+ protected:
+  virtual inline int cur_bottom() const { return 0; }
+  virtual inline int w_cur_bottom() const { return 3; }
+  virtual inline int prev_bottom(const int k) const { return 1; }
+  virtual inline int flow_bottom(const int k) const { return 2; }
+  virtual inline int weight_bottom(const int k) const { return 4; }
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NETWARP_COMBINE_LAYER_HPP_
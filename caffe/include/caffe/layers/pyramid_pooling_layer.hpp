@@ -0,0 +1,82 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_PYRAMID_POOLING_LAYER_HPP_
+#define CAFFE_PYRAMID_POOLING_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Average pooling of an NCHW blob at several levels, one top per
+ *        level, as the Pooling layers (pool: AVE, no padding) of the
+ *        pyramid pooling module of PSPNet.
+ *
+ * The CPU path reads the bottom once: it builds the summed-area table of
+ * a channel, from which every window sum of every level is four lookups,
+ * and runs on pyramid_pooling_param.num_threads threads over the channels.
+ * The sums are accumulated in double precision, so the outputs can differ
+ * from those of the Pooling layer, which sums in Dtype, by rounding.
+ * The gradient spreads the window gradients with the same table, built
+ * from the window corners.
+ */
+template <typename Dtype>
+class PyramidPoolingLayer : public Layer<Dtype> {
+ public:
+  explicit PyramidPoolingLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "PyramidPooling"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Thread t of [begin, end) pools its share of the (n, c) planes into the
+  // tops of every level.
+  void Forward_cpu_thread(const Dtype* bottom_data, Dtype* const* top_data,
+      const int begin, const int end);
+  // Gradient of the planes of the threads [begin, end).
+  void Backward_cpu_thread(const Dtype* const* top_diff, Dtype* bottom_diff,
+      const int begin, const int end);
+
+  int num_threads_;
+  // Threads used for the current shape, at most one per plane
+  int threads_;
+  // One (height + 1) x (width + 1) table per thread, the summed-area table
+  // in the forward pass and the window corners in the backward pass
+  vector<double> table_;
+  // Window size, stride and output size of every level
+  vector<int> kernel_size_;
+  vector<int> stride_;
+  vector<int> pooled_height_;
+  vector<int> pooled_width_;
+
+  int num_;
+  int channels_;
+  int height_;
+  int width_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_PYRAMID_POOLING_LAYER_HPP_
@@ -0,0 +1,67 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_PYRAMID_UPSAMPLE_CONCAT_LAYER_HPP_
+#define CAFFE_PYRAMID_UPSAMPLE_CONCAT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/interp.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Concatenation along the channels of NCHW blobs bi-linearly
+ *        interpolated to the size of the first one, as the pyramid pooling
+ *        module of PSPNet does with Interp layers followed by a Concat
+ *        layer.
+ *
+ * Every bottom is interpolated (or copied, if it already has the size of
+ * the first bottom) straight into its channel slice of the top, so neither
+ * the upsampled blobs nor the concatenation copy exist. The interpolation
+ * is that of the Interp layer, without cropping, on
+ * interp_param.num_threads threads.
+ */
+template <typename Dtype>
+class PyramidUpsampleConcatLayer : public Layer<Dtype> {
+ public:
+  explicit PyramidUpsampleConcatLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "PyramidUpsampleConcat"; }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  int num_threads_;
+  // Interpolation tables of every bottom to the output size
+  vector<Interp2Tables<Dtype> > tables_;
+  // First channel of every bottom in the top
+  vector<int> channel_offset_;
+
+  int num_;
+  int height_;
+  int width_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_PYRAMID_UPSAMPLE_CONCAT_LAYER_HPP_
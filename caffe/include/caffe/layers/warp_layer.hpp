@@ -6,6 +6,7 @@
 #ifndef CAFFE_WARP_LAYER_HPP_
 #define CAFFE_WARP_LAYER_HPP_
 
+#include <stdint.h>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -16,6 +17,17 @@ namespace caffe {
 
 /**
  * @brief Warp input blob according to given optical flow.
+ *
+ * The image and the output are NCHW or, with warp_param.layout = NHWC,
+ * channels-last; the optical flow is always (num, 2, flow_height,
+ * flow_width). A flow of another size than the image is bilinearly
+ * resampled on the fly and multiplied by warp_param.flow_scale.
+ * With warp_param.storage = FP16 or BF16, Forward_cpu gathers from a 16-bit
+ * copy of the image; the output and the gradients stay in Dtype. With
+ * UINT8 it gathers from an 8-bit copy quantized per channel by
+ * warp_param.quant_scale and quant_zero_point, interpolates in fixed point
+ * and dequantizes each output once. Forward_gpu then runs Forward_cpu, so
+ * that both modes give the same output.
  */
 template <typename Dtype>
 class WarpLayer : public Layer<Dtype> {
@@ -41,15 +53,87 @@ class WarpLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Shapes the per-pixel buffers, which lean inference leaves empty.
+  void Reshape_buffers();
+  // Builds the sampling plan of the whole flow into plan_*_.
+  void Plan_cpu(const Dtype* bottom_1_data_);
+  // Builds the sampling plan for the (n, h) rows [begin, end).
+  void Plan_cpu_rows(const Dtype* bottom_1_data_, int* plan_offset,
+      Dtype* plan_weight, Dtype* plan_theta, const int begin, const int end);
+  // Converts the elements [begin, end) of data to the storage precision.
+  void Convert_cpu_half(const Dtype* data, uint16_t* data_half,
+      const int begin, const int end);
+  // Quantizes the (n, c) planes, or the pixels if channels-last,
+  // [begin, end) of data to 8 bits.
+  void Quantize_cpu_u8(const Dtype* data, uint8_t* data_u8, const int begin,
+      const int end);
+  // Warps the (n, c) planes [begin, end) with the sampling plan. The image
+  // is read from bottom_0_half instead if it is not NULL.
+  void Forward_cpu_planes(const Dtype* bottom_0_data_,
+      const uint16_t* bottom_0_half, const int* plan_offset,
+      const Dtype* plan_weight, Dtype* top_data, const int begin,
+      const int end);
+  // Warps the (n, h) rows [begin, end) of channels-last images.
+  void Forward_cpu_packed_rows(const Dtype* bottom_0_data_,
+      const uint16_t* bottom_0_half, const int* plan_offset,
+      const Dtype* plan_weight, Dtype* top_data, const int begin,
+      const int end);
+  // Same as the two above for the 8-bit image and the fixed-point plan.
+  void Forward_cpu_planes_u8(const uint8_t* bottom_0_u8,
+      const int* plan_offset, const int* plan_qweight, Dtype* top_data,
+      const int begin, const int end);
+  void Forward_cpu_packed_rows_u8(const uint8_t* bottom_0_u8,
+      const int* plan_offset, const int* plan_qweight, Dtype* top_data,
+      const int begin, const int end);
+
+  // Lean inference of the (n, h) rows [begin, end): the plan of a row is
+  // built on the fly and shared by all the channels of that row. The image
+  // is read from bottom_0_half or bottom_0_u8 if either is not NULL.
+  void Forward_cpu_lean_rows(const Dtype* bottom_0_data_,
+      const uint16_t* bottom_0_half, const uint8_t* bottom_0_u8,
+      const Dtype* bottom_1_data_, Dtype* top_data, const int begin,
+      const int end);
+  // Backward pass of thread t for t in [begin, end), out of `threads`.
+  // Either gradient may be NULL to skip it.
+  void Backward_cpu_thread(const Dtype* top_diff, const Dtype* bottom_0_data,
+      Dtype* bottom_0_diff, Dtype* bottom_1_diff, Dtype* flow_diff_partial,
+      const int threads, const int begin, const int end);
+
   WarpParameter_WarpType outliers_;
+  Layout layout_;
+  int num_threads_;
+  // TEST phase: the buffers below are neither allocated nor written by
+  // Forward and only built if Backward is called.
+  bool lean_;
+  // Sampling coordinates of the GPU kernels
   Blob<Dtype> theta;
   Blob<Dtype> theta_;
   Blob<Dtype> x_w;
+  // Sampling plan of the CPU path, see caffe_cpu_warp_plan
+  Blob<int> plan_offset_;
+  Blob<Dtype> plan_weight_;
+  Blob<Dtype> plan_theta_;
+  // Flow gradient of the backward threads other than the first
+  Blob<Dtype> flow_diff_partial_;
+  // Flow gradient at the image size when the flow is resampled
+  Blob<Dtype> flow_diff_full_;
+  // Precision of the image read by Forward_cpu, and the 16-bit copy
+  StoragePrecision storage_;
+  shared_ptr<SyncedMemory> image_half_;
+  // UINT8 storage: quantization of each channel, the 8-bit copy of the
+  // image and the fixed-point weights of the plan
+  vector<Dtype> quant_scale_;
+  vector<int> quant_zero_point_;
+  shared_ptr<SyncedMemory> image_u8_;
+  Blob<int> plan_qweight_;
 
   int num_;
   int channels_;
   int height_;
   int width_;
+  int flow_height_;
+  int flow_width_;
+  Dtype flow_scale_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,162 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#ifndef CAFFE_TEST_MULTI_WARP_UTIL_H_
+#define CAFFE_TEST_MULTI_WARP_UTIL_H_
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/warp_layer.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+// Tests of the layers computing top = [w_cur * cur +] sum_k w_k *
+// warp(prev_k, flow_k) in one pass, MultiWarpLayer and the layers built on
+// it. The blobs are kept in the order of MultiWarp, [cur, w_cur,] then
+// (prev, flow, w) per frame, and LayerBottoms() orders them for the layer
+// under test.
+template <typename TypeParam, template <typename> class MultiWarpType>
+class MultiWarpTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // cur, w_cur and frames previous frames of shape (2, 3, 4, 5)
+  explicit MultiWarpTest(const int frames)
+      : blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_std(1.5);
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < 2 + 3 * frames; ++i) {
+      const bool flow = (i % 3 == 0 && i > 0);
+      blobs_.push_back(shared_ptr<Blob<Dtype> >(flow ?
+          new Blob<Dtype>(2, 2, 4, 5) : new Blob<Dtype>(2, 3, 4, 5)));
+      filler.Fill(blobs_.back().get());
+      blob_vec_.push_back(blobs_.back().get());
+    }
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~MultiWarpTest() { delete blob_top_; }
+
+  // The bottoms of the layer under test for blobs in the MultiWarp order
+  virtual vector<Blob<Dtype>*> LayerBottoms(
+      const vector<Blob<Dtype>*>& blobs) {
+    return blobs;
+  }
+
+  // A copy of blobs with (2, 2, 3, 3) flows, resampled by the layer
+  vector<Blob<Dtype>*> ResampledFlows(const vector<Blob<Dtype>*>& blobs) {
+    FillerParameter filler_param;
+    filler_param.set_std(1.5);
+    GaussianFiller<Dtype> filler(filler_param);
+    vector<Blob<Dtype>*> resampled(blobs);
+    for (int b = blobs.size() % 3 + 1; b < blobs.size(); b += 3) {
+      blobs_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(2, 2, 3, 3)));
+      filler.Fill(blobs_.back().get());
+      resampled[b] = blobs_.back().get();
+    }
+    return resampled;
+  }
+
+  // Compares the layer with Warp layers and the Eltwise products and sum
+  void CheckForward(const vector<Blob<Dtype>*>& blobs,
+      const WarpParameter_WarpType outliers, const Phase phase) {
+    LayerParameter layer_param;
+    layer_param.set_phase(phase);
+    layer_param.mutable_warp_param()->set_outliers(outliers);
+    MultiWarpType<Dtype> layer(layer_param);
+    const vector<Blob<Dtype>*> bottom = LayerBottoms(blobs);
+    layer.SetUp(bottom, blob_top_vec_);
+    layer.Forward(bottom, blob_top_vec_);
+    const int first = blobs.size() % 3;
+    const int count = blob_top_->count();
+    ASSERT_EQ(blob_top_->shape(), blobs[first]->shape());
+    vector<Dtype> expected(count, Dtype(0));
+    if (first) {
+      for (int i = 0; i < count; ++i) {
+        expected[i] = blobs[0]->cpu_data()[i] * blobs[1]->cpu_data()[i];
+      }
+    }
+    for (int b = first; b < blobs.size(); b += 3) {
+      Blob<Dtype> warped;
+      vector<Blob<Dtype>*> warp_bottom_vec;
+      warp_bottom_vec.push_back(blobs[b]);
+      warp_bottom_vec.push_back(blobs[b + 1]);
+      vector<Blob<Dtype>*> warp_top_vec(1, &warped);
+      WarpLayer<Dtype> warp_layer(layer_param);
+      warp_layer.SetUp(warp_bottom_vec, warp_top_vec);
+      warp_layer.Forward(warp_bottom_vec, warp_top_vec);
+      for (int i = 0; i < count; ++i) {
+        expected[i] += warped.cpu_data()[i] * blobs[b + 2]->cpu_data()[i];
+      }
+    }
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(expected[i], blob_top_->cpu_data()[i], 1e-5);
+    }
+  }
+
+  void CheckGradient(const vector<Blob<Dtype>*>& blobs,
+      const LayerParameter& layer_param) {
+    MultiWarpType<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-4, 1e-1, 1701);
+    checker.CheckGradientExhaustive(&layer, LayerBottoms(blobs),
+        blob_top_vec_);
+  }
+
+  void TestForwardMatchesWarpEltwise() {
+    CheckForward(blob_vec_, WarpParameter_WarpType_TRUNCATE, TRAIN);
+    CheckForward(blob_vec_, WarpParameter_WarpType_NEAREST, TRAIN);
+    CheckForward(blob_vec_, WarpParameter_WarpType_TRUNCATE, TEST);
+    CheckForward(blob_vec_, WarpParameter_WarpType_NEAREST, TEST);
+  }
+
+  void TestForwardResampledFlow() {
+    const vector<Blob<Dtype>*> blobs = ResampledFlows(blob_vec_);
+    CheckForward(blobs, WarpParameter_WarpType_TRUNCATE, TRAIN);
+    CheckForward(blobs, WarpParameter_WarpType_NEAREST, TEST);
+  }
+
+  void TestGradient(const WarpParameter_WarpType outliers) {
+    LayerParameter layer_param;
+    layer_param.mutable_warp_param()->set_outliers(outliers);
+    CheckGradient(blob_vec_, layer_param);
+  }
+
+  // More threads than images: the threads split the channels of an image
+  // and sum their flow gradients
+  void TestThreadsGradient() {
+    CpuParallelGrain grain(1);
+    LayerParameter layer_param;
+    layer_param.mutable_warp_param()->set_num_threads(4);
+    CheckGradient(blob_vec_, layer_param);
+  }
+
+  // Inference keeps no plan, so Backward builds it
+  void TestLeanResampledGradient(const vector<Blob<Dtype>*>& blobs) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    layer_param.mutable_warp_param()->set_outliers(
+        WarpParameter_WarpType_NEAREST);
+    layer_param.mutable_warp_param()->set_flow_scale(0.5);
+    CheckGradient(ResampledFlows(blobs), layer_param);
+  }
+
+  vector<shared_ptr<Blob<Dtype> > > blobs_;
+  // cur, w_cur, then (prev, flow, w) per frame
+  vector<Blob<Dtype>*> blob_vec_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_TEST_MULTI_WARP_UTIL_H_
@@ -0,0 +1,81 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_BN_H_
+#define CAFFE_UTIL_BN_H_
+
+namespace caffe {
+
+// Per-channel affine transform of the normalization with fixed statistics,
+// scale = slope / sqrt(variance + eps) and shift = bias - mean * scale.
+// IN : slope, bias, mean, variance [channels], OUT: scale, shift [channels]
+template <typename Dtype>
+void caffe_cpu_bn_affine_params(const int channels, const Dtype *slope,
+    const Dtype *bias, const Dtype *mean, const Dtype *variance,
+    const Dtype eps, Dtype *scale, Dtype *shift);
+
+// y = scale[c] * x + shift[c], rectified with max(y, 0) if relu is set, in
+// one pass on num_threads threads over the planes (rows with spatial = 1, the
+// channels-last case) and with the widest supported vector instructions.
+// x and y may be the same.
+// IN : x [num channels spatial], OUT: y [num channels spatial]
+template <typename Dtype>
+void caffe_cpu_bn_affine(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *scale,
+    const Dtype *shift, const bool relu, const Dtype *x, Dtype *y);
+
+// Gradient of caffe_cpu_bn_affine, dx = scale[c] * dy, or 0 where the output
+// y was rectified. dy and dx may be the same.
+// IN : y, dy [num channels spatial], OUT: dx [num channels spatial]
+template <typename Dtype>
+void caffe_cpu_bn_affine_backward(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *scale,
+    const bool relu, const Dtype *y, const Dtype *dy, Dtype *dx);
+
+// Batch normalization of the training pass, x_norm = norm_scale[c] * x +
+// norm_shift[c] and y = slope[c] * x_norm + bias[c], rectified if relu is
+// set, in one pass like caffe_cpu_bn_affine. x and y may be the same.
+// IN : x [num channels spatial], OUT: x_norm, y [num channels spatial]
+template <typename Dtype>
+void caffe_cpu_bn_normalize(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *norm_scale,
+    const Dtype *norm_shift, const Dtype *slope, const Dtype *bias,
+    const bool relu, const Dtype *x, Dtype *x_norm, Dtype *y);
+
+// Per-channel mean and (biased) variance over num and spatial in one pass on
+// num_threads threads. Blocks of the data are reduced in cache and merged
+// with the pairwise update of Chan et al., which stays accurate for large
+// and offset inputs.
+// IN : x [num channels spatial], OUT: mean, variance [channels]
+template <typename Dtype>
+void caffe_cpu_bn_statistics(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *x, Dtype *mean,
+    Dtype *variance);
+
+// Per-channel sums of dy and of dy * x_norm in one pass on num_threads
+// threads, the slope and bias gradients of the BN layer. If y is not NULL,
+// dy is first zeroed in place where the rectified output y is not positive.
+// IN : y, x_norm [num channels spatial], IN/OUT: dy [num channels spatial],
+// OUT: sum_dy, sum_dy_x_norm [channels]
+template <typename Dtype>
+void caffe_cpu_bn_grad_sums(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *y,
+    const Dtype *x_norm, Dtype *dy, Dtype *sum_dy, Dtype *sum_dy_x_norm);
+
+// Input gradient of the batch normalization with batch statistics,
+// dx = slope * inv_std * (dy - mean(dy) - x_norm * mean(dy * x_norm)), with
+// the means over num and spatial given by the sums of caffe_cpu_bn_grad_sums.
+// One pass on num_threads threads; dy and dx may be the same.
+// IN : slope, inv_std, sum_dy, sum_dy_x_norm [channels],
+//      x_norm, dy [num channels spatial], OUT: dx [num channels spatial]
+template <typename Dtype>
+void caffe_cpu_bn_backward(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *slope,
+    const Dtype *inv_std, const Dtype *sum_dy, const Dtype *sum_dy_x_norm,
+    const Dtype *x_norm, const Dtype *dy, Dtype *dx);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BN_H_
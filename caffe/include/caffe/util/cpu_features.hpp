@@ -0,0 +1,36 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_CPU_FEATURES_H_
+#define CAFFE_UTIL_CPU_FEATURES_H_
+
+namespace caffe {
+
+// SIMD levels of x86 CPUs, in increasing order of vector width. A level is
+// only reported if the CPU also has all the levels below it, so a kernel
+// compiled with __attribute__((target(...))) for the extensions of a level
+// runs on every CPU at that level or above.
+enum CpuSimdLevel {
+  CPU_SIMD_SCALAR = 0,
+  CPU_SIMD_SSE42 = 1,
+  CPU_SIMD_AVX = 2,
+  CPU_SIMD_AVX2 = 3,
+  CPU_SIMD_AVX512 = 4  // AVX-512F
+};
+
+// Highest SIMD level of the running CPU (detected once), CPU_SIMD_SCALAR
+// on other architectures and compilers.
+CpuSimdLevel caffe_cpu_simd_level();
+
+// Whether the CPU converts IEEE half natively (F16C), detected once.
+bool caffe_cpu_has_f16c();
+
+// Whether the CPU converts to bfloat16 natively (AVX512-BF16), detected
+// once. Always false with compilers older than GCC 10 or Clang 9.
+bool caffe_cpu_has_avx512bf16();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CPU_FEATURES_H_
@@ -0,0 +1,135 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_HALF_H_
+#define CAFFE_UTIL_HALF_H_
+
+#include <stdint.h>
+#include <cstring>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// 16-bit storage of activations, see StoragePrecision. Values are only
+// stored in 16 bits: kernels widen them on load and compute in Dtype.
+
+// IEEE half to float (exact).
+inline float caffe_fp16_to_float(const uint16_t h) {
+  const uint32_t sign = (h & 0x8000u) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000u | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // subnormal half, normal float
+    exponent = 113;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Float to IEEE half, rounding to nearest even.
+inline uint16_t caffe_float_to_fp16(const float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits > 0x7f800000) {
+    return sign | 0x7e00;  // NaN
+  }
+  if (bits >= 0x47800000) {
+    return sign | 0x7c00;  // overflow
+  }
+  if (bits < 0x38800000) {
+    // subnormal half
+    if (bits < 0x33000000) {
+      return sign;
+    }
+    const int shift = 126 - (bits >> 23);
+    const uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t tie = 1u << (shift - 1);
+    if (rest > tie || (rest == tie && (h & 1))) {
+      ++h;
+    }
+    return sign | h;
+  }
+  // A carry out of the mantissa correctly rounds up to the next exponent
+  uint32_t h = (bits - 0x38000000) >> 13;
+  const uint32_t rest = bits & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+    ++h;
+  }
+  return sign | h;
+}
+
+// bfloat16 to float (exact).
+inline float caffe_bf16_to_float(const uint16_t h) {
+  const uint32_t bits = static_cast<uint32_t>(h) << 16;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Float to bfloat16, rounding to nearest even.
+inline uint16_t caffe_float_to_bf16(const float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return (bits >> 16) | 0x40;  // quiet NaN
+  }
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return bits >> 16;
+}
+
+// Widens one stored value to Dtype, for kernels templated on the storage.
+template <typename Dtype, StoragePrecision precision>
+struct StorageLoad;
+
+template <typename Dtype>
+struct StorageLoad<Dtype, FP32> {
+  typedef Dtype Stype;
+  static inline Dtype load(const Dtype x) { return x; }
+};
+
+template <typename Dtype>
+struct StorageLoad<Dtype, FP16> {
+  typedef uint16_t Stype;
+  static inline Dtype load(const uint16_t x) { return caffe_fp16_to_float(x); }
+};
+
+template <typename Dtype>
+struct StorageLoad<Dtype, BF16> {
+  typedef uint16_t Stype;
+  static inline Dtype load(const uint16_t x) { return caffe_bf16_to_float(x); }
+};
+
+// Bulk conversions to and from a 16-bit precision (FP16 or BF16), using
+// F16C and AVX512-BF16 where the CPU supports them. All paths round to
+// nearest even.
+template <typename Dtype>
+void caffe_cpu_to_half(const StoragePrecision precision, const int n,
+    const Dtype *x, uint16_t *y);
+
+template <typename Dtype>
+void caffe_cpu_from_half(const StoragePrecision precision, const int n,
+    const uint16_t *x, Dtype *y);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HALF_H_
@@ -3,6 +3,8 @@
 #ifndef CAFFE_UTIL_INTERP_H_
 #define CAFFE_UTIL_INTERP_H_
 
+#include <stdint.h>
+#include <vector>
 #include <cublas_v2.h>
 #include "caffe/proto/caffe.pb.h"
 
@@ -17,6 +19,66 @@ void caffe_cpu_interp2(const int channels,
     const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
           Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
 
+// Same as caffe_cpu_interp2 with data1 stored in 16 bits (precision FP16 or
+// BF16, see caffe/util/half.hpp); the interpolation is computed in Dtype.
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_half(const StoragePrecision precision, const int channels,
+    const uint16_t *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+          Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
+
+// Source indices and weights of the bi-linear interpolation from a
+// [height1 width1] crop to a [height2 width2] crop, which only depend on the
+// sizes. Output row h2 reads the source rows h1[h2] and h1[h2] + h1p[h2]
+// with the weights h0lambda[h2] and h1lambda[h2], and likewise along the
+// width.
+template <typename Dtype>
+struct Interp2Tables {
+  int height1, width1, height2, width2;
+  std::vector<int> h1, h1p, w1, w1p;
+  std::vector<Dtype> h0lambda, h1lambda, w0lambda, w1lambda;
+  // Exact integer zoom (2, 4 or 8) or shrink factor of both axes, 0 if none;
+  // these sizes have specialized kernels
+  int zoom, shrink;
+  // Transposed tables of the backward in CSR form: source index i1 receives
+  // from the output indices h2_index[h2_begin[i1] .. h2_begin[i1 + 1]) with
+  // weights h2_lambda, and the same for the width
+  std::vector<int> h2_begin, h2_index, w2_begin, w2_index;
+  std::vector<Dtype> h2_lambda, w2_lambda;
+};
+
+template <typename Dtype>
+void caffe_cpu_interp2_tables(const int height1, const int width1,
+    const int height2, const int width2, Interp2Tables<Dtype> *tables);
+
+// Same as caffe_cpu_interp2 with tables computed once by
+// caffe_cpu_interp2_tables, on num_threads threads over the channels and
+// the output rows. The output does not depend on the number of threads; it
+// may differ from caffe_cpu_interp2 in the last bits.
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    const Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2);
+
+// Output rows [h2_begin, h2_end) of the planar caffe_cpu_interp2 with
+// tables, written to band as [channels h2_end-h2_begin width2] in the
+// calling thread; for callers that consume the output tile by tile.
+template <typename Dtype>
+void caffe_cpu_interp2_band(const Interp2Tables<Dtype> &tables,
+    const int channels, const Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    const int h2_begin, const int h2_end, Dtype *band);
+
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_half(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const StoragePrecision precision,
+    const int channels, const uint16_t *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2);
+
 template <typename Dtype, bool packed>
 void caffe_gpu_interp2(const int channels,
     const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
@@ -28,6 +90,17 @@ void caffe_cpu_interp2_backward(const int channels,
 	  Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
     const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
 
+// Same with tables, on num_threads threads over the channels and the source
+// rows: every source row gathers its gradient from the output rows that read
+// it, so the threads never write to the same element.
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_backward(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    const Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2);
+
 template <typename Dtype, bool packed>
 void caffe_gpu_interp2_backward(const int channels,
 	  Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
@@ -40,11 +113,30 @@ void caffe_cpu_pyramid2(const int channels,
     const Dtype *data, const int height, const int width,
     Dtype *data_pyr, const int levels);
 
+// Same on num_threads threads over the channels and the output rows of a
+// level; the output is identical.
+template <typename Dtype, bool packed>
+void caffe_cpu_pyramid2(const int num_threads, const int channels,
+    const Dtype *data, const int height, const int width,
+    Dtype *data_pyr, const int levels);
+
 template <typename Dtype, bool packed>
 void caffe_gpu_pyramid2(const int channels,
     const Dtype *data, const int height, const int width,
     Dtype *data_pyr, const int levels);
 
+// Backward (adjoint) of one level of the pyramid: adds the gradient of the
+// [channels height/2 width/2] level diff_pyr to diff, [channels height width].
+template <typename Dtype, bool packed>
+void caffe_cpu_pyramid2_backward(const int channels,
+    Dtype *diff, const int height, const int width,
+    const Dtype *diff_pyr);
+
+template <typename Dtype, bool packed>
+void caffe_gpu_pyramid2_backward(const int channels,
+    Dtype *diff, const int height, const int width,
+    const Dtype *diff_pyr);
+
   /*
 template <typename Dtype, bool packed>
 void caffe_cpu_mosaic(const int channels,
@@ -0,0 +1,48 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_NET_SURGERY_H_
+#define CAFFE_UTIL_NET_SURGERY_H_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Folds the BN layers that directly follow a Convolution into the weights
+// and bias of that convolution, and removes them. A BN layer is folded when
+// it normalizes with its stored statistics, i.e. it is frozen or phase is
+// TEST, and when the convolution output is read by no other layer.
+//
+// param is the net definition and weights the trained net (as read from a
+// .caffemodel), whose layers are matched by name; both are rewritten. The
+// result can be loaded with Net(param) and CopyTrainedLayersFrom(weights).
+// A BN layer with bn_param.relu is replaced by an in-place ReLU layer.
+// Returns the number of folded BN layers.
+int FoldBNIntoConvolution(const Phase phase, NetParameter* param,
+    NetParameter* weights);
+
+// Merges each ReLU layer that directly follows a BN layer into it by setting
+// bn_param.relu, and removes it. The pair is merged when the ReLU has no
+// negative slope and is the only reader of the BN output, and the merged
+// layer writes the output of the ReLU. No weights change, so trained nets
+// load as before. Returns the number of merged ReLU layers.
+int MergeBNReLU(NetParameter* param);
+
+// Evaluates once the layers of the TEST phase whose inputs only depend on
+// DummyData layers with constant fillers, with their trained weights, and
+// replaces them by Parameter layers that hold the blobs they pass to the
+// rest of the net, named after each blob with a "_folded" suffix (and a
+// number if needed to keep the layer names unique). The DummyData layers
+// that no longer feed any layer are removed. Layers with include or exclude
+// rules or a loss are left as they are, and so are layers with learnable
+// blobs missing from weights.
+//
+// param and weights are rewritten as by FoldBNIntoConvolution. Returns the
+// number of removed layers.
+int FoldConstantLayers(NetParameter* param, NetParameter* weights);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NET_SURGERY_H_
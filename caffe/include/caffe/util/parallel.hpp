@@ -0,0 +1,111 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_PARALLEL_H_
+#define CAFFE_UTIL_PARALLEL_H_
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Number of CPU threads to use for a layer. A requested value of 0 picks
+// the number of hardware threads reported by the system.
+inline int caffe_cpu_num_threads(const int requested) {
+  if (requested > 0) {
+    return requested;
+  }
+  const int hardware = boost::thread::hardware_concurrency();
+  return std::max(hardware, 1);
+}
+
+// Minimum number of elements worth a thread of its own, 32768 by default:
+// smaller ranges run on the calling thread. The tests lower it to run the
+// threaded code on small blobs.
+int caffe_cpu_parallel_grain();
+void caffe_cpu_set_parallel_grain(const int grain);
+
+// Sets the grain for the lifetime of the object
+class CpuParallelGrain {
+ public:
+  explicit CpuParallelGrain(const int grain)
+      : previous_(caffe_cpu_parallel_grain()) {
+    caffe_cpu_set_parallel_grain(grain);
+  }
+  ~CpuParallelGrain() { caffe_cpu_set_parallel_grain(previous_); }
+
+ private:
+  const int previous_;
+
+  DISABLE_COPY_AND_ASSIGN(CpuParallelGrain);
+};
+
+// Number of chunks to split n items of item_size elements each into: at
+// most num_threads and n, and few enough for each chunk to get the grain.
+inline int caffe_cpu_parallel_threads(const int n, const int item_size,
+    const int num_threads) {
+  const long long work = static_cast<long long>(n) * std::max(item_size, 1);
+  const long long threads = std::min<long long>(std::min(num_threads, n),
+      work / caffe_cpu_parallel_grain());
+  return static_cast<int>(std::max(threads, 1LL));
+}
+
+// Calls task(t) for every t in [0, chunks), each on its own thread, and
+// returns when all are done. The threads are kept from one call to the
+// next, one set per calling thread; the calling thread runs the last chunk
+// itself. Calls made from within a task run all the chunks in turn on the
+// thread that makes them.
+void caffe_cpu_parallel_run(const int chunks,
+    const boost::function<void(int)>& task);
+
+// Chunk t of [0, n) out of chunks, passed to a copy of func
+template <typename Func>
+class CpuParallelChunk {
+ public:
+  CpuParallelChunk(const int n, const int chunks, const Func& func)
+      : n_(n), chunks_(chunks), func_(func) {}
+  void operator()(const int t) const {
+    Func func(func_);
+    func(static_cast<int>(static_cast<long long>(n_) * t / chunks_),
+         static_cast<int>(static_cast<long long>(n_) * (t + 1) / chunks_));
+  }
+
+ private:
+  const int n_;
+  const int chunks_;
+  const Func& func_;
+};
+
+// Splits the range [0, n) into min(num_threads, n) contiguous chunks and
+// calls func(begin, end) once per chunk, on the threads of
+// caffe_cpu_parallel_run. Chunks never overlap, so func may write to any
+// output that is partitioned the same way without synchronization.
+template <typename Func>
+void caffe_cpu_parallel_for(const int n, const int num_threads, Func func) {
+  const int threads = std::max(std::min(num_threads, n), 1);
+  if (threads == 1) {
+    func(0, n);
+    return;
+  }
+  caffe_cpu_parallel_run(threads, CpuParallelChunk<Func>(n, threads, func));
+}
+
+// Same for n items of item_size elements each, on at most num_threads
+// threads but with at least the grain of elements per thread
+template <typename Func>
+void caffe_cpu_parallel_for(const int n, const int item_size,
+    const int num_threads, Func func) {
+  caffe_cpu_parallel_for(n,
+      caffe_cpu_parallel_threads(n, item_size, num_threads), func);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_H_
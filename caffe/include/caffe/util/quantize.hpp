@@ -0,0 +1,30 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_QUANTIZE_H_
+#define CAFFE_UTIL_QUANTIZE_H_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// 8-bit affine storage of activations (StoragePrecision UINT8): x is stored
+// as q = clamp(round(x / scale) + zero_point, 0, 255) and stands for
+// scale * (q - zero_point). Ties round up, and NaN is stored as zero_point.
+
+// IN : x [count], OUT: y [count], one scale and zero point
+template <typename Dtype>
+void caffe_cpu_quantize_u8(const int count, const Dtype scale,
+    const int zero_point, const Dtype *x, uint8_t *y);
+
+// Channels-last version with a scale and a zero point per channel
+// IN : x [count channels], OUT: y [count channels]
+template <typename Dtype>
+void caffe_cpu_quantize_u8_packed(const int channels, const int count,
+    const Dtype *scale, const int *zero_point, const Dtype *x, uint8_t *y);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_H_
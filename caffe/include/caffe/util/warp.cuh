@@ -0,0 +1,96 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_WARP_CUH_
+#define CAFFE_UTIL_WARP_CUH_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Flow at pixel (h, w) of the image, resampled from a flow of another size
+// as caffe_gpu_interp2 does, and scaled (see caffe_cpu_warp_plan).
+template <typename Dtype>
+__device__ inline Dtype warp_flow_at(const Dtype *flow, const int height_,
+    const int width_, const int flow_height_, const int flow_width_,
+    const Dtype flow_scale_, const int h, const int w) {
+  if (flow_height_ == height_ && flow_width_ == width_) {
+    return flow_scale_ * flow[ h * width_ + w ];
+  }
+  const float rheight = (height_ > 1) ?
+      static_cast<float>(flow_height_ - 1) / (height_ - 1) : 0.f;
+  const float rwidth = (width_ > 1) ?
+      static_cast<float>(flow_width_ - 1) / (width_ - 1) : 0.f;
+  const float h1r = rheight * h;
+  const int h1 = h1r;
+  const int h1p = (h1 < flow_height_ - 1) ? flow_width_ : 0;
+  const Dtype h1lambda = h1r - h1;
+  const Dtype h0lambda = Dtype(1.) - h1lambda;
+  const float w1r = rwidth * w;
+  const int w1 = w1r;
+  const int w1p = (w1 < flow_width_ - 1) ? 1 : 0;
+  const Dtype w1lambda = w1r - w1;
+  const Dtype w0lambda = Dtype(1.) - w1lambda;
+  const Dtype *pos = flow + h1 * flow_width_ + w1;
+  return flow_scale_ *
+      (h0lambda * (w0lambda * pos[0]   + w1lambda * pos[w1p]) +
+       h1lambda * (w0lambda * pos[h1p] + w1lambda * pos[h1p + w1p]));
+}
+
+// Bilinear sample of pixel (h, w) of a plane displaced by the flow
+// [2 flow_height_ flow_width_], as warp_sample in warp.cpp. o are the offsets
+// of the 4 taps in the plane and theta_x, theta_y the interpolation
+// coordinates along the height and the width. Returns false for a TRUNCATE
+// outlier, whose output is zero.
+template <typename Dtype>
+__device__ inline bool warp_sample_at(const WarpParameter_WarpType outliers,
+    const Dtype *flow, const int height_, const int width_,
+    const int flow_height_, const int flow_width_, const Dtype flow_scale_,
+    const int h, const int w, int *o, Dtype *theta_x_out,
+    Dtype *theta_y_out) {
+  const Dtype x_w_x = h + warp_flow_at(flow + flow_height_ * flow_width_,
+      height_, width_, flow_height_, flow_width_, flow_scale_, h, w);
+  const Dtype x_w_y = w + warp_flow_at(flow, height_, width_,
+      flow_height_, flow_width_, flow_scale_, h, w);
+  int xw_floor = (int)floor(x_w_x);
+  int yw_floor = (int)floor(x_w_y);
+  int xw_ceil = (int)ceil(x_w_x);
+  int yw_ceil = (int)ceil(x_w_y);
+  Dtype theta_x = x_w_x - floor(x_w_x);
+  Dtype theta_y = x_w_y - floor(x_w_y);
+  if (outliers == WarpParameter_WarpType_TRUNCATE) {
+    if (x_w_x < 0 || x_w_x > height_-1 || x_w_y < 0 || x_w_y > width_-1) {
+      return false;
+    }
+  } else {
+    if (x_w_x < 0) {
+      theta_x = x_w_x;
+      xw_floor = 0; xw_ceil = 0;
+    }
+    if (x_w_x >= height_-1) {
+      theta_x = x_w_x - height_;
+      xw_floor = height_-1; xw_ceil = height_-1;
+    }
+    if (x_w_y < 0) {
+      theta_y = x_w_y;
+      yw_floor = 0; yw_ceil = 0;
+    }
+    if (x_w_y >= width_-1) {
+      theta_y = x_w_y - width_;
+      yw_floor = width_-1; yw_ceil = width_-1;
+    }
+  }
+  o[0] = xw_floor * width_ + yw_floor;
+  o[1] = xw_ceil  * width_ + yw_floor;
+  o[2] = xw_floor * width_ + yw_ceil;
+  o[3] = xw_ceil  * width_ + yw_ceil;
+  *theta_x_out = theta_x;
+  *theta_y_out = theta_y;
+  return true;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WARP_CUH_
@@ -0,0 +1,136 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+
+#ifndef CAFFE_UTIL_WARP_H_
+#define CAFFE_UTIL_WARP_H_
+
+#include <stdint.h>
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/cpu_features.hpp"
+
+namespace caffe {
+
+// Number of source taps of a bilinear sample.
+const int kWarpTaps = 4;
+
+// Bilinear sampling plan of an optical flow field, shared by all channels.
+// IN : flow   [2 flow_height flow_width], channel 0 displaces along the
+//      width and channel 1 along the height. A flow of another size than
+//      the image is resampled as by caffe_cpu_interp2; the displacement is
+//      the flow multiplied by flow_scale.
+// OUT: offset [4 height width] source offset of the taps (floor, floor),
+//      (ceil, floor), (floor, ceil), (ceil, ceil) in (height, width) order.
+//      offset[0] < 0 marks a TRUNCATE outlier whose output is zero.
+//      weight [4 height width] weight of each tap
+//      theta  [2 height width] interpolation coordinate, same channel order
+//      as the flow
+// Only the rows [row_begin, row_end) of the plan are written.
+template <typename Dtype>
+void caffe_cpu_warp_plan(const WarpParameter_WarpType outliers,
+    const int height, const int width, const Dtype *flow,
+    const int flow_height, const int flow_width, const Dtype flow_scale,
+    const int row_begin, const int row_end,
+    int *offset, Dtype *weight, Dtype *theta);
+
+// Sampling plan of the single row h, without theta, for inference.
+// OUT: offset, weight [4 width]; offsets still index the whole image, so
+//      the row plan can be passed to the blend functions with count = width.
+template <typename Dtype>
+void caffe_cpu_warp_plan_row(const WarpParameter_WarpType outliers,
+    const int height, const int width, const Dtype *flow,
+    const int flow_height, const int flow_width, const Dtype flow_scale,
+    const int h, int *offset, Dtype *weight);
+
+// Gathers and blends one channel plane according to a sampling plan, using
+// the widest kernel for caffe_cpu_simd_level(): SSE4.2, AVX2 or AVX-512.
+// All kernels add the taps in the same order; where the compiler fuses the
+// multiplies and adds of some of them (-mfma, aarch64), their outputs
+// differ by a few ulps.
+// IN : data1 [height width], OUT: data2 [count], count = height * width
+template <typename Dtype>
+void caffe_cpu_warp_blend(const int count, const Dtype *data1,
+    const int *offset, const Dtype *weight, Dtype *data2);
+
+// Same as above with the kernel of an explicit SIMD level, which must not
+// exceed caffe_cpu_simd_level().
+template <typename Dtype>
+void caffe_cpu_warp_blend(const CpuSimdLevel level, const int count,
+    const Dtype *data1, const int *offset, const Dtype *weight,
+    Dtype *data2);
+
+// Channels-last gather and blend of the pixels [begin, end) of one image.
+// IN : data1 [height width channels], OUT: data2 [count channels]
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed(const int channels, const int count,
+    const int begin, const int end, const Dtype *data1, const int *offset,
+    const Dtype *weight, Dtype *data2);
+
+// Same as caffe_cpu_warp_blend and caffe_cpu_warp_blend_packed with data1
+// stored in 16 bits (precision FP16 or BF16, see caffe/util/half.hpp). The
+// blend itself is computed in Dtype.
+template <typename Dtype>
+void caffe_cpu_warp_blend_half(const StoragePrecision precision,
+    const int count, const uint16_t *data1, const int *offset,
+    const Dtype *weight, Dtype *data2);
+
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed_half(const StoragePrecision precision,
+    const int channels, const int count, const int begin, const int end,
+    const uint16_t *data1, const int *offset, const Dtype *weight,
+    Dtype *data2);
+
+// Weights of the 8-bit blends are in units of 2^-kWarpFixedBits.
+const int kWarpFixedBits = 14;
+
+// Fixed-point weights of a sampling plan for the 8-bit blends. Taps that
+// read the same pixel are merged into the first of them, which brings the
+// NEAREST outliers into [0, 1], and the weights of a pixel are rounded to
+// sum to exactly 1 << kWarpFixedBits.
+// IN : offset, weight [4 count], OUT: qweight [4 count]
+template <typename Dtype>
+void caffe_cpu_warp_plan_fixed(const int count, const int *offset,
+    const Dtype *weight, int *qweight);
+
+// Same as caffe_cpu_warp_blend with data1 quantized to 8 bits (see
+// caffe/util/quantize.hpp) and the weights of caffe_cpu_warp_plan_fixed.
+// The taps are blended in integers and each output is dequantized once:
+// data2 = scale * (sum * 2^-kWarpFixedBits - zero_point).
+template <typename Dtype>
+void caffe_cpu_warp_blend_u8(const int count, const uint8_t *data1,
+    const int *offset, const int *qweight, const Dtype scale,
+    const int zero_point, Dtype *data2);
+
+// Channels-last version with a scale and a zero point per channel
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed_u8(const int channels, const int count,
+    const int begin, const int end, const uint8_t *data1, const int *offset,
+    const int *qweight, const Dtype *scale, const int *zero_point,
+    Dtype *data2);
+
+// Backward (adjoint) operation of caffe_cpu_warp_blend over `channels`
+// planes sharing one plan (accumulates). Either data1_diff or flow_diff may
+// be NULL to skip that gradient. Each plane only scatters into its own
+// plane of data1_diff, so disjoint sets of planes may run concurrently if
+// they accumulate the flow gradient into separate buffers.
+template <typename Dtype>
+void caffe_cpu_warp_blend_backward(const int channels, const int count,
+    const int *offset, const Dtype *weight, const Dtype *theta,
+    const Dtype *data1, const Dtype *data2_diff,
+    Dtype *data1_diff, Dtype *flow_diff);
+
+// Backward (adjoint) operation of caffe_cpu_warp_blend_packed over a whole
+// image for the channels [channel_begin, channel_end) (accumulates). The
+// flow gradient stays [2 height width]. Either gradient may be NULL.
+template <typename Dtype>
+void caffe_cpu_warp_blend_backward_packed(const int channels,
+    const int channel_begin, const int channel_end, const int count,
+    const int *offset, const Dtype *weight, const Dtype *theta,
+    const Dtype *data1, const Dtype *data2_diff,
+    Dtype *data1_diff, Dtype *flow_diff);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WARP_H_
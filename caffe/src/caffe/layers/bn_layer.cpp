@@ -3,7 +3,9 @@
 
 #include "caffe/layers/bn_layer.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/bn.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 
 namespace caffe {
 
@@ -13,6 +15,10 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   frozen_ = this->layer_param_.bn_param().frozen();
   bn_momentum_ = this->layer_param_.bn_param().momentum();
   bn_eps_ = this->layer_param_.bn_param().eps();
+  layout_ = this->layer_param_.bn_param().layout();
+  num_threads_ =
+    caffe_cpu_num_threads(this->layer_param_.bn_param().num_threads());
+  relu_ = this->layer_param_.bn_param().relu();
   // Initialize parameters
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -20,7 +26,7 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     this->blobs_.resize(4);
     vector<int> shape;
     shape.push_back(1);
-    shape.push_back(bottom[0]->channels());
+    shape.push_back(bottom[0]->shape(layout_ == NHWC ? 3 : 1));
     shape.push_back(1);
     shape.push_back(1);
     // slope
@@ -69,271 +75,150 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  num_ = bottom[0]->num();
-  channels_ = bottom[0]->channels();
-  height_ = bottom[0]->height();
-  width_ = bottom[0]->width();
+  if (layout_ == NHWC) {
+    // The statistics are per channel over all the other axes, so a
+    // channels-last blob is normalized as a batch of num * height * width
+    // 1 x 1 images.
+    num_ = bottom[0]->count(0, 3);
+    channels_ = bottom[0]->shape(3);
+    height_ = 1;
+    width_ = 1;
+  } else {
+    num_ = bottom[0]->num();
+    channels_ = bottom[0]->channels();
+    height_ = bottom[0]->height();
+    width_ = bottom[0]->width();
+  }
 
   top[0]->ReshapeLike(*(bottom[0]));
 
-  broadcast_buffer_.ReshapeLike(*(bottom[0]));
-  spatial_statistic_.Reshape(num_, channels_, 1, 1);
   batch_statistic_.Reshape(1, channels_, 1, 1);
-
-  x_norm_.ReshapeLike(*(bottom[0]));
   x_inv_std_.ReshapeLike(batch_statistic_);
+  affine_.Reshape(2, channels_, 1, 1);
 
-  spatial_sum_multiplier_.Reshape(1, 1, height_, width_);
-  caffe_set(spatial_sum_multiplier_.count(), Dtype(1),
-      spatial_sum_multiplier_.mutable_cpu_data());
-  batch_sum_multiplier_.Reshape(num_, 1, 1, 1);
-  caffe_set(batch_sum_multiplier_.count(), Dtype(1),
-      batch_sum_multiplier_.mutable_cpu_data());
+  // Only the batch statistics of training keep the normalized inputs. The
+  // broadcast buffers are sized by the GPU training pass, which alone uses
+  // them.
+  if (!frozen_ && this->phase_ == TRAIN) {
+    x_norm_.ReshapeLike(*(bottom[0]));
+  }
+}
+
+template <typename Dtype>
+void BNLayer<Dtype>::ReshapeBroadcast() {
+  broadcast_buffer_.ReshapeLike(x_norm_);
+  spatial_statistic_.Reshape(num_, channels_, 1, 1);
+  if (spatial_sum_multiplier_.count() != height_ * width_) {
+    spatial_sum_multiplier_.Reshape(1, 1, height_, width_);
+    caffe_set(spatial_sum_multiplier_.count(), Dtype(1),
+        spatial_sum_multiplier_.mutable_cpu_data());
+  }
+  if (batch_sum_multiplier_.count() != num_) {
+    batch_sum_multiplier_.Reshape(num_, 1, 1, 1);
+    caffe_set(batch_sum_multiplier_.count(), Dtype(1),
+        batch_sum_multiplier_.mutable_cpu_data());
+  }
+}
+
+template <typename Dtype>
+int BNLayer<Dtype>::scratch_count() const {
+  return broadcast_buffer_.count() + spatial_statistic_.count() +
+      batch_statistic_.count() + x_norm_.count() + x_inv_std_.count() +
+      affine_.count() + spatial_sum_multiplier_.count() +
+      batch_sum_multiplier_.count();
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const vector<Blob<Dtype>*>& top) {
   const Dtype* const_bottom_data = bottom[0]->cpu_data();
-  const Dtype* const_top_data = top[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
 
   const Dtype* scale_data = this->blobs_[0]->cpu_data();
   const Dtype* shift_data = this->blobs_[1]->cpu_data();
 
-  // Mean normalization
   if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.cpu_data(),
-        batch_sum_multiplier_.cpu_data(), Dtype(0),
-        batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
-    if (!frozen_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
-    }
-  }
-  // Broadcast the mean vector
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Subtract
-  caffe_add(broadcast_buffer_.count(), const_bottom_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Variance normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average variance
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // calculate batch variance
-    caffe_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // Add to the moving average
-    caffe_cpu_axpby(batch_statistic_.count(),
-        Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-        bn_momentum_, this->blobs_[3]->mutable_cpu_data());
+    // y = slope * (x - mean) / sqrt(variance + eps) + bias as a single
+    // affine transform per channel
+    Dtype* scale = affine_.mutable_cpu_data();
+    Dtype* shift = scale + channels_;
+    caffe_cpu_bn_affine_params(channels_, scale_data, shift_data,
+        this->blobs_[2]->cpu_data(), this->blobs_[3]->cpu_data(), bn_eps_,
+        scale, shift);
+    caffe_cpu_bn_affine(num_threads_, num_, channels_, height_ * width_,
+        scale, shift, relu_, const_bottom_data, top_data);
+    return;
   }
 
-  // Add eps
-  caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-                   batch_statistic_.mutable_cpu_data());
-  // Inverse standard deviation
-  caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-             Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-
-  // Broadcast the inverse std
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Multiply with the inverse std
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Save the normalized inputs and std for backprop
-  if (!frozen_) {
-    caffe_copy(broadcast_buffer_.count(), const_top_data,
-        x_norm_.mutable_cpu_data());
-    caffe_copy(batch_statistic_.count(), batch_statistic_.cpu_data(),
-        x_inv_std_.mutable_cpu_data());
+  // Batch statistics in one pass
+  Dtype* mean = batch_statistic_.mutable_cpu_data();
+  Dtype* inv_std = x_inv_std_.mutable_cpu_data();
+  caffe_cpu_bn_statistics(num_threads_, num_, channels_, height_ * width_,
+      const_bottom_data, mean, inv_std);
+  // Add to the moving averages
+  caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, mean,
+      bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+  caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, inv_std,
+      bn_momentum_, this->blobs_[3]->mutable_cpu_data());
+  // Inverse standard deviation, saved for backprop
+  caffe_add_scalar(channels_, bn_eps_, inv_std);
+  caffe_powx(channels_, x_inv_std_.cpu_data(), Dtype(-0.5), inv_std);
+
+  // x_norm = (x - mean) * inv_std, saved for backprop, and the scaled and
+  // shifted output in the same pass
+  Dtype* norm_shift = affine_.mutable_cpu_data();
+  for (int c = 0; c < channels_; ++c) {
+    norm_shift[c] = -mean[c] * inv_std[c];
   }
-
-  // Scale
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Shift
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), shift_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_add(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  caffe_cpu_bn_normalize(num_threads_, num_, channels_, height_ * width_,
+      x_inv_std_.cpu_data(), affine_.cpu_data(), scale_data, shift_data,
+      relu_, const_bottom_data, x_norm_.mutable_cpu_data(), top_data);
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (frozen_) {
+  // The gradient of the transform applied by Forward_cpu
+  if (frozen_ || this->phase_ == TEST) {
     if (propagate_down[0]) {
-      const Dtype* const_top_diff = top[0]->cpu_diff();
-      Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-      // Use the moving average variance
-      caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-          batch_statistic_.mutable_cpu_data());
-      caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-          batch_statistic_.mutable_cpu_data());
-      caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-          Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-      // Divide slope with std
-      caffe_mul(batch_statistic_.count(), this->blobs_[0]->cpu_data(),
-          batch_statistic_.cpu_data(), batch_statistic_.mutable_cpu_data());
-      // Broadcast
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-          height_ * width_, 1, Dtype(1),
-          spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), broadcast_buffer_.mutable_cpu_data());
-      // Elementwise multiply top grad with (slope / std)
-      caffe_mul(broadcast_buffer_.count(), const_top_diff,
-          broadcast_buffer_.cpu_data(), bottom_diff);
+      // Multiply the top grad with slope / std, masked by the rectification
+      Dtype* scale = affine_.mutable_cpu_data();
+      caffe_cpu_bn_affine_params(channels_, this->blobs_[0]->cpu_data(),
+          this->blobs_[1]->cpu_data(), this->blobs_[2]->cpu_data(),
+          this->blobs_[3]->cpu_data(), bn_eps_, scale, scale + channels_);
+      caffe_cpu_bn_affine_backward(num_threads_, num_, channels_,
+          height_ * width_, scale, relu_, top[0]->cpu_data(),
+          top[0]->cpu_diff(), bottom[0]->mutable_cpu_diff());
     }
     return;
   }
 
+  // Sums of the top grad and of its product with the normalized inputs, in
+  // one pass that also applies the rectification to the top grad
+  Dtype* sum_dy = affine_.mutable_cpu_data();
+  Dtype* sum_dy_x_norm = sum_dy + channels_;
+  caffe_cpu_bn_grad_sums(num_threads_, num_, channels_, height_ * width_,
+      relu_ ? top[0]->cpu_data() : NULL, x_norm_.cpu_data(),
+      top[0]->mutable_cpu_diff(), sum_dy, sum_dy_x_norm);
+
   // gradient w.r.t. slope
   if (this->param_propagate_down_[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(), const_top_diff,
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), scale_diff);
+    caffe_axpy(channels_, Dtype(1), sum_dy_x_norm,
+        this->blobs_[0]->mutable_cpu_diff());
   }
 
   // gradient w.r.t. bias
   if (this->param_propagate_down_[1]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_top_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), shift_diff);
+    caffe_axpy(channels_, Dtype(1), sum_dy,
+        this->blobs_[1]->mutable_cpu_diff());
   }
 
   // gradient w.r.t. normalized inputs
   if (propagate_down[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    const Dtype* const_bottom_diff = bottom[0]->cpu_diff();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* scale_data = this->blobs_[0]->cpu_data();
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1), spatial_statistic_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_top_diff,
-        broadcast_buffer_.cpu_data(), broadcast_buffer_.mutable_cpu_data());
-
-    // sum of x_hat * (dl / dx_hat)
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        broadcast_buffer_.cpu_data(), bottom_diff);
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_bottom_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // x_hat times the sum
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), bottom_diff);
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        const_bottom_diff, bottom_diff);
-
-    // Subtract the average of x_hat times the sum
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(1), bottom_diff);
-    caffe_cpu_axpby(broadcast_buffer_.count(), Dtype(1),
-        broadcast_buffer_.cpu_data(), Dtype(-1) / (num_ * height_ * width_),
-        bottom_diff);
-
-    // Multiply with the inverse std
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), x_inv_std_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_bottom_diff,
-        broadcast_buffer_.cpu_data(), bottom_diff);
+    caffe_cpu_bn_backward(num_threads_, num_, channels_, height_ * width_,
+        this->blobs_[0]->cpu_data(), x_inv_std_.cpu_data(), sum_dy,
+        sum_dy_x_norm, x_norm_.cpu_data(), top[0]->cpu_diff(),
+        bottom[0]->mutable_cpu_diff());
   }
 }
 
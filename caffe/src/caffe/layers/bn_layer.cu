@@ -7,6 +7,70 @@
 
 namespace caffe {
 
+// Rectifies data in place
+template <typename Dtype>
+__global__ void bn_relu_fwd(const int nthreads, Dtype* data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    data[index] = max(data[index], Dtype(0));
+  }
+}
+
+// Zeroes the grad where the rectified output is not positive
+template <typename Dtype>
+__global__ void bn_relu_bwd(const int nthreads, const Dtype* data,
+    Dtype* diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    if (data[index] <= 0) {
+      diff[index] = Dtype(0);
+    }
+  }
+}
+
+// Per-channel scale and shift of the normalization with fixed statistics
+template <typename Dtype>
+__global__ void bn_affine_params(const int channels, const Dtype* slope,
+    const Dtype* bias, const Dtype* mean, const Dtype* variance,
+    const Dtype eps, Dtype* scale, Dtype* shift) {
+  CUDA_KERNEL_LOOP(c, channels) {
+    scale[c] = slope[c] / sqrt(variance[c] + eps);
+    shift[c] = bias[c] - mean[c] * scale[c];
+  }
+}
+
+// y = scale[c] * x + shift[c], rectified if relu is set
+template <typename Dtype>
+__global__ void bn_affine_fwd(const int nthreads, const int channels,
+    const int spatial, const Dtype* scale, const Dtype* shift,
+    const bool relu, const Dtype* x, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int c = (index / spatial) % channels;
+    const Dtype v = scale[c] * x[index] + shift[c];
+    y[index] = relu ? max(v, Dtype(0)) : v;
+  }
+}
+
+// dx = scale[c] * dy, or 0 where the rectified output is not positive
+template <typename Dtype>
+__global__ void bn_affine_bwd(const int nthreads, const int channels,
+    const int spatial, const Dtype* scale, const bool relu, const Dtype* y,
+    const Dtype* dy, Dtype* dx) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int c = (index / spatial) % channels;
+    dx[index] = (relu && y[index] <= 0) ? Dtype(0) : scale[c] * dy[index];
+  }
+}
+
+template <typename Dtype>
+void BNLayer<Dtype>::FixedAffine_gpu() {
+  Dtype* scale = affine_.mutable_gpu_data();
+  bn_affine_params<Dtype>
+    <<<CAFFE_GET_BLOCKS(channels_), CAFFE_CUDA_NUM_THREADS>>>
+    (channels_, this->blobs_[0]->gpu_data(), this->blobs_[1]->gpu_data(),
+     this->blobs_[2]->gpu_data(), this->blobs_[3]->gpu_data(), bn_eps_,
+     scale, scale + channels_);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template <typename Dtype>
 void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const vector<Blob<Dtype>*>& top) {
@@ -17,28 +81,32 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* scale_data = this->blobs_[0]->gpu_data();
   const Dtype* shift_data = this->blobs_[1]->gpu_data();
 
-  // Mean normalization
   if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->gpu_data(),
-        batch_statistic_.mutable_gpu_data());
-  } else {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.gpu_data(), Dtype(0),
-        spatial_statistic_.mutable_gpu_data());
-    caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.gpu_data(),
-        batch_sum_multiplier_.gpu_data(), Dtype(0),
-        batch_statistic_.mutable_gpu_data());
-    // Add to the moving average
-    if (!frozen_) {
-      caffe_gpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_gpu_data());
-    }
+    // One affine transform per channel, with no activation-sized scratch
+    FixedAffine_gpu();
+    const int count = top[0]->count();
+    bn_affine_fwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+      (count, channels_, height_ * width_, affine_.gpu_data(),
+       affine_.gpu_data() + channels_, relu_, const_bottom_data, top_data);
+    CUDA_POST_KERNEL_CHECK;
+    return;
   }
+  ReshapeBroadcast();
+
+  // Mean normalization
+  // Compute the mean by averaging over spatial and batch dimensions.
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
+      Dtype(1) / (height_ * width_), const_bottom_data,
+      spatial_sum_multiplier_.gpu_data(), Dtype(0),
+      spatial_statistic_.mutable_gpu_data());
+  caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_,
+      Dtype(1) / num_, spatial_statistic_.gpu_data(),
+      batch_sum_multiplier_.gpu_data(), Dtype(0),
+      batch_statistic_.mutable_gpu_data());
+  // Add to the moving average
+  caffe_gpu_axpby(batch_statistic_.count(),
+      Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
+      bn_momentum_, this->blobs_[2]->mutable_gpu_data());
   // Broadcast the mean vector
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
       Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
@@ -52,26 +120,20 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       broadcast_buffer_.gpu_data(), top_data);
 
   // Variance normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average variance
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->gpu_data(),
-        batch_statistic_.mutable_gpu_data());
-  } else {
-    caffe_gpu_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_gpu_data());
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.gpu_data(),
-        spatial_sum_multiplier_.gpu_data(), Dtype(0),
-        spatial_statistic_.mutable_gpu_data());
-    caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
-        Dtype(0), batch_statistic_.mutable_gpu_data());
+  caffe_gpu_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
+      broadcast_buffer_.mutable_gpu_data());
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
+      Dtype(1) / (height_ * width_), broadcast_buffer_.gpu_data(),
+      spatial_sum_multiplier_.gpu_data(), Dtype(0),
+      spatial_statistic_.mutable_gpu_data());
+  caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
+      spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
+      Dtype(0), batch_statistic_.mutable_gpu_data());
 
-    // Add to the moving average
-    caffe_gpu_axpby(batch_statistic_.count(),
-        Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
-        bn_momentum_, this->blobs_[3]->mutable_gpu_data());
-  }
+  // Add to the moving average
+  caffe_gpu_axpby(batch_statistic_.count(),
+      Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
+      bn_momentum_, this->blobs_[3]->mutable_gpu_data());
 
   // Add eps
   caffe_gpu_add_scalar(batch_statistic_.count(), bn_eps_,
@@ -92,12 +154,10 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       broadcast_buffer_.gpu_data(), top_data);
 
   // Save the normalized inputs and std for backprop
-  if (!frozen_) {
-    caffe_copy(broadcast_buffer_.count(), const_top_data,
-        x_norm_.mutable_gpu_data());
-    caffe_copy(batch_statistic_.count(), batch_statistic_.gpu_data(),
-        x_inv_std_.mutable_gpu_data());
-  }
+  caffe_copy(broadcast_buffer_.count(), const_top_data,
+      x_norm_.mutable_gpu_data());
+  caffe_copy(batch_statistic_.count(), batch_statistic_.gpu_data(),
+      x_inv_std_.mutable_gpu_data());
 
   // Scale
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
@@ -120,40 +180,41 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   caffe_gpu_add(broadcast_buffer_.count(), const_top_data,
       broadcast_buffer_.gpu_data(), top_data);
+
+  // Rectify
+  if (relu_) {
+    const int count = top[0]->count();
+    bn_relu_fwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+      (count, top_data);
+    CUDA_POST_KERNEL_CHECK;
+  }
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (frozen_) {
+  // The gradient of the transform applied by Forward_gpu
+  if (frozen_ || this->phase_ == TEST) {
     if (propagate_down[0]) {
-      const Dtype* const_top_diff = top[0]->gpu_diff();
-      Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
-      // Use the moving average variance
-      caffe_copy(batch_statistic_.count(), this->blobs_[3]->gpu_data(),
-          batch_statistic_.mutable_gpu_data());
-      caffe_gpu_add_scalar(batch_statistic_.count(), bn_eps_,
-          batch_statistic_.mutable_gpu_data());
-      caffe_gpu_powx(batch_statistic_.count(), batch_statistic_.gpu_data(),
-          Dtype(-0.5), batch_statistic_.mutable_gpu_data());
-      // Multiple slope with inverse std
-      caffe_gpu_mul(batch_statistic_.count(), this->blobs_[0]->gpu_data(),
-          batch_statistic_.gpu_data(), batch_statistic_.mutable_gpu_data());
-      // Broadcast
-      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
-          Dtype(0), spatial_statistic_.mutable_gpu_data());
-      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-          height_ * width_, 1, Dtype(1),
-          spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
-          Dtype(0), broadcast_buffer_.mutable_gpu_data());
-      // Elementwise multiply top grad with (slope / std)
-      caffe_gpu_mul(broadcast_buffer_.count(), const_top_diff,
-          broadcast_buffer_.gpu_data(), bottom_diff);
+      // Multiply the top grad with slope / std, masked by the rectification
+      FixedAffine_gpu();
+      const int count = top[0]->count();
+      bn_affine_bwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+        (count, channels_, height_ * width_, affine_.gpu_data(), relu_,
+         top[0]->gpu_data(), top[0]->gpu_diff(), bottom[0]->mutable_gpu_diff());
+      CUDA_POST_KERNEL_CHECK;
     }
     return;
   }
 
+  // The rectification passes the top grad where the output is positive
+  if (relu_) {
+    const int count = top[0]->count();
+    bn_relu_bwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+      (count, top[0]->gpu_data(), top[0]->mutable_gpu_diff());
+    CUDA_POST_KERNEL_CHECK;
+  }
+
   // gradient w.r.t. slope
   if (this->param_propagate_down_[0]) {
     const Dtype* const_top_diff = top[0]->gpu_diff();
@@ -0,0 +1,112 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/gaussian_pyramid_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const InterpParameter& interp_param = this->layer_param_.interp_param();
+  CHECK_EQ(interp_param.storage(), FP32)
+    << "GaussianPyramid only supports FP32 storage.";
+  layout_ = interp_param.layout();
+  num_threads_ = caffe_cpu_num_threads(interp_param.num_threads());
+}
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(bottom[0]->num_axes(), 4);
+  num_ = bottom[0]->num();
+  if (layout_ == NHWC) {
+    height_ = bottom[0]->shape(1);
+    width_ = bottom[0]->shape(2);
+    channels_ = bottom[0]->shape(3);
+  } else {
+    channels_ = bottom[0]->channels();
+    height_ = bottom[0]->height();
+    width_ = bottom[0]->width();
+  }
+  for (int l = 1; l <= top.size(); ++l) {
+    CHECK_GT(level_height(l), 0) << "Too many levels for the input size.";
+    CHECK_GT(level_width(l), 0) << "Too many levels for the input size.";
+    if (layout_ == NHWC) {
+      top[l - 1]->Reshape(num_, level_height(l), level_width(l), channels_);
+    } else {
+      top[l - 1]->Reshape(num_, channels_, level_height(l), level_width(l));
+    }
+  }
+}
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // Every level is decimated from the previous top
+  for (int l = 1; l <= top.size(); ++l) {
+    const Blob<Dtype>* src = (l == 1) ? bottom[0] : top[l - 2];
+    if (layout_ == NHWC) {
+      const int src_dim = src->count(1);
+      const int dst_dim = top[l - 1]->count(1);
+      for (int n = 0; n < num_; ++n) {
+        caffe_cpu_pyramid2<Dtype,true>(num_threads_, channels_,
+            src->cpu_data() + n * src_dim,
+            level_height(l - 1), level_width(l - 1),
+            top[l - 1]->mutable_cpu_data() + n * dst_dim, 1);
+      }
+    } else {
+      caffe_cpu_pyramid2<Dtype,false>(num_threads_, num_ * channels_,
+          src->cpu_data(), level_height(l - 1), level_width(l - 1),
+          top[l - 1]->mutable_cpu_data(), 1);
+    }
+  }
+}
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  // From the last level down: the gradient of level l - 1 is its top diff
+  // plus the gradient spread back from level l
+  const Dtype* diff2 = top.back()->cpu_diff();
+  for (int l = top.size(); l >= 1; --l) {
+    Dtype* diff1;
+    if (l == 1) {
+      diff1 = bottom[0]->mutable_cpu_diff();
+      caffe_set(bottom[0]->count(), Dtype(0), diff1);
+    } else {
+      Blob<Dtype>& level_diff = level_diff_[l % 2];
+      level_diff.ReshapeLike(*top[l - 2]);
+      diff1 = level_diff.mutable_cpu_data();
+      caffe_copy(level_diff.count(), top[l - 2]->cpu_diff(), diff1);
+    }
+    if (layout_ == NHWC) {
+      const int dim1 = level_height(l - 1) * level_width(l - 1) * channels_;
+      const int dim2 = level_height(l) * level_width(l) * channels_;
+      for (int n = 0; n < num_; ++n) {
+        caffe_cpu_pyramid2_backward<Dtype,true>(channels_, diff1 + n * dim1,
+            level_height(l - 1), level_width(l - 1), diff2 + n * dim2);
+      }
+    } else {
+      caffe_cpu_pyramid2_backward<Dtype,false>(num_ * channels_, diff1,
+          level_height(l - 1), level_width(l - 1), diff2);
+    }
+    diff2 = diff1;
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(GaussianPyramidLayer);
+#endif
+
+INSTANTIATE_CLASS(GaussianPyramidLayer);
+REGISTER_LAYER_CLASS(GaussianPyramid);
+
+}  // namespace caffe
@@ -0,0 +1,68 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/gaussian_pyramid_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::Forward_gpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  for (int l = 1; l <= top.size(); ++l) {
+    const Blob<Dtype>* src = (l == 1) ? bottom[0] : top[l - 2];
+    if (layout_ == NHWC) {
+      const int src_dim = src->count(1);
+      const int dst_dim = top[l - 1]->count(1);
+      for (int n = 0; n < num_; ++n) {
+        caffe_gpu_pyramid2<Dtype,true>(channels_,
+            src->gpu_data() + n * src_dim,
+            level_height(l - 1), level_width(l - 1),
+            top[l - 1]->mutable_gpu_data() + n * dst_dim, 1);
+      }
+    } else {
+      caffe_gpu_pyramid2<Dtype,false>(num_ * channels_,
+          src->gpu_data(), level_height(l - 1), level_width(l - 1),
+          top[l - 1]->mutable_gpu_data(), 1);
+    }
+  }
+}
+
+template <typename Dtype>
+void GaussianPyramidLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const Dtype* diff2 = top.back()->gpu_diff();
+  for (int l = top.size(); l >= 1; --l) {
+    Dtype* diff1;
+    if (l == 1) {
+      diff1 = bottom[0]->mutable_gpu_diff();
+      caffe_gpu_set(bottom[0]->count(), Dtype(0), diff1);
+    } else {
+      Blob<Dtype>& level_diff = level_diff_[l % 2];
+      level_diff.ReshapeLike(*top[l - 2]);
+      diff1 = level_diff.mutable_gpu_data();
+      caffe_copy(level_diff.count(), top[l - 2]->gpu_diff(), diff1);
+    }
+    if (layout_ == NHWC) {
+      const int dim1 = level_height(l - 1) * level_width(l - 1) * channels_;
+      const int dim2 = level_height(l) * level_width(l) * channels_;
+      for (int n = 0; n < num_; ++n) {
+        caffe_gpu_pyramid2_backward<Dtype,true>(channels_, diff1 + n * dim1,
+            level_height(l - 1), level_width(l - 1), diff2 + n * dim2);
+      }
+    } else {
+      caffe_gpu_pyramid2_backward<Dtype,false>(num_ * channels_, diff1,
+          level_height(l - 1), level_width(l - 1), diff2);
+    }
+    diff2 = diff1;
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(GaussianPyramidLayer);
+
+}  // namespace caffe
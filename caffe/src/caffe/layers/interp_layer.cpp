@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/layers/interp_layer.hpp"
 
 namespace caffe {
@@ -13,17 +17,45 @@ void InterpLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   InterpParameter interp_param = this->layer_param_.interp_param();
   pad_beg_ = interp_param.pad_beg();
   pad_end_ = interp_param.pad_end();
+  layout_ = interp_param.layout();
+  storage_ = interp_param.storage();
+  num_threads_ = caffe_cpu_num_threads(interp_param.num_threads());
+  CHECK_NE(storage_, UINT8) << "UINT8 storage is only supported by Warp.";
   CHECK_LE(pad_beg_, 0) << "Only supports non-pos padding (cropping) for now";
   CHECK_LE(pad_end_, 0) << "Only supports non-pos padding (cropping) for now";
+  pyramid_ = interp_param.pyramid();
+  level_ = 0;
+  if (pyramid_) {
+    CHECK_EQ(storage_, FP32)
+      << "The pyramid downscale only supports FP32 storage.";
+    CHECK(pad_beg_ == 0 && pad_end_ == 0)
+      << "The pyramid downscale does not crop.";
+  }
 }
 
 template <typename Dtype>
 void InterpLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  Reshape_sizes(bottom);
+  if (layout_ == NHWC) {
+    top[0]->Reshape(num_, height_out_, width_out_, channels_);
+  } else {
+    top[0]->Reshape(num_, channels_, height_out_, width_out_);
+  }
+}
+
+template <typename Dtype>
+void InterpLayer<Dtype>::Reshape_sizes(const vector<Blob<Dtype>*>& bottom) {
   num_ = bottom[0]->num();
-  channels_ = bottom[0]->channels();
-  height_in_ = bottom[0]->height();
-  width_in_ = bottom[0]->width();
+  if (layout_ == NHWC) {
+    height_in_ = bottom[0]->shape(1);
+    width_in_ = bottom[0]->shape(2);
+    channels_ = bottom[0]->shape(3);
+  } else {
+    channels_ = bottom[0]->channels();
+    height_in_ = bottom[0]->height();
+    width_in_ = bottom[0]->width();
+  }
   height_in_eff_ = height_in_ + pad_beg_ + pad_end_;
   width_in_eff_ = width_in_ + pad_beg_ + pad_end_;
   InterpParameter interp_param = this->layer_param_.interp_param();
@@ -59,15 +91,123 @@ void InterpLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(width_in_eff_, 0) << "width should be positive";
   CHECK_GT(height_out_, 0) << "height should be positive";
   CHECK_GT(width_out_, 0) << "width should be positive";
-  top[0]->Reshape(num_, channels_, height_out_, width_out_);
+  if (pyramid_) {
+    // Same level as caffe_cpu_mosaic, but never one of zero size
+    level_ = log2(sqrt((float)height_in_ * width_in_ /
+                       height_out_ / width_out_));
+    level_ = std::max(0, level_);
+    while (level_ > 0 &&
+           (level_height(level_) == 0 || level_width(level_) == 0)) {
+      --level_;
+    }
+    const int levels_dim = level_offset(level_ + 1);
+    pyramid_levels_.Reshape(1, 1, 1,
+        std::max(1, (layout_ == NHWC) ? num_ * levels_dim : levels_dim));
+  }
+  const int height1 = (level_ > 0) ? level_height(level_) : height_in_eff_;
+  const int width1 = (level_ > 0) ? level_width(level_) : width_in_eff_;
+  if (tables_.h1.empty() || tables_.height1 != height1 ||
+      tables_.width1 != width1 || tables_.height2 != height_out_ ||
+      tables_.width2 != width_out_) {
+    caffe_cpu_interp2_tables(height1, width1, height_out_,
+        width_out_, &tables_);
+  }
+}
+
+template <typename Dtype>
+int InterpLayer<Dtype>::level_offset(const int l) const {
+  const int channels = (layout_ == NHWC) ? channels_ : num_ * channels_;
+  int offset = 0;
+  for (int k = 1; k < l; ++k) {
+    offset += channels * level_height(k) * level_width(k);
+  }
+  return offset;
 }
 
 template <typename Dtype>
 void InterpLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  caffe_cpu_interp2<Dtype,false>(num_ * channels_,
-    bottom[0]->cpu_data(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
-    top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_, height_out_, width_out_);
+  if (storage_ != FP32) {
+    Forward_cpu_half(bottom, top);
+    return;
+  }
+  if (level_ > 0) {
+    Forward_cpu_pyramid(bottom, top);
+    return;
+  }
+  if (layout_ == NHWC) {
+    // Channels-last images are interpolated one at a time, all channels of
+    // a pixel together
+    const int bottom_dim = bottom[0]->count(1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2<Dtype,true>(tables_, num_threads_, channels_,
+        bottom[0]->cpu_data() + n * bottom_dim, - pad_beg_, - pad_beg_,
+        height_in_, width_in_,
+        top[0]->mutable_cpu_data() + n * top_dim, 0, 0,
+        height_out_, width_out_);
+    }
+    return;
+  }
+  caffe_cpu_interp2<Dtype,false>(tables_, num_threads_, num_ * channels_,
+    bottom[0]->cpu_data(), - pad_beg_, - pad_beg_, height_in_, width_in_,
+    top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_);
+}
+
+template <typename Dtype>
+void InterpLayer<Dtype>::Forward_cpu_pyramid(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int height1 = level_height(level_), width1 = level_width(level_);
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int levels_dim = level_offset(level_ + 1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      Dtype* levels = pyramid_levels_.mutable_cpu_data() + n * levels_dim;
+      caffe_cpu_pyramid2<Dtype,true>(num_threads_, channels_,
+        bottom[0]->cpu_data() + n * bottom_dim, height_in_, width_in_,
+        levels, level_);
+      caffe_cpu_interp2<Dtype,true>(tables_, num_threads_, channels_,
+        levels + level_offset(level_), 0, 0, height1, width1,
+        top[0]->mutable_cpu_data() + n * top_dim, 0, 0,
+        height_out_, width_out_);
+    }
+    return;
+  }
+  Dtype* levels = pyramid_levels_.mutable_cpu_data();
+  caffe_cpu_pyramid2<Dtype,false>(num_threads_, num_ * channels_,
+    bottom[0]->cpu_data(), height_in_, width_in_, levels, level_);
+  caffe_cpu_interp2<Dtype,false>(tables_, num_threads_, num_ * channels_,
+    levels + level_offset(level_), 0, 0, height1, width1,
+    top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_);
+}
+
+template <typename Dtype>
+void InterpLayer<Dtype>::Forward_cpu_half(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int count = bottom[0]->count();
+  if (!bottom_half_ || bottom_half_->size() < count * sizeof(uint16_t)) {
+    bottom_half_.reset(new SyncedMemory(count * sizeof(uint16_t)));
+  }
+  uint16_t* bottom_half =
+    static_cast<uint16_t*>(bottom_half_->mutable_cpu_data());
+  caffe_cpu_to_half(storage_, count, bottom[0]->cpu_data(), bottom_half);
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2_half<Dtype,true>(tables_, num_threads_, storage_,
+        channels_, bottom_half + n * bottom_dim, - pad_beg_, - pad_beg_,
+        height_in_, width_in_,
+        top[0]->mutable_cpu_data() + n * top_dim, 0, 0,
+        height_out_, width_out_);
+    }
+    return;
+  }
+  caffe_cpu_interp2_half<Dtype,false>(tables_, num_threads_, storage_,
+    num_ * channels_, bottom_half, - pad_beg_, - pad_beg_,
+    height_in_, width_in_,
+    top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_);
 }
 
 template <typename Dtype>
@@ -75,15 +215,90 @@ void InterpLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) { return; }
   caffe_set(bottom[0]->count(), Dtype(0), bottom[0]->mutable_cpu_diff());
-  caffe_cpu_interp2_backward<Dtype,false>(num_ * channels_,
-    bottom[0]->mutable_cpu_diff(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
-    top[0]->cpu_diff(), 0, 0, height_out_, width_out_, height_out_, width_out_);
+  if (level_ > 0) {
+    Backward_cpu_pyramid(top, bottom);
+    return;
+  }
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2_backward<Dtype,true>(tables_, num_threads_, channels_,
+        bottom[0]->mutable_cpu_diff() + n * bottom_dim, - pad_beg_, - pad_beg_,
+        height_in_, width_in_,
+        top[0]->cpu_diff() + n * top_dim, 0, 0, height_out_, width_out_);
+    }
+    return;
+  }
+  caffe_cpu_interp2_backward<Dtype,false>(tables_, num_threads_,
+    num_ * channels_, bottom[0]->mutable_cpu_diff(), - pad_beg_, - pad_beg_,
+    height_in_, width_in_,
+    top[0]->cpu_diff(), 0, 0, height_out_, width_out_);
+}
+
+// The gradient of the level is spread back down the pyramid, level by level
+template <typename Dtype>
+void InterpLayer<Dtype>::Backward_cpu_pyramid(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int height1 = level_height(level_), width1 = level_width(level_);
+  const bool packed = (layout_ == NHWC);
+  const int images = packed ? num_ : 1;
+  const int channels = packed ? channels_ : num_ * channels_;
+  const int bottom_dim = bottom[0]->count() / images;
+  const int levels_dim = level_offset(level_ + 1);
+  const int top_dim = top[0]->count() / images;
+  caffe_set(pyramid_levels_.count(), Dtype(0),
+      pyramid_levels_.mutable_cpu_diff());
+  for (int n = 0; n < images; ++n) {
+    Dtype* levels = pyramid_levels_.mutable_cpu_diff() + n * levels_dim;
+    if (packed) {
+      caffe_cpu_interp2_backward<Dtype,true>(tables_, num_threads_, channels,
+        levels + level_offset(level_), 0, 0, height1, width1,
+        top[0]->cpu_diff() + n * top_dim, 0, 0, height_out_, width_out_);
+    } else {
+      caffe_cpu_interp2_backward<Dtype,false>(tables_, num_threads_, channels,
+        levels + level_offset(level_), 0, 0, height1, width1,
+        top[0]->cpu_diff() + n * top_dim, 0, 0, height_out_, width_out_);
+    }
+    for (int l = level_; l >= 1; --l) {
+      Dtype* diff = (l == 1) ? bottom[0]->mutable_cpu_diff() + n * bottom_dim :
+        levels + level_offset(l - 1);
+      if (packed) {
+        caffe_cpu_pyramid2_backward<Dtype,true>(channels, diff,
+          level_height(l - 1), level_width(l - 1), levels + level_offset(l));
+      } else {
+        caffe_cpu_pyramid2_backward<Dtype,false>(channels, diff,
+          level_height(l - 1), level_width(l - 1), levels + level_offset(l));
+      }
+    }
+  }
 }
 
 #ifndef CPU_ONLY
 template <typename Dtype>
 void InterpLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (storage_ != FP32) {
+    // The GPU kernels read the Dtype bottom
+    Forward_cpu(bottom, top);
+    return;
+  }
+  if (level_ > 0) {
+    Forward_gpu_pyramid(bottom, top);
+    return;
+  }
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_gpu_interp2<Dtype,true>(channels_,
+        bottom[0]->gpu_data() + n * bottom_dim, - pad_beg_, - pad_beg_,
+        height_in_eff_, width_in_eff_, height_in_, width_in_,
+        top[0]->mutable_gpu_data() + n * top_dim, 0, 0,
+        height_out_, width_out_, height_out_, width_out_);
+    }
+    return;
+  }
   caffe_gpu_interp2<Dtype,false>(num_ * channels_,
     bottom[0]->gpu_data(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
     top[0]->mutable_gpu_data(), 0, 0, height_out_, width_out_, height_out_, width_out_);
@@ -94,10 +309,94 @@ void InterpLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) { return; }
   caffe_gpu_set(bottom[0]->count(), Dtype(0), bottom[0]->mutable_gpu_diff());
+  if (level_ > 0) {
+    Backward_gpu_pyramid(top, bottom);
+    return;
+  }
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_gpu_interp2_backward<Dtype,true>(channels_,
+        bottom[0]->mutable_gpu_diff() + n * bottom_dim, - pad_beg_, - pad_beg_,
+        height_in_eff_, width_in_eff_, height_in_, width_in_,
+        top[0]->gpu_diff() + n * top_dim, 0, 0,
+        height_out_, width_out_, height_out_, width_out_);
+    }
+    return;
+  }
   caffe_gpu_interp2_backward<Dtype,false>(num_ * channels_,
     bottom[0]->mutable_gpu_diff(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
     top[0]->gpu_diff(), 0, 0, height_out_, width_out_, height_out_, width_out_);
 }
+
+template <typename Dtype>
+void InterpLayer<Dtype>::Forward_gpu_pyramid(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int height1 = level_height(level_), width1 = level_width(level_);
+  if (layout_ == NHWC) {
+    const int bottom_dim = bottom[0]->count(1);
+    const int levels_dim = level_offset(level_ + 1);
+    const int top_dim = top[0]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      Dtype* levels = pyramid_levels_.mutable_gpu_data() + n * levels_dim;
+      caffe_gpu_pyramid2<Dtype,true>(channels_,
+        bottom[0]->gpu_data() + n * bottom_dim, height_in_, width_in_,
+        levels, level_);
+      caffe_gpu_interp2<Dtype,true>(channels_,
+        levels + level_offset(level_), 0, 0, height1, width1, height1, width1,
+        top[0]->mutable_gpu_data() + n * top_dim, 0, 0,
+        height_out_, width_out_, height_out_, width_out_);
+    }
+    return;
+  }
+  Dtype* levels = pyramid_levels_.mutable_gpu_data();
+  caffe_gpu_pyramid2<Dtype,false>(num_ * channels_,
+    bottom[0]->gpu_data(), height_in_, width_in_, levels, level_);
+  caffe_gpu_interp2<Dtype,false>(num_ * channels_,
+    levels + level_offset(level_), 0, 0, height1, width1, height1, width1,
+    top[0]->mutable_gpu_data(), 0, 0,
+    height_out_, width_out_, height_out_, width_out_);
+}
+
+template <typename Dtype>
+void InterpLayer<Dtype>::Backward_gpu_pyramid(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int height1 = level_height(level_), width1 = level_width(level_);
+  const bool packed = (layout_ == NHWC);
+  const int images = packed ? num_ : 1;
+  const int channels = packed ? channels_ : num_ * channels_;
+  const int bottom_dim = bottom[0]->count() / images;
+  const int levels_dim = level_offset(level_ + 1);
+  const int top_dim = top[0]->count() / images;
+  caffe_gpu_set(pyramid_levels_.count(), Dtype(0),
+      pyramid_levels_.mutable_gpu_diff());
+  for (int n = 0; n < images; ++n) {
+    Dtype* levels = pyramid_levels_.mutable_gpu_diff() + n * levels_dim;
+    if (packed) {
+      caffe_gpu_interp2_backward<Dtype,true>(channels,
+        levels + level_offset(level_), 0, 0, height1, width1, height1, width1,
+        top[0]->gpu_diff() + n * top_dim, 0, 0,
+        height_out_, width_out_, height_out_, width_out_);
+    } else {
+      caffe_gpu_interp2_backward<Dtype,false>(channels,
+        levels + level_offset(level_), 0, 0, height1, width1, height1, width1,
+        top[0]->gpu_diff() + n * top_dim, 0, 0,
+        height_out_, width_out_, height_out_, width_out_);
+    }
+    for (int l = level_; l >= 1; --l) {
+      Dtype* diff = (l == 1) ? bottom[0]->mutable_gpu_diff() + n * bottom_dim :
+        levels + level_offset(l - 1);
+      if (packed) {
+        caffe_gpu_pyramid2_backward<Dtype,true>(channels, diff,
+          level_height(l - 1), level_width(l - 1), levels + level_offset(l));
+      } else {
+        caffe_gpu_pyramid2_backward<Dtype,false>(channels, diff,
+          level_height(l - 1), level_width(l - 1), levels + level_offset(l));
+      }
+    }
+  }
+}
 #endif
 
 #ifdef CPU_ONLY
@@ -0,0 +1,165 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/interp_softmax_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void InterpSoftmaxLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  InterpLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK_EQ(Caffe::mode(), Caffe::CPU)
+    << "InterpSoftmax only runs on the CPU; use Interp and Softmax on the GPU.";
+  CHECK_EQ(this->layout_, NCHW)
+    << "InterpSoftmax only supports the NCHW layout.";
+  CHECK_EQ(this->storage_, FP32)
+    << "InterpSoftmax only supports FP32 storage.";
+  CHECK(!this->pyramid_)
+    << "InterpSoftmax does not support the pyramid downscale.";
+  const InterpSoftmaxParameter& param =
+    this->layer_param_.interp_softmax_param();
+  output_prob_ = (param.output() != InterpSoftmaxParameter_Output_LABEL);
+  output_label_ = (param.output() != InterpSoftmaxParameter_Output_PROB);
+  accumulate_ = param.accumulate();
+  mirror_ = param.mirror();
+  CHECK_EQ(top.size(), (output_prob_ && output_label_) ? 2 : 1)
+    << "InterpSoftmax has one top per output.";
+  CHECK(output_prob_ || !accumulate_)
+    << "Accumulation needs the probability top.";
+}
+
+template <typename Dtype>
+void InterpSoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  this->Reshape_sizes(bottom);
+  if (output_prob_) {
+    top[0]->Reshape(this->num_, this->channels_, this->height_out_,
+        this->width_out_);
+  }
+  if (output_label_) {
+    top[output_prob_ ? 1 : 0]->Reshape(this->num_, 1, this->height_out_,
+        this->width_out_);
+  }
+  const int row_size = this->channels_ * this->width_out_;
+  band_rows_ = std::max(1, std::min(this->height_out_,
+      static_cast<int>((256 << 10) / sizeof(Dtype)) / row_size));
+  bands_ = (this->height_out_ + band_rows_ - 1) / band_rows_;
+}
+
+template <typename Dtype>
+void InterpSoftmaxLayer<Dtype>::Forward_cpu_bands(const Dtype* bottom_data,
+    Dtype* prob, Dtype* label, const int begin, const int end) {
+  const int channels = this->channels_;
+  const int height = this->height_out_;
+  const int width = this->width_out_;
+  const int bottom_dim = channels * this->height_in_ * this->width_in_;
+  std::vector<Dtype> band(channels * band_rows_ * width);
+  std::vector<Dtype> scale(band_rows_ * width);
+  std::vector<int> best(band_rows_ * width);
+  for (int task = begin; task < end; ++task) {
+    const int n = task / bands_;
+    const int h_begin = (task % bands_) * band_rows_;
+    const int h_end = std::min(h_begin + band_rows_, height);
+    const int plane = (h_end - h_begin) * width;
+    caffe_cpu_interp2_band(this->tables_, channels,
+        bottom_data + n * bottom_dim, - this->pad_beg_, - this->pad_beg_,
+        this->height_in_, this->width_in_, h_begin, h_end, &band[0]);
+    // Softmax over the channels, as the Softmax layer: subtract the
+    // maximum, exponentiate and divide by the sum
+    std::copy(band.begin(), band.begin() + plane, scale.begin());
+    for (int c = 1; c < channels; ++c) {
+      const Dtype* x = &band[c * plane];
+      for (int i = 0; i < plane; ++i) {
+        scale[i] = std::max(scale[i], x[i]);
+      }
+    }
+    for (int c = 0; c < channels; ++c) {
+      Dtype* x = &band[c * plane];
+      for (int i = 0; i < plane; ++i) {
+        x[i] = std::exp(x[i] - scale[i]);
+      }
+    }
+    std::copy(band.begin(), band.begin() + plane, scale.begin());
+    for (int c = 1; c < channels; ++c) {
+      const Dtype* x = &band[c * plane];
+      for (int i = 0; i < plane; ++i) {
+        scale[i] += x[i];
+      }
+    }
+    for (int c = 0; c < channels; ++c) {
+      Dtype* x = &band[c * plane];
+      for (int i = 0; i < plane; ++i) {
+        x[i] /= scale[i];
+      }
+    }
+    if (mirror_) {
+      for (int r = 0; r < channels * (h_end - h_begin); ++r) {
+        std::reverse(&band[r * width], &band[r * width] + width);
+      }
+    }
+    // Writes the band; the labels are those of the written probabilities,
+    // so of the sums when accumulating
+    const Dtype* label_src = &band[0];
+    int label_stride = plane;
+    if (prob) {
+      for (int c = 0; c < channels; ++c) {
+        for (int h = h_begin; h < h_end; ++h) {
+          const Dtype* x = &band[c * plane + (h - h_begin) * width];
+          Dtype* y = prob + ((n * channels + c) * height + h) * width;
+          if (accumulate_) {
+            for (int w = 0; w < width; ++w) {
+              y[w] += x[w];
+            }
+          } else {
+            std::copy(x, x + width, y);
+          }
+        }
+      }
+      label_src = prob + n * channels * height * width + h_begin * width;
+      label_stride = height * width;
+    }
+    if (!label) { continue; }
+    for (int i = 0; i < plane; ++i) {
+      scale[i] = label_src[i];
+      best[i] = 0;
+    }
+    for (int c = 1; c < channels; ++c) {
+      const Dtype* x = label_src + c * label_stride;
+      for (int i = 0; i < plane; ++i) {
+        if (x[i] > scale[i]) {
+          scale[i] = x[i];
+          best[i] = c;
+        }
+      }
+    }
+    Dtype* y = label + (n * height + h_begin) * width;
+    for (int i = 0; i < plane; ++i) {
+      y[i] = best[i];
+    }
+  }
+}
+
+template <typename Dtype>
+void InterpSoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  Dtype* prob = output_prob_ ? top[0]->mutable_cpu_data() : NULL;
+  Dtype* label = output_label_ ?
+    top[output_prob_ ? 1 : 0]->mutable_cpu_data() : NULL;
+  caffe_cpu_parallel_for(this->num_ * bands_,
+      this->channels_ * band_rows_ * this->width_out_, this->num_threads_,
+      boost::bind(&InterpSoftmaxLayer<Dtype>::Forward_cpu_bands, this,
+          bottom[0]->cpu_data(), prob, label, _1, _2));
+}
+
+INSTANTIATE_CLASS(InterpSoftmaxLayer);
+REGISTER_LAYER_CLASS(InterpSoftmax);
+
+}  // namespace caffe
@@ -0,0 +1,87 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/layout_layer.hpp"
+
+namespace caffe {
+
+// Transposes each of the num rows x cols matrices of src into dst, in
+// square tiles so that both the reads and the writes stay in cache.
+template <typename Dtype>
+static void transpose_batch(const int num, const int rows, const int cols,
+    const Dtype* src, Dtype* dst) {
+  const int tile = 32;
+  for (int n = 0; n < num; ++n) {
+    const Dtype* src_n = src + n * rows * cols;
+    Dtype* dst_n = dst + n * rows * cols;
+    for (int r0 = 0; r0 < rows; r0 += tile) {
+      const int r1 = std::min(rows, r0 + tile);
+      for (int c0 = 0; c0 < cols; c0 += tile) {
+        const int c1 = std::min(cols, c0 + tile);
+        for (int r = r0; r < r1; ++r) {
+          for (int c = c0; c < c1; ++c) {
+            dst_n[c * rows + r] = src_n[r * cols + c];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  layout_ = this->layer_param_.layout_param().layout();
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(bottom[0]->num_axes(), 4)
+    << "Layout conversion only supports 4-D blobs.";
+  const vector<int>& bottom_shape = bottom[0]->shape();
+  vector<int> top_shape(4, bottom_shape[0]);
+  if (layout_ == NHWC) {
+    // (num, channels, height, width) -> (num, height, width, channels)
+    top_shape[1] = bottom_shape[2];
+    top_shape[2] = bottom_shape[3];
+    top_shape[3] = bottom_shape[1];
+  } else {
+    // (num, height, width, channels) -> (num, channels, height, width)
+    top_shape[1] = bottom_shape[3];
+    top_shape[2] = bottom_shape[1];
+    top_shape[3] = bottom_shape[2];
+  }
+  top[0]->Reshape(top_shape);
+  num_ = bottom_shape[0];
+  rows_ = (layout_ == NHWC) ? bottom_shape[1] : bottom[0]->count(1, 3);
+  cols_ = (layout_ == NHWC) ? bottom[0]->count(2) : bottom_shape[3];
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  transpose_batch(num_, rows_, cols_, bottom[0]->cpu_data(),
+      top[0]->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  transpose_batch(num_, cols_, rows_, top[0]->cpu_diff(),
+      bottom[0]->mutable_cpu_diff());
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(LayoutLayer);
+#endif
+
+INSTANTIATE_CLASS(LayoutLayer);
+REGISTER_LAYER_CLASS(Layout);
+
+}  // namespace caffe
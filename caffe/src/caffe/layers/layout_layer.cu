@@ -0,0 +1,46 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/layout_layer.hpp"
+
+namespace caffe {
+
+// Transposes each of the rows x cols matrices of src into dst
+template <typename Dtype>
+__global__ void transpose_batch_kernel(const int nthreads, const int rows,
+    const int cols, const Dtype* src, Dtype* dst) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / (rows * cols);
+    const int r = (index / cols) % rows;
+    const int c = index % cols;
+    dst[(n * cols + c) * rows + r] = src[index];
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int count = bottom[0]->count();
+  transpose_batch_kernel<Dtype>
+    <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+    (count, rows_, cols_, bottom[0]->gpu_data(), top[0]->mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const int count = top[0]->count();
+  transpose_batch_kernel<Dtype>
+    <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+    (count, cols_, rows_, top[0]->gpu_diff(), bottom[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(LayoutLayer);
+
+}  // namespace caffe
@@ -0,0 +1,367 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/multi_warp_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/warp.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::LayerSetUp(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const WarpParameter& warp_param = this->layer_param_.warp_param();
+  CHECK_EQ(warp_param.layout(), NCHW)
+    << this->type() << " only supports the NCHW layout.";
+  CHECK_EQ(warp_param.storage(), FP32)
+    << this->type() << " only supports FP32 storage.";
+  CHECK_NE(bottom.size() % 3, 1)
+    << "MultiWarp takes [cur, w_cur,] then (prev, flow, w) per frame.";
+  has_cur_ = (bottom.size() % 3 == 2);
+  frames_ = bottom.size() / 3;
+  outliers_ = warp_param.outliers();
+  flow_scale_ = warp_param.flow_scale();
+  num_threads_ = caffe_cpu_num_threads(warp_param.num_threads());
+  // Inference keeps no per-pixel state between Forward and Backward
+  lean_ = (this->phase_ == TEST);
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const Blob<Dtype>* image = bottom[prev_bottom(0)];
+  const Blob<Dtype>* flow = bottom[flow_bottom(0)];
+  CHECK_EQ(image->num_axes(), 4);
+  if (has_cur_) {
+    CHECK(bottom[cur_bottom()]->shape() == image->shape())
+      << "cur needs the shape of the previous frames.";
+    CHECK(bottom[w_cur_bottom()]->shape() == image->shape())
+      << "w_cur needs the shape of the previous frames.";
+  }
+  for (int k = 0; k < frames_; ++k) {
+    CHECK(bottom[prev_bottom(k)]->shape() == image->shape())
+      << "All the previous frames need the same shape.";
+    CHECK(bottom[weight_bottom(k)]->shape() == image->shape())
+      << "The weights need the shape of the previous frames.";
+    CHECK(bottom[flow_bottom(k)]->shape() == flow->shape())
+      << "All the Optical Flows need the same shape.";
+  }
+  CHECK_EQ(flow->num(), image->num())
+    << "Optical Flow and input blobs need the same number of images.";
+  CHECK_EQ(flow->channels(), 2)
+    << "Optical Flow needs 2 channels.";
+  top[0]->ReshapeLike(*image);
+  num_ = image->num();
+  channels_ = image->channels();
+  height_ = image->height();
+  width_ = image->width();
+  flow_height_ = flow->height();
+  flow_width_ = flow->width();
+  if (!lean_) {
+    Reshape_buffers();
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Reshape_buffers() {
+  plan_offset_.Reshape(frames_ * num_, kWarpTaps, height_, width_);
+  plan_weight_.Reshape(frames_ * num_, kWarpTaps, height_, width_);
+  plan_theta_.Reshape(frames_ * num_, 2, height_, width_);
+  warped_.Reshape(frames_ * num_, channels_, height_, width_);
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Plan_cpu(const vector<Blob<Dtype>*>& bottom) {
+  vector<const Dtype*> flows(frames_);
+  for (int k = 0; k < frames_; ++k) {
+    flows[k] = bottom[flow_bottom(k)]->cpu_data();
+  }
+  caffe_cpu_parallel_for(frames_ * num_ * height_, width_, num_threads_,
+      boost::bind(&MultiWarpLayer<Dtype>::Plan_cpu_rows, this, &flows[0],
+                  plan_offset_.mutable_cpu_data(),
+                  plan_weight_.mutable_cpu_data(),
+                  plan_theta_.mutable_cpu_data(), _1, _2));
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* cur = has_cur_ ? bottom[cur_bottom()]->cpu_data() : NULL;
+  const Dtype* w_cur = has_cur_ ? bottom[w_cur_bottom()]->cpu_data() : NULL;
+  vector<const Dtype*> prevs(frames_), flows(frames_), weights(frames_);
+  for (int k = 0; k < frames_; ++k) {
+    prevs[k] = bottom[prev_bottom(k)]->cpu_data();
+    flows[k] = bottom[flow_bottom(k)]->cpu_data();
+    weights[k] = bottom[weight_bottom(k)]->cpu_data();
+  }
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  if (lean_) {
+    caffe_cpu_parallel_for(num_ * height_, frames_ * channels_ * width_,
+        num_threads_,
+        boost::bind(&MultiWarpLayer<Dtype>::Forward_cpu_lean_rows, this,
+                    cur, w_cur, &prevs[0], &flows[0], &weights[0], top_data,
+                    _1, _2));
+    return;
+  }
+  // The plans are shared by all the channels; threads own disjoint (n, c)
+  // planes of warped_ and of the output.
+  Plan_cpu(bottom);
+  caffe_cpu_parallel_for(num_ * channels_, frames_ * height_ * width_,
+      num_threads_,
+      boost::bind(&MultiWarpLayer<Dtype>::Forward_cpu_planes, this,
+                  cur, w_cur, &prevs[0], &weights[0],
+                  warped_.mutable_cpu_data(), top_data, _1, _2));
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Plan_cpu_rows(const Dtype* const* flows,
+    int* plan_offset, Dtype* plan_weight, Dtype* plan_theta,
+    const int begin, const int end) {
+  const int spatial_dim = height_ * width_;
+  const int flow_dim = 2 * flow_height_ * flow_width_;
+  for (int row=begin; row<end;) {
+    // Image i of the plans is image n of the flow of frame k
+    const int i = row / height_;
+    const int k = i / num_;
+    const int n = i % num_;
+    const int h_begin = row % height_;
+    const int h_end = std::min(height_, h_begin + end - row);
+    caffe_cpu_warp_plan(outliers_, height_, width_, flows[k] + n * flow_dim,
+        flow_height_, flow_width_, flow_scale_, h_begin, h_end,
+        plan_offset + i * kWarpTaps * spatial_dim,
+        plan_weight + i * kWarpTaps * spatial_dim,
+        plan_theta + i * 2 * spatial_dim);
+    row += h_end - h_begin;
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Forward_cpu_planes(const Dtype* cur,
+    const Dtype* w_cur, const Dtype* const* prevs,
+    const Dtype* const* weights, Dtype* warped, Dtype* top_data,
+    const int begin, const int end) {
+  const int spatial_dim = height_ * width_;
+  const int count = num_ * channels_ * spatial_dim;
+  const int* plan_offset = plan_offset_.cpu_data();
+  const Dtype* plan_weight = plan_weight_.cpu_data();
+  for (int plane=begin; plane<end; plane++) {
+    const int n = plane / channels_;
+    const int offset = plane * spatial_dim;
+    if (top_data) {
+      for (int i=offset; i<offset + spatial_dim; i++) {
+        top_data[i] = cur ? cur[i] * w_cur[i] : Dtype(0);
+      }
+    }
+    for (int k=0; k<frames_; k++) {
+      const int plan = (k * num_ + n) * kWarpTaps * spatial_dim;
+      Dtype* warped_k = warped + k * count;
+      caffe_cpu_warp_blend(spatial_dim, prevs[k] + offset,
+          plan_offset + plan, plan_weight + plan, warped_k + offset);
+      if (!top_data) { continue; }
+      // Same products and sum as the Eltwise layers
+      const Dtype* w_k = weights[k];
+      for (int i=offset; i<offset + spatial_dim; i++) {
+        top_data[i] += warped_k[i] * w_k[i];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Forward_cpu_lean_rows(const Dtype* cur,
+    const Dtype* w_cur, const Dtype* const* prevs, const Dtype* const* flows,
+    const Dtype* const* weights, Dtype* top_data, const int begin,
+    const int end) {
+  const int spatial_dim = height_ * width_;
+  const int flow_dim = 2 * flow_height_ * flow_width_;
+  const int row_plan = kWarpTaps * width_;
+  vector<int> offset(frames_ * row_plan);
+  vector<Dtype> weight(frames_ * row_plan);
+  vector<Dtype> warped(width_);
+  for (int row=begin; row<end; row++) {
+    const int n = row / height_;
+    const int h = row % height_;
+    for (int k=0; k<frames_; k++) {
+      caffe_cpu_warp_plan_row(outliers_, height_, width_,
+          flows[k] + n * flow_dim, flow_height_, flow_width_, flow_scale_, h,
+          &offset[k * row_plan], &weight[k * row_plan]);
+    }
+    for (int c=0; c<channels_; c++) {
+      const int plane = (n * channels_ + c) * spatial_dim;
+      Dtype* top_row = top_data + plane + h * width_;
+      for (int w=0; w<width_; w++) {
+        const int i = plane + h * width_ + w;
+        top_row[w] = cur ? cur[i] * w_cur[i] : Dtype(0);
+      }
+      for (int k=0; k<frames_; k++) {
+        caffe_cpu_warp_blend(width_, prevs[k] + plane, &offset[k * row_plan],
+            &weight[k * row_plan], &warped[0]);
+        const Dtype* w_k = weights[k] + plane + h * width_;
+        for (int w=0; w<width_; w++) {
+          top_row[w] += warped[w] * w_k[w];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const int count = top[0]->count();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  bool frames_down = false;
+  for (int k = 0; k < frames_; ++k) {
+    frames_down = frames_down || propagate_down[prev_bottom(k)] ||
+        propagate_down[flow_bottom(k)] || propagate_down[weight_bottom(k)];
+  }
+  if (lean_ && frames_down) {
+    // Inference kept neither the plans nor the warped frames
+    vector<const Dtype*> prevs(frames_), weights(frames_);
+    for (int k = 0; k < frames_; ++k) {
+      prevs[k] = bottom[prev_bottom(k)]->cpu_data();
+      weights[k] = bottom[weight_bottom(k)]->cpu_data();
+    }
+    Reshape_buffers();
+    Plan_cpu(bottom);
+    caffe_cpu_parallel_for(num_ * channels_, frames_ * height_ * width_,
+        num_threads_,
+        boost::bind(&MultiWarpLayer<Dtype>::Forward_cpu_planes, this,
+                    static_cast<const Dtype*>(NULL),
+                    static_cast<const Dtype*>(NULL), &prevs[0], &weights[0],
+                    warped_.mutable_cpu_data(), static_cast<Dtype*>(NULL),
+                    _1, _2));
+  }
+  const int cur = cur_bottom();
+  const int w_cur = w_cur_bottom();
+  if (has_cur_ && propagate_down[cur]) {
+    caffe_mul(count, top_diff, bottom[w_cur]->cpu_data(),
+        bottom[cur]->mutable_cpu_diff());
+  }
+  if (has_cur_ && propagate_down[w_cur]) {
+    caffe_mul(count, top_diff, bottom[cur]->cpu_data(),
+        bottom[w_cur]->mutable_cpu_diff());
+  }
+  const bool resampled = (flow_height_ != height_ || flow_width_ != width_);
+  const int flow_dim = 2 * flow_height_ * flow_width_;
+  const int flow_count = num_ * 2 * height_ * width_;
+  // Every thread owns a range of (n, c) planes, so the scatter into the
+  // gradient of prev_k never collides. The flow gradient sums over the
+  // channels: thread 0 accumulates into flow_diff directly and the other
+  // threads into their own partial buffer, added up after each frame.
+  const int threads = caffe_cpu_parallel_threads(num_ * channels_,
+      height_ * width_, num_threads_);
+  for (int k = 0; k < frames_; ++k) {
+    const int prev = prev_bottom(k);
+    const int flow = flow_bottom(k);
+    const int weight = weight_bottom(k);
+    if (propagate_down[weight]) {
+      caffe_mul(count, top_diff, warped_.cpu_data() + k * count,
+          bottom[weight]->mutable_cpu_diff());
+    }
+    if (!propagate_down[prev] && !propagate_down[flow]) { continue; }
+    // The warp of frame k sees the gradient w_k * top_diff
+    warped_diff_.ReshapeLike(*top[0]);
+    caffe_mul(count, top_diff, bottom[weight]->cpu_data(),
+        warped_diff_.mutable_cpu_data());
+    Dtype* prev_diff = NULL;
+    Dtype* flow_diff = NULL;
+    Dtype* flow_diff_partial = NULL;
+    if (propagate_down[prev]) {
+      prev_diff = bottom[prev]->mutable_cpu_diff();
+      caffe_set(count, (Dtype)0., prev_diff);
+    }
+    if (propagate_down[flow]) {
+      flow_diff = bottom[flow]->mutable_cpu_diff();
+      caffe_set(bottom[flow]->count(), (Dtype)0., flow_diff);
+      if (resampled) {
+        // The gradient of a resampled flow is first taken at the image size
+        flow_diff_full_.Reshape(num_, 2, height_, width_);
+        flow_diff = flow_diff_full_.mutable_cpu_data();
+        caffe_set(flow_count, (Dtype)0., flow_diff);
+      }
+      if (threads > 1) {
+        flow_diff_partial_.Reshape(num_ * (threads - 1), 2, height_, width_);
+        flow_diff_partial = flow_diff_partial_.mutable_cpu_data();
+        caffe_set(flow_diff_partial_.count(), (Dtype)0., flow_diff_partial);
+      }
+    }
+    // One chunk per thread, see Backward_cpu_thread
+    caffe_cpu_parallel_for(threads, threads,
+        boost::bind(&MultiWarpLayer<Dtype>::Backward_cpu_thread, this, k,
+                    bottom[prev]->cpu_data(), prev_diff, flow_diff,
+                    flow_diff_partial, threads, _1, _2));
+    if (!flow_diff) { continue; }
+    for (int t = 1; t < threads; ++t) {
+      caffe_axpy(flow_count, (Dtype)1.,
+          flow_diff_partial + (t - 1) * flow_count, flow_diff);
+    }
+    Dtype* bottom_flow_diff = bottom[flow]->mutable_cpu_diff();
+    if (resampled) {
+      for (int n=0; n<num_; n++) {
+        caffe_cpu_interp2_backward<Dtype,false>(2,
+            bottom_flow_diff + n * flow_dim, 0, 0, flow_height_, flow_width_,
+            flow_height_, flow_width_,
+            flow_diff + n * 2 * height_ * width_, 0, 0, height_, width_,
+            height_, width_);
+      }
+    }
+    if (flow_scale_ != Dtype(1)) {
+      caffe_scal(bottom[flow]->count(), flow_scale_, bottom_flow_diff);
+    }
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Backward_cpu_thread(const int k,
+    const Dtype* prev, Dtype* prev_diff, Dtype* flow_diff,
+    Dtype* flow_diff_partial, const int threads, const int begin,
+    const int end) {
+  const int spatial_dim = height_ * width_;
+  const Dtype* warped_diff = warped_diff_.cpu_data();
+  const int flow_dim = 2 * spatial_dim;
+  const int* plan_offset = plan_offset_.cpu_data();
+  const Dtype* plan_weight = plan_weight_.cpu_data();
+  const Dtype* plan_theta = plan_theta_.cpu_data();
+  const int units = num_ * channels_;
+  for (int t=begin; t<end; t++) {
+    const int unit_begin = (long long)units * t / threads;
+    const int unit_end = (long long)units * (t + 1) / threads;
+    Dtype* thread_flow_diff = flow_diff;
+    if (flow_diff && t > 0) {
+      thread_flow_diff = flow_diff_partial + (t - 1) * num_ * flow_dim;
+    }
+    for (int plane=unit_begin; plane<unit_end;) {
+      // Image i of the plans is image n of the flow of frame k
+      const int n = plane / channels_;
+      const int i = k * num_ + n;
+      const int c_end = std::min(channels_, plane % channels_ +
+                                            unit_end - plane);
+      const int planes = c_end - plane % channels_;
+      caffe_cpu_warp_blend_backward(planes, spatial_dim,
+          plan_offset + i * kWarpTaps * spatial_dim,
+          plan_weight + i * kWarpTaps * spatial_dim,
+          plan_theta + i * flow_dim,
+          prev + plane * spatial_dim, warped_diff + plane * spatial_dim,
+          prev_diff ? prev_diff + plane * spatial_dim : NULL,
+          thread_flow_diff ? thread_flow_diff + n * flow_dim : NULL);
+      plane += planes;
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(MultiWarpLayer);
+#endif
+
+INSTANTIATE_CLASS(MultiWarpLayer);
+REGISTER_LAYER_CLASS(MultiWarp);
+
+}  // namespace caffe
@@ -0,0 +1,187 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/multi_warp_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/gpu_util.cuh"
+#include "caffe/util/warp.cuh"
+
+namespace caffe {
+
+// One thread per output element: samples prev_k and adds w_k * warp(prev_k)
+// to the output. The sampling coordinates stay in registers.
+template <typename Dtype>
+__global__ void multi_warp_fwd(const int nthreads,
+    const WarpParameter_WarpType outliers, const Dtype *prev,
+    const Dtype *flow, const Dtype *w_k, const int channels_,
+    const int height_, const int width_, const int flow_height_,
+    const int flow_width_, const Dtype flow_scale_, Dtype *top_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width_;
+    const int h = (index / width_) % height_;
+    const int n = index / (channels_ * height_ * width_);
+    const Dtype *src = prev + index - (h * width_ + w);
+    int o[4];
+    Dtype theta_x, theta_y;
+    if (warp_sample_at(outliers, flow + n * 2 * flow_height_ * flow_width_,
+                       height_, width_, flow_height_, flow_width_,
+                       flow_scale_, h, w, o, &theta_x, &theta_y)) {
+      const Dtype theta_x_ = 1 - theta_x;
+      const Dtype theta_y_ = 1 - theta_y;
+      const Dtype warped = (theta_x_ * theta_y_ * src[o[0]]) +
+                           (theta_x  * theta_y_ * src[o[1]]) +
+                           (theta_x_ * theta_y  * src[o[2]]) +
+                           (theta_x  * theta_y  * src[o[3]]);
+      top_data[index] += warped * w_k[index];
+    }
+  }
+}
+
+// Gradients of prev_k, flow_k (at the image size) and w_k, each skipped if
+// NULL. The scatter into prev_k and the flow gradient, which sums over the
+// channels, use atomics.
+template <typename Dtype>
+__global__ void multi_warp_bwd(const int nthreads,
+    const WarpParameter_WarpType outliers, const Dtype *prev,
+    const Dtype *flow, const Dtype *w_k, const Dtype *top_diff,
+    const int channels_, const int height_, const int width_,
+    const int flow_height_, const int flow_width_, const Dtype flow_scale_,
+    Dtype *prev_diff, Dtype *flow_diff, Dtype *w_k_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width_;
+    const int h = (index / width_) % height_;
+    const int n = index / (channels_ * height_ * width_);
+    const int plane = index - (h * width_ + w);
+    const Dtype diff = top_diff[index];
+    int o[4];
+    Dtype theta_x, theta_y;
+    if (!warp_sample_at(outliers, flow + n * 2 * flow_height_ * flow_width_,
+                        height_, width_, flow_height_, flow_width_,
+                        flow_scale_, h, w, o, &theta_x, &theta_y)) {
+      if (w_k_diff) {
+        w_k_diff[index] = 0;
+      }
+      continue;
+    }
+    const Dtype theta_x_ = 1 - theta_x;
+    const Dtype theta_y_ = 1 - theta_y;
+    const Dtype I0 = prev[plane + o[0]];
+    const Dtype I1 = prev[plane + o[1]];
+    const Dtype I2 = prev[plane + o[2]];
+    const Dtype I3 = prev[plane + o[3]];
+    if (w_k_diff) {
+      w_k_diff[index] = diff * ((theta_x_ * theta_y_ * I0) +
+                                (theta_x  * theta_y_ * I1) +
+                                (theta_x_ * theta_y  * I2) +
+                                (theta_x  * theta_y  * I3));
+    }
+    const Dtype warped_diff = diff * w_k[index];
+    if (prev_diff) {
+      Dtype *src_diff = prev_diff + plane;
+      caffe_gpu_atomic_add(theta_x_ * theta_y_ * warped_diff, src_diff + o[0]);
+      caffe_gpu_atomic_add(theta_x  * theta_y_ * warped_diff, src_diff + o[1]);
+      caffe_gpu_atomic_add(theta_x_ * theta_y  * warped_diff, src_diff + o[2]);
+      caffe_gpu_atomic_add(theta_x  * theta_y  * warped_diff, src_diff + o[3]);
+    }
+    if (flow_diff) {
+      Dtype *pos = flow_diff + n * 2 * height_ * width_ + h * width_ + w;
+      caffe_gpu_atomic_add((-1*theta_y_*I0 + theta_y_*I1 - theta_y*I2 +
+                            theta_y*I3) * warped_diff, pos + height_ * width_);
+      caffe_gpu_atomic_add((-1*theta_x_*I0 - theta_x*I1 + theta_x_*I2 +
+                            theta_x*I3) * warped_diff, pos);
+    }
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const int num_kernels = top[0]->count();
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  if (has_cur_) {
+    caffe_gpu_mul(num_kernels, bottom[cur_bottom()]->gpu_data(),
+        bottom[w_cur_bottom()]->gpu_data(), top_data);
+  } else {
+    caffe_gpu_set(num_kernels, (Dtype)0., top_data);
+  }
+  // One pass per frame; each frame and flow is still read once
+  for (int k = 0; k < frames_; ++k) {
+    multi_warp_fwd<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+        CAFFE_CUDA_NUM_THREADS>>>(num_kernels, outliers_,
+        bottom[prev_bottom(k)]->gpu_data(), bottom[flow_bottom(k)]->gpu_data(),
+        bottom[weight_bottom(k)]->gpu_data(), channels_, height_, width_,
+        flow_height_, flow_width_, flow_scale_, top_data);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+template <typename Dtype>
+void MultiWarpLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  const int num_kernels = top[0]->count();
+  const Dtype* top_diff = top[0]->gpu_diff();
+  const int cur = cur_bottom();
+  const int w_cur = w_cur_bottom();
+  if (has_cur_ && propagate_down[cur]) {
+    caffe_gpu_mul(num_kernels, top_diff, bottom[w_cur]->gpu_data(),
+        bottom[cur]->mutable_gpu_diff());
+  }
+  if (has_cur_ && propagate_down[w_cur]) {
+    caffe_gpu_mul(num_kernels, top_diff, bottom[cur]->gpu_data(),
+        bottom[w_cur]->mutable_gpu_diff());
+  }
+  // The gradient of a resampled flow is first taken at the image size
+  const bool resampled = (flow_height_ != height_ || flow_width_ != width_);
+  for (int k = 0; k < frames_; ++k) {
+    const int prev = prev_bottom(k);
+    const int flow = flow_bottom(k);
+    const int weight = weight_bottom(k);
+    Dtype* prev_diff =
+        propagate_down[prev] ? bottom[prev]->mutable_gpu_diff() : NULL;
+    Dtype* flow_diff =
+        propagate_down[flow] ? bottom[flow]->mutable_gpu_diff() : NULL;
+    Dtype* w_k_diff =
+        propagate_down[weight] ? bottom[weight]->mutable_gpu_diff() : NULL;
+    if (!prev_diff && !flow_diff && !w_k_diff) { continue; }
+    if (prev_diff) {
+      caffe_gpu_set(bottom[prev]->count(), (Dtype)0., prev_diff);
+    }
+    if (flow_diff) {
+      caffe_gpu_set(bottom[flow]->count(), (Dtype)0., flow_diff);
+      if (resampled) {
+        flow_diff_full_.Reshape(num_, 2, height_, width_);
+        flow_diff = flow_diff_full_.mutable_gpu_data();
+        caffe_gpu_set(flow_diff_full_.count(), (Dtype)0., flow_diff);
+      }
+    }
+    multi_warp_bwd<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+        CAFFE_CUDA_NUM_THREADS>>>(num_kernels, outliers_,
+        bottom[prev]->gpu_data(), bottom[flow]->gpu_data(),
+        bottom[weight]->gpu_data(), top_diff, channels_, height_, width_,
+        flow_height_, flow_width_, flow_scale_, prev_diff, flow_diff,
+        w_k_diff);
+    CUDA_POST_KERNEL_CHECK;
+    if (!flow_diff) { continue; }
+    Dtype* bottom_flow_diff = bottom[flow]->mutable_gpu_diff();
+    if (resampled) {
+      for (int n = 0; n < num_; ++n) {
+        caffe_gpu_interp2_backward<Dtype,false>(2,
+            bottom_flow_diff + n * 2 * flow_height_ * flow_width_,
+            0, 0, flow_height_, flow_width_, flow_height_, flow_width_,
+            flow_diff + n * 2 * height_ * width_, 0, 0, height_, width_,
+            height_, width_);
+      }
+    }
+    if (flow_scale_ != Dtype(1)) {
+      caffe_gpu_scal(bottom[flow]->count(), flow_scale_, bottom_flow_diff);
+    }
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(MultiWarpLayer);
+
+}  // namespace caffe
@@ -0,0 +1,13 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include "caffe/layers/netwarp_combine_layer.hpp"
+
+namespace caffe {
+
+// The forward and backward passes are those of MultiWarpLayer
+INSTANTIATE_CLASS(NetWarpCombineLayer);
+REGISTER_LAYER_CLASS(NetWarpCombine);
+
+}  // namespace caffe
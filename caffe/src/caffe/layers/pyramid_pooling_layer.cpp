@@ -0,0 +1,196 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/pyramid_pooling_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const PyramidPoolingParameter& param =
+    this->layer_param_.pyramid_pooling_param();
+  CHECK_EQ(top.size(), param.kernel_size_size())
+    << "PyramidPooling has one top per kernel_size.";
+  CHECK(param.stride_size() == 0 ||
+        param.stride_size() == param.kernel_size_size())
+    << "Give no stride or one stride per kernel_size.";
+  num_threads_ = caffe_cpu_num_threads(param.num_threads());
+  kernel_size_.resize(top.size());
+  stride_.resize(top.size());
+  for (int l = 0; l < top.size(); ++l) {
+    kernel_size_[l] = param.kernel_size(l);
+    stride_[l] = param.stride_size() ? param.stride(l) : kernel_size_[l];
+    CHECK_GT(kernel_size_[l], 0) << "Kernel size cannot be zero.";
+    CHECK_GT(stride_[l], 0) << "Stride cannot be zero.";
+  }
+  pooled_height_.resize(top.size());
+  pooled_width_.resize(top.size());
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(bottom[0]->num_axes(), 4);
+  num_ = bottom[0]->num();
+  channels_ = bottom[0]->channels();
+  height_ = bottom[0]->height();
+  width_ = bottom[0]->width();
+  for (int l = 0; l < top.size(); ++l) {
+    const int kernel = kernel_size_[l];
+    const int stride = stride_[l];
+    CHECK_LE(kernel, height_) << "Kernel larger than the input.";
+    CHECK_LE(kernel, width_) << "Kernel larger than the input.";
+    // As the Pooling layer without padding
+    pooled_height_[l] = static_cast<int>(ceil(static_cast<float>(
+        height_ - kernel) / stride)) + 1;
+    pooled_width_[l] = static_cast<int>(ceil(static_cast<float>(
+        width_ - kernel) / stride)) + 1;
+    CHECK_LT((pooled_height_[l] - 1) * stride, height_);
+    CHECK_LT((pooled_width_[l] - 1) * stride, width_);
+    top[l]->Reshape(num_, channels_, pooled_height_[l], pooled_width_[l]);
+  }
+  threads_ = caffe_cpu_parallel_threads(num_ * channels_, height_ * width_,
+      num_threads_);
+  table_.resize(threads_ * (height_ + 1) * (width_ + 1));
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Forward_cpu_thread(const Dtype* bottom_data,
+    Dtype* const* top_data, const int begin, const int end) {
+  const int stride = width_ + 1;
+  const int planes = num_ * channels_;
+  for (int t = begin; t < end; ++t) {
+    // sat[h * stride + w] is the sum of the rows < h and the columns < w
+    double* sat = &table_[t * (height_ + 1) * stride];
+    std::fill(sat, sat + stride, 0.);
+    for (int h = 1; h <= height_; ++h) {
+      sat[h * stride] = 0.;
+    }
+    const int plane_begin = (long long)planes * t / threads_;
+    const int plane_end = (long long)planes * (t + 1) / threads_;
+    for (int p = plane_begin; p < plane_end; ++p) {
+      const Dtype* x = bottom_data + p * height_ * width_;
+      for (int h = 0; h < height_; ++h) {
+        double row = 0.;
+        for (int w = 0; w < width_; ++w) {
+          row += x[h * width_ + w];
+          sat[(h + 1) * stride + w + 1] = sat[h * stride + w + 1] + row;
+        }
+      }
+      for (int l = 0; l < kernel_size_.size(); ++l) {
+        const int pooled_height = pooled_height_[l];
+        const int pooled_width = pooled_width_[l];
+        Dtype* y = top_data[l] + p * pooled_height * pooled_width;
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          const int hstart = ph * stride_[l];
+          const int hend = std::min(hstart + kernel_size_[l], height_);
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            const int wstart = pw * stride_[l];
+            const int wend = std::min(wstart + kernel_size_[l], width_);
+            const double sum =
+              sat[hend * stride + wend] - sat[hstart * stride + wend] -
+              sat[hend * stride + wstart] + sat[hstart * stride + wstart];
+            y[ph * pooled_width + pw] =
+              sum / ((hend - hstart) * (wend - wstart));
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  vector<Dtype*> top_data(top.size());
+  for (int l = 0; l < top.size(); ++l) {
+    top_data[l] = top[l]->mutable_cpu_data();
+  }
+  caffe_cpu_parallel_for(threads_, threads_,
+      boost::bind(&PyramidPoolingLayer<Dtype>::Forward_cpu_thread, this,
+                  bottom[0]->cpu_data(), &top_data[0], _1, _2));
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Backward_cpu_thread(
+    const Dtype* const* top_diff, Dtype* bottom_diff, const int begin,
+    const int end) {
+  const int stride = width_ + 1;
+  const int planes = num_ * channels_;
+  for (int t = begin; t < end; ++t) {
+    // The gradient of a window is added at its four corners with alternate
+    // signs; the prefix sums of these corners are the bottom gradient.
+    double* corners = &table_[t * (height_ + 1) * stride];
+    const int plane_begin = (long long)planes * t / threads_;
+    const int plane_end = (long long)planes * (t + 1) / threads_;
+    for (int p = plane_begin; p < plane_end; ++p) {
+      std::fill(corners, corners + (height_ + 1) * stride, 0.);
+      for (int l = 0; l < kernel_size_.size(); ++l) {
+        const int pooled_height = pooled_height_[l];
+        const int pooled_width = pooled_width_[l];
+        const Dtype* dy = top_diff[l] + p * pooled_height * pooled_width;
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          const int hstart = ph * stride_[l];
+          const int hend = std::min(hstart + kernel_size_[l], height_);
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            const int wstart = pw * stride_[l];
+            const int wend = std::min(wstart + kernel_size_[l], width_);
+            const double g = static_cast<double>(dy[ph * pooled_width + pw]) /
+              ((hend - hstart) * (wend - wstart));
+            corners[hstart * stride + wstart] += g;
+            corners[hstart * stride + wend] -= g;
+            corners[hend * stride + wstart] -= g;
+            corners[hend * stride + wend] += g;
+          }
+        }
+      }
+      Dtype* dx = bottom_diff + p * height_ * width_;
+      // Prefix sums along the width, then along the height
+      for (int h = 0; h < height_; ++h) {
+        double* row = &corners[h * stride];
+        for (int w = 1; w < width_; ++w) {
+          row[w] += row[w - 1];
+        }
+        if (h > 0) {
+          const double* prev = &corners[(h - 1) * stride];
+          for (int w = 0; w < width_; ++w) {
+            row[w] += prev[w];
+          }
+        }
+        for (int w = 0; w < width_; ++w) {
+          dx[h * width_ + w] = row[w];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  vector<const Dtype*> top_diff(top.size());
+  for (int l = 0; l < top.size(); ++l) {
+    top_diff[l] = top[l]->cpu_diff();
+  }
+  caffe_cpu_parallel_for(threads_, threads_,
+      boost::bind(&PyramidPoolingLayer<Dtype>::Backward_cpu_thread, this,
+                  &top_diff[0], bottom[0]->mutable_cpu_diff(), _1, _2));
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(PyramidPoolingLayer);
+#endif
+
+INSTANTIATE_CLASS(PyramidPoolingLayer);
+REGISTER_LAYER_CLASS(PyramidPooling);
+
+}  // namespace caffe
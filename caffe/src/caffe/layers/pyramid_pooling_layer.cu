@@ -0,0 +1,100 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/pyramid_pooling_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// One thread per output element of a level, as AvePoolForward without
+// padding
+template <typename Dtype>
+__global__ void pyramid_pool_fwd(const int nthreads, const Dtype* bottom_data,
+    const int height, const int width, const int pooled_height,
+    const int pooled_width, const int kernel, const int stride,
+    Dtype* top_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int pw = index % pooled_width;
+    const int ph = (index / pooled_width) % pooled_height;
+    const int p = index / pooled_width / pooled_height;
+    const int hstart = ph * stride;
+    const int wstart = pw * stride;
+    const int hend = min(hstart + kernel, height);
+    const int wend = min(wstart + kernel, width);
+    const Dtype* x = bottom_data + p * height * width;
+    Dtype sum = 0;
+    for (int h = hstart; h < hend; ++h) {
+      for (int w = wstart; w < wend; ++w) {
+        sum += x[h * width + w];
+      }
+    }
+    top_data[index] = sum / ((hend - hstart) * (wend - wstart));
+  }
+}
+
+// One thread per bottom element, summing the gradients of the windows of
+// every level that contain it
+template <typename Dtype>
+__global__ void pyramid_pool_bwd(const int nthreads, const Dtype* top_diff,
+    const int height, const int width, const int pooled_height,
+    const int pooled_width, const int kernel, const int stride,
+    Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int p = index / width / height;
+    const int phstart = (h < kernel) ? 0 : (h - kernel) / stride + 1;
+    const int phend = min(h / stride + 1, pooled_height);
+    const int pwstart = (w < kernel) ? 0 : (w - kernel) / stride + 1;
+    const int pwend = min(w / stride + 1, pooled_width);
+    const Dtype* dy = top_diff + p * pooled_height * pooled_width;
+    Dtype gradient = 0;
+    for (int ph = phstart; ph < phend; ++ph) {
+      for (int pw = pwstart; pw < pwend; ++pw) {
+        const int hstart = ph * stride;
+        const int wstart = pw * stride;
+        const int hend = min(hstart + kernel, height);
+        const int wend = min(wstart + kernel, width);
+        gradient += dy[ph * pooled_width + pw] /
+            ((hend - hstart) * (wend - wstart));
+      }
+    }
+    bottom_diff[index] += gradient;
+  }
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  for (int l = 0; l < top.size(); ++l) {
+    const int count = top[l]->count();
+    pyramid_pool_fwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+        (count, bottom[0]->gpu_data(), height_, width_, pooled_height_[l],
+         pooled_width_[l], kernel_size_[l], stride_[l],
+         top[l]->mutable_gpu_data());
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+template <typename Dtype>
+void PyramidPoolingLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const int count = bottom[0]->count();
+  Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
+  caffe_gpu_set(count, Dtype(0), bottom_diff);
+  for (int l = 0; l < top.size(); ++l) {
+    pyramid_pool_bwd<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>
+        (count, top[l]->gpu_diff(), height_, width_, pooled_height_[l],
+         pooled_width_[l], kernel_size_[l], stride_[l], bottom_diff);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(PyramidPoolingLayer);
+
+}  // namespace caffe
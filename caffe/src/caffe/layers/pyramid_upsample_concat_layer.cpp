@@ -0,0 +1,99 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/pyramid_upsample_concat_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::LayerSetUp(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const InterpParameter& interp_param = this->layer_param_.interp_param();
+  CHECK_EQ(interp_param.layout(), NCHW)
+    << "PyramidUpsampleConcat only supports the NCHW layout.";
+  CHECK_EQ(interp_param.storage(), FP32)
+    << "PyramidUpsampleConcat only supports FP32 storage.";
+  num_threads_ = caffe_cpu_num_threads(interp_param.num_threads());
+  tables_.resize(bottom.size());
+  channel_offset_.resize(bottom.size());
+}
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::Reshape(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  num_ = bottom[0]->num();
+  height_ = bottom[0]->height();
+  width_ = bottom[0]->width();
+  int channels = 0;
+  for (int b = 0; b < bottom.size(); ++b) {
+    CHECK_EQ(bottom[b]->num_axes(), 4);
+    CHECK_EQ(bottom[b]->num(), num_)
+      << "All the bottoms need the same number of images.";
+    channel_offset_[b] = channels;
+    channels += bottom[b]->channels();
+    Interp2Tables<Dtype>& tables = tables_[b];
+    if (tables.h1.empty() || tables.height1 != bottom[b]->height() ||
+        tables.width1 != bottom[b]->width() || tables.height2 != height_ ||
+        tables.width2 != width_) {
+      caffe_cpu_interp2_tables(bottom[b]->height(), bottom[b]->width(),
+          height_, width_, &tables);
+    }
+  }
+  top[0]->Reshape(num_, channels, height_, width_);
+}
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int top_dim = top[0]->count(1);
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int b = 0; b < bottom.size(); ++b) {
+    const int channels = bottom[b]->channels();
+    const int bottom_dim = bottom[b]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2<Dtype,false>(tables_[b], num_threads_, channels,
+          bottom[b]->cpu_data() + n * bottom_dim, 0, 0,
+          bottom[b]->height(), bottom[b]->width(),
+          top_data + n * top_dim + channel_offset_[b] * height_ * width_,
+          0, 0, height_, width_);
+    }
+  }
+}
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::Backward_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int top_dim = top[0]->count(1);
+  const Dtype* top_diff = top[0]->cpu_diff();
+  for (int b = 0; b < bottom.size(); ++b) {
+    if (!propagate_down[b]) { continue; }
+    const int height = bottom[b]->height();
+    const int width = bottom[b]->width();
+    const int bottom_dim = bottom[b]->count(1);
+    Dtype* bottom_diff = bottom[b]->mutable_cpu_diff();
+    caffe_set(bottom[b]->count(), Dtype(0), bottom_diff);
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2_backward<Dtype,false>(tables_[b], num_threads_,
+          bottom[b]->channels(), bottom_diff + n * bottom_dim, 0, 0,
+          height, width,
+          top_diff + n * top_dim + channel_offset_[b] * height_ * width_,
+          0, 0, height_, width_);
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(PyramidUpsampleConcatLayer);
+#endif
+
+INSTANTIATE_CLASS(PyramidUpsampleConcatLayer);
+REGISTER_LAYER_CLASS(PyramidUpsampleConcat);
+
+}  // namespace caffe
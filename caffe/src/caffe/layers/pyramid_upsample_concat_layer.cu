@@ -0,0 +1,56 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "caffe/layers/pyramid_upsample_concat_layer.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::Forward_gpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int top_dim = top[0]->count(1);
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  for (int b = 0; b < bottom.size(); ++b) {
+    const int height = bottom[b]->height();
+    const int width = bottom[b]->width();
+    const int bottom_dim = bottom[b]->count(1);
+    for (int n = 0; n < num_; ++n) {
+      caffe_gpu_interp2<Dtype,false>(bottom[b]->channels(),
+          bottom[b]->gpu_data() + n * bottom_dim, 0, 0, height, width,
+          height, width,
+          top_data + n * top_dim + channel_offset_[b] * height_ * width_,
+          0, 0, height_, width_, height_, width_);
+    }
+  }
+}
+
+template <typename Dtype>
+void PyramidUpsampleConcatLayer<Dtype>::Backward_gpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int top_dim = top[0]->count(1);
+  const Dtype* top_diff = top[0]->gpu_diff();
+  for (int b = 0; b < bottom.size(); ++b) {
+    if (!propagate_down[b]) { continue; }
+    const int height = bottom[b]->height();
+    const int width = bottom[b]->width();
+    const int bottom_dim = bottom[b]->count(1);
+    Dtype* bottom_diff = bottom[b]->mutable_gpu_diff();
+    caffe_gpu_set(bottom[b]->count(), Dtype(0), bottom_diff);
+    for (int n = 0; n < num_; ++n) {
+      caffe_gpu_interp2_backward<Dtype,false>(bottom[b]->channels(),
+          bottom_diff + n * bottom_dim, 0, 0, height, width, height, width,
+          top_diff + n * top_dim + channel_offset_[b] * height_ * width_,
+          0, 0, height_, width_, height_, width_);
+    }
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(PyramidUpsampleConcatLayer);
+
+}  // namespace caffe
@@ -2,12 +2,18 @@
 // Distributed under the BSD-3 Software license,
 // (See accompanying file LICENSE.txt or copy at
 // https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
 #include <cfloat>
 #include <vector>
 #include <math.h>
 
 #include "caffe/layers/warp_layer.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/interp.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/warp.hpp"
 
 namespace caffe {
 
@@ -16,13 +22,39 @@ void WarpLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   CHECK_EQ(bottom.size(), 2);
   CHECK_EQ(top.size(), 1);
-  vector<int> bottom_0_shape = bottom[0]->shape();
-  vector<int> bottom_1_shape = bottom[1]->shape();
-  CHECK_EQ(bottom_0_shape[2], bottom_1_shape[2])
-    << "Optical Flow dimensions need to match input blob.";
-  CHECK_EQ(bottom_0_shape[3], bottom_1_shape[3])
-    << "Optical Flow dimensions need to match input blob.";
+  layout_ = this->layer_param_.warp_param().layout();
+  // The flow may have any spatial size, it is resampled to the image
+  CHECK_EQ(bottom[0]->num(), bottom[1]->num())
+    << "Optical Flow and input blob need the same number of images.";
+  CHECK_EQ(bottom[1]->channels(), 2)
+    << "Optical Flow needs 2 channels.";
+  flow_scale_ = this->layer_param_.warp_param().flow_scale();
+  storage_ = this->layer_param_.warp_param().storage();
+  if (storage_ == UINT8) {
+    const WarpParameter& warp_param = this->layer_param_.warp_param();
+    const int channels = bottom[0]->shape(layout_ == NHWC ? 3 : 1);
+    const int scales = warp_param.quant_scale_size();
+    const int zero_points = warp_param.quant_zero_point_size();
+    CHECK(scales == 1 || scales == channels)
+      << "UINT8 storage needs 1 or " << channels << " quant_scale values.";
+    CHECK(zero_points <= 1 || zero_points == channels)
+      << "UINT8 storage needs 0, 1 or " << channels
+      << " quant_zero_point values.";
+    quant_scale_.resize(channels);
+    quant_zero_point_.resize(channels);
+    for (int c=0; c<channels; c++) {
+      quant_scale_[c] = warp_param.quant_scale(scales == 1 ? 0 : c);
+      quant_zero_point_[c] = (zero_points == 0) ? 0 :
+          warp_param.quant_zero_point(zero_points == 1 ? 0 : c);
+      CHECK_GT(quant_scale_[c], 0) << "quant_scale must be positive.";
+      CHECK_LE(quant_zero_point_[c], 255) << "quant_zero_point exceeds 255.";
+    }
+  }
   outliers_ = this->layer_param_.warp_param().outliers();
+  num_threads_ = caffe_cpu_num_threads(
+      this->layer_param_.warp_param().num_threads());
+  // Inference keeps no per-pixel state between Forward and Backward
+  lean_ = (this->phase_ == TEST);
 }
 
 template <typename Dtype>
@@ -31,13 +63,53 @@ void WarpLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   vector<int> bottom_0_shape = bottom[0]->shape();
   vector<int> bottom_1_shape = bottom[1]->shape();
   top[0]->Reshape(bottom_0_shape);
-  theta.Reshape(bottom_1_shape);
-  theta_.Reshape(bottom_1_shape);
-  x_w.Reshape(bottom_1_shape);
   num_ = bottom_0_shape[0];
-  channels_ = bottom_0_shape[1];
-  height_ = bottom_0_shape[2];
-  width_ = bottom_0_shape[3];
+  if (layout_ == NHWC) {
+    height_ = bottom_0_shape[1];
+    width_ = bottom_0_shape[2];
+    channels_ = bottom_0_shape[3];
+  } else {
+    channels_ = bottom_0_shape[1];
+    height_ = bottom_0_shape[2];
+    width_ = bottom_0_shape[3];
+  }
+  flow_height_ = bottom_1_shape[2];
+  flow_width_ = bottom_1_shape[3];
+  if (storage_ == UINT8) {
+    CHECK_EQ(quant_scale_.size(), channels_)
+      << "The quantization was set up for another number of channels.";
+  }
+  if (!lean_) {
+    Reshape_buffers();
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Reshape_buffers() {
+  // The buffers hold the flow resampled to the image
+  vector<int> flow_shape(4);
+  flow_shape[0] = num_;
+  flow_shape[1] = 2;
+  flow_shape[2] = height_;
+  flow_shape[3] = width_;
+  theta.Reshape(flow_shape);
+  theta_.Reshape(flow_shape);
+  x_w.Reshape(flow_shape);
+  vector<int> plan_shape = flow_shape;
+  plan_shape[1] = kWarpTaps;
+  plan_offset_.Reshape(plan_shape);
+  plan_weight_.Reshape(plan_shape);
+  plan_theta_.Reshape(flow_shape);
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Plan_cpu(const Dtype* bottom_1_data_) {
+  // Threads own disjoint (n, h) rows of the plan
+  caffe_cpu_parallel_for(num_ * height_, width_, num_threads_,
+      boost::bind(&WarpLayer<Dtype>::Plan_cpu_rows, this, bottom_1_data_,
+                  plan_offset_.mutable_cpu_data(),
+                  plan_weight_.mutable_cpu_data(),
+                  plan_theta_.mutable_cpu_data(), _1, _2));
 }
 
 template <typename Dtype>
@@ -46,64 +118,266 @@ void WarpLayer<Dtype>::Forward_cpu(
   const Dtype* bottom_0_data_ = bottom[0]->cpu_data();
   const Dtype* bottom_1_data_ = bottom[1]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* theta_data = theta.mutable_cpu_data();
-  Dtype* theta_data_ = theta_.mutable_cpu_data();
-  Dtype* x_w_data = x_w.mutable_cpu_data();
-  caffe_set(bottom[0]->count(), (Dtype)0., top_data);
-  caffe_set(bottom[1]->count(), (Dtype)0., theta_data);
-  caffe_set(bottom[1]->count(), (Dtype)0., theta_data_);
-  caffe_set(bottom[1]->count(), (Dtype)0., x_w_data);
-  for (int n=0; n<num_; n++) {
+  const uint16_t* bottom_0_half = NULL;
+  const uint8_t* bottom_0_u8 = NULL;
+  const int count = bottom[0]->count();
+  if (storage_ == UINT8) {
+    // The gathers read an 8-bit copy of the image
+    if (!image_u8_ || image_u8_->size() < count) {
+      image_u8_.reset(new SyncedMemory(count));
+    }
+    uint8_t* image_u8 = static_cast<uint8_t*>(image_u8_->mutable_cpu_data());
+    caffe_cpu_parallel_for(
+        (layout_ == NHWC) ? num_ * height_ * width_ : num_ * channels_,
+        (layout_ == NHWC) ? channels_ : height_ * width_, num_threads_,
+        boost::bind(&WarpLayer<Dtype>::Quantize_cpu_u8, this,
+                    bottom_0_data_, image_u8, _1, _2));
+    bottom_0_u8 = image_u8;
+  } else if (storage_ != FP32) {
+    // The gathers read a 16-bit copy of the image
+    if (!image_half_ || image_half_->size() < count * sizeof(uint16_t)) {
+      image_half_.reset(new SyncedMemory(count * sizeof(uint16_t)));
+    }
+    uint16_t* image_half =
+        static_cast<uint16_t*>(image_half_->mutable_cpu_data());
+    caffe_cpu_parallel_for(count, 1, num_threads_,
+        boost::bind(&WarpLayer<Dtype>::Convert_cpu_half, this,
+                    bottom_0_data_, image_half, _1, _2));
+    bottom_0_half = image_half;
+  }
+  if (lean_) {
+    // Build the plan of one row at a time in a small buffer and use it for
+    // all the channels of that row
+    caffe_cpu_parallel_for(num_ * height_, channels_ * width_, num_threads_,
+        boost::bind(&WarpLayer<Dtype>::Forward_cpu_lean_rows, this,
+                    bottom_0_data_, bottom_0_half, bottom_0_u8,
+                    bottom_1_data_, top_data, _1, _2));
+    return;
+  }
+  // The sampling positions depend on the flow only: build the plan once and
+  // reuse it for every channel. Threads own disjoint (n, c) planes of the
+  // output, so the result is identical to the serial loop.
+  Plan_cpu(bottom_1_data_);
+  const int* plan_offset = plan_offset_.cpu_data();
+  const Dtype* plan_weight = plan_weight_.cpu_data();
+  if (bottom_0_u8) {
+    plan_qweight_.Reshape(plan_weight_.shape());
+    const int plan_dim = kWarpTaps * height_ * width_;
+    for (int n=0; n<num_; n++) {
+      caffe_cpu_warp_plan_fixed(height_ * width_, plan_offset + n * plan_dim,
+          plan_weight + n * plan_dim,
+          plan_qweight_.mutable_cpu_data() + n * plan_dim);
+    }
+    const int* plan_qweight = plan_qweight_.cpu_data();
+    if (layout_ == NHWC) {
+      caffe_cpu_parallel_for(num_ * height_, channels_ * width_,
+          num_threads_,
+          boost::bind(&WarpLayer<Dtype>::Forward_cpu_packed_rows_u8, this,
+                      bottom_0_u8, plan_offset, plan_qweight, top_data,
+                      _1, _2));
+    } else {
+      caffe_cpu_parallel_for(num_ * channels_, height_ * width_,
+          num_threads_,
+          boost::bind(&WarpLayer<Dtype>::Forward_cpu_planes_u8, this,
+                      bottom_0_u8, plan_offset, plan_qweight, top_data,
+                      _1, _2));
+    }
+    return;
+  }
+  if (layout_ == NHWC) {
+    // Channels-last: every tap reads the contiguous channels of one pixel
+    caffe_cpu_parallel_for(num_ * height_, channels_ * width_, num_threads_,
+        boost::bind(&WarpLayer<Dtype>::Forward_cpu_packed_rows, this,
+                    bottom_0_data_, bottom_0_half, plan_offset, plan_weight,
+                    top_data, _1, _2));
+  } else {
+    caffe_cpu_parallel_for(num_ * channels_, height_ * width_, num_threads_,
+        boost::bind(&WarpLayer<Dtype>::Forward_cpu_planes, this,
+                    bottom_0_data_, bottom_0_half, plan_offset, plan_weight,
+                    top_data, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Plan_cpu_rows(const Dtype* bottom_1_data_,
+    int* plan_offset, Dtype* plan_weight, Dtype* plan_theta,
+    const int begin, const int end) {
+  const int spatial_dim = height_ * width_;
+  const int flow_dim = 2 * flow_height_ * flow_width_;
+  for (int row=begin; row<end;) {
+    const int n = row / height_;
+    const int h_begin = row % height_;
+    const int h_end = std::min(height_, h_begin + end - row);
+    caffe_cpu_warp_plan(outliers_, height_, width_,
+        bottom_1_data_ + n * flow_dim, flow_height_, flow_width_,
+        flow_scale_, h_begin, h_end,
+        plan_offset + n * kWarpTaps * spatial_dim,
+        plan_weight + n * kWarpTaps * spatial_dim,
+        plan_theta + n * 2 * spatial_dim);
+    row += h_end - h_begin;
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Convert_cpu_half(const Dtype* data,
+    uint16_t* data_half, const int begin, const int end) {
+  caffe_cpu_to_half(storage_, end - begin, data + begin, data_half + begin);
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Quantize_cpu_u8(const Dtype* data, uint8_t* data_u8,
+    const int begin, const int end) {
+  if (layout_ == NHWC) {
+    caffe_cpu_quantize_u8_packed(channels_, end - begin, &quant_scale_[0],
+        &quant_zero_point_[0], data + begin * channels_,
+        data_u8 + begin * channels_);
+    return;
+  }
+  const int spatial_dim = height_ * width_;
+  for (int plane=begin; plane<end; plane++) {
+    const int c = plane % channels_;
+    caffe_cpu_quantize_u8(spatial_dim, quant_scale_[c], quant_zero_point_[c],
+        data + plane * spatial_dim, data_u8 + plane * spatial_dim);
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_cpu_planes(const Dtype* bottom_0_data_,
+    const uint16_t* bottom_0_half, const int* plan_offset,
+    const Dtype* plan_weight, Dtype* top_data, const int begin,
+    const int end) {
+  const int spatial_dim = height_ * width_;
+  for (int plane=begin; plane<end; plane++) {
+    const int n = plane / channels_;
+    if (bottom_0_half) {
+      caffe_cpu_warp_blend_half(storage_, spatial_dim,
+          bottom_0_half + plane * spatial_dim,
+          plan_offset + n * kWarpTaps * spatial_dim,
+          plan_weight + n * kWarpTaps * spatial_dim,
+          top_data + plane * spatial_dim);
+      continue;
+    }
+    caffe_cpu_warp_blend(spatial_dim, bottom_0_data_ + plane * spatial_dim,
+        plan_offset + n * kWarpTaps * spatial_dim,
+        plan_weight + n * kWarpTaps * spatial_dim,
+        top_data + plane * spatial_dim);
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_cpu_packed_rows(const Dtype* bottom_0_data_,
+    const uint16_t* bottom_0_half, const int* plan_offset,
+    const Dtype* plan_weight, Dtype* top_data, const int begin,
+    const int end) {
+  const int spatial_dim = height_ * width_;
+  const int image_dim = channels_ * spatial_dim;
+  for (int row=begin; row<end;) {
+    const int n = row / height_;
+    const int h_begin = row % height_;
+    const int h_end = std::min(height_, h_begin + end - row);
+    if (bottom_0_half) {
+      caffe_cpu_warp_blend_packed_half(storage_, channels_, spatial_dim,
+          h_begin * width_, h_end * width_, bottom_0_half + n * image_dim,
+          plan_offset + n * kWarpTaps * spatial_dim,
+          plan_weight + n * kWarpTaps * spatial_dim,
+          top_data + n * image_dim);
+      row += h_end - h_begin;
+      continue;
+    }
+    caffe_cpu_warp_blend_packed(channels_, spatial_dim, h_begin * width_,
+        h_end * width_, bottom_0_data_ + n * image_dim,
+        plan_offset + n * kWarpTaps * spatial_dim,
+        plan_weight + n * kWarpTaps * spatial_dim,
+        top_data + n * image_dim);
+    row += h_end - h_begin;
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_cpu_planes_u8(const uint8_t* bottom_0_u8,
+    const int* plan_offset, const int* plan_qweight, Dtype* top_data,
+    const int begin, const int end) {
+  const int spatial_dim = height_ * width_;
+  for (int plane=begin; plane<end; plane++) {
+    const int n = plane / channels_;
+    const int c = plane % channels_;
+    caffe_cpu_warp_blend_u8(spatial_dim, bottom_0_u8 + plane * spatial_dim,
+        plan_offset + n * kWarpTaps * spatial_dim,
+        plan_qweight + n * kWarpTaps * spatial_dim, quant_scale_[c],
+        quant_zero_point_[c], top_data + plane * spatial_dim);
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_cpu_packed_rows_u8(const uint8_t* bottom_0_u8,
+    const int* plan_offset, const int* plan_qweight, Dtype* top_data,
+    const int begin, const int end) {
+  const int spatial_dim = height_ * width_;
+  const int image_dim = channels_ * spatial_dim;
+  for (int row=begin; row<end;) {
+    const int n = row / height_;
+    const int h_begin = row % height_;
+    const int h_end = std::min(height_, h_begin + end - row);
+    caffe_cpu_warp_blend_packed_u8(channels_, spatial_dim, h_begin * width_,
+        h_end * width_, bottom_0_u8 + n * image_dim,
+        plan_offset + n * kWarpTaps * spatial_dim,
+        plan_qweight + n * kWarpTaps * spatial_dim, &quant_scale_[0],
+        &quant_zero_point_[0], top_data + n * image_dim);
+    row += h_end - h_begin;
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_cpu_lean_rows(const Dtype* bottom_0_data_,
+    const uint16_t* bottom_0_half, const uint8_t* bottom_0_u8,
+    const Dtype* bottom_1_data_, Dtype* top_data, const int begin,
+    const int end) {
+  const int spatial_dim = height_ * width_;
+  const int image_dim = channels_ * spatial_dim;
+  vector<int> offset(kWarpTaps * width_);
+  vector<Dtype> weight(kWarpTaps * width_);
+  vector<int> qweight(bottom_0_u8 ? kWarpTaps * width_ : 0);
+  const int flow_dim = 2 * flow_height_ * flow_width_;
+  for (int row=begin; row<end; row++) {
+    const int n = row / height_;
+    const int h = row % height_;
+    caffe_cpu_warp_plan_row(outliers_, height_, width_,
+        bottom_1_data_ + n * flow_dim, flow_height_, flow_width_, flow_scale_,
+        h, &offset[0], &weight[0]);
+    const Dtype* image = bottom_0_data_ + n * image_dim;
+    const uint16_t* image_half =
+        bottom_0_half ? bottom_0_half + n * image_dim : NULL;
+    const uint8_t* image_u8 = bottom_0_u8 ? bottom_0_u8 + n * image_dim : NULL;
+    if (image_u8) {
+      caffe_cpu_warp_plan_fixed(width_, &offset[0], &weight[0], &qweight[0]);
+    }
+    if (layout_ == NHWC) {
+      Dtype* top_row = top_data + row * width_ * channels_;
+      if (image_u8) {
+        caffe_cpu_warp_blend_packed_u8(channels_, width_, 0, width_,
+            image_u8, &offset[0], &qweight[0], &quant_scale_[0],
+            &quant_zero_point_[0], top_row);
+      } else if (image_half) {
+        caffe_cpu_warp_blend_packed_half(storage_, channels_, width_, 0,
+            width_, image_half, &offset[0], &weight[0], top_row);
+      } else {
+        caffe_cpu_warp_blend_packed(channels_, width_, 0, width_, image,
+            &offset[0], &weight[0], top_row);
+      }
+      continue;
+    }
     for (int c=0; c<channels_; c++) {
-      for (int h=0; h<height_; h++) {
-        for (int w=0; w<width_; w++) {
-          int index_x = ((n * 2 + 1) * height_ + h) * width_ + w;
-          int index_y = ((n * 2 + 0) * height_ + h) * width_ + w;
-          x_w_data[ index_x ] = h + bottom_1_data_[ index_x ];// + 0.00000001;
-          x_w_data[ index_y ] = w + bottom_1_data_[ index_y ];// + 0.00000001;
-          int xw_floor = (int)floor(x_w_data[ index_x ]);
-          int yw_floor = (int)floor(x_w_data[ index_y ]);
-          int xw_ceil = (int)ceil(x_w_data[ index_x ]);
-          int yw_ceil = (int)ceil(x_w_data[ index_y ]);
-          theta_data[ index_x ] = x_w_data[ index_x ] - floor(x_w_data[ index_x ]);
-          theta_data[ index_y ] = x_w_data[ index_y ] - floor(x_w_data[ index_y ]);
-          if (outliers_ == WarpParameter_WarpType_NEAREST) {
-            if (x_w_data[ index_x ] < 0) {
-              theta_data[ index_x ] = x_w_data[ index_x ];
-              xw_floor = 0; xw_ceil = 0;
-            } 
-            if (x_w_data[ index_x ] >= height_-1) {
-              theta_data[ index_x ] = x_w_data[ index_x ] - height_;
-              xw_floor = height_-1; xw_ceil = height_-1;
-            }
-            if (x_w_data[ index_y ] < 0) {
-              theta_data[ index_y ] = x_w_data[ index_y ];
-              yw_floor = 0; yw_ceil = 0;
-            }
-            if (x_w_data[ index_y ] >= width_-1) {
-              theta_data[ index_y ] = x_w_data[ index_y ] - width_;
-              yw_floor = width_-1; yw_ceil = width_-1;
-            }
-          }
-          theta_data_[ index_x ] = 1 - theta_data[ index_x ];
-          theta_data_[ index_y ] = 1 - theta_data[ index_y ];
-          int offset = (n * channels_ + c) * height_;
-
-          if (!(outliers_ == WarpParameter_WarpType_TRUNCATE && 
-                (x_w_data[ index_x ] < 0 || 
-                 x_w_data[ index_x ] > height_-1 || 
-                 x_w_data[ index_y ] < 0 || 
-                 x_w_data[ index_y ] > width_-1))) {
-            Dtype I0 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_floor ]; 
-            Dtype I1 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_floor ]; 
-            Dtype I2 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_ceil ]; 
-            Dtype I3 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_ceil ];
-            top_data[ (offset +  h) * width_ +  w ] = (theta_data_[index_x] * theta_data_[index_y] * I0) + 
-                                                      (theta_data[index_x]  * theta_data_[index_y] * I1) + 
-                                                      (theta_data_[index_x] * theta_data[index_y]  * I2) + 
-                                                      (theta_data[index_x]  * theta_data[index_y]  * I3);
-          }
-        }
+      Dtype* top_row = top_data + n * image_dim + c * spatial_dim + h * width_;
+      if (image_u8) {
+        caffe_cpu_warp_blend_u8(width_, image_u8 + c * spatial_dim,
+            &offset[0], &qweight[0], quant_scale_[c], quant_zero_point_[c],
+            top_row);
+      } else if (image_half) {
+        caffe_cpu_warp_blend_half(storage_, width_,
+            image_half + c * spatial_dim, &offset[0], &weight[0], top_row);
+      } else {
+        caffe_cpu_warp_blend(width_, image + c * spatial_dim, &offset[0],
+            &weight[0], top_row);
       }
     }
   }
@@ -112,79 +386,119 @@ void WarpLayer<Dtype>::Forward_cpu(
 template <typename Dtype>
 void WarpLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (propagate_down[0] || propagate_down[1]) {
-    caffe_set(bottom[0]->count(), (Dtype)0., bottom[0]->mutable_cpu_diff());
-    caffe_set(bottom[1]->count(), (Dtype)0., bottom[1]->mutable_cpu_diff());
-  
-    const Dtype* theta_data = theta.cpu_data();
-    const Dtype* theta_data_ = theta_.cpu_data();
-    const Dtype* x_w_data = x_w.cpu_data();
-  
-    const Dtype* top_diff = top[0]->cpu_diff();
-    Dtype* bottom_0_diff = bottom[0]->mutable_cpu_diff();
-    Dtype* bottom_1_diff = bottom[1]->mutable_cpu_diff();
-  
-    //const Dtype* top_data = top[0]->cpu_data();
-    const Dtype* bottom_0_data = bottom[0]->cpu_data();
-    //const Dtype* bottom_1_data = bottom[1]->cpu_data();
-  
+  if (!propagate_down[0] && !propagate_down[1]) { return; }
+  if (lean_) {
+    // Inference did not keep the plan
+    Reshape_buffers();
+    Plan_cpu(bottom[1]->cpu_data());
+  }
+  Dtype* bottom_0_diff = NULL;
+  Dtype* bottom_1_diff = NULL;
+  if (propagate_down[0]) {
+    bottom_0_diff = bottom[0]->mutable_cpu_diff();
+    caffe_set(bottom[0]->count(), (Dtype)0., bottom_0_diff);
+  }
+  if (propagate_down[1]) {
+    bottom_1_diff = bottom[1]->mutable_cpu_diff();
+    caffe_set(bottom[1]->count(), (Dtype)0., bottom_1_diff);
+  }
+  // The gradient of a resampled flow is first taken at the image size
+  const bool resampled = (flow_height_ != height_ || flow_width_ != width_);
+  const int flow_count = num_ * 2 * height_ * width_;
+  Dtype* flow_diff = bottom_1_diff;
+  if (bottom_1_diff && resampled) {
+    flow_diff_full_.Reshape(num_, 2, height_, width_);
+    flow_diff = flow_diff_full_.mutable_cpu_data();
+    caffe_set(flow_count, (Dtype)0., flow_diff);
+  }
+  // Every thread owns a range of channels, so the scatter into the image
+  // gradient never collides. The flow gradient sums over the channels:
+  // thread 0 accumulates into bottom[1] directly and the other threads into
+  // their own partial buffer, added up at the end.
+  const int units = (layout_ == NHWC) ? channels_ : num_ * channels_;
+  const int threads = caffe_cpu_parallel_threads(units,
+      bottom[0]->count() / units, num_threads_);
+  Dtype* flow_diff_partial = NULL;
+  if (flow_diff && threads > 1) {
+    flow_diff_partial_.Reshape(num_ * (threads - 1), 2, height_, width_);
+    flow_diff_partial = flow_diff_partial_.mutable_cpu_data();
+    caffe_set(flow_diff_partial_.count(), (Dtype)0., flow_diff_partial);
+  }
+  // One chunk per thread, see Backward_cpu_thread
+  caffe_cpu_parallel_for(threads, threads,
+      boost::bind(&WarpLayer<Dtype>::Backward_cpu_thread, this,
+                  top[0]->cpu_diff(), bottom[0]->cpu_data(), bottom_0_diff,
+                  flow_diff, flow_diff_partial, threads, _1, _2));
+  for (int t = 1; t < threads && flow_diff_partial; ++t) {
+    caffe_axpy(flow_count, (Dtype)1.,
+        flow_diff_partial + (t - 1) * flow_count, flow_diff);
+  }
+  if (!bottom_1_diff) { return; }
+  if (resampled) {
+    const int flow_dim = 2 * flow_height_ * flow_width_;
     for (int n=0; n<num_; n++) {
-      for (int h=0; h<height_; h++) {
-        for (int w=0; w<width_; w++) {
-
-          int index_x = ((n * 2 + 1) * height_ + h) * width_ + w;
-          int index_y = ((n * 2 + 0) * height_ + h) * width_ + w;
-  
-          int xw_floor = (int)floor(x_w_data[ index_x ]);
-          int yw_floor = (int)floor(x_w_data[ index_y ]);
-          int xw_ceil = (int)ceil(x_w_data[ index_x ]);
-          int yw_ceil = (int)ceil(x_w_data[ index_y ]);
-
-          if (outliers_ == WarpParameter_WarpType_NEAREST) {
-            if (x_w_data[ index_x ] < 0) {
-              xw_floor = 0; xw_ceil = 0;
-            } 
-            if (x_w_data[ index_x ] >= height_-1) {
-              xw_floor = height_-1; xw_ceil = height_-1;
-            }
-            if (x_w_data[ index_y ] < 0) {
-              yw_floor = 0; yw_ceil = 0;
-            }
-            if (x_w_data[ index_y ] >= width_-1) {
-              yw_floor = width_-1; yw_ceil = width_-1;
-            }
-          }
-
-          for (int c=0; c<channels_; c++) {
-            int bottom_0_index = ((n * channels_ + c) * height_ +  h) * width_ +  w;
-            int offset = (n * channels_ + c) * height_;
-            Dtype I0 = bottom_0_data[ (offset + xw_floor) * width_ + yw_floor ]; 
-            Dtype I1 = bottom_0_data[ (offset + xw_ceil ) * width_ + yw_floor ]; 
-            Dtype I2 = bottom_0_data[ (offset + xw_floor) * width_ + yw_ceil ]; 
-            Dtype I3 = bottom_0_data[ (offset + xw_ceil ) * width_ + yw_ceil ];
-            if (!(outliers_ == WarpParameter_WarpType_TRUNCATE && 
-                  (x_w_data[ index_x ] < 0 ||
-                  x_w_data[ index_x ] > height_-1 ||
-                  x_w_data[ index_y ] < 0 ||
-                  x_w_data[ index_y ] > width_-1))) {
-              bottom_1_diff[ index_x ] += ( -1*theta_data_[index_y]*I0 + 
-                                               theta_data_[index_y]*I1 - 
-                                               theta_data[index_y] *I2 + 
-                                               theta_data[index_y] *I3 ) * 
-                                          top_diff[(offset + h) * width_ + w];
-              bottom_1_diff[ index_y ] += ( -1*theta_data_[index_x]*I0 - 
-                                               theta_data[index_x] *I1 + 
-                                               theta_data_[index_x]*I2 + 
-                                               theta_data[index_x] *I3 ) * 
-                                          top_diff[(offset + h) * width_ + w];
-              bottom_0_diff[ (offset + xw_floor) * width_ + yw_floor ] += theta_data_[ index_x ]*theta_data_[ index_y ]*top_diff[bottom_0_index];
-              bottom_0_diff[ (offset + xw_ceil ) * width_ + yw_floor ] += theta_data[ index_x ] *theta_data_[ index_y ]*top_diff[bottom_0_index];
-              bottom_0_diff[ (offset + xw_floor) * width_ + yw_ceil  ] += theta_data_[ index_x ]*theta_data[ index_y ] *top_diff[bottom_0_index];
-              bottom_0_diff[ (offset + xw_ceil ) * width_ + yw_ceil  ] += theta_data[ index_x ] *theta_data[ index_y ] *top_diff[bottom_0_index];
-            }
-          }
-        }
+      caffe_cpu_interp2_backward<Dtype,false>(2,
+          bottom_1_diff + n * flow_dim, 0, 0, flow_height_, flow_width_,
+          flow_height_, flow_width_,
+          flow_diff + n * 2 * height_ * width_, 0, 0, height_, width_,
+          height_, width_);
+    }
+  }
+  if (flow_scale_ != Dtype(1)) {
+    caffe_scal(bottom[1]->count(), flow_scale_, bottom_1_diff);
+  }
+}
+
+template <typename Dtype>
+void WarpLayer<Dtype>::Backward_cpu_thread(const Dtype* top_diff,
+    const Dtype* bottom_0_data, Dtype* bottom_0_diff, Dtype* bottom_1_diff,
+    Dtype* flow_diff_partial, const int threads, const int begin,
+    const int end) {
+  // Reuse the sampling plan of the forward pass
+  const int* plan_offset = plan_offset_.cpu_data();
+  const Dtype* plan_weight = plan_weight_.cpu_data();
+  const Dtype* plan_theta = plan_theta_.cpu_data();
+  const int spatial_dim = height_ * width_;
+  const int image_dim = channels_ * spatial_dim;
+  const int flow_dim = 2 * spatial_dim;
+  const int units = (layout_ == NHWC) ? channels_ : num_ * channels_;
+  for (int t=begin; t<end; t++) {
+    const int unit_begin = (long long)units * t / threads;
+    const int unit_end = (long long)units * (t + 1) / threads;
+    Dtype* flow_diff = bottom_1_diff;
+    if (flow_diff && t > 0) {
+      flow_diff = flow_diff_partial + (t - 1) * num_ * flow_dim;
+    }
+    if (layout_ == NHWC) {
+      // Units are channels of every image
+      for (int n=0; n<num_; n++) {
+        caffe_cpu_warp_blend_backward_packed(channels_, unit_begin,
+            unit_end, spatial_dim,
+            plan_offset + n * kWarpTaps * spatial_dim,
+            plan_weight + n * kWarpTaps * spatial_dim,
+            plan_theta + n * flow_dim,
+            bottom_0_data + n * image_dim,
+            top_diff + n * image_dim,
+            bottom_0_diff ? bottom_0_diff + n * image_dim : NULL,
+            flow_diff ? flow_diff + n * flow_dim : NULL);
       }
+      continue;
+    }
+    // Units are (n, c) planes
+    for (int plane=unit_begin; plane<unit_end;) {
+      const int n = plane / channels_;
+      const int c_end = std::min(channels_, plane % channels_ +
+                                            unit_end - plane);
+      const int planes = c_end - plane % channels_;
+      caffe_cpu_warp_blend_backward(planes, spatial_dim,
+          plan_offset + n * kWarpTaps * spatial_dim,
+          plan_weight + n * kWarpTaps * spatial_dim,
+          plan_theta + n * flow_dim,
+          bottom_0_data + plane * spatial_dim,
+          top_diff + plane * spatial_dim,
+          bottom_0_diff ? bottom_0_diff + plane * spatial_dim : NULL,
+          flow_diff ? flow_diff + n * flow_dim : NULL);
+      plane += planes;
     }
   }
 }
@@ -6,14 +6,22 @@
 #include <vector>
 
 #include "caffe/layers/warp_layer.hpp"
+#include "caffe/util/interp.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/gpu_util.cuh"
+#include "caffe/util/warp.cuh"
 
 namespace caffe {
 
+// The forward kernels keep the sampling coordinates in registers. The
+// buffers x_w, theta and theta_ are written only if they are given, once
+// per pixel, for the backward kernels; lean inference passes NULL.
 template <typename Dtype>
 __global__ void truncate_interp2_fwd(const int nthreads, const Dtype *bottom_0_data_, const Dtype *bottom_1_data_,
                                      const int num_, const int channels_, const int height_, const int width_, 
+                                     const int flow_height_,
+                                     const int flow_width_,
+                                     const Dtype flow_scale_,
                                      Dtype *theta_data, Dtype* theta_data_, Dtype *x_w_data, Dtype *top_data) {
   CUDA_KERNEL_LOOP(index, nthreads) {
     int temp = 0;
@@ -25,27 +33,40 @@ __global__ void truncate_interp2_fwd(const int nthreads, const Dtype *bottom_0_d
     const int w = temp % width_;
     int index_x = ((n * 2 + 1) * height_ + h) * width_ + w;
     int index_y = ((n * 2 + 0) * height_ + h) * width_ + w;
-    x_w_data[ index_x ] = h + bottom_1_data_[ index_x ];
-    x_w_data[ index_y ] = w + bottom_1_data_[ index_y ];
-    int xw_floor = (int)floor(x_w_data[ index_x ]);
-    int yw_floor = (int)floor(x_w_data[ index_y ]);
-    int xw_ceil = (int)ceil(x_w_data[ index_x ]);
-    int yw_ceil = (int)ceil(x_w_data[ index_y ]);
-    theta_data[ index_x ] = x_w_data[ index_x ] - floor(x_w_data[ index_x ]);
-    theta_data[ index_y ] = x_w_data[ index_y ] - floor(x_w_data[ index_y ]);
-    theta_data_[ index_x ] = 1 - theta_data[ index_x ];
-    theta_data_[ index_y ] = 1 - theta_data[ index_y ];
+    const Dtype *flow = bottom_1_data_ + n * 2 * flow_height_ * flow_width_;
+    const Dtype x_w_x = h + warp_flow_at(flow + flow_height_ * flow_width_,
+        height_, width_, flow_height_, flow_width_, flow_scale_, h, w);
+    const Dtype x_w_y = w + warp_flow_at(flow, height_, width_,
+        flow_height_, flow_width_, flow_scale_, h, w);
+    int xw_floor = (int)floor(x_w_x);
+    int yw_floor = (int)floor(x_w_y);
+    int xw_ceil = (int)ceil(x_w_x);
+    int yw_ceil = (int)ceil(x_w_y);
+    const Dtype theta_x = x_w_x - floor(x_w_x);
+    const Dtype theta_y = x_w_y - floor(x_w_y);
+    const Dtype theta_x_ = 1 - theta_x;
+    const Dtype theta_y_ = 1 - theta_y;
+    if (x_w_data && c == 0) {
+      x_w_data[ index_x ] = x_w_x;
+      x_w_data[ index_y ] = x_w_y;
+      theta_data[ index_x ] = theta_x;
+      theta_data[ index_y ] = theta_y;
+      theta_data_[ index_x ] = theta_x_;
+      theta_data_[ index_y ] = theta_y_;
+    }
     int offset = (n * channels_ + c) * height_;
-    if (x_w_data[ index_x ] >= 0 && x_w_data[ index_x ] <= height_-1 && 
-        x_w_data[ index_y ] >= 0 && x_w_data[ index_y ] <= width_-1) {
+    if (x_w_x >= 0 && x_w_x <= height_-1 && 
+        x_w_y >= 0 && x_w_y <= width_-1) {
       Dtype I0 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_floor ]; 
       Dtype I1 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_floor ]; 
       Dtype I2 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_ceil ]; 
       Dtype I3 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_ceil ];
-      top_data[ (offset +  h) * width_ +  w ] = (theta_data_[index_x] * theta_data_[index_y] * I0) + 
-                                                (theta_data[index_x]  * theta_data_[index_y] * I1) + 
-                                                (theta_data_[index_x] * theta_data[index_y]  * I2) + 
-                                                (theta_data[index_x]  * theta_data[index_y]  * I3);
+      top_data[ (offset +  h) * width_ +  w ] = (theta_x_ * theta_y_ * I0) + 
+                                                (theta_x  * theta_y_ * I1) + 
+                                                (theta_x_ * theta_y  * I2) + 
+                                                (theta_x  * theta_y  * I3);
+    } else {
+      top_data[ (offset +  h) * width_ +  w ] = 0;
     }
   }
 }
@@ -53,6 +74,9 @@ __global__ void truncate_interp2_fwd(const int nthreads, const Dtype *bottom_0_d
 template <typename Dtype>
 __global__ void nearest_interp2_fwd(const int nthreads, const Dtype *bottom_0_data_, const Dtype *bottom_1_data_,
                                     const int num_, const int channels_, const int height_, const int width_, 
+                                    const int flow_height_,
+                                    const int flow_width_,
+                                    const Dtype flow_scale_,
                                     Dtype *theta_data, Dtype* theta_data_, Dtype *x_w_data, Dtype *top_data) {
   CUDA_KERNEL_LOOP(index, nthreads) {
     int temp = 0;
@@ -64,41 +88,52 @@ __global__ void nearest_interp2_fwd(const int nthreads, const Dtype *bottom_0_da
     const int w = temp % width_;
     int index_x = ((n * 2 + 1) * height_ + h) * width_ + w;
     int index_y = ((n * 2 + 0) * height_ + h) * width_ + w;
-    x_w_data[ index_x ] = h + bottom_1_data_[ index_x ];
-    x_w_data[ index_y ] = w + bottom_1_data_[ index_y ];
-    int xw_floor = (int)floor(x_w_data[ index_x ]);
-    int yw_floor = (int)floor(x_w_data[ index_y ]);
-    int xw_ceil = (int)ceil(x_w_data[ index_x ]);
-    int yw_ceil = (int)ceil(x_w_data[ index_y ]);
-    theta_data[ index_x ] = x_w_data[ index_x ] - floor(x_w_data[ index_x ]);
-    theta_data[ index_y ] = x_w_data[ index_y ] - floor(x_w_data[ index_y ]);
-    if (x_w_data[ index_x ] < 0) {
-      theta_data[ index_x ] = x_w_data[ index_x ];
+    const Dtype *flow = bottom_1_data_ + n * 2 * flow_height_ * flow_width_;
+    const Dtype x_w_x = h + warp_flow_at(flow + flow_height_ * flow_width_,
+        height_, width_, flow_height_, flow_width_, flow_scale_, h, w);
+    const Dtype x_w_y = w + warp_flow_at(flow, height_, width_,
+        flow_height_, flow_width_, flow_scale_, h, w);
+    int xw_floor = (int)floor(x_w_x);
+    int yw_floor = (int)floor(x_w_y);
+    int xw_ceil = (int)ceil(x_w_x);
+    int yw_ceil = (int)ceil(x_w_y);
+    Dtype theta_x = x_w_x - floor(x_w_x);
+    Dtype theta_y = x_w_y - floor(x_w_y);
+    if (x_w_x < 0) {
+      theta_x = x_w_x;
       xw_floor = 0; xw_ceil = 0;
     } 
-    if (x_w_data[ index_x ] >= height_-1) {
-      theta_data[ index_x ] = x_w_data[ index_x ] - height_;
+    if (x_w_x >= height_-1) {
+      theta_x = x_w_x - height_;
       xw_floor = height_-1; xw_ceil = height_-1;
     }
-    if (x_w_data[ index_y ] < 0) {
-      theta_data[ index_y ] = x_w_data[ index_y ];
+    if (x_w_y < 0) {
+      theta_y = x_w_y;
       yw_floor = 0; yw_ceil = 0;
     }
-    if (x_w_data[ index_y ] >= width_-1) {
-      theta_data[ index_y ] = x_w_data[ index_y ] - width_;
+    if (x_w_y >= width_-1) {
+      theta_y = x_w_y - width_;
       yw_floor = width_-1; yw_ceil = width_-1;
     }
-    theta_data_[ index_x ] = 1 - theta_data[ index_x ];
-    theta_data_[ index_y ] = 1 - theta_data[ index_y ];
+    const Dtype theta_x_ = 1 - theta_x;
+    const Dtype theta_y_ = 1 - theta_y;
+    if (x_w_data && c == 0) {
+      x_w_data[ index_x ] = x_w_x;
+      x_w_data[ index_y ] = x_w_y;
+      theta_data[ index_x ] = theta_x;
+      theta_data[ index_y ] = theta_y;
+      theta_data_[ index_x ] = theta_x_;
+      theta_data_[ index_y ] = theta_y_;
+    }
     int offset = (n * channels_ + c) * height_;
     Dtype I0 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_floor ]; 
     Dtype I1 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_floor ]; 
     Dtype I2 = bottom_0_data_[ (offset + xw_floor) * width_ + yw_ceil ]; 
     Dtype I3 = bottom_0_data_[ (offset + xw_ceil ) * width_ + yw_ceil ];
-    top_data[ (offset +  h) * width_ +  w ] = (theta_data_[index_x] * theta_data_[index_y] * I0) + 
-                                              (theta_data[index_x]  * theta_data_[index_y] * I1) + 
-                                              (theta_data_[index_x] * theta_data[index_y]  * I2) + 
-                                              (theta_data[index_x]  * theta_data[index_y]  * I3);
+    top_data[ (offset +  h) * width_ +  w ] = (theta_x_ * theta_y_ * I0) + 
+                                              (theta_x  * theta_y_ * I1) + 
+                                              (theta_x_ * theta_y  * I2) + 
+                                              (theta_x  * theta_y  * I3);
   }
 }
 
@@ -220,36 +255,67 @@ __global__ void nearest_interp2_bwd(const int nthreads, const int num_, const in
  
 
 template <typename Dtype>
-void WarpLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-    const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data_0 = bottom[0]->gpu_data(); // image
-  const Dtype* bottom_data_1 = bottom[1]->gpu_data(); // optical flow
-  Dtype* top_data = top[0]->mutable_gpu_data();
-  Dtype* theta_data = theta.mutable_gpu_data();
-  Dtype* theta_data_ = theta_.mutable_gpu_data();
-  Dtype* x_w_data = x_w.mutable_gpu_data();
+static void interp2_fwd_gpu(const WarpParameter_WarpType outliers,
+    const Dtype *bottom_data_0, const Dtype *bottom_data_1, const int num_,
+    const int channels_, const int height_, const int width_,
+    const int flow_height_, const int flow_width_, const Dtype flow_scale_,
+    Dtype *theta_data, Dtype *theta_data_, Dtype *x_w_data, Dtype *top_data) {
   const int num_kernels = num_ * channels_ * height_ * width_;
-  caffe_gpu_set(bottom[0]->count(), (Dtype)0., top_data);
-  switch (outliers_) {
+  switch (outliers) {
     case WarpParameter_WarpType_TRUNCATE:
       truncate_interp2_fwd<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>
         (num_kernels, bottom_data_0, bottom_data_1, num_, channels_, height_, width_, 
-         theta_data, theta_data_, x_w_data, top_data);
+         flow_height_, flow_width_, flow_scale_, theta_data, theta_data_,
+         x_w_data, top_data);
       break;
     case WarpParameter_WarpType_NEAREST:
       nearest_interp2_fwd<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>
         (num_kernels, bottom_data_0, bottom_data_1, num_, channels_, height_, width_, 
-         theta_data, theta_data_, x_w_data, top_data);
+         flow_height_, flow_width_, flow_scale_, theta_data, theta_data_,
+         x_w_data, top_data);
       break;
 
   }
   CUDA_POST_KERNEL_CHECK;
 }
 
+template <typename Dtype>
+void WarpLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  if (layout_ == NHWC || storage_ != FP32) {
+    // The GPU kernels are NCHW only and gather from the Dtype image
+    Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* bottom_data_0 = bottom[0]->gpu_data(); // image
+  const Dtype* bottom_data_1 = bottom[1]->gpu_data(); // optical flow
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  Dtype* theta_data = lean_ ? NULL : theta.mutable_gpu_data();
+  Dtype* theta_data_ = lean_ ? NULL : theta_.mutable_gpu_data();
+  Dtype* x_w_data = lean_ ? NULL : x_w.mutable_gpu_data();
+  interp2_fwd_gpu(outliers_, bottom_data_0, bottom_data_1, num_, channels_,
+                  height_, width_, flow_height_, flow_width_, flow_scale_,
+                  theta_data, theta_data_, x_w_data, top_data);
+}
+
 template <typename Dtype>
 void WarpLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (layout_ == NHWC) {
+    Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
   if (propagate_down[0] || propagate_down[1]) {
+    if (lean_) {
+      // Inference did not keep the sampling coordinates: recompute them with
+      // a single channel, warping into the image diff that is cleared below
+      Reshape_buffers();
+      interp2_fwd_gpu(outliers_, bottom[0]->gpu_data(), bottom[1]->gpu_data(),
+                      num_, 1, height_, width_, flow_height_, flow_width_,
+                      flow_scale_, theta.mutable_gpu_data(),
+                      theta_.mutable_gpu_data(), x_w.mutable_gpu_data(),
+                      bottom[0]->mutable_gpu_diff());
+    }
     caffe_gpu_set(bottom[0]->count(), (Dtype)0., bottom[0]->mutable_gpu_diff());
     caffe_gpu_set(bottom[1]->count(), (Dtype)0., bottom[1]->mutable_gpu_diff());
     const Dtype* theta_data = theta.mutable_gpu_data();
@@ -261,6 +327,13 @@ void WarpLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->gpu_diff();
     Dtype* bottom_0_diff = bottom[0]->mutable_gpu_diff();
     Dtype* bottom_1_diff = bottom[1]->mutable_gpu_diff();
+    // The gradient of a resampled flow is first taken at the image size
+    const bool resampled = (flow_height_ != height_ || flow_width_ != width_);
+    if (resampled) {
+      flow_diff_full_.Reshape(num_, 2, height_, width_);
+      bottom_1_diff = flow_diff_full_.mutable_gpu_data();
+      caffe_gpu_set(flow_diff_full_.count(), (Dtype)0., bottom_1_diff);
+    }
     const int num_kernels = num_ * channels_ * height_ * width_;
     switch (outliers_) {
       case WarpParameter_WarpType_NEAREST:
@@ -275,6 +348,19 @@ void WarpLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
         break;
     }
     CUDA_POST_KERNEL_CHECK;
+    if (resampled) {
+      for (int n = 0; n < num_; ++n) {
+        caffe_gpu_interp2_backward<Dtype,false>(2,
+            bottom[1]->mutable_gpu_diff() + n * 2 * flow_height_ * flow_width_,
+            0, 0, flow_height_, flow_width_, flow_height_, flow_width_,
+            bottom_1_diff + n * 2 * height_ * width_, 0, 0, height_, width_,
+            height_, width_);
+      }
+    }
+    if (flow_scale_ != Dtype(1)) {
+      caffe_gpu_scal(bottom[1]->count(), flow_scale_,
+          bottom[1]->mutable_gpu_diff());
+    }
     //caffe_gpu_mul(top[0]->count(), top_diff, bottom_0_diff, bottom_0_diff);
   }
 }
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/bn_layer.hpp"
+#include "caffe/layers/layout_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BNLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  BNLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~BNLayerTest() { delete blob_bottom_; delete blob_top_; }
+  // Random slope and bias so that every gradient is exercised
+  void SetFillers(BNParameter* bn_param) {
+    bn_param->mutable_slope_filler()->set_type("gaussian");
+    bn_param->mutable_bias_filler()->set_type("gaussian");
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BNLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetFillers(layer_param.mutable_bn_param());
+  BNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(BNLayerTest, TestNHWCMatchesNCHW) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  this->SetFillers(bn_param);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_diff(2, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&top_diff);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+      this->blob_bottom_vec_);
+  // Same layer on the channels-last copies of the blobs
+  Blob<Dtype> bottom_nhwc, top_nhwc;
+  vector<Blob<Dtype>*> bottom_nhwc_vec(1, &bottom_nhwc);
+  vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+  LayerParameter to_nhwc_param;
+  LayoutLayer<Dtype> to_nhwc(to_nhwc_param);
+  to_nhwc.SetUp(this->blob_bottom_vec_, bottom_nhwc_vec);
+  to_nhwc.Forward(this->blob_bottom_vec_, bottom_nhwc_vec);
+  bn_param->set_layout(NHWC);
+  BNLayer<Dtype> nhwc_layer(layer_param);
+  nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+  for (int i = 0; i < 2; ++i) {
+    nhwc_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < 4; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          top_nhwc.mutable_cpu_diff()[top_nhwc.offset(n, h, w, c)] =
+              this->blob_top_->diff_at(n, c, h, w);
+        }
+      }
+    }
+  }
+  nhwc_layer.Backward(top_nhwc_vec, vector<bool>(1, true), bottom_nhwc_vec);
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_NEAR(layer.blobs()[2]->cpu_data()[c],
+        nhwc_layer.blobs()[2]->cpu_data()[c], 1e-5);
+    EXPECT_NEAR(layer.blobs()[3]->cpu_data()[c],
+        nhwc_layer.blobs()[3]->cpu_data()[c], 1e-5);
+  }
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < 4; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+              top_nhwc.data_at(n, h, w, c), 1e-4);
+          EXPECT_NEAR(this->blob_bottom_->diff_at(n, c, h, w),
+              bottom_nhwc.diff_at(n, h, w, c), 1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestForwardFrozen) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  // Wide enough planes and rows for the vector kernels
+  this->blob_bottom_->Reshape(2, 11, 3, 7);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> uniform(filler_param);
+  for (int layout = 0; layout < 2; ++layout) {
+    LayerParameter layer_param;
+    BNParameter* bn_param = layer_param.mutable_bn_param();
+    bn_param->set_frozen(true);
+    bn_param->set_num_threads(2);
+    bn_param->set_layout(layout ? NHWC : NCHW);
+    BNLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    filler.Fill(layer.blobs()[0].get());
+    filler.Fill(layer.blobs()[1].get());
+    filler.Fill(layer.blobs()[2].get());
+    uniform.Fill(layer.blobs()[3].get());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // In place gives the same output
+    Blob<Dtype> in_place;
+    in_place.CopyFrom(*this->blob_bottom_, false, true);
+    vector<Blob<Dtype>*> in_place_vec(1, &in_place);
+    layer.Forward(in_place_vec, in_place_vec);
+    const int channels = layout ? 7 : 11;
+    const int spatial = layout ? 1 : 21;
+    const Dtype eps = bn_param->eps();
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      const int c = (i / spatial) % channels;
+      const Dtype expected = layer.blobs()[0]->cpu_data()[c] *
+          (this->blob_bottom_->cpu_data()[i] -
+           layer.blobs()[2]->cpu_data()[c]) /
+          std::sqrt(layer.blobs()[3]->cpu_data()[c] + eps) +
+          layer.blobs()[1]->cpu_data()[c];
+      EXPECT_NEAR(expected, this->blob_top_->cpu_data()[i], 1e-4);
+      EXPECT_NEAR(expected, in_place.cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> uniform(filler_param);
+  Blob<Dtype> top_diff(2, 3, 4, 5);
+  filler.Fill(&top_diff);
+  for (int frozen = 0; frozen < 2; ++frozen) {
+    LayerParameter layer_param;
+    BNParameter* bn_param = layer_param.mutable_bn_param();
+    this->SetFillers(bn_param);
+    bn_param->set_frozen(frozen);
+    BNLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    uniform.Fill(layer.blobs()[3].get());
+    // Same layer with the rectification
+    bn_param->set_relu(true);
+    BNLayer<Dtype> relu_layer(layer_param);
+    Blob<Dtype> bottom, top;
+    bottom.CopyFrom(*this->blob_bottom_, false, true);
+    vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+    vector<Blob<Dtype>*> top_vec(1, &top);
+    relu_layer.SetUp(bottom_vec, top_vec);
+    for (int i = 0; i < 4; ++i) {
+      relu_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    relu_layer.Forward(bottom_vec, top_vec);
+    // The top grad of the BN layer is the one passed by a following ReLU
+    Dtype* plain_top_diff = this->blob_top_->mutable_cpu_diff();
+    for (int i = 0; i < top.count(); ++i) {
+      const Dtype y = this->blob_top_->cpu_data()[i];
+      EXPECT_NEAR(std::max(y, Dtype(0)), top.cpu_data()[i], 1e-4);
+      plain_top_diff[i] = (y > 0) ? top_diff.cpu_data()[i] : Dtype(0);
+    }
+    caffe_copy(top.count(), top_diff.cpu_data(), top.mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+        this->blob_bottom_vec_);
+    relu_layer.Backward(top_vec, vector<bool>(1, true), bottom_vec);
+    for (int i = 0; i < bottom.count(); ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i], bottom.cpu_diff()[i],
+          1e-4);
+    }
+    for (int i = 0; i < 2; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_NEAR(layer.blobs()[i]->cpu_diff()[c],
+            relu_layer.blobs()[i]->cpu_diff()[c], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestBatchStatisticsThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  // A large offset, which a sum of squares would lose in single precision
+  this->blob_bottom_->Reshape(3, 5, 13, 11);
+  FillerParameter filler_param;
+  filler_param.set_mean(1000);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Blob<Dtype> top_diff;
+  top_diff.ReshapeLike(*this->blob_bottom_);
+  filler_param.set_mean(0);
+  GaussianFiller<Dtype> diff_filler(filler_param);
+  diff_filler.Fill(&top_diff);
+  for (int layout = 0; layout < 2; ++layout) {
+    const int channels = layout ? 11 : 5;
+    const int spatial = layout ? 1 : 13 * 11;
+    const int count = this->blob_bottom_->count();
+    vector<double> mean(channels, 0.), variance(channels, 0.);
+    for (int i = 0; i < count; ++i) {
+      mean[(i / spatial) % channels] += this->blob_bottom_->cpu_data()[i];
+    }
+    for (int c = 0; c < channels; ++c) {
+      mean[c] /= count / channels;
+    }
+    for (int i = 0; i < count; ++i) {
+      const int c = (i / spatial) % channels;
+      const double d = this->blob_bottom_->cpu_data()[i] - mean[c];
+      variance[c] += d * d / (count / channels);
+    }
+    // One and three threads, compared with each other and the reference
+    Blob<Dtype> bottom_diff[2];
+    Blob<Dtype> slope_diff[2];
+    for (int t = 0; t < 2; ++t) {
+      LayerParameter layer_param;
+      BNParameter* bn_param = layer_param.mutable_bn_param();
+      this->SetFillers(bn_param);
+      bn_param->set_momentum(0);
+      bn_param->set_layout(layout ? NHWC : NCHW);
+      bn_param->set_num_threads(t ? 3 : 1);
+      Caffe::set_random_seed(1701);
+      BNLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int c = 0; c < channels; ++c) {
+        EXPECT_NEAR(mean[c], layer.blobs()[2]->cpu_data()[c], 1e-3);
+        EXPECT_NEAR(variance[c], layer.blobs()[3]->cpu_data()[c], 1e-3);
+      }
+      caffe_copy(count, top_diff.cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+          this->blob_bottom_vec_);
+      bottom_diff[t].CopyFrom(*this->blob_bottom_, true, true);
+      slope_diff[t].CopyFrom(*layer.blobs()[0], true, true);
+    }
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(bottom_diff[0].cpu_diff()[i], bottom_diff[1].cpu_diff()[i],
+          1e-4);
+    }
+    // The slope grad sums hundreds of x_norm, each rounded at the offset
+    for (int c = 0; c < channels; ++c) {
+      EXPECT_NEAR(slope_diff[0].cpu_diff()[c], slope_diff[1].cpu_diff()[c],
+          1e-2);
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestScratch) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Only per-channel buffers with fixed statistics
+  EXPECT_EQ(layer.scratch_count(), 4 * 3);
+  layer_param.set_phase(TRAIN);
+  BNLayer<Dtype> train_layer(layer_param);
+  train_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_GE(train_layer.scratch_count(), this->blob_bottom_->count());
+}
+
+}  // namespace caffe
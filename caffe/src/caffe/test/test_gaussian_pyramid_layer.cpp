@@ -0,0 +1,166 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/gaussian_pyramid_layer.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class GaussianPyramidLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // Odd sizes, and wide enough rows for the vector kernel
+  GaussianPyramidLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 13, 43)) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    for (int l = 0; l < 3; ++l) {
+      blob_top_vec_.push_back(new Blob<Dtype>());
+    }
+  }
+  virtual ~GaussianPyramidLayerTest() {
+    delete blob_bottom_;
+    for (int l = 0; l < blob_top_vec_.size(); ++l) {
+      delete blob_top_vec_[l];
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(GaussianPyramidLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(GaussianPyramidLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  GaussianPyramidLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int height[3] = {6, 3, 1};
+  const int width[3] = {21, 10, 5};
+  for (int l = 0; l < 3; ++l) {
+    EXPECT_EQ(this->blob_top_vec_[l]->num(), 2);
+    EXPECT_EQ(this->blob_top_vec_[l]->channels(), 3);
+    EXPECT_EQ(this->blob_top_vec_[l]->height(), height[l]);
+    EXPECT_EQ(this->blob_top_vec_[l]->width(), width[l]);
+  }
+}
+
+TYPED_TEST(GaussianPyramidLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_num_threads(2);
+  GaussianPyramidLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Same as the scalar loop of caffe_cpu_pyramid2
+  for (int l = 0; l < 3; ++l) {
+    const Blob<Dtype>& src = (l == 0) ? *this->blob_bottom_ :
+      *this->blob_top_vec_[l - 1];
+    const Blob<Dtype>& dst = *this->blob_top_vec_[l];
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < dst.height(); ++h) {
+          for (int w = 0; w < dst.width(); ++w) {
+            const Dtype expected = static_cast<Dtype>(.25) *
+              (src.data_at(n, c, 2 * h, 2 * w) +
+               src.data_at(n, c, 2 * h, 2 * w + 1) +
+               src.data_at(n, c, 2 * h + 1, 2 * w) +
+               src.data_at(n, c, 2 * h + 1, 2 * w + 1));
+            EXPECT_EQ(expected, dst.data_at(n, c, h, w));
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(GaussianPyramidLayerTest, TestForwardNHWC) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  GaussianPyramidLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The channels-last copy of the bottom gives the same levels
+  Blob<Dtype> bottom_nhwc(2, 13, 43, 3);
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < 13; ++h) {
+        for (int w = 0; w < 43; ++w) {
+          bottom_nhwc.mutable_cpu_data()[bottom_nhwc.offset(n, h, w, c)] =
+            this->blob_bottom_->data_at(n, c, h, w);
+        }
+      }
+    }
+  }
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom_nhwc);
+  Blob<Dtype> top_nhwc[3];
+  vector<Blob<Dtype>*> top_vec;
+  for (int l = 0; l < 3; ++l) {
+    top_vec.push_back(&top_nhwc[l]);
+  }
+  layer_param.mutable_interp_param()->set_layout(NHWC);
+  GaussianPyramidLayer<Dtype> nhwc_layer(layer_param);
+  nhwc_layer.SetUp(bottom_vec, top_vec);
+  nhwc_layer.Forward(bottom_vec, top_vec);
+  for (int l = 0; l < 3; ++l) {
+    const Blob<Dtype>& top = *this->blob_top_vec_[l];
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < top.height(); ++h) {
+          for (int w = 0; w < top.width(); ++w) {
+            EXPECT_EQ(top.data_at(n, c, h, w), top_nhwc[l].data_at(n, h, w, c));
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(GaussianPyramidLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 9, 7);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  GaussianPyramidLayer<Dtype> layer(layer_param);
+  vector<Blob<Dtype>*> top_vec(this->blob_top_vec_.begin(),
+      this->blob_top_vec_.begin() + 2);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, top_vec);
+}
+
+TYPED_TEST(GaussianPyramidLayerTest, TestGradientNHWC) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 9, 7, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_layout(NHWC);
+  GaussianPyramidLayer<Dtype> layer(layer_param);
+  vector<Blob<Dtype>*> top_vec(this->blob_top_vec_.begin(),
+      this->blob_top_vec_.begin() + 2);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, top_vec);
+}
+
+}  // namespace caffe
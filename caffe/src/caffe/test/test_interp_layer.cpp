@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,7 +9,11 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layers/gaussian_pyramid_layer.hpp"
 #include "caffe/layers/interp_layer.hpp"
+#include "caffe/layers/layout_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -28,6 +35,55 @@ class InterpLayerTest : public MultiDeviceTest<TypeParam> {
     blob_top_vec_.push_back(blob_top_);
   }
   virtual ~InterpLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  // Bound of the rounding differences between two interpolations of the
+  // bottom that add their products in another order or fuse multiplies and
+  // adds: a few ulps of the largest input
+  Dtype Tolerance() const {
+    Dtype bottom_max = 0;
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      bottom_max = std::max(bottom_max, std::abs(blob_bottom_->cpu_data()[i]));
+    }
+    return 8 * std::numeric_limits<Dtype>::epsilon() * bottom_max;
+  }
+
+  // Checks the NCHW top against the per-pixel bi-linear interpolation of
+  // the height1 x width1 top-left crop of the bottom
+  void CheckForwardBilinear(const int height1, const int width1) {
+    const int Height1 = blob_bottom_->height();
+    const int Width1 = blob_bottom_->width();
+    const int height2 = blob_top_->height();
+    const int width2 = blob_top_->width();
+    const float rheight = (height2 > 1) ?
+        static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
+    const float rwidth = (width2 > 1) ?
+        static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
+    const Dtype tolerance = Tolerance();
+    for (int c = 0; c < blob_bottom_->num() * blob_bottom_->channels(); ++c) {
+      const Dtype* data1 = blob_bottom_->cpu_data() + c * Height1 * Width1;
+      const Dtype* data2 = blob_top_->cpu_data() + c * height2 * width2;
+      for (int h2 = 0; h2 < height2; ++h2) {
+        const float h1r = rheight * h2;
+        const int h1 = h1r;
+        const int h1p = (h1 < height1 - 1) ? Width1 : 0;
+        const Dtype h1lambda = h1r - h1;
+        const Dtype h0lambda = Dtype(1.) - h1lambda;
+        for (int w2 = 0; w2 < width2; ++w2) {
+          const float w1r = rwidth * w2;
+          const int w1 = w1r;
+          const int w1p = (w1 < width1 - 1) ? 1 : 0;
+          const Dtype w1lambda = w1r - w1;
+          const Dtype w0lambda = Dtype(1.) - w1lambda;
+          const Dtype* pos1 = data1 + h1 * Width1 + w1;
+          const Dtype expected =
+              h0lambda * (w0lambda * pos1[0] + w1lambda * pos1[w1p]) +
+              h1lambda * (w0lambda * pos1[h1p] + w1lambda * pos1[h1p + w1p]);
+          EXPECT_NEAR(expected, data2[h2 * width2 + w2], tolerance);
+        }
+      }
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_;
   Blob<Dtype>* const blob_top_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
@@ -64,4 +120,330 @@ TYPED_TEST(InterpLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(InterpLayerTest, TestForwardNHWC) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InterpParameter* interp_param =
+      layer_param.mutable_interp_param();
+  interp_param->set_height(11);
+  interp_param->set_width(9);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // NCHW -> NHWC -> Interp -> NCHW gives the same result
+  Blob<Dtype> bottom_nhwc, top_nhwc, top_nchw;
+  vector<Blob<Dtype>*> bottom_nhwc_vec(1, &bottom_nhwc);
+  vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+  vector<Blob<Dtype>*> top_nchw_vec(1, &top_nchw);
+  LayerParameter to_nhwc_param;
+  LayoutLayer<Dtype> to_nhwc(to_nhwc_param);
+  to_nhwc.SetUp(this->blob_bottom_vec_, bottom_nhwc_vec);
+  to_nhwc.Forward(this->blob_bottom_vec_, bottom_nhwc_vec);
+  interp_param->set_layout(NHWC);
+  InterpLayer<Dtype> nhwc_layer(layer_param);
+  nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+  EXPECT_EQ(top_nhwc.shape(1), 11);
+  EXPECT_EQ(top_nhwc.shape(2), 9);
+  EXPECT_EQ(top_nhwc.shape(3), 3);
+  nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+  LayerParameter to_nchw_param;
+  to_nchw_param.mutable_layout_param()->set_layout(NCHW);
+  LayoutLayer<Dtype> to_nchw(to_nchw_param);
+  to_nchw.SetUp(top_nhwc_vec, top_nchw_vec);
+  to_nchw.Forward(top_nhwc_vec, top_nchw_vec);
+  ASSERT_TRUE(top_nchw.shape() == this->blob_top_->shape());
+  for (int i = 0; i < top_nchw.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_nchw.cpu_data()[i],
+        1e-5);
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientNHWC) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InterpParameter* interp_param =
+      layer_param.mutable_interp_param();
+  interp_param->set_height(11);
+  interp_param->set_width(9);
+  interp_param->set_layout(NHWC);
+  InterpLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+
+TYPED_TEST(InterpLayerTest, TestForwardZoomThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  LayerParameter layer_param;
+  InterpParameter* interp_param = layer_param.mutable_interp_param();
+  interp_param->set_zoom_factor(8);
+  interp_param->set_pad_end(-1);
+  interp_param->set_num_threads(3);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The per-pixel interpolation of the 5x4 crop
+  EXPECT_EQ(this->blob_top_->height(), 33);
+  EXPECT_EQ(this->blob_top_->width(), 25);
+  this->CheckForwardBilinear(5, 4);
+}
+
+TYPED_TEST(InterpLayerTest, TestBackwardThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  // Zooming and shrinking the 5x4 crop, planar and packed, on 3 threads
+  const int heights[] = {33, 3};
+  const int widths[] = {25, 3};
+  const Layout layouts[] = {NCHW, NHWC};
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int s = 0; s < 2; ++s) {
+    for (int l = 0; l < 2; ++l) {
+      LayerParameter layer_param;
+      InterpParameter* interp_param = layer_param.mutable_interp_param();
+      interp_param->set_height(heights[s]);
+      interp_param->set_width(widths[s]);
+      interp_param->set_pad_end(-1);
+      interp_param->set_layout(layouts[l]);
+      interp_param->set_num_threads(3);
+      InterpLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      filler.Fill(this->blob_top_);
+      caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+          this->blob_bottom_vec_);
+      // Scatter of every output pixel to its four source pixels
+      const bool nhwc = (layouts[l] == NHWC);
+      const Blob<Dtype>& bottom = *this->blob_bottom_;
+      const int Height1 = bottom.shape(nhwc ? 1 : 2);
+      const int Width1 = bottom.shape(nhwc ? 2 : 3);
+      const int channels = bottom.shape(nhwc ? 3 : 1);
+      const int height1 = Height1 - 1, width1 = Width1 - 1;
+      const int height2 = heights[s], width2 = widths[s];
+      const float rheight = static_cast<float>(height1 - 1) / (height2 - 1);
+      const float rwidth = static_cast<float>(width1 - 1) / (width2 - 1);
+      Blob<Dtype> expected(bottom.shape());
+      Dtype* diff1 = expected.mutable_cpu_data();
+      caffe_set(expected.count(), Dtype(0), diff1);
+      const Dtype* diff2 = this->blob_top_->cpu_diff();
+      for (int n = 0; n < bottom.num(); ++n) {
+        for (int c = 0; c < channels; ++c) {
+          for (int h2 = 0; h2 < height2; ++h2) {
+            const float h1r = rheight * h2;
+            const int h1 = h1r;
+            const int h1p = (h1 < height1 - 1) ? 1 : 0;
+            const Dtype hlambda[2] = {Dtype(1.) - (h1r - h1), h1r - h1};
+            for (int w2 = 0; w2 < width2; ++w2) {
+              const float w1r = rwidth * w2;
+              const int w1 = w1r;
+              const int w1p = (w1 < width1 - 1) ? 1 : 0;
+              const Dtype wlambda[2] = {Dtype(1.) - (w1r - w1), w1r - w1};
+              const Dtype g = nhwc ?
+                  diff2[this->blob_top_->offset(n, h2, w2, c)] :
+                  diff2[this->blob_top_->offset(n, c, h2, w2)];
+              for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                  const int h = h1 + i * h1p, w = w1 + j * w1p;
+                  diff1[nhwc ? bottom.offset(n, h, w, c) :
+                        bottom.offset(n, c, h, w)] +=
+                      hlambda[i] * wlambda[j] * g;
+                }
+              }
+            }
+          }
+        }
+      }
+      // The sums are in a different order; a zoom by 8 adds up to 81 terms
+      for (int i = 0; i < expected.count(); ++i) {
+        EXPECT_NEAR(expected.cpu_data()[i], bottom.cpu_diff()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestForwardIntegerFactors) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  // The specialized zoom 2 and 4 kernels on the 5x4 crop
+  for (int zoom = 2; zoom <= 4; zoom *= 2) {
+    LayerParameter layer_param;
+    InterpParameter* interp_param = layer_param.mutable_interp_param();
+    interp_param->set_zoom_factor(zoom);
+    interp_param->set_pad_end(-1);
+    interp_param->set_num_threads(2);
+    InterpLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_->height(), 4 * zoom + 1);
+    EXPECT_EQ(this->blob_top_->width(), 3 * zoom + 1);
+    this->CheckForwardBilinear(5, 4);
+    // Same output with the NHWC layout
+    Blob<Dtype> bottom_nhwc(2, 5, 4, 3), top_nhwc;
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < 5; ++h) {
+          for (int w = 0; w < 4; ++w) {
+            bottom_nhwc.mutable_cpu_data()[bottom_nhwc.offset(n, h, w, c)] =
+                this->blob_bottom_->data_at(n, c, h, w);
+          }
+        }
+      }
+    }
+    vector<Blob<Dtype>*> bottom_nhwc_vec(1, &bottom_nhwc);
+    vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+    interp_param->set_pad_end(0);
+    interp_param->set_layout(NHWC);
+    InterpLayer<Dtype> nhwc_layer(layer_param);
+    nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+    nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < 4 * zoom + 1; ++h) {
+          for (int w = 0; w < 3 * zoom + 1; ++w) {
+            EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+                top_nhwc.data_at(n, h, w, c), this->Tolerance());
+          }
+        }
+      }
+    }
+  }
+  // The strided shrink of a 9x7 input by 2
+  this->blob_bottom_->Reshape(2, 3, 9, 7);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_shrink_factor(2);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->height(), 5);
+  EXPECT_EQ(this->blob_top_->width(), 4);
+  this->CheckForwardBilinear(9, 7);
+}
+
+TYPED_TEST(InterpLayerTest, TestForwardHalfStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  const StoragePrecision storage[] = {FP16, BF16};
+  // Relative precision of the stored input
+  const Dtype eps[] = {Dtype(1) / 2048, Dtype(1) / 256};
+  const Layout layouts[] = {NCHW, NHWC};
+  Dtype bottom_max = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_max = std::max(bottom_max,
+                          std::abs(this->blob_bottom_->cpu_data()[i]));
+  }
+  for (int l = 0; l < 2; ++l) {
+    LayerParameter layer_param;
+    InterpParameter* interp_param = layer_param.mutable_interp_param();
+    interp_param->set_height(11);
+    interp_param->set_width(9);
+    interp_param->set_layout(layouts[l]);
+    InterpLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int p = 0; p < 2; ++p) {
+      interp_param->set_storage(storage[p]);
+      Blob<Dtype> top;
+      vector<Blob<Dtype>*> top_vec(1, &top);
+      InterpLayer<Dtype> half_layer(layer_param);
+      half_layer.SetUp(this->blob_bottom_vec_, top_vec);
+      half_layer.Forward(this->blob_bottom_vec_, top_vec);
+      ASSERT_TRUE(top.shape() == this->blob_top_->shape());
+      for (int i = 0; i < top.count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i], top.cpu_data()[i],
+            eps[p] * bottom_max);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestForwardPyramid) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  this->blob_bottom_->Reshape(2, 3, 33, 35);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  InterpParameter* interp_param = layer_param.mutable_interp_param();
+  interp_param->set_shrink_factor(8);
+  interp_param->set_pyramid(true);
+  interp_param->set_num_threads(2);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->height(), 5);
+  EXPECT_EQ(this->blob_top_->width(), 5);
+  // The area ratio picks level 2, 8x8, interpolated to 5x5
+  Blob<Dtype> level1, level2, top;
+  vector<Blob<Dtype>*> level_vec;
+  level_vec.push_back(&level1);
+  level_vec.push_back(&level2);
+  vector<Blob<Dtype>*> level2_vec(1, &level2);
+  vector<Blob<Dtype>*> top_vec(1, &top);
+  LayerParameter pyramid_param;
+  GaussianPyramidLayer<Dtype> pyramid(pyramid_param);
+  pyramid.SetUp(this->blob_bottom_vec_, level_vec);
+  pyramid.Forward(this->blob_bottom_vec_, level_vec);
+  LayerParameter interp_level_param;
+  interp_level_param.mutable_interp_param()->set_height(5);
+  interp_level_param.mutable_interp_param()->set_width(5);
+  InterpLayer<Dtype> interp_level(interp_level_param);
+  interp_level.SetUp(level2_vec, top_vec);
+  interp_level.Forward(level2_vec, top_vec);
+  ASSERT_TRUE(top.shape() == this->blob_top_->shape());
+  const Dtype tolerance = this->Tolerance();
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(top.cpu_data()[i], this->blob_top_->cpu_data()[i], tolerance);
+  }
+  // The channels-last layer gives the same result
+  Blob<Dtype> bottom_nhwc, top_nhwc;
+  vector<Blob<Dtype>*> bottom_nhwc_vec(1, &bottom_nhwc);
+  vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+  LayerParameter to_nhwc_param;
+  LayoutLayer<Dtype> to_nhwc(to_nhwc_param);
+  to_nhwc.SetUp(this->blob_bottom_vec_, bottom_nhwc_vec);
+  to_nhwc.Forward(this->blob_bottom_vec_, bottom_nhwc_vec);
+  interp_param->set_layout(NHWC);
+  InterpLayer<Dtype> nhwc_layer(layer_param);
+  nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+  nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < 5; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+              top_nhwc.data_at(n, h, w, c), tolerance);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientPyramid) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Odd sizes, level 2 of 4x3 interpolated to 3x3
+  this->blob_bottom_->Reshape(2, 3, 17, 13);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const Layout layouts[] = {NCHW, NHWC};
+  for (int l = 0; l < 2; ++l) {
+    LayerParameter layer_param;
+    InterpParameter* interp_param = layer_param.mutable_interp_param();
+    interp_param->set_height(3);
+    interp_param->set_width(3);
+    interp_param->set_pyramid(true);
+    interp_param->set_layout(layouts[l]);
+    InterpLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-2);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
 }  // namespace caffe
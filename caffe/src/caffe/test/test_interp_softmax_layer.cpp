@@ -0,0 +1,194 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/interp_layer.hpp"
+#include "caffe/layers/interp_softmax_layer.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class InterpSoftmaxLayerTest : public CPUDeviceTest<Dtype> {
+
+ protected:
+  InterpSoftmaxLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 5, 4, 3)),
+        blob_prob_(new Blob<Dtype>()),
+        blob_label_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_std(2);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_prob_);
+    blob_top_vec_.push_back(blob_label_);
+  }
+  virtual ~InterpSoftmaxLayerTest() {
+    delete blob_bottom_;
+    delete blob_prob_;
+    delete blob_label_;
+  }
+
+  // Softmax over the channels of the Interp layer output
+  void Reference(const LayerParameter& layer_param, Blob<Dtype>* prob) {
+    vector<Blob<Dtype>*> top_vec(1, prob);
+    InterpLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, top_vec);
+    layer.Forward(blob_bottom_vec_, top_vec);
+    const int channels = prob->channels();
+    const int dim = prob->height() * prob->width();
+    for (int n = 0; n < prob->num(); ++n) {
+      Dtype* x = prob->mutable_cpu_data() + n * channels * dim;
+      for (int i = 0; i < dim; ++i) {
+        Dtype max_x = x[i];
+        for (int c = 1; c < channels; ++c) {
+          max_x = std::max(max_x, x[c * dim + i]);
+        }
+        Dtype sum = 0;
+        for (int c = 0; c < channels; ++c) {
+          x[c * dim + i] = std::exp(x[c * dim + i] - max_x);
+          sum += x[c * dim + i];
+        }
+        for (int c = 0; c < channels; ++c) {
+          x[c * dim + i] /= sum;
+        }
+      }
+    }
+  }
+
+  // Checks that label holds the first channel of highest value of prob
+  void CheckLabels(const Blob<Dtype>& prob, const Blob<Dtype>& label) {
+    const int channels = prob.channels();
+    const int dim = prob.height() * prob.width();
+    ASSERT_EQ(label.count(), prob.num() * dim);
+    for (int n = 0; n < prob.num(); ++n) {
+      const Dtype* x = prob.cpu_data() + n * channels * dim;
+      for (int i = 0; i < dim; ++i) {
+        int best = 0;
+        for (int c = 1; c < channels; ++c) {
+          if (x[c * dim + i] > x[best * dim + i]) { best = c; }
+        }
+        EXPECT_EQ(best, label.cpu_data()[n * dim + i]);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_prob_;
+  Blob<Dtype>* const blob_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(InterpSoftmaxLayerTest, TestDtypes);
+
+TYPED_TEST(InterpSoftmaxLayerTest, TestSetUp) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(8);
+  InterpSoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_prob_->num(), 2);
+  EXPECT_EQ(this->blob_prob_->channels(), 5);
+  EXPECT_EQ(this->blob_prob_->height(), 25);
+  EXPECT_EQ(this->blob_prob_->width(), 17);
+  EXPECT_EQ(this->blob_label_->num(), 2);
+  EXPECT_EQ(this->blob_label_->channels(), 1);
+  EXPECT_EQ(this->blob_label_->height(), 25);
+  EXPECT_EQ(this->blob_label_->width(), 17);
+}
+
+TYPED_TEST(InterpSoftmaxLayerTest, TestForward) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(8);
+  InterpSoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected;
+  this->Reference(layer_param, &expected);
+  ASSERT_EQ(expected.shape(), this->blob_prob_->shape());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_prob_->cpu_data()[i],
+        1e-6);
+  }
+  this->CheckLabels(*this->blob_prob_, *this->blob_label_);
+}
+
+TYPED_TEST(InterpSoftmaxLayerTest, TestForwardBands) {
+  typedef TypeParam Dtype;
+  CpuParallelGrain grain(1);
+  // Wide enough for several bands, on several threads, with a crop
+  LayerParameter layer_param;
+  InterpParameter* interp_param = layer_param.mutable_interp_param();
+  interp_param->set_height(23);
+  interp_param->set_width(2000);
+  interp_param->set_pad_beg(-1);
+  interp_param->set_num_threads(3);
+  InterpSoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected;
+  this->Reference(layer_param, &expected);
+  ASSERT_EQ(expected.shape(), this->blob_prob_->shape());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_prob_->cpu_data()[i],
+        1e-6);
+  }
+  this->CheckLabels(*this->blob_prob_, *this->blob_label_);
+}
+
+TYPED_TEST(InterpSoftmaxLayerTest, TestLabelOnly) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(4);
+  layer_param.mutable_interp_softmax_param()->set_output(
+      InterpSoftmaxParameter_Output_LABEL);
+  InterpSoftmaxLayer<Dtype> layer(layer_param);
+  vector<Blob<Dtype>*> top_vec(1, this->blob_label_);
+  layer.SetUp(this->blob_bottom_vec_, top_vec);
+  layer.Forward(this->blob_bottom_vec_, top_vec);
+  Blob<Dtype> expected;
+  this->Reference(layer_param, &expected);
+  this->CheckLabels(expected, *this->blob_label_);
+}
+
+TYPED_TEST(InterpSoftmaxLayerTest, TestAccumulateMirror) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(2);
+  InterpSoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> single;
+  single.CopyFrom(*this->blob_prob_, false, true);
+  // Adds the mirrored output to the first one
+  layer_param.mutable_interp_softmax_param()->set_accumulate(true);
+  layer_param.mutable_interp_softmax_param()->set_mirror(true);
+  InterpSoftmaxLayer<Dtype> mirror_layer(layer_param);
+  mirror_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  mirror_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int width = single.width();
+  for (int i = 0; i < single.count() / width; ++i) {
+    for (int w = 0; w < width; ++w) {
+      EXPECT_NEAR(single.cpu_data()[i * width + w] +
+          single.cpu_data()[i * width + width - 1 - w],
+          this->blob_prob_->cpu_data()[i * width + w], 1e-6);
+    }
+  }
+  this->CheckLabels(*this->blob_prob_, *this->blob_label_);
+}
+
+}  // namespace caffe
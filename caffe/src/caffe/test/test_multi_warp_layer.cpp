@@ -0,0 +1,73 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/multi_warp_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_multi_warp_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class MultiWarpLayerTest : public MultiWarpTest<TypeParam, MultiWarpLayer> {
+ protected:
+  // cur, w_cur, then (prev, flow, w) for 2 previous frames
+  MultiWarpLayerTest() : MultiWarpTest<TypeParam, MultiWarpLayer>(2) {}
+};
+
+TYPED_TEST_CASE(MultiWarpLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(MultiWarpLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  MultiWarpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 4);
+  EXPECT_EQ(this->blob_top_->width(), 5);
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestForwardMatchesWarpEltwise) {
+  this->TestForwardMatchesWarpEltwise();
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestForwardWithoutCurrent) {
+  typedef typename TypeParam::Dtype Dtype;
+  const vector<Blob<Dtype>*> bottom(this->blob_vec_.begin() + 2,
+      this->blob_vec_.end());
+  this->CheckForward(bottom, WarpParameter_WarpType_NEAREST, TRAIN);
+  this->CheckForward(bottom, WarpParameter_WarpType_TRUNCATE, TEST);
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestForwardResampledFlow) {
+  this->TestForwardResampledFlow();
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestTruncateGradient) {
+  this->TestGradient(WarpParameter_WarpType_TRUNCATE);
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestNearestGradient) {
+  this->TestGradient(WarpParameter_WarpType_NEAREST);
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestThreadsGradient) {
+  this->TestThreadsGradient();
+}
+
+TYPED_TEST(MultiWarpLayerTest, TestLeanResampledGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const vector<Blob<Dtype>*> bottom(this->blob_vec_.begin() + 2,
+      this->blob_vec_.end());
+  this->TestLeanResampledGradient(bottom);
+}
+
+}  // namespace caffe
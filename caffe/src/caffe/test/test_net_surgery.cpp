@@ -0,0 +1,309 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/bn_layer.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/net_surgery.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class NetSurgeryTest : public CPUDeviceTest<Dtype> {
+ protected:
+  NetSurgeryTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 7, 6)),
+        blob_conv_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_conv_vec_.push_back(blob_conv_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~NetSurgeryTest() {
+    delete blob_bottom_;
+    delete blob_conv_;
+    delete blob_top_;
+  }
+
+  // A Convolution, an in-place BN layer with random statistics and a ReLU
+  void InitNet(const bool bias_term, const string& bn_param,
+      NetParameter* param) {
+    const string proto =
+        "layer { name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+        "  convolution_param { num_output: 4 kernel_size: 3 pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } } "
+        "layer { name: 'conv/bn' type: 'BN' bottom: 'conv' top: 'conv' "
+        "  bn_param { " + bn_param + " } } "
+        "layer { name: 'conv/relu' type: 'ReLU' bottom: 'conv' top: 'conv' } ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, param));
+    param->mutable_layer(0)->mutable_convolution_param()->set_bias_term(
+        bias_term);
+  }
+
+  // Runs the Convolution and BN layers of param to blob_top_ and writes
+  // their weights to weights
+  void ForwardConvBN(const NetParameter& param, NetParameter* weights) {
+    ConvolutionLayer<Dtype> conv(param.layer(0));
+    conv.SetUp(blob_bottom_vec_, blob_conv_vec_);
+    conv.Forward(blob_bottom_vec_, blob_conv_vec_);
+    BNLayer<Dtype> bn(param.layer(1));
+    bn.SetUp(blob_conv_vec_, blob_top_vec_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> gaussian(filler_param);
+    filler_param.set_min(0.5);
+    filler_param.set_max(2);
+    UniformFiller<Dtype> uniform(filler_param);
+    gaussian.Fill(bn.blobs()[0].get());
+    gaussian.Fill(bn.blobs()[1].get());
+    gaussian.Fill(bn.blobs()[2].get());
+    uniform.Fill(bn.blobs()[3].get());
+    bn.Forward(blob_conv_vec_, blob_top_vec_);
+    conv.ToProto(weights->add_layer());
+    bn.ToProto(weights->add_layer());
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_conv_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_conv_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(NetSurgeryTest, TestDtypes);
+
+TYPED_TEST(NetSurgeryTest, TestFoldBN) {
+  typedef TypeParam Dtype;
+  for (int bias_term = 0; bias_term < 2; ++bias_term) {
+    NetParameter param, weights;
+    this->InitNet(bias_term, "frozen: true", &param);
+    this->ForwardConvBN(param, &weights);
+    EXPECT_EQ(FoldBNIntoConvolution(TRAIN, &param, &weights), 1);
+    ASSERT_EQ(param.layer_size(), 2);
+    EXPECT_EQ(param.layer(0).name(), "conv");
+    EXPECT_TRUE(param.layer(0).convolution_param().bias_term());
+    EXPECT_EQ(param.layer(1).name(), "conv/relu");
+    ASSERT_EQ(weights.layer_size(), 1);
+    ASSERT_EQ(weights.layer(0).blobs_size(), 2);
+    // The folded convolution computes the output of the BN layer
+    ConvolutionLayer<Dtype> folded(weights.layer(0));
+    Blob<Dtype> top;
+    vector<Blob<Dtype>*> top_vec(1, &top);
+    folded.SetUp(this->blob_bottom_vec_, top_vec);
+    folded.Forward(this->blob_bottom_vec_, top_vec);
+    ASSERT_TRUE(top.shape() == this->blob_top_->shape());
+    for (int i = 0; i < top.count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], top.cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetSurgeryTest, TestFoldBNNotInPlace) {
+  NetParameter param, weights;
+  this->InitNet(false, "", &param);
+  param.mutable_layer(1)->set_top(0, "conv/bn");
+  param.mutable_layer(2)->set_bottom(0, "conv/bn");
+  param.mutable_layer(2)->set_top(0, "conv/bn");
+  this->ForwardConvBN(param, &weights);
+  // Not frozen, so only folded for TEST
+  NetParameter train_param(param), train_weights(weights);
+  EXPECT_EQ(FoldBNIntoConvolution(TRAIN, &train_param, &train_weights), 0);
+  EXPECT_EQ(train_param.layer_size(), 3);
+  EXPECT_EQ(train_weights.layer_size(), 2);
+  EXPECT_EQ(FoldBNIntoConvolution(TEST, &param, &weights), 1);
+  ASSERT_EQ(param.layer_size(), 2);
+  EXPECT_EQ(param.layer(0).top(0), "conv/bn");
+  EXPECT_EQ(param.layer(1).bottom(0), "conv/bn");
+}
+
+TYPED_TEST(NetSurgeryTest, TestNoFoldSharedOutput) {
+  NetParameter param, weights;
+  this->InitNet(true, "frozen: true", &param);
+  this->ForwardConvBN(param, &weights);
+  // Another layer reads the convolution output before the BN layer
+  LayerParameter* reader = param.add_layer();
+  reader->CopyFrom(param.layer(2));
+  reader->set_name("conv/copy");
+  reader->set_top(0, "conv/copy");
+  param.mutable_layer()->SwapElements(1, 3);
+  param.mutable_layer()->SwapElements(2, 3);
+  ASSERT_EQ(param.layer(1).name(), "conv/copy");
+  ASSERT_EQ(param.layer(2).name(), "conv/bn");
+  EXPECT_EQ(FoldBNIntoConvolution(TEST, &param, &weights), 0);
+  EXPECT_EQ(param.layer_size(), 4);
+  EXPECT_EQ(weights.layer_size(), 2);
+}
+
+TYPED_TEST(NetSurgeryTest, TestMergeBNReLU) {
+  NetParameter param, weights;
+  this->InitNet(true, "", &param);
+  this->ForwardConvBN(param, &weights);
+  // No merge with a leaky ReLU
+  NetParameter leaky_param(param);
+  leaky_param.mutable_layer(2)->mutable_relu_param()->set_negative_slope(0.1);
+  EXPECT_EQ(MergeBNReLU(&leaky_param), 0);
+  EXPECT_EQ(leaky_param.layer_size(), 3);
+  // Not in place, the merged BN layer writes the output of the ReLU
+  param.mutable_layer(2)->set_top(0, "conv/relu");
+  EXPECT_EQ(MergeBNReLU(&param), 1);
+  ASSERT_EQ(param.layer_size(), 2);
+  EXPECT_EQ(param.layer(1).name(), "conv/bn");
+  EXPECT_TRUE(param.layer(1).bn_param().relu());
+  EXPECT_EQ(param.layer(1).bottom(0), "conv");
+  EXPECT_EQ(param.layer(1).top(0), "conv/relu");
+  // Folding leaves the rectification as a ReLU layer
+  EXPECT_EQ(FoldBNIntoConvolution(TEST, &param, &weights), 1);
+  ASSERT_EQ(param.layer_size(), 2);
+  EXPECT_EQ(param.layer(0).top(0), "conv/relu");
+  EXPECT_EQ(param.layer(1).type(), "ReLU");
+  EXPECT_EQ(param.layer(1).bottom(0), "conv/relu");
+  EXPECT_EQ(param.layer(1).top(0), "conv/relu");
+  EXPECT_EQ(weights.layer_size(), 1);
+}
+
+TYPED_TEST(NetSurgeryTest, TestFoldConstantLayers) {
+  typedef TypeParam Dtype;
+  // Weight maps from constant and from random DummyData, as in NetWarp
+  const string proto =
+      "input: 'data' input_shape { dim: 2 dim: 3 dim: 7 dim: 6 } "
+      "layer { name: 'ones' type: 'DummyData' top: 'ones' "
+      "  dummy_data_param { data_filler { type: 'constant' value: 1 } "
+      "    shape { dim: 1 dim: 1 dim: 7 dim: 6 } } } "
+      "layer { name: 'noise' type: 'DummyData' top: 'noise' "
+      "  dummy_data_param { data_filler { type: 'gaussian' } "
+      "    shape { dim: 1 dim: 1 dim: 7 dim: 6 } } } "
+      "layer { name: 'w' type: 'Convolution' bottom: 'ones' top: 'w' "
+      "  convolution_param { num_output: 3 kernel_size: 1 } } "
+      "layer { name: 'w_noise' type: 'Convolution' bottom: 'noise' "
+      "  top: 'w_noise' convolution_param { num_output: 3 kernel_size: 1 } } "
+      "layer { name: 'prod' type: 'Eltwise' bottom: 'data' bottom: 'w' "
+      "  top: 'prod' eltwise_param { operation: PROD } } "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'prod' bottom: 'w_noise' "
+      "  top: 'sum' } ";
+  NetParameter param, weights;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Blob<Dtype> ones(1, 1, 7, 6);
+  vector<Blob<Dtype>*> ones_vec(1, &ones);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 2; i < 4; ++i) {
+    LayerParameter conv_param(param.layer(i));
+    conv_param.mutable_convolution_param()->mutable_weight_filler()->set_type(
+        "gaussian");
+    ConvolutionLayer<Dtype> conv(conv_param);
+    Blob<Dtype> top;
+    vector<Blob<Dtype>*> top_vec(1, &top);
+    conv.SetUp(ones_vec, top_vec);
+    filler.Fill(conv.blobs()[1].get());
+    conv.ToProto(weights.add_layer());
+  }
+  const NetParameter trained(weights);
+  EXPECT_EQ(FoldConstantLayers(&param, &weights), 2);
+  ASSERT_EQ(param.layer_size(), 5);
+  EXPECT_EQ(param.layer(0).name(), "noise");
+  const LayerParameter& parameter = param.layer(1);
+  EXPECT_EQ(parameter.name(), "w_folded");
+  EXPECT_EQ(parameter.type(), "Parameter");
+  EXPECT_EQ(parameter.top(0), "w");
+  ASSERT_EQ(parameter.parameter_param().shape().dim_size(), 4);
+  EXPECT_EQ(parameter.parameter_param().shape().dim(1), 3);
+  EXPECT_EQ(parameter.parameter_param().shape().dim(2), 7);
+  EXPECT_EQ(param.layer(2).name(), "w_noise");
+  ASSERT_EQ(weights.layer_size(), 2);
+  EXPECT_EQ(weights.layer(0).name(), "w_noise");
+  // The convolution of ones gives weight + bias on every pixel
+  const LayerParameter& w = weights.layer(1);
+  EXPECT_EQ(w.name(), "w_folded");
+  ASSERT_EQ(w.blobs_size(), 1);
+  ASSERT_EQ(w.blobs(0).data_size(), 3 * 7 * 6);
+  Blob<Dtype> kernel, bias;
+  kernel.FromProto(trained.layer(0).blobs(0));
+  bias.FromProto(trained.layer(0).blobs(1));
+  for (int c = 0; c < 3; ++c) {
+    const Dtype expected = kernel.cpu_data()[c] + bias.cpu_data()[c];
+    for (int i = 0; i < 7 * 6; ++i) {
+      EXPECT_NEAR(expected, w.blobs(0).data(c * 7 * 6 + i), 1e-5);
+    }
+  }
+}
+
+TYPED_TEST(NetSurgeryTest, TestFoldConstantLayersUniqueNames) {
+  typedef TypeParam Dtype;
+  // The folded layer is named after its top, and the layer reading it has
+  // the name the Parameter layer would take
+  const string proto =
+      "input: 'data' input_shape { dim: 2 dim: 3 dim: 7 dim: 6 } "
+      "layer { name: 'ones' type: 'DummyData' top: 'ones' "
+      "  dummy_data_param { data_filler { type: 'constant' value: 1 } "
+      "    shape { dim: 1 dim: 1 dim: 7 dim: 6 } } } "
+      "layer { name: 'w' type: 'Convolution' bottom: 'ones' top: 'w' "
+      "  convolution_param { num_output: 3 kernel_size: 1 } } "
+      "layer { name: 'w_folded' type: 'Eltwise' bottom: 'data' bottom: 'w' "
+      "  top: 'prod' eltwise_param { operation: PROD } } ";
+  NetParameter param, weights;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Blob<Dtype> ones(1, 1, 7, 6);
+  vector<Blob<Dtype>*> ones_vec(1, &ones);
+  ConvolutionLayer<Dtype> conv(param.layer(1));
+  Blob<Dtype> top;
+  vector<Blob<Dtype>*> top_vec(1, &top);
+  conv.SetUp(ones_vec, top_vec);
+  conv.ToProto(weights.add_layer());
+  EXPECT_EQ(FoldConstantLayers(&param, &weights), 2);
+  ASSERT_EQ(param.layer_size(), 2);
+  EXPECT_EQ(param.layer(0).name(), "w_folded_1");
+  EXPECT_EQ(param.layer(0).type(), "Parameter");
+  EXPECT_EQ(param.layer(0).top(0), "w");
+  EXPECT_EQ(param.layer(1).name(), "w_folded");
+  ASSERT_EQ(weights.layer_size(), 1);
+  EXPECT_EQ(weights.layer(0).name(), "w_folded_1");
+}
+
+TYPED_TEST(NetSurgeryTest, TestFoldConstantLayersInPlace) {
+  typedef TypeParam Dtype;
+  // The constant DummyData output is rewritten in place before the rest of
+  // the net reads it, so only the Parameter layer may produce it
+  const string proto =
+      "input: 'data' input_shape { dim: 2 dim: 3 dim: 7 dim: 6 } "
+      "layer { name: 'ones' type: 'DummyData' top: 'ones' "
+      "  dummy_data_param { data_filler { type: 'constant' value: 1 } "
+      "    shape { dim: 1 dim: 3 dim: 7 dim: 6 } } } "
+      "layer { name: 'ones/bn' type: 'BN' bottom: 'ones' top: 'ones' "
+      "  bn_param { frozen: true } } "
+      "layer { name: 'prod' type: 'Eltwise' bottom: 'data' bottom: 'ones' "
+      "  top: 'prod' eltwise_param { operation: PROD } } ";
+  NetParameter param, weights;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Blob<Dtype> ones(1, 3, 7, 6);
+  vector<Blob<Dtype>*> ones_vec(1, &ones);
+  BNLayer<Dtype> bn(param.layer(1));
+  Blob<Dtype> top;
+  vector<Blob<Dtype>*> top_vec(1, &top);
+  bn.SetUp(ones_vec, top_vec);
+  bn.ToProto(weights.add_layer());
+  EXPECT_EQ(FoldConstantLayers(&param, &weights), 2);
+  ASSERT_EQ(param.layer_size(), 2);
+  EXPECT_EQ(param.layer(0).name(), "ones_folded");
+  EXPECT_EQ(param.layer(0).type(), "Parameter");
+  EXPECT_EQ(param.layer(0).top(0), "ones");
+  EXPECT_EQ(param.layer(1).name(), "prod");
+  ASSERT_EQ(weights.layer_size(), 1);
+  EXPECT_EQ(weights.layer(0).name(), "ones_folded");
+}
+
+}  // namespace caffe
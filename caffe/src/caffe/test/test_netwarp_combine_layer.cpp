@@ -0,0 +1,78 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/netwarp_combine_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_multi_warp_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NetWarpCombineLayerTest
+    : public MultiWarpTest<TypeParam, NetWarpCombineLayer> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // cur, w_cur, then prev, flow and w_prev
+  NetWarpCombineLayerTest()
+      : MultiWarpTest<TypeParam, NetWarpCombineLayer>(1) {}
+
+  // cur, prev, flow, w_cur, w_prev
+  virtual vector<Blob<Dtype>*> LayerBottoms(
+      const vector<Blob<Dtype>*>& blobs) {
+    vector<Blob<Dtype>*> bottom;
+    bottom.push_back(blobs[0]);
+    bottom.push_back(blobs[2]);
+    bottom.push_back(blobs[3]);
+    bottom.push_back(blobs[1]);
+    bottom.push_back(blobs[4]);
+    return bottom;
+  }
+};
+
+TYPED_TEST_CASE(NetWarpCombineLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetWarpCombineLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  NetWarpCombineLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->LayerBottoms(this->blob_vec_), this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 4);
+  EXPECT_EQ(this->blob_top_->width(), 5);
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestForwardMatchesWarpEltwise) {
+  this->TestForwardMatchesWarpEltwise();
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestForwardResampledFlow) {
+  this->TestForwardResampledFlow();
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestTruncateGradient) {
+  this->TestGradient(WarpParameter_WarpType_TRUNCATE);
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestNearestGradient) {
+  this->TestGradient(WarpParameter_WarpType_NEAREST);
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestThreadsGradient) {
+  this->TestThreadsGradient();
+}
+
+TYPED_TEST(NetWarpCombineLayerTest, TestLeanResampledGradient) {
+  this->TestLeanResampledGradient(this->blob_vec_);
+}
+
+}  // namespace caffe
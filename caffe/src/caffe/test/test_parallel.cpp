@@ -0,0 +1,119 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <set>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Counts the visits of every index and records the threads of the chunks
+struct ParallelVisits {
+  ParallelVisits(vector<int>* visits, vector<boost::thread::id>* ids)
+      : visits(visits), ids(ids) {}
+  void operator()(const int begin, const int end) const {
+    for (int i = begin; i < end; ++i) {
+      ++(*visits)[i];
+      (*ids)[i] = boost::this_thread::get_id();
+    }
+  }
+  vector<int>* visits;
+  vector<boost::thread::id>* ids;
+};
+
+// Runs ParallelVisits over a row of visits for each index
+struct NestedParallelVisits {
+  NestedParallelVisits(const int width, vector<int>* visits,
+      vector<boost::thread::id>* ids)
+      : width(width), visits(visits), ids(ids) {}
+  void operator()(const int begin, const int end) const {
+    for (int i = begin; i < end; ++i) {
+      vector<int> row(width, 0);
+      vector<boost::thread::id> row_ids(width);
+      caffe_cpu_parallel_for(width, 3, ParallelVisits(&row, &row_ids));
+      for (int j = 0; j < width; ++j) {
+        (*visits)[i * width + j] += row[j];
+        (*ids)[i * width + j] = row_ids[j];
+      }
+    }
+  }
+  const int width;
+  vector<int>* visits;
+  vector<boost::thread::id>* ids;
+};
+
+class ParallelTest : public ::testing::Test {
+ protected:
+  ParallelTest() : visits_(10, 0), ids_(10) {}
+
+  // Distinct threads among ids_
+  int Threads() const {
+    return std::set<boost::thread::id>(ids_.begin(), ids_.end()).size();
+  }
+
+  vector<int> visits_;
+  vector<boost::thread::id> ids_;
+};
+
+TEST_F(ParallelTest, TestChunks) {
+  CpuParallelGrain grain(1);
+  caffe_cpu_parallel_for(10, 3, ParallelVisits(&visits_, &ids_));
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(visits_[i], 1);
+  }
+  EXPECT_EQ(Threads(), 3);
+  // The calling thread runs the last chunk
+  EXPECT_EQ(ids_[9], boost::this_thread::get_id());
+}
+
+TEST_F(ParallelTest, TestGrain) {
+  CpuParallelGrain grain(4);
+  EXPECT_EQ(caffe_cpu_parallel_threads(10, 1, 8), 2);
+  EXPECT_EQ(caffe_cpu_parallel_threads(10, 2, 8), 5);
+  EXPECT_EQ(caffe_cpu_parallel_threads(10, 100, 8), 8);
+  EXPECT_EQ(caffe_cpu_parallel_threads(3, 1, 8), 1);
+  // Small ranges run on the calling thread
+  caffe_cpu_parallel_for(3, 1, 8, ParallelVisits(&visits_, &ids_));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(visits_[i], 1);
+    EXPECT_EQ(ids_[i], boost::this_thread::get_id());
+  }
+}
+
+TEST_F(ParallelTest, TestThreadsKept) {
+  CpuParallelGrain grain(1);
+  caffe_cpu_parallel_for(10, 4, ParallelVisits(&visits_, &ids_));
+  const std::set<boost::thread::id> first(ids_.begin(), ids_.end());
+  caffe_cpu_parallel_for(10, 4, ParallelVisits(&visits_, &ids_));
+  const std::set<boost::thread::id> second(ids_.begin(), ids_.end());
+  EXPECT_EQ(first.size(), 4);
+  EXPECT_TRUE(first == second);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(visits_[i], 2);
+  }
+}
+
+TEST_F(ParallelTest, TestNested) {
+  CpuParallelGrain grain(1);
+  vector<int> visits(4 * 5, 0);
+  vector<boost::thread::id> ids(4 * 5);
+  caffe_cpu_parallel_for(4, 2, NestedParallelVisits(5, &visits, &ids));
+  for (int i = 0; i < 4 * 5; ++i) {
+    EXPECT_EQ(visits[i], 1);
+  }
+  // The workers run the rows of their tasks in turn
+  for (int j = 0; j < 5; ++j) {
+    EXPECT_EQ(ids[j], ids[0]);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,117 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/pyramid_pooling_layer.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class PyramidPoolingLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // Levels of 1, 2 and 3 bins, overlapping windows and a clipped last
+  // window
+  PyramidPoolingLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 6, 6)) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    const int kernel_size[5] = {6, 3, 2, 4, 4};
+    const int stride[5] = {6, 3, 2, 2, 4};
+    PyramidPoolingParameter* param =
+      layer_param_.mutable_pyramid_pooling_param();
+    for (int l = 0; l < 5; ++l) {
+      param->add_kernel_size(kernel_size[l]);
+      param->add_stride(stride[l]);
+      blob_top_vec_.push_back(new Blob<Dtype>());
+    }
+  }
+  virtual ~PyramidPoolingLayerTest() {
+    delete blob_bottom_;
+    for (int l = 0; l < blob_top_vec_.size(); ++l) {
+      delete blob_top_vec_[l];
+    }
+  }
+
+  LayerParameter layer_param_;
+  Blob<Dtype>* const blob_bottom_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PyramidPoolingLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(PyramidPoolingLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  PyramidPoolingLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int pooled[5] = {1, 2, 3, 2, 2};
+  for (int l = 0; l < 5; ++l) {
+    EXPECT_EQ(this->blob_top_vec_[l]->num(), 2);
+    EXPECT_EQ(this->blob_top_vec_[l]->channels(), 3);
+    EXPECT_EQ(this->blob_top_vec_[l]->height(), pooled[l]);
+    EXPECT_EQ(this->blob_top_vec_[l]->width(), pooled[l]);
+  }
+}
+
+TYPED_TEST(PyramidPoolingLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  this->layer_param_.mutable_pyramid_pooling_param()->set_num_threads(2);
+  PyramidPoolingLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const PyramidPoolingParameter& param =
+    this->layer_param_.pyramid_pooling_param();
+  for (int l = 0; l < 5; ++l) {
+    const Blob<Dtype>& top = *this->blob_top_vec_[l];
+    const int kernel = param.kernel_size(l);
+    const int stride = param.stride(l);
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int ph = 0; ph < top.height(); ++ph) {
+          for (int pw = 0; pw < top.width(); ++pw) {
+            const int hend = std::min(ph * stride + kernel, 6);
+            const int wend = std::min(pw * stride + kernel, 6);
+            Dtype sum = 0;
+            for (int h = ph * stride; h < hend; ++h) {
+              for (int w = pw * stride; w < wend; ++w) {
+                sum += this->blob_bottom_->data_at(n, c, h, w);
+              }
+            }
+            EXPECT_NEAR(sum / ((hend - ph * stride) * (wend - pw * stride)),
+                top.data_at(n, c, ph, pw), 1e-5);
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(PyramidPoolingLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  // Each thread spreads the gradients of its planes in its own table
+  this->layer_param_.mutable_pyramid_pooling_param()->set_num_threads(3);
+  PyramidPoolingLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
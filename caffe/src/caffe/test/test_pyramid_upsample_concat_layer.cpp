@@ -0,0 +1,107 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/interp_layer.hpp"
+#include "caffe/layers/pyramid_upsample_concat_layer.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class PyramidUpsampleConcatLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // A feature map and three pooled levels, as in the PSP module
+  PyramidUpsampleConcatLayerTest()
+      : blob_top_(new Blob<Dtype>()) {
+    const int shapes[4][3] = {{3, 6, 5}, {2, 1, 1}, {4, 2, 3}, {2, 3, 3}};
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int b = 0; b < 4; ++b) {
+      Blob<Dtype>* blob = new Blob<Dtype>(2, shapes[b][0], shapes[b][1],
+          shapes[b][2]);
+      filler.Fill(blob);
+      blob_bottom_vec_.push_back(blob);
+    }
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~PyramidUpsampleConcatLayerTest() {
+    for (int b = 0; b < blob_bottom_vec_.size(); ++b) {
+      delete blob_bottom_vec_[b];
+    }
+    delete blob_top_;
+  }
+
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PyramidUpsampleConcatLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(PyramidUpsampleConcatLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PyramidUpsampleConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3 + 2 + 4 + 2);
+  EXPECT_EQ(this->blob_top_->height(), 6);
+  EXPECT_EQ(this->blob_top_->width(), 5);
+}
+
+TYPED_TEST(PyramidUpsampleConcatLayerTest, TestForwardMatchesInterpConcat) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_num_threads(2);
+  PyramidUpsampleConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Each slice is the output of an Interp layer to the size of bottom 0
+  layer_param.mutable_interp_param()->set_height(6);
+  layer_param.mutable_interp_param()->set_width(5);
+  int offset = 0;
+  for (int b = 0; b < this->blob_bottom_vec_.size(); ++b) {
+    Blob<Dtype> interp;
+    vector<Blob<Dtype>*> bottom_vec(1, this->blob_bottom_vec_[b]);
+    vector<Blob<Dtype>*> top_vec(1, &interp);
+    InterpLayer<Dtype> interp_layer(layer_param);
+    interp_layer.SetUp(bottom_vec, top_vec);
+    interp_layer.Forward(bottom_vec, top_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < interp.channels(); ++c) {
+        for (int h = 0; h < 6; ++h) {
+          for (int w = 0; w < 5; ++w) {
+            EXPECT_EQ(interp.data_at(n, c, h, w),
+                this->blob_top_->data_at(n, offset + c, h, w));
+          }
+        }
+      }
+    }
+    offset += interp.channels();
+  }
+}
+
+TYPED_TEST(PyramidUpsampleConcatLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PyramidUpsampleConcatLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -3,6 +3,8 @@
 // (See accompanying file LICENSE.txt or copy at
 // https://opensource.org/licenses/BSD-3-Clause)
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -10,11 +12,17 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layers/layout_layer.hpp"
 #include "caffe/layers/warp_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/cpu_features.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/warp.hpp"
 
 namespace caffe {
 
@@ -816,4 +824,651 @@ TYPED_TEST(WarpLayerTest, TestTruncateImgGradient7) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(WarpLayerTest, TestThreadedForwardMatchesSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  Blob<Dtype> image(2, 3, 7, 9);
+  Blob<Dtype> flow(2, 2, 7, 9);
+  FillerParameter filler_param;
+  filler_param.set_std(2);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&image);
+  filler.Fill(&flow);
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&image);
+  bottom_vec.push_back(&flow);
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    WarpParameter* warp_param = layer_param.mutable_warp_param();
+    warp_param->set_outliers(outliers[i]);
+    warp_param->set_num_threads(1);
+    Blob<Dtype> serial_top;
+    vector<Blob<Dtype>*> serial_top_vec(1, &serial_top);
+    WarpLayer<Dtype> serial_layer(layer_param);
+    serial_layer.SetUp(bottom_vec, serial_top_vec);
+    serial_layer.Forward(bottom_vec, serial_top_vec);
+
+    warp_param->set_num_threads(4);
+    WarpLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_->cpu_data();
+    const Dtype* serial_data = serial_top.cpu_data();
+    for (int j = 0; j < serial_top.count(); ++j) {
+      EXPECT_EQ(serial_data[j], data[j]);
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestSimdBlendMatchesScalar) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 7 x 9 pixels leaves a scalar tail after every vector width
+  const int height = 7;
+  const int width = 9;
+  const int count = height * width;
+  Blob<Dtype> image(1, 1, height, width);
+  Blob<Dtype> flow(1, 2, height, width);
+  FillerParameter filler_param;
+  filler_param.set_std(3);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&image);
+  filler.Fill(&flow);
+  Blob<int> offset(1, kWarpTaps, height, width);
+  Blob<Dtype> weight(1, kWarpTaps, height, width);
+  Blob<Dtype> theta(1, 2, height, width);
+  Blob<Dtype> scalar_top(1, 1, height, width);
+  // The kernels may round differently where the compiler fuses multiplies
+  // and adds: a few ulps of the largest pixel
+  Dtype image_max = 0;
+  for (int j = 0; j < count; ++j) {
+    image_max = std::max(image_max, std::abs(image.cpu_data()[j]));
+  }
+  const Dtype tolerance = 8 * std::numeric_limits<Dtype>::epsilon() *
+      image_max;
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  for (int i = 0; i < 2; ++i) {
+    caffe_cpu_warp_plan(outliers[i], height, width, flow.cpu_data(), height,
+        width, Dtype(1), 0, height, offset.mutable_cpu_data(),
+        weight.mutable_cpu_data(), theta.mutable_cpu_data());
+    caffe_cpu_warp_blend(CPU_SIMD_SCALAR, count, image.cpu_data(),
+        offset.cpu_data(), weight.cpu_data(), scalar_top.mutable_cpu_data());
+    for (int level = CPU_SIMD_SCALAR + 1; level <= caffe_cpu_simd_level();
+         ++level) {
+      Blob<Dtype> top(1, 1, height, width);
+      caffe_cpu_warp_blend(static_cast<CpuSimdLevel>(level), count,
+          image.cpu_data(), offset.cpu_data(), weight.cpu_data(),
+          top.mutable_cpu_data());
+      for (int j = 0; j < count; ++j) {
+        EXPECT_NEAR(scalar_top.cpu_data()[j], top.cpu_data()[j], tolerance)
+            << "level " << level << " pixel " << j;
+      }
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestNHWCMatchesNCHW) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> image(2, 3, 7, 9);
+  Blob<Dtype> flow(2, 2, 7, 9);
+  Blob<Dtype> top_diff(2, 3, 7, 9);
+  FillerParameter filler_param;
+  filler_param.set_std(2);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&image);
+  filler.Fill(&flow);
+  filler.Fill(&top_diff);
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&image);
+  bottom_vec.push_back(&flow);
+  // Channels-last copy of the image, the flow is shared
+  Blob<Dtype> image_nhwc;
+  vector<Blob<Dtype>*> image_vec(1, &image);
+  vector<Blob<Dtype>*> image_nhwc_vec(1, &image_nhwc);
+  LayerParameter layout_param;
+  LayoutLayer<Dtype> to_nhwc(layout_param);
+  to_nhwc.SetUp(image_vec, image_nhwc_vec);
+  to_nhwc.Forward(image_vec, image_nhwc_vec);
+  vector<Blob<Dtype>*> bottom_nhwc_vec;
+  bottom_nhwc_vec.push_back(&image_nhwc);
+  bottom_nhwc_vec.push_back(&flow);
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    WarpParameter* warp_param = layer_param.mutable_warp_param();
+    warp_param->set_outliers(outliers[i]);
+    WarpLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(2, true), bottom_vec);
+    Blob<Dtype> flow_diff(2, 2, 7, 9);
+    caffe_copy(flow.count(), flow.cpu_diff(), flow_diff.mutable_cpu_data());
+
+    warp_param->set_layout(NHWC);
+    Blob<Dtype> top_nhwc;
+    vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+    WarpLayer<Dtype> nhwc_layer(layer_param);
+    nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+    nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < 7; ++h) {
+          for (int w = 0; w < 9; ++w) {
+            top_nhwc.mutable_cpu_diff()[top_nhwc.offset(n, h, w, c)] =
+                top_diff.data_at(n, c, h, w);
+          }
+        }
+      }
+    }
+    nhwc_layer.Backward(top_nhwc_vec, vector<bool>(2, true),
+        bottom_nhwc_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < 7; ++h) {
+          for (int w = 0; w < 9; ++w) {
+            EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+                top_nhwc.data_at(n, h, w, c), 1e-5);
+            EXPECT_NEAR(image.diff_at(n, c, h, w),
+                image_nhwc.diff_at(n, h, w, c), 1e-5);
+          }
+        }
+      }
+    }
+    for (int j = 0; j < flow.count(); ++j) {
+      EXPECT_NEAR(flow_diff.cpu_data()[j], flow.cpu_diff()[j], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestThreadedBackwardMatchesSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  CpuParallelGrain grain(1);
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  const Layout layouts[] = { NCHW, NHWC };
+  FillerParameter filler_param;
+  filler_param.set_std(2);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int l = 0; l < 2; ++l) {
+    // 2 x 5 channels do not split evenly across 4 threads
+    Blob<Dtype> image(2, 5, 7, 9);
+    if (layouts[l] == NHWC) {
+      image.Reshape(2, 7, 9, 5);
+    }
+    Blob<Dtype> flow(2, 2, 7, 9);
+    Blob<Dtype> top_diff(image.shape());
+    filler.Fill(&image);
+    filler.Fill(&flow);
+    filler.Fill(&top_diff);
+    vector<Blob<Dtype>*> bottom_vec;
+    bottom_vec.push_back(&image);
+    bottom_vec.push_back(&flow);
+    for (int i = 0; i < 2; ++i) {
+      LayerParameter layer_param;
+      WarpParameter* warp_param = layer_param.mutable_warp_param();
+      warp_param->set_outliers(outliers[i]);
+      warp_param->set_layout(layouts[l]);
+      warp_param->set_num_threads(1);
+      WarpLayer<Dtype> serial_layer(layer_param);
+      serial_layer.SetUp(bottom_vec, this->blob_top_vec_);
+      serial_layer.Forward(bottom_vec, this->blob_top_vec_);
+      caffe_copy(top_diff.count(), top_diff.cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      serial_layer.Backward(this->blob_top_vec_, vector<bool>(2, true),
+          bottom_vec);
+      Blob<Dtype> image_diff(image.shape());
+      Blob<Dtype> flow_diff(flow.shape());
+      caffe_copy(image.count(), image.cpu_diff(),
+          image_diff.mutable_cpu_data());
+      caffe_copy(flow.count(), flow.cpu_diff(), flow_diff.mutable_cpu_data());
+
+      warp_param->set_num_threads(4);
+      WarpLayer<Dtype> layer(layer_param);
+      layer.SetUp(bottom_vec, this->blob_top_vec_);
+      layer.Forward(bottom_vec, this->blob_top_vec_);
+      caffe_copy(top_diff.count(), top_diff.cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      layer.Backward(this->blob_top_vec_, vector<bool>(2, true), bottom_vec);
+      // Each image gradient has a single writer
+      for (int j = 0; j < image.count(); ++j) {
+        EXPECT_EQ(image_diff.cpu_data()[j], image.cpu_diff()[j]);
+      }
+      // The flow gradient is summed in a different order
+      for (int j = 0; j < flow.count(); ++j) {
+        EXPECT_NEAR(flow_diff.cpu_data()[j], flow.cpu_diff()[j], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestBackwardPropagateDown) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> image(2, 3, 7, 9);
+  Blob<Dtype> flow(2, 2, 7, 9);
+  FillerParameter filler_param;
+  filler_param.set_std(2);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&image);
+  filler.Fill(&flow);
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&image);
+  bottom_vec.push_back(&flow);
+  LayerParameter layer_param;
+  WarpLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(2, true), bottom_vec);
+  Blob<Dtype> image_diff(image.shape());
+  Blob<Dtype> flow_diff(flow.shape());
+  caffe_copy(image.count(), image.cpu_diff(), image_diff.mutable_cpu_data());
+  caffe_copy(flow.count(), flow.cpu_diff(), flow_diff.mutable_cpu_data());
+  // A disabled gradient is left untouched, the other one is unchanged
+  for (int p = 0; p < 2; ++p) {
+    caffe_set(image.count(), Dtype(7), image.mutable_cpu_diff());
+    caffe_set(flow.count(), Dtype(7), flow.mutable_cpu_diff());
+    vector<bool> propagate_down(2, false);
+    propagate_down[p] = true;
+    layer.Backward(this->blob_top_vec_, propagate_down, bottom_vec);
+    for (int j = 0; j < image.count(); ++j) {
+      EXPECT_EQ(p == 0 ? image_diff.cpu_data()[j] : Dtype(7),
+                image.cpu_diff()[j]);
+    }
+    for (int j = 0; j < flow.count(); ++j) {
+      EXPECT_EQ(p == 1 ? flow_diff.cpu_data()[j] : Dtype(7),
+                flow.cpu_diff()[j]);
+    }
+  }
+}
+
+
+TYPED_TEST(WarpLayerTest, TestLeanInferenceMatchesTrain) {
+  typedef typename TypeParam::Dtype Dtype;
+  const WarpParameter_WarpType outliers[] = {
+      WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST};
+  const Layout layouts[] = {NCHW, NHWC};
+  for (int i = 0; i < 2; ++i) {
+    for (int l = 0; l < 2; ++l) {
+      Blob<Dtype> image(2, 3, 7, 9);
+      if (layouts[l] == NHWC) {
+        image.Reshape(2, 7, 9, 3);
+      }
+      Blob<Dtype> flow(2, 2, 7, 9);
+      FillerParameter filler_param;
+      filler_param.set_std(2);
+      GaussianFiller<Dtype> filler(filler_param);
+      filler.Fill(&image);
+      filler.Fill(&flow);
+      vector<Blob<Dtype>*> bottom_vec;
+      bottom_vec.push_back(&image);
+      bottom_vec.push_back(&flow);
+      LayerParameter layer_param;
+      layer_param.mutable_warp_param()->set_outliers(outliers[i]);
+      layer_param.mutable_warp_param()->set_layout(layouts[l]);
+      Blob<Dtype> train_top, test_top;
+      vector<Blob<Dtype>*> train_top_vec(1, &train_top);
+      vector<Blob<Dtype>*> test_top_vec(1, &test_top);
+      layer_param.set_phase(TRAIN);
+      WarpLayer<Dtype> train_layer(layer_param);
+      train_layer.SetUp(bottom_vec, train_top_vec);
+      train_layer.Forward(bottom_vec, train_top_vec);
+      layer_param.set_phase(TEST);
+      WarpLayer<Dtype> test_layer(layer_param);
+      test_layer.SetUp(bottom_vec, test_top_vec);
+      test_layer.Forward(bottom_vec, test_top_vec);
+      for (int j = 0; j < train_top.count(); ++j) {
+        EXPECT_NEAR(train_top.cpu_data()[j], test_top.cpu_data()[j], 1e-5);
+      }
+      // Backward still works after a lean forward
+      filler.Fill(&train_top);
+      caffe_copy(train_top.count(), train_top.cpu_data(),
+          train_top.mutable_cpu_diff());
+      caffe_copy(train_top.count(), train_top.cpu_data(),
+          test_top.mutable_cpu_diff());
+      train_layer.Backward(train_top_vec, vector<bool>(2, true), bottom_vec);
+      Blob<Dtype> image_diff(image.shape());
+      Blob<Dtype> flow_diff(flow.shape());
+      caffe_copy(image.count(), image.cpu_diff(),
+          image_diff.mutable_cpu_data());
+      caffe_copy(flow.count(), flow.cpu_diff(), flow_diff.mutable_cpu_data());
+      test_layer.Backward(test_top_vec, vector<bool>(2, true), bottom_vec);
+      for (int j = 0; j < image.count(); ++j) {
+        EXPECT_NEAR(image_diff.cpu_data()[j], image.cpu_diff()[j], 1e-5);
+      }
+      for (int j = 0; j < flow.count(); ++j) {
+        EXPECT_NEAR(flow_diff.cpu_data()[j], flow.cpu_diff()[j], 1e-4);
+      }
+    }
+  }
+}
+
+
+TYPED_TEST(WarpLayerTest, TestResampledFlowMatchesInterp) {
+  typedef typename TypeParam::Dtype Dtype;
+  const WarpParameter_WarpType outliers[] = {
+      WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST};
+  const Dtype flow_scale = 2.5;
+  for (int i = 0; i < 2; ++i) {
+    Blob<Dtype> image(2, 3, 9, 11);
+    Blob<Dtype> flow(2, 2, 4, 5);
+    FillerParameter filler_param;
+    filler_param.set_std(1);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&image);
+    filler.Fill(&flow);
+    // Reference: the flow upsampled by Interp and scaled beforehand
+    Blob<Dtype> flow_up(2, 2, 9, 11);
+    for (int n = 0; n < 2; ++n) {
+      caffe_cpu_interp2<Dtype,false>(2, flow.cpu_data() + flow.offset(n),
+          0, 0, 4, 5, 4, 5, flow_up.mutable_cpu_data() + flow_up.offset(n),
+          0, 0, 9, 11, 9, 11);
+    }
+    caffe_scal(flow_up.count(), flow_scale, flow_up.mutable_cpu_data());
+    LayerParameter layer_param;
+    layer_param.mutable_warp_param()->set_outliers(outliers[i]);
+    vector<Blob<Dtype>*> ref_bottom_vec;
+    ref_bottom_vec.push_back(&image);
+    ref_bottom_vec.push_back(&flow_up);
+    Blob<Dtype> ref_top;
+    vector<Blob<Dtype>*> ref_top_vec(1, &ref_top);
+    WarpLayer<Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(ref_bottom_vec, ref_top_vec);
+    ref_layer.Forward(ref_bottom_vec, ref_top_vec);
+    filler.Fill(&ref_top);
+    caffe_copy(ref_top.count(), ref_top.cpu_data(), ref_top.mutable_cpu_diff());
+    ref_layer.Forward(ref_bottom_vec, ref_top_vec);
+    ref_layer.Backward(ref_top_vec, vector<bool>(2, true), ref_bottom_vec);
+    Blob<Dtype> image_diff(image.shape());
+    caffe_copy(image.count(), image.cpu_diff(), image_diff.mutable_cpu_data());
+    Blob<Dtype> flow_diff(flow.shape());
+    for (int n = 0; n < 2; ++n) {
+      caffe_cpu_interp2_backward<Dtype,false>(2,
+          flow_diff.mutable_cpu_data() + flow_diff.offset(n), 0, 0, 4, 5, 4, 5,
+          flow_up.cpu_diff() + flow_up.offset(n), 0, 0, 9, 11, 9, 11);
+    }
+    caffe_scal(flow_diff.count(), flow_scale, flow_diff.mutable_cpu_data());
+    // The layer resamples and scales the flow itself
+    layer_param.mutable_warp_param()->set_flow_scale(flow_scale);
+    vector<Blob<Dtype>*> bottom_vec;
+    bottom_vec.push_back(&image);
+    bottom_vec.push_back(&flow);
+    WarpLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    for (int j = 0; j < ref_top.count(); ++j) {
+      EXPECT_NEAR(ref_top.cpu_data()[j], this->blob_top_->cpu_data()[j], 1e-4);
+    }
+    caffe_copy(ref_top.count(), ref_top.cpu_diff(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(2, true), bottom_vec);
+    for (int j = 0; j < image.count(); ++j) {
+      EXPECT_NEAR(image_diff.cpu_data()[j], image.cpu_diff()[j], 1e-4);
+    }
+    for (int j = 0; j < flow.count(); ++j) {
+      EXPECT_NEAR(flow_diff.cpu_data()[j], flow.cpu_diff()[j], 1e-3);
+    }
+  }
+}
+
+
+TYPED_TEST(WarpLayerTest, TestHalfConversionMatchesSoftware) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int count = 1000;
+  Blob<Dtype> data(1, 1, 1, count);
+  FillerParameter filler_param;
+  filler_param.set_std(100);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&data);
+  Dtype* x = data.mutable_cpu_data();
+  // Ties, half subnormals, overflow and infinities
+  x[0] = 1 + Dtype(1) / 2048;
+  x[1] = 1 + Dtype(3) / 2048;
+  x[2] = Dtype(3e-6);
+  x[3] = Dtype(-5e-8);
+  x[4] = 70000;
+  x[5] = -std::numeric_limits<float>::infinity();
+  x[6] = 65519;
+  x[7] = 0;
+  const StoragePrecision storage[] = {FP16, BF16};
+  for (int p = 0; p < 2; ++p) {
+    vector<uint16_t> half(count);
+    vector<Dtype> back(count);
+    caffe_cpu_to_half(storage[p], count, data.cpu_data(), &half[0]);
+    caffe_cpu_from_half(storage[p], count, &half[0], &back[0]);
+    for (int i = 0; i < count; ++i) {
+      const float f = static_cast<float>(data.cpu_data()[i]);
+      const uint16_t h = (storage[p] == FP16) ? caffe_float_to_fp16(f) :
+                                                caffe_float_to_bf16(f);
+      EXPECT_EQ(h, half[i]) << "precision " << storage[p] << " value " << f;
+      const float g = (storage[p] == FP16) ? caffe_fp16_to_float(h) :
+                                             caffe_bf16_to_float(h);
+      EXPECT_EQ(Dtype(g), back[i]);
+    }
+  }
+  EXPECT_EQ(0x3c00, caffe_float_to_fp16(1 + 1.f / 2048));
+  EXPECT_EQ(0x3c02, caffe_float_to_fp16(1 + 3.f / 2048));
+  EXPECT_EQ(0x7bff, caffe_float_to_fp16(65519));
+  EXPECT_EQ(0x7c00, caffe_float_to_fp16(65520));
+  EXPECT_EQ(0x0001, caffe_float_to_fp16(6e-8f));
+  EXPECT_FLOAT_EQ(6.103515625e-05f, caffe_fp16_to_float(0x0400));
+  EXPECT_FLOAT_EQ(5.9604645e-08f, caffe_fp16_to_float(0x0001));
+}
+
+TYPED_TEST(WarpLayerTest, TestHalfStorageMatchesFloat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const StoragePrecision storage[] = {FP16, BF16};
+  // Relative precision of the stored image
+  const Dtype eps[] = {Dtype(1) / 2048, Dtype(1) / 256};
+  const Layout layouts[] = {NCHW, NHWC};
+  const Phase phases[] = {TRAIN, TEST};
+  for (int l = 0; l < 2; ++l) {
+    // 11 channels cover the vector and the scalar part of packed kernels
+    Blob<Dtype> image(2, 11, 7, 9);
+    if (layouts[l] == NHWC) {
+      image.Reshape(2, 7, 9, 11);
+    }
+    Blob<Dtype> flow(2, 2, 7, 9);
+    FillerParameter filler_param;
+    filler_param.set_std(2);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&image);
+    filler.Fill(&flow);
+    Dtype image_max = 0;
+    for (int j = 0; j < image.count(); ++j) {
+      image_max = std::max(image_max, std::abs(image.cpu_data()[j]));
+    }
+    vector<Blob<Dtype>*> bottom_vec;
+    bottom_vec.push_back(&image);
+    bottom_vec.push_back(&flow);
+    for (int ph = 0; ph < 2; ++ph) {
+      LayerParameter layer_param;
+      layer_param.set_phase(phases[ph]);
+      layer_param.mutable_warp_param()->set_layout(layouts[l]);
+      layer_param.mutable_warp_param()->set_outliers(
+          WarpParameter_WarpType_TRUNCATE);
+      WarpLayer<Dtype> layer(layer_param);
+      layer.SetUp(bottom_vec, this->blob_top_vec_);
+      layer.Forward(bottom_vec, this->blob_top_vec_);
+      for (int p = 0; p < 2; ++p) {
+        layer_param.mutable_warp_param()->set_storage(storage[p]);
+        Blob<Dtype> top;
+        vector<Blob<Dtype>*> top_vec(1, &top);
+        WarpLayer<Dtype> half_layer(layer_param);
+        half_layer.SetUp(bottom_vec, top_vec);
+        half_layer.Forward(bottom_vec, top_vec);
+        for (int j = 0; j < top.count(); ++j) {
+          EXPECT_NEAR(this->blob_top_->cpu_data()[j], top.cpu_data()[j],
+              eps[p] * image_max);
+        }
+      }
+    }
+  }
+}
+
+
+TYPED_TEST(WarpLayerTest, TestFixedPlanSumsToOne) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int height = 7;
+  const int width = 9;
+  const int count = height * width;
+  Blob<Dtype> flow(1, 2, height, width);
+  FillerParameter filler_param;
+  filler_param.set_std(4);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&flow);
+  Blob<int> offset(1, kWarpTaps, height, width);
+  Blob<Dtype> weight(1, kWarpTaps, height, width);
+  Blob<Dtype> theta(1, 2, height, width);
+  Blob<int> qweight(1, kWarpTaps, height, width);
+  // A constant image is reproduced exactly
+  const vector<uint8_t> image(count, 200);
+  Blob<Dtype> top(1, 1, height, width);
+  const int one = 1 << kWarpFixedBits;
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  for (int i = 0; i < 2; ++i) {
+    caffe_cpu_warp_plan(outliers[i], height, width, flow.cpu_data(), height,
+        width, Dtype(1), 0, height, offset.mutable_cpu_data(),
+        weight.mutable_cpu_data(), theta.mutable_cpu_data());
+    caffe_cpu_warp_plan_fixed(count, offset.cpu_data(), weight.cpu_data(),
+        qweight.mutable_cpu_data());
+    caffe_cpu_warp_blend_u8(count, &image[0], offset.cpu_data(),
+        qweight.cpu_data(), Dtype(0.5), 10, top.mutable_cpu_data());
+    for (int j = 0; j < count; ++j) {
+      const bool outlier = offset.cpu_data()[j] < 0;
+      int sum = 0;
+      for (int k = 0; k < kWarpTaps; ++k) {
+        const int q = qweight.cpu_data()[k * count + j];
+        EXPECT_GE(q, 0);
+        EXPECT_LE(q, one);
+        sum += q;
+      }
+      EXPECT_EQ(outlier ? 0 : one, sum) << "pixel " << j;
+      EXPECT_EQ(outlier ? Dtype(0) : Dtype(95), top.cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestUint8StorageMatchesFloat) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 37 channels cover the vector and the scalar part of the packed kernel
+  const int num = 2;
+  const int channels = 37;
+  const int height = 7;
+  const int width = 9;
+  Blob<Dtype> image(num, channels, height, width);
+  Blob<Dtype> flow(num, 2, height, width);
+  FillerParameter filler_param;
+  filler_param.set_std(2);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&image);
+  filler.Fill(&flow);
+  Blob<Dtype> image_nhwc(num, height, width, channels);
+  vector<Dtype> image_min(channels, 0);
+  vector<Dtype> image_max(channels, 0);
+  for (int n = 0; n < num; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height; ++h) {
+        for (int w = 0; w < width; ++w) {
+          // An offset per channel gives different zero points
+          const Dtype x = image.data_at(n, c, h, w) + Dtype(c % 5);
+          image.mutable_cpu_data()[image.offset(n, c, h, w)] = x;
+          image_nhwc.mutable_cpu_data()[image_nhwc.offset(n, h, w, c)] = x;
+          image_min[c] = std::min(image_min[c], x);
+          image_max[c] = std::max(image_max[c], x);
+        }
+      }
+    }
+  }
+  // Calibrate every channel on its range
+  LayerParameter layer_param;
+  vector<Dtype> scale(channels);
+  for (int c = 0; c < channels; ++c) {
+    scale[c] = (image_max[c] - image_min[c]) / 255;
+    layer_param.mutable_warp_param()->add_quant_scale(scale[c]);
+    layer_param.mutable_warp_param()->add_quant_zero_point(
+        static_cast<int>(-image_min[c] / scale[c] + Dtype(0.5)));
+  }
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&image);
+  bottom_vec.push_back(&flow);
+  vector<Blob<Dtype>*> bottom_nhwc_vec;
+  bottom_nhwc_vec.push_back(&image_nhwc);
+  bottom_nhwc_vec.push_back(&flow);
+  const WarpParameter_WarpType outliers[] = {
+    WarpParameter_WarpType_TRUNCATE, WarpParameter_WarpType_NEAREST };
+  const Phase phases[] = {TRAIN, TEST};
+  for (int o = 0; o < 2; ++o) {
+    for (int ph = 0; ph < 2; ++ph) {
+      layer_param.set_phase(phases[ph]);
+      layer_param.mutable_warp_param()->set_outliers(outliers[o]);
+      layer_param.mutable_warp_param()->set_layout(NCHW);
+      layer_param.mutable_warp_param()->set_storage(FP32);
+      WarpLayer<Dtype> layer(layer_param);
+      layer.SetUp(bottom_vec, this->blob_top_vec_);
+      layer.Forward(bottom_vec, this->blob_top_vec_);
+      layer_param.mutable_warp_param()->set_storage(UINT8);
+      Blob<Dtype> top;
+      vector<Blob<Dtype>*> top_vec(1, &top);
+      WarpLayer<Dtype> u8_layer(layer_param);
+      u8_layer.SetUp(bottom_vec, top_vec);
+      u8_layer.Forward(bottom_vec, top_vec);
+      layer_param.mutable_warp_param()->set_layout(NHWC);
+      Blob<Dtype> top_nhwc;
+      vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+      WarpLayer<Dtype> u8_nhwc_layer(layer_param);
+      u8_nhwc_layer.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+      u8_nhwc_layer.Forward(bottom_nhwc_vec, top_nhwc_vec);
+      for (int n = 0; n < num; ++n) {
+        for (int c = 0; c < channels; ++c) {
+          for (int h = 0; h < height; ++h) {
+            for (int w = 0; w < width; ++w) {
+              // Half a step of rounding plus the fixed-point weights
+              EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+                  top.data_at(n, c, h, w), Dtype(0.6) * scale[c]);
+              EXPECT_NEAR(top.data_at(n, c, h, w),
+                  top_nhwc.data_at(n, h, w, c), 1e-5);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(WarpLayerTest, TestUint8StorageSaturates) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype inf = std::numeric_limits<Dtype>::infinity();
+  const Dtype values[] = { std::numeric_limits<Dtype>::quiet_NaN(), inf,
+    -inf, Dtype(1e30), Dtype(-1e30), Dtype(3) };
+  // With zero flow every pixel is read back at its own position
+  Blob<Dtype> image(1, 1, 1, 6);
+  Blob<Dtype> flow(1, 2, 1, 6);
+  for (int i = 0; i < 6; ++i) {
+    image.mutable_cpu_data()[i] = values[i];
+  }
+  caffe_set(flow.count(), Dtype(0), flow.mutable_cpu_data());
+  LayerParameter layer_param;
+  layer_param.mutable_warp_param()->set_storage(UINT8);
+  layer_param.mutable_warp_param()->add_quant_scale(0.5);
+  layer_param.mutable_warp_param()->add_quant_zero_point(10);
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&image);
+  bottom_vec.push_back(&flow);
+  WarpLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  const Dtype expected[] = { 0, 122.5, -5, 122.5, -5, 3 };
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_NEAR(expected[i], this->blob_top_->cpu_data()[i], 1e-5);
+  }
+}
+
 }  // namespace caffe
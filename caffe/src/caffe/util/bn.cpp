@@ -0,0 +1,530 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/bn.hpp"
+#include "caffe/util/cpu_features.hpp"
+#include "caffe/util/parallel.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_BN_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+template <typename Dtype>
+void caffe_cpu_bn_affine_params(const int channels, const Dtype *slope,
+    const Dtype *bias, const Dtype *mean, const Dtype *variance,
+    const Dtype eps, Dtype *scale, Dtype *shift) {
+  for (int c = 0; c < channels; ++c) {
+    scale[c] = slope[c] / std::sqrt(variance[c] + eps);
+    shift[c] = bias[c] - mean[c] * scale[c];
+  }
+}
+
+// y = a * x + b over a plane, and y = a[i] * x + b[i] over a channels-last
+// row, followed by max(y, 0) when relu is set. The vector kernels return the
+// index of the first element left for the scalar tail.
+template <typename Dtype>
+static int bn_affine_plane_vec(const int count, const Dtype a, const Dtype b,
+    const bool relu, const Dtype *x, Dtype *y) {
+  return 0;
+}
+
+template <typename Dtype>
+static int bn_affine_row_vec(const int count, const Dtype *a, const Dtype *b,
+    const bool relu, const Dtype *x, Dtype *y) {
+  return 0;
+}
+
+#ifdef CAFFE_BN_X86
+__attribute__((target("avx")))
+static int bn_affine_plane_vec(const int count, const float a, const float b,
+    const bool relu, const float *x, float *y) {
+  const __m256 va = _mm256_set1_ps(a);
+  const __m256 vb = _mm256_set1_ps(b);
+  const __m256 zero = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(x + i)), vb);
+    if (relu) { v = _mm256_max_ps(v, zero); }
+    _mm256_storeu_ps(y + i, v);
+  }
+  return i;
+}
+
+__attribute__((target("avx")))
+static int bn_affine_plane_vec(const int count, const double a, const double b,
+    const bool relu, const double *x, double *y) {
+  const __m256d va = _mm256_set1_pd(a);
+  const __m256d vb = _mm256_set1_pd(b);
+  const __m256d zero = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d v = _mm256_add_pd(_mm256_mul_pd(va, _mm256_loadu_pd(x + i)), vb);
+    if (relu) { v = _mm256_max_pd(v, zero); }
+    _mm256_storeu_pd(y + i, v);
+  }
+  return i;
+}
+
+__attribute__((target("avx")))
+static int bn_affine_row_vec(const int count, const float *a, const float *b,
+    const bool relu, const float *x, float *y) {
+  const __m256 zero = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(x + i)),
+        _mm256_loadu_ps(b + i));
+    if (relu) { v = _mm256_max_ps(v, zero); }
+    _mm256_storeu_ps(y + i, v);
+  }
+  return i;
+}
+
+__attribute__((target("avx")))
+static int bn_affine_row_vec(const int count, const double *a, const double *b,
+    const bool relu, const double *x, double *y) {
+  const __m256d zero = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d v = _mm256_add_pd(
+        _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(x + i)),
+        _mm256_loadu_pd(b + i));
+    if (relu) { v = _mm256_max_pd(v, zero); }
+    _mm256_storeu_pd(y + i, v);
+  }
+  return i;
+}
+#endif
+
+// Planes (or channels-last rows) [begin, end) of caffe_cpu_bn_affine and
+// caffe_cpu_bn_normalize. With x_norm set, the plane is first normalized to
+// x_norm with norm_scale and norm_shift, then transformed from there while
+// it is still in cache.
+template <typename Dtype>
+struct BNAffineRows {
+  int channels, spatial;
+  const Dtype *norm_scale, *norm_shift, *scale, *shift, *x;
+  Dtype *x_norm, *y;
+  bool relu, vec;
+
+  void apply(const int task, const Dtype *a, const Dtype *b, const bool rect,
+      const Dtype *xi, Dtype *yi) const {
+    if (spatial == 1) {
+      int i = vec ? bn_affine_row_vec(channels, a, b, rect, xi, yi) : 0;
+      for (; i < channels; ++i) {
+        const Dtype v = a[i] * xi[i] + b[i];
+        yi[i] = rect ? std::max(v, Dtype(0)) : v;
+      }
+    } else {
+      const Dtype ac = a[task % channels];
+      const Dtype bc = b[task % channels];
+      int i = vec ? bn_affine_plane_vec(spatial, ac, bc, rect, xi, yi) : 0;
+      for (; i < spatial; ++i) {
+        const Dtype v = ac * xi[i] + bc;
+        yi[i] = rect ? std::max(v, Dtype(0)) : v;
+      }
+    }
+  }
+
+  void operator()(const int begin, const int end) const {
+    const int dim = (spatial == 1) ? channels : spatial;
+    for (int task = begin; task < end; ++task) {
+      const Dtype *xi = x + task * dim;
+      if (x_norm) {
+        apply(task, norm_scale, norm_shift, false, xi, x_norm + task * dim);
+        xi = x_norm + task * dim;
+      }
+      apply(task, scale, shift, relu, xi, y + task * dim);
+    }
+  }
+};
+
+template <typename Dtype>
+static void bn_affine_rows(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *norm_scale,
+    const Dtype *norm_shift, const Dtype *scale, const Dtype *shift,
+    const bool relu, const Dtype *x, Dtype *x_norm, Dtype *y) {
+  BNAffineRows<Dtype> rows;
+  rows.channels = channels;
+  rows.spatial = spatial;
+  rows.norm_scale = norm_scale;
+  rows.norm_shift = norm_shift;
+  rows.scale = scale;
+  rows.shift = shift;
+  rows.x = x;
+  rows.x_norm = x_norm;
+  rows.y = y;
+  rows.relu = relu;
+#ifdef CAFFE_BN_X86
+  rows.vec = (caffe_cpu_simd_level() >= CPU_SIMD_AVX);
+#else
+  rows.vec = false;
+#endif
+  caffe_cpu_parallel_for((spatial == 1) ? num : num * channels,
+      (spatial == 1) ? channels : spatial, num_threads, rows);
+}
+
+template <typename Dtype>
+void caffe_cpu_bn_affine(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *scale,
+    const Dtype *shift, const bool relu, const Dtype *x, Dtype *y) {
+  bn_affine_rows<Dtype>(num_threads, num, channels, spatial, NULL, NULL,
+      scale, shift, relu, x, NULL, y);
+}
+
+template <typename Dtype>
+void caffe_cpu_bn_normalize(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *norm_scale,
+    const Dtype *norm_shift, const Dtype *slope, const Dtype *bias,
+    const bool relu, const Dtype *x, Dtype *x_norm, Dtype *y) {
+  bn_affine_rows<Dtype>(num_threads, num, channels, spatial, norm_scale,
+      norm_shift, slope, bias, relu, x, x_norm, y);
+}
+
+// Planes (or channels-last rows) [begin, end) of caffe_cpu_bn_affine_backward
+template <typename Dtype>
+struct BNAffineBackwardRows {
+  int channels, spatial;
+  const Dtype *scale, *y, *dy;
+  Dtype *dx;
+  bool relu;
+
+  void operator()(const int begin, const int end) const {
+    const int dim = (spatial == 1) ? channels : spatial;
+    for (int task = begin; task < end; ++task) {
+      const Dtype *yi = y + task * dim;
+      const Dtype *dyi = dy + task * dim;
+      Dtype *dxi = dx + task * dim;
+      for (int i = 0; i < dim; ++i) {
+        const Dtype a = (spatial == 1) ? scale[i] : scale[task % channels];
+        dxi[i] = (relu && yi[i] <= 0) ? Dtype(0) : a * dyi[i];
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void caffe_cpu_bn_affine_backward(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *scale,
+    const bool relu, const Dtype *y, const Dtype *dy, Dtype *dx) {
+  BNAffineBackwardRows<Dtype> rows;
+  rows.channels = channels;
+  rows.spatial = spatial;
+  rows.scale = scale;
+  rows.y = y;
+  rows.dy = dy;
+  rows.dx = dx;
+  rows.relu = relu;
+  caffe_cpu_parallel_for((spatial == 1) ? num : num * channels,
+      (spatial == 1) ? channels : spatial, num_threads, rows);
+}
+
+// Elements per block of the statistics: each block gets its mean and sum of
+// squared deviations in two passes over cache-resident data, and the blocks
+// are merged in double precision, so one pass over memory stays stable.
+static const int kBNBlock = 1024;
+
+// Count, mean and sum of squared deviations of one channel
+struct BNMoments {
+  double count, mean, m2;
+
+  BNMoments() : count(0), mean(0), m2(0) {}
+
+  // Pairwise update of Chan, Golub and LeVeque
+  void merge(const double n, const double block_mean, const double block_m2) {
+    if (n == 0) { return; }
+    const double total = count + n;
+    const double delta = block_mean - mean;
+    mean += delta * n / total;
+    m2 += block_m2 + delta * delta * count * n / total;
+    count = total;
+  }
+};
+
+// Chunks [begin, end) of caffe_cpu_bn_statistics and caffe_cpu_bn_grad_sums,
+// one per thread. Planar blobs are split by channels, and each chunk writes
+// the results of its channels. Channels-last blobs are split by rows, and
+// each chunk accumulates all the channels into its own partial results,
+// merged in chunk order by the caller so that the result does not depend on
+// the scheduling.
+template <typename Dtype>
+struct BNReduceChunks {
+  int num, channels, spatial, chunks;
+  // Statistics
+  const Dtype *x;
+  BNMoments *moments;
+  // Gradient sums
+  const Dtype *y, *x_norm;
+  Dtype *dy;
+  double *sums;
+
+  int unit_begin(const int t) const {
+    const int units = (spatial == 1) ? num : channels;
+    return static_cast<long long>(units) * t / chunks;
+  }
+
+  void statistics(const int t) const {
+    if (spatial > 1) {
+      for (int c = unit_begin(t); c < unit_begin(t + 1); ++c) {
+        BNMoments& acc = moments[c];
+        for (int n = 0; n < num; ++n) {
+          const Dtype *p = x + (n * channels + c) * spatial;
+          for (int b = 0; b < spatial; b += kBNBlock) {
+            const int len = std::min(kBNBlock, spatial - b);
+            Dtype sum = 0;
+            for (int i = b; i < b + len; ++i) {
+              sum += p[i];
+            }
+            const Dtype mean = sum / len;
+            Dtype m2 = 0;
+            for (int i = b; i < b + len; ++i) {
+              m2 += (p[i] - mean) * (p[i] - mean);
+            }
+            acc.merge(len, mean, m2);
+          }
+        }
+      }
+      return;
+    }
+    BNMoments *acc = moments + t * channels;
+    const int block_rows = std::max(kBNBlock / channels, 1);
+    std::vector<Dtype> mean(channels), m2(channels);
+    for (int r = unit_begin(t); r < unit_begin(t + 1); r += block_rows) {
+      const int len = std::min(block_rows, unit_begin(t + 1) - r);
+      const Dtype *p = x + r * channels;
+      std::fill(mean.begin(), mean.end(), Dtype(0));
+      std::fill(m2.begin(), m2.end(), Dtype(0));
+      for (int k = 0; k < len; ++k) {
+        for (int c = 0; c < channels; ++c) {
+          mean[c] += p[k * channels + c];
+        }
+      }
+      for (int c = 0; c < channels; ++c) {
+        mean[c] /= len;
+      }
+      for (int k = 0; k < len; ++k) {
+        for (int c = 0; c < channels; ++c) {
+          const Dtype d = p[k * channels + c] - mean[c];
+          m2[c] += d * d;
+        }
+      }
+      for (int c = 0; c < channels; ++c) {
+        acc[c].merge(len, mean[c], m2[c]);
+      }
+    }
+  }
+
+  void grad_sums(const int t) const {
+    if (spatial > 1) {
+      for (int c = unit_begin(t); c < unit_begin(t + 1); ++c) {
+        double sum_dy = 0, sum_dy_x = 0;
+        for (int n = 0; n < num; ++n) {
+          const int offset = (n * channels + c) * spatial;
+          Dtype plane_dy = 0, plane_dy_x = 0;
+          for (int i = offset; i < offset + spatial; ++i) {
+            if (y && y[i] <= 0) { dy[i] = 0; }
+            plane_dy += dy[i];
+            plane_dy_x += dy[i] * x_norm[i];
+          }
+          sum_dy += plane_dy;
+          sum_dy_x += plane_dy_x;
+        }
+        sums[c] = sum_dy;
+        sums[channels + c] = sum_dy_x;
+      }
+      return;
+    }
+    double *sum_dy = sums + 2 * t * channels;
+    double *sum_dy_x = sum_dy + channels;
+    for (int i = unit_begin(t) * channels; i < unit_begin(t + 1) * channels;
+         i += channels) {
+      for (int c = 0; c < channels; ++c) {
+        if (y && y[i + c] <= 0) { dy[i + c] = 0; }
+        sum_dy[c] += dy[i + c];
+        sum_dy_x[c] += dy[i + c] * x_norm[i + c];
+      }
+    }
+  }
+
+  void operator()(const int begin, const int end) const {
+    for (int t = begin; t < end; ++t) {
+      if (moments) {
+        statistics(t);
+      } else {
+        grad_sums(t);
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+static BNReduceChunks<Dtype> bn_reduce_chunks(const int num_threads,
+    const int num, const int channels, const int spatial) {
+  BNReduceChunks<Dtype> chunks;
+  chunks.num = num;
+  chunks.channels = channels;
+  chunks.spatial = spatial;
+  chunks.chunks = caffe_cpu_parallel_threads((spatial == 1) ? num : channels,
+      (spatial == 1) ? channels : num * spatial, num_threads);
+  chunks.x = NULL;
+  chunks.moments = NULL;
+  chunks.y = NULL;
+  chunks.x_norm = NULL;
+  chunks.dy = NULL;
+  chunks.sums = NULL;
+  return chunks;
+}
+
+template <typename Dtype>
+void caffe_cpu_bn_statistics(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *x, Dtype *mean,
+    Dtype *variance) {
+  BNReduceChunks<Dtype> chunks =
+    bn_reduce_chunks<Dtype>(num_threads, num, channels, spatial);
+  const int partials = (spatial == 1) ? chunks.chunks : 1;
+  std::vector<BNMoments> moments(partials * channels);
+  chunks.x = x;
+  chunks.moments = &moments[0];
+  caffe_cpu_parallel_for(chunks.chunks, chunks.chunks, chunks);
+  for (int c = 0; c < channels; ++c) {
+    BNMoments& acc = moments[c];
+    for (int t = 1; t < partials; ++t) {
+      const BNMoments& part = moments[t * channels + c];
+      acc.merge(part.count, part.mean, part.m2);
+    }
+    mean[c] = acc.mean;
+    variance[c] = acc.m2 / acc.count;
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_bn_grad_sums(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *y,
+    const Dtype *x_norm, Dtype *dy, Dtype *sum_dy, Dtype *sum_dy_x_norm) {
+  BNReduceChunks<Dtype> chunks =
+    bn_reduce_chunks<Dtype>(num_threads, num, channels, spatial);
+  const int partials = (spatial == 1) ? chunks.chunks : 1;
+  std::vector<double> sums(2 * partials * channels, 0.);
+  chunks.y = y;
+  chunks.x_norm = x_norm;
+  chunks.dy = dy;
+  chunks.sums = &sums[0];
+  caffe_cpu_parallel_for(chunks.chunks, chunks.chunks, chunks);
+  for (int t = 1; t < partials; ++t) {
+    for (int i = 0; i < 2 * channels; ++i) {
+      sums[i] += sums[2 * t * channels + i];
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    sum_dy[c] = sums[c];
+    sum_dy_x_norm[c] = sums[channels + c];
+  }
+}
+
+// Planes (or channels-last rows) [begin, end) of caffe_cpu_bn_backward,
+// dx = a[c] * (dy - b[c] - x_norm * d[c])
+template <typename Dtype>
+struct BNBackwardRows {
+  int channels, spatial;
+  const Dtype *a, *b, *d, *x_norm, *dy;
+  Dtype *dx;
+
+  void operator()(const int begin, const int end) const {
+    for (int task = begin; task < end; ++task) {
+      if (spatial == 1) {
+        const int offset = task * channels;
+        for (int c = 0; c < channels; ++c) {
+          dx[offset + c] = a[c] * (dy[offset + c] - b[c] -
+                                   x_norm[offset + c] * d[c]);
+        }
+      } else {
+        const int c = task % channels;
+        const int offset = task * spatial;
+        for (int i = offset; i < offset + spatial; ++i) {
+          dx[i] = a[c] * (dy[i] - b[c] - x_norm[i] * d[c]);
+        }
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void caffe_cpu_bn_backward(const int num_threads, const int num,
+    const int channels, const int spatial, const Dtype *slope,
+    const Dtype *inv_std, const Dtype *sum_dy, const Dtype *sum_dy_x_norm,
+    const Dtype *x_norm, const Dtype *dy, Dtype *dx) {
+  const Dtype count = static_cast<Dtype>(num) * spatial;
+  std::vector<Dtype> coeffs(3 * channels);
+  for (int c = 0; c < channels; ++c) {
+    coeffs[c] = slope[c] * inv_std[c];
+    coeffs[channels + c] = sum_dy[c] / count;
+    coeffs[2 * channels + c] = sum_dy_x_norm[c] / count;
+  }
+  BNBackwardRows<Dtype> rows;
+  rows.channels = channels;
+  rows.spatial = spatial;
+  rows.a = &coeffs[0];
+  rows.b = &coeffs[channels];
+  rows.d = &coeffs[2 * channels];
+  rows.x_norm = x_norm;
+  rows.dy = dy;
+  rows.dx = dx;
+  caffe_cpu_parallel_for((spatial == 1) ? num : num * channels,
+      (spatial == 1) ? channels : spatial, num_threads, rows);
+}
+
+// Explicit instances
+template void caffe_cpu_bn_affine_params<float>(const int, const float *,
+    const float *, const float *, const float *, const float, float *, float *);
+template void caffe_cpu_bn_affine_params<double>(const int, const double *,
+    const double *, const double *, const double *, const double, double *,
+    double *);
+
+template void caffe_cpu_bn_affine<float>(const int, const int, const int,
+    const int, const float *, const float *, const bool, const float *,
+    float *);
+template void caffe_cpu_bn_affine<double>(const int, const int, const int,
+    const int, const double *, const double *, const bool, const double *,
+    double *);
+
+template void caffe_cpu_bn_affine_backward<float>(const int, const int,
+    const int, const int, const float *, const bool, const float *,
+    const float *, float *);
+template void caffe_cpu_bn_affine_backward<double>(const int, const int,
+    const int, const int, const double *, const bool, const double *,
+    const double *, double *);
+
+template void caffe_cpu_bn_normalize<float>(const int, const int, const int,
+    const int, const float *, const float *, const float *, const float *,
+    const bool, const float *, float *, float *);
+template void caffe_cpu_bn_normalize<double>(const int, const int, const int,
+    const int, const double *, const double *, const double *, const double *,
+    const bool, const double *, double *, double *);
+
+template void caffe_cpu_bn_statistics<float>(const int, const int, const int,
+    const int, const float *, float *, float *);
+template void caffe_cpu_bn_statistics<double>(const int, const int, const int,
+    const int, const double *, double *, double *);
+
+template void caffe_cpu_bn_grad_sums<float>(const int, const int, const int,
+    const int, const float *, const float *, float *, float *, float *);
+template void caffe_cpu_bn_grad_sums<double>(const int, const int, const int,
+    const int, const double *, const double *, double *, double *, double *);
+
+template void caffe_cpu_bn_backward<float>(const int, const int, const int,
+    const int, const float *, const float *, const float *, const float *,
+    const float *, const float *, float *);
+template void caffe_cpu_bn_backward<double>(const int, const int, const int,
+    const int, const double *, const double *, const double *, const double *,
+    const double *, const double *, double *);
+
+}  // namespace caffe
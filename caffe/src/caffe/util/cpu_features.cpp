@@ -0,0 +1,54 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include "caffe/util/cpu_features.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_CPU_X86
+// The "avx512bf16" feature name needs GCC 10 or Clang 9
+#if defined(__clang__) ? (__clang_major__ >= 9) : (__GNUC__ >= 10)
+#define CAFFE_CPU_BF16
+#endif
+#endif
+
+namespace caffe {
+
+#ifdef CAFFE_CPU_X86
+static CpuSimdLevel detect_simd_level() {
+  if (!__builtin_cpu_supports("sse4.2")) { return CPU_SIMD_SCALAR; }
+  if (!__builtin_cpu_supports("avx")) { return CPU_SIMD_SSE42; }
+  if (!__builtin_cpu_supports("avx2")) { return CPU_SIMD_AVX; }
+  if (!__builtin_cpu_supports("avx512f")) { return CPU_SIMD_AVX2; }
+  return CPU_SIMD_AVX512;
+}
+#endif
+
+CpuSimdLevel caffe_cpu_simd_level() {
+#ifdef CAFFE_CPU_X86
+  static const CpuSimdLevel level = detect_simd_level();
+  return level;
+#else
+  return CPU_SIMD_SCALAR;
+#endif
+}
+
+bool caffe_cpu_has_f16c() {
+#ifdef CAFFE_CPU_X86
+  static const bool has = __builtin_cpu_supports("f16c");
+  return has;
+#else
+  return false;
+#endif
+}
+
+bool caffe_cpu_has_avx512bf16() {
+#ifdef CAFFE_CPU_BF16
+  static const bool has = __builtin_cpu_supports("avx512bf16");
+  return has;
+#else
+  return false;
+#endif
+}
+
+}  // namespace caffe
@@ -0,0 +1,141 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include "caffe/common.hpp"
+#include "caffe/util/cpu_features.hpp"
+#include "caffe/util/half.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_HALF_X86
+#include <immintrin.h>
+// The AVX512-BF16 intrinsics need GCC 10 or Clang 9
+#if defined(__clang__) ? (__clang_major__ >= 9) : (__GNUC__ >= 10)
+#define CAFFE_HALF_BF16
+#endif
+#endif
+
+namespace caffe {
+
+#ifdef CAFFE_HALF_X86
+// Each kernel converts a prefix of the array and returns where the scalar
+// tail starts.
+__attribute__((target("avx,f16c")))
+static int to_fp16_f16c(const int n, const float *x, uint16_t *y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(x + i),
+        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), h);
+  }
+  return i;
+}
+
+__attribute__((target("avx,f16c")))
+static int from_fp16_f16c(const int n, const uint16_t *x, float *y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(h));
+  }
+  return i;
+}
+
+#ifdef CAFFE_HALF_BF16
+// vcvtneps2bf16 treats denormal inputs as zero, which only changes values
+// below 1e-38.
+__attribute__((target("avx512f,avx512bf16")))
+static int to_bf16_avx512(const int n, const float *x, uint16_t *y) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(x + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), (__m256i)h);
+  }
+  return i;
+}
+#endif  // CAFFE_HALF_BF16
+#endif  // CAFFE_HALF_X86
+
+// Converts the prefix of the arrays that the CPU has instructions for and
+// returns where the scalar conversion continues.
+static int to_half_simd(const StoragePrecision precision, const int n,
+    const float *x, uint16_t *y) {
+#ifdef CAFFE_HALF_X86
+  if (precision == FP16 && caffe_cpu_has_f16c() &&
+      caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+    return to_fp16_f16c(n, x, y);
+  }
+#ifdef CAFFE_HALF_BF16
+  if (precision == BF16 && caffe_cpu_has_avx512bf16() &&
+      caffe_cpu_simd_level() >= CPU_SIMD_AVX512) {
+    return to_bf16_avx512(n, x, y);
+  }
+#endif
+#endif
+  return 0;
+}
+
+static int to_half_simd(const StoragePrecision precision, const int n,
+    const double *x, uint16_t *y) {
+  return 0;
+}
+
+static int from_half_simd(const StoragePrecision precision, const int n,
+    const uint16_t *x, float *y) {
+#ifdef CAFFE_HALF_X86
+  if (precision == FP16 && caffe_cpu_has_f16c() &&
+      caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+    return from_fp16_f16c(n, x, y);
+  }
+#endif
+  return 0;
+}
+
+static int from_half_simd(const StoragePrecision precision, const int n,
+    const uint16_t *x, double *y) {
+  return 0;
+}
+
+template <typename Dtype>
+void caffe_cpu_to_half(const StoragePrecision precision, const int n,
+    const Dtype *x, uint16_t *y) {
+  CHECK(precision == FP16 || precision == BF16);
+  int i = to_half_simd(precision, n, x, y);
+  if (precision == FP16) {
+    for (; i < n; ++i) {
+      y[i] = caffe_float_to_fp16(x[i]);
+    }
+  } else {
+    for (; i < n; ++i) {
+      y[i] = caffe_float_to_bf16(x[i]);
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_from_half(const StoragePrecision precision, const int n,
+    const uint16_t *x, Dtype *y) {
+  CHECK(precision == FP16 || precision == BF16);
+  int i = from_half_simd(precision, n, x, y);
+  if (precision == FP16) {
+    for (; i < n; ++i) {
+      y[i] = caffe_fp16_to_float(x[i]);
+    }
+  } else {
+    // A shift, left to the compiler to vectorize
+    for (; i < n; ++i) {
+      y[i] = caffe_bf16_to_float(x[i]);
+    }
+  }
+}
+
+template void caffe_cpu_to_half<float>(const StoragePrecision, const int,
+    const float *, uint16_t *);
+template void caffe_cpu_to_half<double>(const StoragePrecision, const int,
+    const double *, uint16_t *);
+template void caffe_cpu_from_half<float>(const StoragePrecision, const int,
+    const uint16_t *, float *);
+template void caffe_cpu_from_half<double>(const StoragePrecision, const int,
+    const uint16_t *, double *);
+
+}  // namespace caffe
@@ -1,21 +1,415 @@
 // Copyright 2014 George Papandreou
 
 #include "caffe/common.hpp"
+#include "caffe/util/cpu_features.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
 #include <algorithm>
 #include <cmath>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_INTERP_X86
+#include <immintrin.h>
+#endif
 
 namespace caffe {
 
+// Interpolation tables of one axis: source index, step to the next source
+// index (0 on the last one) and the two weights of every output index
+template <typename Dtype>
+static void interp2_axis(const int size1, const int size2, int *index,
+    int *step, Dtype *lambda0, Dtype *lambda1) {
+  const float r = (size2 > 1) ?
+      static_cast<float>(size1 - 1) / (size2 - 1) : 0.f;
+  for (int i2 = 0; i2 < size2; ++i2) {
+    const float i1r = r * i2;
+    const int i1 = i1r;
+    index[i2] = i1;
+    step[i2] = (i1 < size1 - 1) ? 1 : 0;
+    lambda1[i2] = i1r - i1;
+    lambda0[i2] = Dtype(1.) - lambda1[i2];
+  }
+}
+
+// Transpose of the tables of one axis: the output indices reading every
+// source index and their weights, null weights left out
+template <typename Dtype>
+static void interp2_axis_transpose(const int size1, const int size2,
+    const int *index, const int *step, const Dtype *lambda0,
+    const Dtype *lambda1, std::vector<int> *begin, std::vector<int> *index2,
+    std::vector<Dtype> *lambda2) {
+  begin->assign(size1 + 1, 0);
+  for (int i2 = 0; i2 < size2; ++i2) {
+    if (lambda0[i2] != Dtype(0)) { (*begin)[index[i2] + 1]++; }
+    if (lambda1[i2] != Dtype(0)) { (*begin)[index[i2] + step[i2] + 1]++; }
+  }
+  for (int i1 = 0; i1 < size1; ++i1) {
+    (*begin)[i1 + 1] += (*begin)[i1];
+  }
+  index2->resize((*begin)[size1]);
+  lambda2->resize((*begin)[size1]);
+  std::vector<int> next(begin->begin(), begin->end() - 1);
+  for (int i2 = 0; i2 < size2; ++i2) {
+    if (lambda0[i2] != Dtype(0)) {
+      const int k = next[index[i2]]++;
+      (*index2)[k] = i2;
+      (*lambda2)[k] = lambda0[i2];
+    }
+    if (lambda1[i2] != Dtype(0)) {
+      const int k = next[index[i2] + step[i2]]++;
+      (*index2)[k] = i2;
+      (*lambda2)[k] = lambda1[i2];
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_interp2_tables(const int height1, const int width1,
+    const int height2, const int width2, Interp2Tables<Dtype> *tables) {
+  CHECK(height1 > 0 && width1 > 0 && height2 > 0 && width2 > 0);
+  tables->height1 = height1;
+  tables->width1 = width1;
+  tables->height2 = height2;
+  tables->width2 = width2;
+  tables->h1.resize(height2);
+  tables->h1p.resize(height2);
+  tables->h0lambda.resize(height2);
+  tables->h1lambda.resize(height2);
+  tables->w1.resize(width2);
+  tables->w1p.resize(width2);
+  tables->w0lambda.resize(width2);
+  tables->w1lambda.resize(width2);
+  interp2_axis(height1, height2, &tables->h1[0], &tables->h1p[0],
+	       &tables->h0lambda[0], &tables->h1lambda[0]);
+  interp2_axis(width1, width2, &tables->w1[0], &tables->w1p[0],
+	       &tables->w0lambda[0], &tables->w1lambda[0]);
+  interp2_axis_transpose(height1, height2, &tables->h1[0], &tables->h1p[0],
+			 &tables->h0lambda[0], &tables->h1lambda[0],
+			 &tables->h2_begin, &tables->h2_index, &tables->h2_lambda);
+  interp2_axis_transpose(width1, width2, &tables->w1[0], &tables->w1p[0],
+			 &tables->w0lambda[0], &tables->w1lambda[0],
+			 &tables->w2_begin, &tables->w2_index, &tables->w2_lambda);
+  // Exact integer factors: 1 / zoom is exact for powers of 2, and so are all
+  // the weights, as are the source indices of a shrink
+  tables->zoom = 0;
+  if (height1 > 1 && width1 > 1) {
+    for (int zoom = 2; zoom <= 8; zoom *= 2) {
+      if (height2 - 1 == zoom * (height1 - 1) &&
+	  width2 - 1 == zoom * (width1 - 1)) {
+	tables->zoom = zoom;
+      }
+    }
+  }
+  tables->shrink = 0;
+  if (height2 > 1 && width2 > 1 &&
+      (height1 - 1) % (height2 - 1) == 0 && (width1 - 1) % (width2 - 1) == 0 &&
+      (height1 - 1) / (height2 - 1) == (width1 - 1) / (width2 - 1)) {
+    tables->shrink = (height1 - 1) / (height2 - 1);
+  }
+}
+
+// Vertical step of the interpolation, out = h0lambda * row0 + h1lambda * row1.
+// The vector kernels return the index of the first element left for the
+// scalar tail.
+template <typename Dtype>
+static void interp2_mix_scalar(const int begin, const int count,
+    const Dtype h0lambda, const Dtype *row0, const Dtype h1lambda,
+    const Dtype *row1, Dtype *out) {
+  for (int i = begin; i < count; ++i) {
+    out[i] = h0lambda * row0[i] + h1lambda * row1[i];
+  }
+}
+
+#ifdef CAFFE_INTERP_X86
+__attribute__((target("avx")))
+static int interp2_mix_avx(const int count, const float h0lambda,
+    const float *row0, const float h1lambda, const float *row1, float *out) {
+  const __m256 l0 = _mm256_set1_ps(h0lambda);
+  const __m256 l1 = _mm256_set1_ps(h1lambda);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_add_ps(
+        _mm256_mul_ps(l0, _mm256_loadu_ps(row0 + i)),
+        _mm256_mul_ps(l1, _mm256_loadu_ps(row1 + i))));
+  }
+  return i;
+}
+
+__attribute__((target("avx")))
+static int interp2_mix_avx(const int count, const double h0lambda,
+    const double *row0, const double h1lambda, const double *row1,
+    double *out) {
+  const __m256d l0 = _mm256_set1_pd(h0lambda);
+  const __m256d l1 = _mm256_set1_pd(h1lambda);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(
+        _mm256_mul_pd(l0, _mm256_loadu_pd(row0 + i)),
+        _mm256_mul_pd(l1, _mm256_loadu_pd(row1 + i))));
+  }
+  return i;
+}
+#endif
+
+template <typename Dtype>
+static void interp2_mix(const int count, const Dtype h0lambda,
+    const Dtype *row0, const Dtype h1lambda, const Dtype *row1, Dtype *out) {
+  int begin = 0;
+#ifdef CAFFE_INTERP_X86
+  if (caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+    begin = interp2_mix_avx(count, h0lambda, row0, h1lambda, row1, out);
+  }
+#endif
+  interp2_mix_scalar(begin, count, h0lambda, row0, h1lambda, row1, out);
+}
+
+// Planar zoom of a source row by an integer factor: the zoom outputs after
+// source pixel i are w0lambda * src[i] + w1lambda * src[i + 1] with the
+// per-phase weights. The vector kernels process one vector of outputs per
+// source pixel and return the number of source intervals done.
+template <typename Dtype, typename Stype>
+static int interp2_zoom_vec(const int zoom, const int intervals,
+    const Stype *src, const Dtype *w0lambda, const Dtype *w1lambda,
+    Dtype *row) {
+  return 0;
+}
+
+#ifdef CAFFE_INTERP_X86
+__attribute__((target("avx")))
+static int interp2_zoom_vec(const int zoom, const int intervals,
+    const float *src, const float *w0lambda, const float *w1lambda,
+    float *row) {
+  if (zoom == 8) {
+    const __m256 l0 = _mm256_loadu_ps(w0lambda);
+    const __m256 l1 = _mm256_loadu_ps(w1lambda);
+    for (int i = 0; i < intervals; ++i) {
+      _mm256_storeu_ps(row + 8 * i, _mm256_add_ps(
+          _mm256_mul_ps(l0, _mm256_set1_ps(src[i])),
+          _mm256_mul_ps(l1, _mm256_set1_ps(src[i + 1]))));
+    }
+    return intervals;
+  }
+  if (zoom == 4) {
+    const __m128 l0 = _mm_loadu_ps(w0lambda);
+    const __m128 l1 = _mm_loadu_ps(w1lambda);
+    for (int i = 0; i < intervals; ++i) {
+      _mm_storeu_ps(row + 4 * i, _mm_add_ps(
+          _mm_mul_ps(l0, _mm_set1_ps(src[i])),
+          _mm_mul_ps(l1, _mm_set1_ps(src[i + 1]))));
+    }
+    return intervals;
+  }
+  return 0;
+}
+#endif
+
+// Output rows [begin, end) of a bi-linear interpolation with tables. A task
+// is an output row of one channel (planar) or of all channels (packed).
+// Every output row mixes two source rows interpolated along the width,
+//   h0lambda * (w0lambda * a + w1lambda * b) +
+//   h1lambda * (w0lambda * c + w1lambda * d),
+// as the original per-pixel loop did; the interpolated source rows are
+// cached, so when zooming each one is computed once for several output rows.
+// zoom is 0 for arbitrary sizes, or the exact integer zoom of the tables
+// (2, 4 or 8): the phases of the width then have compile-time weights.
+template <typename Dtype, bool packed, StoragePrecision precision, int zoom>
+struct Interp2Rows {
+  typedef StorageLoad<Dtype, precision> Load;
+  typedef typename Load::Stype Stype;
+
+  const Interp2Tables<Dtype> *tables;
+  int channels;
+  const Stype *data1;
+  int x1, y1, Height1, Width1;
+  Dtype *data2;
+  int x2, y2, Height2, Width2;
+
+  // Interpolates the source row h1 of channel c (planar) along the width
+  void source_row(const int c, const int h1, Dtype *row) const {
+    if (zoom > 0) {
+      source_row_zoom(c, h1, row);
+      return;
+    }
+    const Interp2Tables<Dtype> &t = *tables;
+    const int *w1 = &t.w1[0];
+    const int *w1p = &t.w1p[0];
+    const Dtype *w0lambda = &t.w0lambda[0];
+    const Dtype *w1lambda = &t.w1lambda[0];
+    if (packed) {
+      const Stype *src = data1 + channels * ((y1 + h1) * Width1 + x1);
+      for (int w2 = 0; w2 < t.width2; ++w2) {
+	const Stype *pos1 = src + channels * w1[w2];
+	const int step = channels * w1p[w2];
+	Dtype *pos2 = row + channels * w2;
+	for (int k = 0; k < channels; ++k) {
+	  pos2[k] = w0lambda[w2] * Load::load(pos1[k]) +
+	    w1lambda[w2] * Load::load(pos1[k + step]);
+	}
+      }
+    }
+    else {
+      const Stype *src = data1 + c * Height1 * Width1 + (y1 + h1) * Width1 + x1;
+      for (int w2 = 0; w2 < t.width2; ++w2) {
+	const Stype *pos1 = src + w1[w2];
+	row[w2] = w0lambda[w2] * Load::load(pos1[0]) +
+	  w1lambda[w2] * Load::load(pos1[w1p[w2]]);
+      }
+    }
+  }
+
+  // Same for an exact zoom: output w2 = zoom * i + p has the weights
+  // 1 - p / zoom and p / zoom, which are exact and equal to the tables; the
+  // last output is the last source pixel with the weights 1 and 0.
+  void source_row_zoom(const int c, const int h1, Dtype *row) const {
+    const int Z = (zoom > 0) ? zoom : 1;
+    Dtype w0lambda[Z], w1lambda[Z];
+    for (int p = 0; p < Z; ++p) {
+      w1lambda[p] = Dtype(p) / Z;
+      w0lambda[p] = Dtype(1.) - w1lambda[p];
+    }
+    const int intervals = tables->width1 - 1;
+    if (packed) {
+      const Stype *src = data1 + channels * ((y1 + h1) * Width1 + x1);
+      for (int i = 0; i < intervals; ++i) {
+	const Stype *pos1 = src + channels * i;
+	Dtype *pos2 = row + channels * Z * i;
+	for (int p = 0; p < Z; ++p) {
+	  for (int k = 0; k < channels; ++k) {
+	    pos2[channels * p + k] = w0lambda[p] * Load::load(pos1[k]) +
+	      w1lambda[p] * Load::load(pos1[channels + k]);
+	  }
+	}
+      }
+      const Stype *pos1 = src + channels * intervals;
+      Dtype *pos2 = row + channels * Z * intervals;
+      for (int k = 0; k < channels; ++k) {
+	pos2[k] = w0lambda[0] * Load::load(pos1[k]) +
+	  w1lambda[0] * Load::load(pos1[k]);
+      }
+    }
+    else {
+      const Stype *src = data1 + c * Height1 * Width1 + (y1 + h1) * Width1 + x1;
+      int i = 0;
+#ifdef CAFFE_INTERP_X86
+      if (caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+	i = interp2_zoom_vec(Z, intervals, src, w0lambda, w1lambda, row);
+      }
+#endif
+      for (; i < intervals; ++i) {
+	const Dtype a = Load::load(src[i]);
+	const Dtype b = Load::load(src[i + 1]);
+	for (int p = 0; p < Z; ++p) {
+	  row[Z * i + p] = w0lambda[p] * a + w1lambda[p] * b;
+	}
+      }
+      const Dtype a = Load::load(src[intervals]);
+      row[Z * intervals] = w0lambda[0] * a + w1lambda[0] * a;
+    }
+  }
+
+  // Output rows of an exact integer shrink, which samples every shrink-th
+  // source pixel: the weights of the tables are 1 and 0.
+  void shrink_rows(const int begin, const int end) const {
+    const Interp2Tables<Dtype> &t = *tables;
+    const int S = t.shrink;
+    for (int task = begin; task < end; ++task) {
+      const int c = packed ? 0 : task / t.height2;
+      const int h2 = packed ? task : task % t.height2;
+      if (packed) {
+	const Stype *src = data1 + channels * ((y1 + S * h2) * Width1 + x1);
+	Dtype *out = data2 + channels * ((y2 + h2) * Width2 + x2);
+	for (int w2 = 0; w2 < t.width2; ++w2) {
+	  for (int k = 0; k < channels; ++k) {
+	    out[channels * w2 + k] = Load::load(src[channels * S * w2 + k]);
+	  }
+	}
+      }
+      else {
+	const Stype *src = data1 + c * Height1 * Width1 + (y1 + S * h2) * Width1 + x1;
+	Dtype *out = data2 + c * Height2 * Width2 + (y2 + h2) * Width2 + x2;
+	for (int w2 = 0; w2 < t.width2; ++w2) {
+	  out[w2] = Load::load(src[S * w2]);
+	}
+      }
+    }
+  }
+
+  void operator()(const int begin, const int end) const {
+    const Interp2Tables<Dtype> &t = *tables;
+    if (zoom == 0 && t.shrink > 1) {
+      shrink_rows(begin, end);
+      return;
+    }
+    const int row_size = (packed ? channels : 1) * t.width2;
+    // Two cached source rows, keyed by channel * height1 + source row
+    std::vector<Dtype> buffer(2 * row_size);
+    Dtype *rows[2] = {&buffer[0], &buffer[row_size]};
+    int keys[2] = {-1, -1};
+    for (int task = begin; task < end; ++task) {
+      const int c = packed ? 0 : task / t.height2;
+      const int h2 = packed ? task : task % t.height2;
+      const int key0 = c * t.height1 + t.h1[h2];
+      const int key1 = key0 + t.h1p[h2];
+      int s0 = (keys[0] == key0) ? 0 : (keys[1] == key0) ? 1 : -1;
+      if (s0 < 0) {
+	s0 = (keys[0] == key1) ? 1 : 0;
+	source_row(c, t.h1[h2], rows[s0]);
+	keys[s0] = key0;
+      }
+      int s1 = (keys[s0] == key1) ? s0 : 1 - s0;
+      if (keys[s1] != key1) {
+	source_row(c, t.h1[h2] + t.h1p[h2], rows[s1]);
+	keys[s1] = key1;
+      }
+      Dtype *out = packed ?
+	data2 + channels * ((y2 + h2) * Width2 + x2) :
+	data2 + c * Height2 * Width2 + (y2 + h2) * Width2 + x2;
+      interp2_mix(row_size, t.h0lambda[h2], rows[s0], t.h1lambda[h2],
+		  rows[s1], out);
+    }
+  }
+};
+
+// Runs Interp2Rows over all the output rows. Threads own disjoint output
+// rows; planar rows are ordered by channel, so a thread keeps reusing its
+// cached source rows within a channel.
+template <typename Dtype, bool packed, StoragePrecision precision, int zoom>
+static void interp2_rows(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    const typename StorageLoad<Dtype, precision>::Stype *data1,
+    const int x1, const int y1, const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2) {
+  Interp2Rows<Dtype, packed, precision, zoom> rows;
+  rows.tables = &tables;
+  rows.channels = channels;
+  rows.data1 = data1;
+  rows.x1 = x1; rows.y1 = y1; rows.Height1 = Height1; rows.Width1 = Width1;
+  rows.data2 = data2;
+  rows.x2 = x2; rows.y2 = y2; rows.Height2 = Height2; rows.Width2 = Width2;
+  caffe_cpu_parallel_for((packed ? 1 : channels) * tables.height2,
+      (packed ? channels : 1) * tables.width2, num_threads, rows);
+}
+
 // Bi-linear interpolation
-// IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
+// IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image,
+//      stored in the given precision
 // OUT: [channels height2 width2] cropped from a bigger [Height2 Width2] image
-template <typename Dtype, bool packed>
-void caffe_cpu_interp2(const int channels,
-    const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
-    Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
+template <typename Dtype, bool packed, StoragePrecision precision>
+static void interp2_cpu(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    const typename StorageLoad<Dtype, precision>::Stype *data1,
+    const int x1, const int y1, const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2) {
+  const int height1 = tables.height1, width1 = tables.width1;
+  const int height2 = tables.height2, width2 = tables.width2;
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
+  typedef StorageLoad<Dtype, precision> Load;
+  typedef typename Load::Stype Stype;
   // special case: just copy
   if (height1 == height2 && width1 == width2) {
     for (int h2 = 0; h2 < height2; ++h2) {
@@ -23,19 +417,19 @@ void caffe_cpu_interp2(const int channels,
       for (int w2 = 0; w2 < width2; ++w2) {
 	const int w1 = w2;
 	if (packed) {
-	  const Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
+	  const Stype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
 	  Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
 	  for (int c = 0; c < channels; ++c) {
-	    pos2[0] = pos1[0];
+	    pos2[0] = Load::load(pos1[0]);
 	    pos1++;
 	    pos2++;
 	  }
 	}
 	else {
-	  const Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
+	  const Stype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
 	  Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
 	  for (int c = 0; c < channels; ++c) {
-	    pos2[0] = pos1[0];
+	    pos2[0] = Load::load(pos1[0]);
 	    pos1 += Width1 * Height1;
 	    pos2 += Width2 * Height2;
 	  }
@@ -44,173 +438,375 @@ void caffe_cpu_interp2(const int channels,
     }
     return;
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
-      if (packed) {
-	const Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-	Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
-	for (int c = 0; c < channels; ++c) {
-	  pos2[0] =
-	    h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[channels * w1p]) + 
-	    h1lambda * (w0lambda * pos1[channels * h1p * Width1] + w1lambda * pos1[channels * (h1p * Width1 + w1p)]);
-	  pos1++;
-	  pos2++;
+  switch (tables.zoom) {
+  case 2:
+    interp2_rows<Dtype,packed,precision,2>(tables, num_threads, channels,
+					   data1, x1, y1, Height1, Width1,
+					   data2, x2, y2, Height2, Width2);
+    break;
+  case 4:
+    interp2_rows<Dtype,packed,precision,4>(tables, num_threads, channels,
+					   data1, x1, y1, Height1, Width1,
+					   data2, x2, y2, Height2, Width2);
+    break;
+  case 8:
+    interp2_rows<Dtype,packed,precision,8>(tables, num_threads, channels,
+					   data1, x1, y1, Height1, Width1,
+					   data2, x2, y2, Height2, Width2);
+    break;
+  default:
+    interp2_rows<Dtype,packed,precision,0>(tables, num_threads, channels,
+					   data1, x1, y1, Height1, Width1,
+					   data2, x2, y2, Height2, Width2);
+  }
+}
+
+
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2(const int channels,
+    const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
+  Interp2Tables<Dtype> tables;
+  caffe_cpu_interp2_tables(height1, width1, height2, width2, &tables);
+  interp2_cpu<Dtype,packed,FP32>(tables, 1, channels,
+				 data1, x1, y1, Height1, Width1,
+				 data2, x2, y2, Height2, Width2);
+}
+
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    const Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2) {
+  interp2_cpu<Dtype,packed,FP32>(tables, num_threads, channels,
+				 data1, x1, y1, Height1, Width1,
+				 data2, x2, y2, Height2, Width2);
+}
+
+// Output rows [h2_begin, h2_end) of every channel, in the calling thread.
+// Interp2Rows addresses the band as an image of h2_end - h2_begin rows
+// starting at row -h2_begin.
+template <typename Dtype, int zoom>
+static void interp2_band(const Interp2Tables<Dtype> &tables,
+    const int channels, const Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    const int h2_begin, const int h2_end, Dtype *band) {
+  Interp2Rows<Dtype, false, FP32, zoom> rows;
+  rows.tables = &tables;
+  rows.channels = channels;
+  rows.data1 = data1;
+  rows.x1 = x1; rows.y1 = y1; rows.Height1 = Height1; rows.Width1 = Width1;
+  rows.data2 = band;
+  rows.x2 = 0; rows.y2 = - h2_begin;
+  rows.Height2 = h2_end - h2_begin; rows.Width2 = tables.width2;
+  for (int c = 0; c < channels; ++c) {
+    rows(c * tables.height2 + h2_begin, c * tables.height2 + h2_end);
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_interp2_band(const Interp2Tables<Dtype> &tables,
+    const int channels, const Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    const int h2_begin, const int h2_end, Dtype *band) {
+  CHECK(0 <= h2_begin && h2_begin < h2_end && h2_end <= tables.height2);
+  switch (tables.zoom) {
+  case 2:
+    interp2_band<Dtype,2>(tables, channels, data1, x1, y1, Height1, Width1,
+			  h2_begin, h2_end, band);
+    break;
+  case 4:
+    interp2_band<Dtype,4>(tables, channels, data1, x1, y1, Height1, Width1,
+			  h2_begin, h2_end, band);
+    break;
+  case 8:
+    interp2_band<Dtype,8>(tables, channels, data1, x1, y1, Height1, Width1,
+			  h2_begin, h2_end, band);
+    break;
+  default:
+    interp2_band<Dtype,0>(tables, channels, data1, x1, y1, Height1, Width1,
+			  h2_begin, h2_end, band);
+  }
+}
+
+// Same with the input stored in 16 bits
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_half(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const StoragePrecision precision,
+    const int channels, const uint16_t *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2) {
+  switch (precision) {
+  case FP16:
+    interp2_cpu<Dtype,packed,FP16>(tables, num_threads, channels,
+				   data1, x1, y1, Height1, Width1,
+				   data2, x2, y2, Height2, Width2);
+    break;
+  case BF16:
+    interp2_cpu<Dtype,packed,BF16>(tables, num_threads, channels,
+				   data1, x1, y1, Height1, Width1,
+				   data2, x2, y2, Height2, Width2);
+    break;
+  default:
+    LOG(FATAL) << "Not a 16-bit storage precision: " << precision;
+  }
+}
+
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_half(const StoragePrecision precision, const int channels,
+    const uint16_t *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
+  Interp2Tables<Dtype> tables;
+  caffe_cpu_interp2_tables(height1, width1, height2, width2, &tables);
+  caffe_cpu_interp2_half<Dtype,packed>(tables, 1, precision, channels,
+				       data1, x1, y1, Height1, Width1,
+				       data2, x2, y2, Height2, Width2);
+}
+
+// Source rows [begin, end) of the backward: a task is a source row of one
+// channel (planar) or of all channels (packed). The output rows reading it
+// are summed along the height into a row of width2, which is then gathered
+// along the width into the source row.
+template <typename Dtype, bool packed>
+struct Interp2BackwardRows {
+  const Interp2Tables<Dtype> *tables;
+  int channels;
+  Dtype *data1;
+  int x1, y1, Height1, Width1;
+  const Dtype *data2;
+  int x2, y2, Height2, Width2;
+
+  void operator()(const int begin, const int end) const {
+    const Interp2Tables<Dtype> &t = *tables;
+    const int step = packed ? channels : 1;
+    const int row_size = step * t.width2;
+    std::vector<Dtype> buffer(row_size);
+    Dtype *row = &buffer[0];
+    for (int task = begin; task < end; ++task) {
+      const int c = packed ? 0 : task / t.height1;
+      const int h1 = packed ? task : task % t.height1;
+      const int k_begin = t.h2_begin[h1], k_end = t.h2_begin[h1 + 1];
+      if (k_begin == k_end) {
+	continue;
+      }
+      std::fill(row, row + row_size, Dtype(0));
+      for (int k = k_begin; k < k_end; ++k) {
+	const int h2 = t.h2_index[k];
+	const Dtype lambda = t.h2_lambda[k];
+	const Dtype *in = packed ?
+	  data2 + channels * ((y2 + h2) * Width2 + x2) :
+	  data2 + c * Height2 * Width2 + (y2 + h2) * Width2 + x2;
+	for (int i = 0; i < row_size; ++i) {
+	  row[i] += lambda * in[i];
 	}
       }
-      else {
-	const Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-	Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-	for (int c = 0; c < channels; ++c) {
-	  pos2[0] =
-	    h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[w1p]) + 
-	    h1lambda * (w0lambda * pos1[h1p * Width1] + w1lambda * pos1[h1p * Width1 + w1p]);
-	  pos1 += Width1 * Height1;
-	  pos2 += Width2 * Height2;
+      Dtype *out = packed ?
+	data1 + channels * ((y1 + h1) * Width1 + x1) :
+	data1 + c * Height1 * Width1 + (y1 + h1) * Width1 + x1;
+      for (int w1 = 0; w1 < t.width1; ++w1) {
+	Dtype *pos1 = out + step * w1;
+	for (int k = t.w2_begin[w1]; k < t.w2_begin[w1 + 1]; ++k) {
+	  const Dtype lambda = t.w2_lambda[k];
+	  const Dtype *pos2 = row + step * t.w2_index[k];
+	  for (int i = 0; i < step; ++i) {
+	    pos1[i] += lambda * pos2[i];
+	  }
 	}
       }
     }
   }
-}
-
+};
 
 // Backward (adjoint) operation 1 <- 2 (accumulates)
+template <typename Dtype, bool packed>
+void caffe_cpu_interp2_backward(const Interp2Tables<Dtype> &tables,
+    const int num_threads, const int channels,
+    Dtype *data1, const int x1, const int y1,
+    const int Height1, const int Width1,
+    const Dtype *data2, const int x2, const int y2,
+    const int Height2, const int Width2) {
+  const int height1 = tables.height1, width1 = tables.width1;
+  const int height2 = tables.height2, width2 = tables.width2;
+  CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 &&
+        x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
+  CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 &&
+        Width2 >= width2 + x2 && Height2 >= height2 + y2);
+  Interp2BackwardRows<Dtype, packed> rows;
+  rows.tables = &tables;
+  rows.channels = channels;
+  rows.data1 = data1;
+  rows.x1 = x1; rows.y1 = y1; rows.Height1 = Height1; rows.Width1 = Width1;
+  rows.data2 = data2;
+  rows.x2 = x2; rows.y2 = y2; rows.Height2 = Height2; rows.Width2 = Width2;
+  caffe_cpu_parallel_for((packed ? 1 : channels) * height1,
+      (packed ? channels : 1) * width2, num_threads, rows);
+}
+
 template <typename Dtype, bool packed>
 void caffe_cpu_interp2_backward(const int channels,
     Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
     const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
-  CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
-  CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
-  // special case: same-size matching grids
-  if (height1 == height2 && width1 == width2) {
-    for (int h2 = 0; h2 < height2; ++h2) {
-      const int h1 = h2;
-      for (int w2 = 0; w2 < width2; ++w2) {
-	const int w1 = w2;
-	if (packed) {
-	  Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-	  const Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
-	  for (int c = 0; c < channels; ++c) {
-	    pos1[0] += pos2[0];
-	    pos1++;
-	    pos2++;
-	  }
-	}
-	else {
-	  Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-	  const Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-	  for (int c = 0; c < channels; ++c) {
-	    pos1[0] += pos2[0];
-	    pos1 += Width1 * Height1;
-	    pos2 += Width2 * Height2;
-	  }
-	}
-      }
-    }
-    return;
+  Interp2Tables<Dtype> tables;
+  caffe_cpu_interp2_tables(height1, width1, height2, width2, &tables);
+  caffe_cpu_interp2_backward<Dtype,packed>(tables, 1, channels,
+					   data1, x1, y1, Height1, Width1,
+					   data2, x2, y2, Height2, Width2);
+}
+
+// One 2x decimation, out = .25 * (((a0 + a1) + b0) + b1) for the 2x2
+// block of the rows a and b above every output. The vector kernel gathers
+// the even and odd source pixels of 8 outputs and adds them in the same
+// order, so the result is the same; it returns the index of the first
+// output left for the scalar tail.
+template <typename Dtype>
+static int pyramid2_row_vec(const int width2, const Dtype *row1a,
+    const Dtype *row1b, Dtype *row2) {
+  return 0;
+}
+
+#ifdef CAFFE_INTERP_X86
+__attribute__((target("avx2")))
+static int pyramid2_row_vec(const int width2, const float *row1a,
+    const float *row1b, float *row2) {
+  const __m256 quarter = _mm256_set1_ps(.25f);
+  int w2 = 0;
+  for (; w2 + 8 <= width2; w2 += 8) {
+    const __m256 a0 = _mm256_loadu_ps(row1a + 2 * w2);
+    const __m256 a1 = _mm256_loadu_ps(row1a + 2 * w2 + 8);
+    const __m256 b0 = _mm256_loadu_ps(row1b + 2 * w2);
+    const __m256 b1 = _mm256_loadu_ps(row1b + 2 * w2 + 8);
+    // Even and odd pixels, in the order 0 1 4 5 2 3 6 7 of the outputs
+    const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)),
+        _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1))),
+        _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0))),
+        _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+    const __m256 out = _mm256_mul_ps(quarter, sum);
+    _mm256_storeu_ps(row2 + w2, _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_castps_pd(out), _MM_SHUFFLE(3, 1, 2, 0))));
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
+  return w2;
+}
+#endif
+
+// Output rows [begin, end) of one level of caffe_cpu_pyramid2. A task is an
+// output row of one channel (planar) or of all channels (packed).
+template <typename Dtype, bool packed>
+struct Pyramid2Rows {
+  int channels;
+  const Dtype *data1;
+  int height1, width1;
+  Dtype *data2;
+  int height2, width2;
+
+  void operator()(const int begin, const int end) const {
+    const Dtype quarter = static_cast<Dtype>(.25);
+    for (int task = begin; task < end; ++task) {
+      const int c = packed ? 0 : task / height2;
+      const int h2 = packed ? task : task % height2;
+      const int h1 = 2 * h2;
       if (packed) {
-	Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-	const Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
-	for (int c = 0; c < channels; ++c) {
-	  pos1[0] += h0lambda * w0lambda * pos2[0];
-	  pos1[channels * w1p] += h0lambda * w1lambda * pos2[0];
-	  pos1[channels * h1p * Width1] += h1lambda * w0lambda * pos2[0];
-	  pos1[channels * (h1p * Width1 + w1p)] += h1lambda * w1lambda * pos2[0];
-	  pos1++;
-	  pos2++;
+	const Dtype *row1a = data1 + channels * h1 * width1;
+	const Dtype *row1b = row1a + channels * width1;
+	Dtype *row2 = data2 + channels * h2 * width2;
+	for (int w2 = 0; w2 < width2; ++w2) {
+	  const Dtype *a = row1a + channels * 2 * w2;
+	  const Dtype *b = row1b + channels * 2 * w2;
+	  Dtype *out = row2 + channels * w2;
+	  for (int k = 0; k < channels; ++k) {
+	    out[k] = quarter * (a[k] + a[channels + k] + b[k] + b[channels + k]);
+	  }
 	}
       }
       else {
-	Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-	const Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-	for (int c = 0; c < channels; ++c) {
-	  pos1[0] += h0lambda * w0lambda * pos2[0];
-	  pos1[w1p] += h0lambda * w1lambda * pos2[0];
-	  pos1[h1p * Width1] += h1lambda * w0lambda * pos2[0];
-	  pos1[h1p * Width1 + w1p] += h1lambda * w1lambda * pos2[0];
-	  pos1 += Width1 * Height1;
-	  pos2 += Width2 * Height2;
+	const Dtype *row1a = data1 + (c * height1 + h1) * width1;
+	const Dtype *row1b = row1a + width1;
+	Dtype *row2 = data2 + (c * height2 + h2) * width2;
+	int w2 = 0;
+#ifdef CAFFE_INTERP_X86
+	if (caffe_cpu_simd_level() >= CPU_SIMD_AVX2) {
+	  w2 = pyramid2_row_vec(width2, row1a, row1b, row2);
+	}
+#endif
+	for (; w2 < width2; ++w2) {
+	  const int w1 = 2 * w2;
+	  row2[w2] = quarter * (row1a[w1] + row1a[w1 + 1] + row1b[w1] + row1b[w1 + 1]);
 	}
       }
     }
   }
-}
+};
 
 // Create Gaussian pyramid of an image. Assume output space is pre-allocated.
 // IN : [channels height width]
 template <typename Dtype, bool packed>
-void caffe_cpu_pyramid2(const int channels,
+void caffe_cpu_pyramid2(const int num_threads, const int channels,
     const Dtype *data, const int height, const int width,
     Dtype *data_pyr, const int levels) {
   CHECK(height > 0 && width > 0 && levels >= 0);
-  int height1 = height, width1 = width;
-  int height2 = height, width2 = width;
-  const Dtype *data1 = data;
-  Dtype *data2 = data_pyr;
+  Pyramid2Rows<Dtype, packed> rows;
+  rows.channels = channels;
+  rows.data1 = data;
+  rows.height1 = height;
+  rows.width1 = width;
+  rows.data2 = data_pyr;
   for (int l = 0; l < levels; ++l) {
-    height2 /= 2;
-    width2 /= 2;
-    if (height2 == 0 || width2 == 0) {
+    rows.height2 = rows.height1 / 2;
+    rows.width2 = rows.width1 / 2;
+    if (rows.height2 == 0 || rows.width2 == 0) {
       break;
     }
+    // A level reads the previous one, so only its rows run in parallel
+    caffe_cpu_parallel_for((packed ? 1 : channels) * rows.height2,
+        (packed ? channels : 1) * rows.width1, num_threads, rows);
+    rows.data1 = rows.data2;
+    rows.height1 = rows.height2;
+    rows.width1 = rows.width2;
+    rows.data2 += channels * rows.height2 * rows.width2;
+  }
+}
+
+template <typename Dtype, bool packed>
+void caffe_cpu_pyramid2(const int channels,
+    const Dtype *data, const int height, const int width,
+    Dtype *data_pyr, const int levels) {
+  caffe_cpu_pyramid2<Dtype,packed>(1, channels, data, height, width,
+				   data_pyr, levels);
+}
+
+// Backward (adjoint) of one level: every level pixel spreads a quarter of
+// its gradient over its 2x2 block; the rows and columns left out by an odd
+// size get none.
+template <typename Dtype, bool packed>
+void caffe_cpu_pyramid2_backward(const int channels,
+    Dtype *diff, const int height, const int width,
+    const Dtype *diff_pyr) {
+  const int height2 = height / 2, width2 = width / 2;
+  const int planes = packed ? 1 : channels;
+  const int step = packed ? channels : 1;
+  const Dtype quarter = static_cast<Dtype>(.25);
+  for (int p = 0; p < planes; ++p) {
+    const Dtype *diff2 = diff_pyr + p * height2 * width2;
+    Dtype *diff1 = diff + p * height * width;
     for (int h2 = 0; h2 < height2; ++h2) {
-      const int h1 = 2 * h2;
+      Dtype *row1a = diff1 + 2 * h2 * width * step;
+      Dtype *row1b = row1a + width * step;
       for (int w2 = 0; w2 < width2; ++w2) {
-	const int w1 = 2 * w2;
-	if (packed) {
-	  const Dtype* pos1 = &data1[channels * (h1 * width1 + w1)];
-	  Dtype* pos2 = &data2[channels * (h2 * width2 + w2)];
-	  for (int c = 0; c < channels; ++c) {
-	    pos2[0] =  static_cast<Dtype>(.25) *
-	      (pos1[0]                 + pos1[channels] + 
-	       pos1[channels * width1] + pos1[channels * (width1 + 1)]);
-	    pos1++;
-	    pos2++;
-	  }
-	}
-	else {
-	  const Dtype* pos1 = &data1[h1 * width1 + w1];
-	  Dtype* pos2 = &data2[h2 * width2 + w2];
-	  for (int c = 0; c < channels; ++c) {
-	    pos2[0] =  static_cast<Dtype>(.25) *
-	      (pos1[0]      + pos1[1] + 
-	       pos1[width1] + pos1[width1 + 1]);
-	    pos1 += width1 * height1;
-	    pos2 += width2 * height2;
-	  }
+	const Dtype *g = diff2 + (h2 * width2 + w2) * step;
+	Dtype *a = row1a + 2 * w2 * step;
+	Dtype *b = row1b + 2 * w2 * step;
+	for (int k = 0; k < step; ++k) {
+	  const Dtype gk = quarter * g[k];
+	  a[k] += gk;
+	  a[step + k] += gk;
+	  b[k] += gk;
+	  b[step + k] += gk;
 	}
       }
     }
-    data1 = data2;
-    height1 = height2;
-    width1 = width2;
-    data2 += channels * height2 * width2;
   }
 }
 
@@ -289,9 +885,45 @@ template void caffe_cpu_interp2<float,true>(const int, const float *, const int,
 template void caffe_cpu_interp2<double,false>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
 template void caffe_cpu_interp2<double,true>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
 
+template void caffe_cpu_interp2_tables<float>(const int, const int, const int, const int, Interp2Tables<float> *);
+template void caffe_cpu_interp2_tables<double>(const int, const int, const int, const int, Interp2Tables<double> *);
+
+template void caffe_cpu_interp2<float,false>(const Interp2Tables<float> &, const int, const int, const float *, const int, const int, const int, const int, float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2<float,true>(const Interp2Tables<float> &, const int, const int, const float *, const int, const int, const int, const int, float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2<double,false>(const Interp2Tables<double> &, const int, const int, const double *, const int, const int, const int, const int, double *, const int, const int, const int, const int);
+template void caffe_cpu_interp2<double,true>(const Interp2Tables<double> &, const int, const int, const double *, const int, const int, const int, const int, double *, const int, const int, const int, const int);
+
+template void caffe_cpu_interp2_band<float>(const Interp2Tables<float> &, const int, const float *, const int, const int, const int, const int, const int, const int, float *);
+template void caffe_cpu_interp2_band<double>(const Interp2Tables<double> &, const int, const double *, const int, const int, const int, const int, const int, const int, double *);
+
+template void caffe_cpu_interp2_half<float,false>(const Interp2Tables<float> &, const int, const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<float,true>(const Interp2Tables<float> &, const int, const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<double,false>(const Interp2Tables<double> &, const int, const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, double *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<double,true>(const Interp2Tables<double> &, const int, const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, double *, const int, const int, const int, const int);
+
+template void caffe_cpu_interp2_half<float,false>(const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<float,true>(const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<double,false>(const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_half<double,true>(const StoragePrecision, const int, const uint16_t *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
+
+template void caffe_cpu_interp2_backward<float,false>(const Interp2Tables<float> &, const int, const int, float *, const int, const int, const int, const int, const float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<float,true>(const Interp2Tables<float> &, const int, const int, float *, const int, const int, const int, const int, const float *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<double,false>(const Interp2Tables<double> &, const int, const int, double *, const int, const int, const int, const int, const double *, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<double,true>(const Interp2Tables<double> &, const int, const int, double *, const int, const int, const int, const int, const double *, const int, const int, const int, const int);
 template void caffe_cpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<float,true>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
 template void caffe_cpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<double,true>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+
+template void caffe_cpu_pyramid2_backward<float,false>(const int, float *, const int, const int, const float *);
+template void caffe_cpu_pyramid2_backward<float,true>(const int, float *, const int, const int, const float *);
+template void caffe_cpu_pyramid2_backward<double,false>(const int, double *, const int, const int, const double *);
+template void caffe_cpu_pyramid2_backward<double,true>(const int, double *, const int, const int, const double *);
 
+template void caffe_cpu_pyramid2<float,false>(const int, const int, const float *, const int, const int, float *, const int);
+template void caffe_cpu_pyramid2<float,true>(const int, const int, const float *, const int, const int, float *, const int);
+template void caffe_cpu_pyramid2<double,false>(const int, const int, const double *, const int, const int, double *, const int);
+template void caffe_cpu_pyramid2<double,true>(const int, const int, const double *, const int, const int, double *, const int);
 template void caffe_cpu_pyramid2<float,false>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<float,true>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<double,false>(const int, const double *, const int, const int, double *, const int);
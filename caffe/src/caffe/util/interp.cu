@@ -250,6 +250,39 @@ void caffe_gpu_pyramid2(const int channels,
   }
 }
 
+// Backward (adjoint) of one level. One thread per element of diff, planes
+// of [height1 width1 step]: adds a quarter of the gradient of the level
+// pixel whose 2x2 block contains it.
+template <typename Dtype>
+__global__ void caffe_gpu_pyramid2_backward_kernel(const int n, const int step,
+    Dtype *diff1, const int height1, const int width1,
+    const Dtype *diff2, const int height2, const int width2) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int k = index % step;
+    const int w1 = (index / step) % width1;
+    const int h1 = (index / step / width1) % height1;
+    const int p = index / step / width1 / height1;
+    const int h2 = h1 / 2;
+    const int w2 = w1 / 2;
+    if (h2 < height2 && w2 < width2) {
+      diff1[index] += static_cast<Dtype>(.25) *
+	diff2[((p * height2 + h2) * width2 + w2) * step + k];
+    }
+  }
+}
+
+template <typename Dtype, bool packed>
+void caffe_gpu_pyramid2_backward(const int channels,
+    Dtype *diff, const int height, const int width,
+    const Dtype *diff_pyr) {
+  const int num_kernels = channels * height * width;
+  caffe_gpu_pyramid2_backward_kernel<Dtype>
+    <<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>
+    (num_kernels, packed ? channels : 1, diff, height, width, diff_pyr,
+     height / 2, width / 2);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 
 // Explicit instances
 template void caffe_gpu_interp2<float,false>(const int, const float *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int);
@@ -258,11 +291,18 @@ template void caffe_gpu_interp2<double,false>(const int, const double *, const i
 template void caffe_gpu_interp2<double,true>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
 
 template void caffe_gpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
+template void caffe_gpu_interp2_backward<float,true>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
 template void caffe_gpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+template void caffe_gpu_interp2_backward<double,true>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
 
 template void caffe_gpu_pyramid2<float,false>(const int, const float *, const int, const int, float *, const int);
 template void caffe_gpu_pyramid2<float,true>(const int, const float *, const int, const int, float *, const int);
 template void caffe_gpu_pyramid2<double,false>(const int, const double *, const int, const int, double *, const int);
 template void caffe_gpu_pyramid2<double,true>(const int, const double *, const int, const int, double *, const int);
 
+template void caffe_gpu_pyramid2_backward<float,false>(const int, float *, const int, const int, const float *);
+template void caffe_gpu_pyramid2_backward<float,true>(const int, float *, const int, const int, const float *);
+template void caffe_gpu_pyramid2_backward<double,false>(const int, double *, const int, const int, const double *);
+template void caffe_gpu_pyramid2_backward<double,true>(const int, double *, const int, const int, const double *);
+
 }  // namespace caffe
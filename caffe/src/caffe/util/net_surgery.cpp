@@ -0,0 +1,441 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <cmath>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/net_surgery.hpp"
+
+namespace caffe {
+
+// Values of a blob, stored in single or double precision
+static void blob_values(const BlobProto& blob, vector<double>* values) {
+  if (blob.double_data_size() > 0) {
+    values->assign(blob.double_data().begin(), blob.double_data().end());
+  } else {
+    values->assign(blob.data().begin(), blob.data().end());
+  }
+}
+
+static void set_blob_values(const vector<double>& values,
+    const bool double_precision, BlobProto* blob) {
+  if (double_precision) {
+    blob->clear_double_data();
+    for (int i = 0; i < values.size(); ++i) {
+      blob->add_double_data(values[i]);
+    }
+  } else {
+    blob->clear_data();
+    for (int i = 0; i < values.size(); ++i) {
+      blob->add_data(static_cast<float>(values[i]));
+    }
+  }
+}
+
+static LayerParameter* find_layer(const string& name, NetParameter* net) {
+  for (int i = 0; i < net->layer_size(); ++i) {
+    if (net->layer(i).name() == name) {
+      return net->mutable_layer(i);
+    }
+  }
+  return NULL;
+}
+
+static bool has_blob(const LayerParameter& layer, const string& blob,
+    const bool top) {
+  const int size = top ? layer.top_size() : layer.bottom_size();
+  for (int i = 0; i < size; ++i) {
+    if ((top ? layer.top(i) : layer.bottom(i)) == blob) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Keeps the layers of net that are not marked in removed, in order
+static void remove_layers(const vector<bool>& removed, NetParameter* net) {
+  NetParameter kept;
+  for (int i = 0; i < net->layer_size(); ++i) {
+    if (!removed[i]) {
+      kept.add_layer()->CopyFrom(net->layer(i));
+    }
+  }
+  net->mutable_layer()->Swap(kept.mutable_layer());
+}
+
+// Index of the Convolution producing the bottom of BN layer i, if the BN
+// layer alone reads its output, or -1
+static int foldable_convolution(const NetParameter& param, const int i) {
+  const LayerParameter& bn = param.layer(i);
+  if (bn.bottom_size() != 1 || bn.top_size() != 1) { return -1; }
+  const string& blob = bn.bottom(0);
+  int j = i - 1;
+  while (j >= 0 && !has_blob(param.layer(j), blob, true)) { --j; }
+  if (j < 0) { return -1; }
+  const LayerParameter& conv = param.layer(j);
+  if (conv.type() != "Convolution" || conv.top_size() != 1 ||
+      conv.convolution_param().axis() != 1 ||
+      conv.include_size() > 0 || conv.exclude_size() > 0) {
+    return -1;
+  }
+  const bool in_place = (bn.top(0) == blob);
+  for (int k = j + 1; k < param.layer_size(); ++k) {
+    if (k == i) {
+      if (in_place) { break; }
+      continue;
+    }
+    if (has_blob(param.layer(k), blob, false)) { return -1; }
+    if (has_blob(param.layer(k), blob, true)) { break; }
+  }
+  return j;
+}
+
+int FoldBNIntoConvolution(const Phase phase, NetParameter* param,
+    NetParameter* weights) {
+  CHECK_EQ(param->layers_size(), 0)
+    << "Upgrade the V1 net definition before folding.";
+  vector<bool> folded(param->layer_size(), false);
+  int num_folded = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    const LayerParameter& bn = param->layer(i);
+    if (bn.type() != "BN" || bn.include_size() > 0 || bn.exclude_size() > 0 ||
+        bn.bn_param().layout() != NCHW ||
+        !(bn.bn_param().frozen() || phase == TEST)) {
+      continue;
+    }
+    const int j = foldable_convolution(*param, i);
+    if (j < 0) { continue; }
+    LayerParameter* conv = param->mutable_layer(j);
+    LayerParameter* conv_weights = find_layer(conv->name(), weights);
+    LayerParameter* bn_weights = find_layer(bn.name(), weights);
+    if (!conv_weights || !bn_weights || bn_weights->blobs_size() != 4) {
+      LOG(WARNING) << "No trained weights to fold " << bn.name() << " into "
+                   << conv->name();
+      continue;
+    }
+    const bool bias_term = conv->convolution_param().bias_term();
+    CHECK_EQ(conv_weights->blobs_size(), bias_term ? 2 : 1)
+      << conv->name() << " has the wrong number of blobs.";
+    const int channels = conv->convolution_param().num_output();
+    vector<double> slope, bias, mean, variance, kernel, conv_bias;
+    blob_values(bn_weights->blobs(0), &slope);
+    blob_values(bn_weights->blobs(1), &bias);
+    blob_values(bn_weights->blobs(2), &mean);
+    blob_values(bn_weights->blobs(3), &variance);
+    blob_values(conv_weights->blobs(0), &kernel);
+    CHECK(slope.size() == channels && bias.size() == channels &&
+          mean.size() == channels && variance.size() == channels)
+      << bn.name() << " does not match the outputs of " << conv->name();
+    CHECK_EQ(kernel.size() % channels, 0);
+    if (bias_term) {
+      blob_values(conv_weights->blobs(1), &conv_bias);
+      CHECK_EQ(conv_bias.size(), channels);
+    } else {
+      conv_bias.assign(channels, 0.);
+    }
+    // y = slope * (conv(x) + b - mean) / sqrt(variance + eps) + bias
+    const int kernel_dim = kernel.size() / channels;
+    const double eps = bn.bn_param().eps();
+    for (int c = 0; c < channels; ++c) {
+      const double scale = slope[c] / std::sqrt(variance[c] + eps);
+      for (int k = 0; k < kernel_dim; ++k) {
+        kernel[c * kernel_dim + k] *= scale;
+      }
+      conv_bias[c] = scale * (conv_bias[c] - mean[c]) + bias[c];
+    }
+    const bool double_precision =
+      (conv_weights->blobs(0).double_data_size() > 0);
+    set_blob_values(kernel, double_precision, conv_weights->mutable_blobs(0));
+    if (!bias_term) {
+      conv_weights->add_blobs()->mutable_shape()->add_dim(channels);
+      conv->mutable_convolution_param()->set_bias_term(true);
+      if (conv_weights->has_convolution_param()) {
+        conv_weights->mutable_convolution_param()->set_bias_term(true);
+      }
+    }
+    set_blob_values(conv_bias, double_precision,
+        conv_weights->mutable_blobs(1));
+    // The convolution now writes the output of the BN layer
+    conv->set_top(0, bn.top(0));
+    if (conv_weights->top_size() == 1) {
+      conv_weights->set_top(0, bn.top(0));
+    }
+    folded[i] = true;
+    ++num_folded;
+  }
+  // Drop the folded BN layers from both nets, but keep their rectification
+  std::set<string> folded_names;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    if (!folded[i]) { continue; }
+    LayerParameter* bn = param->mutable_layer(i);
+    folded_names.insert(bn->name());
+    if (bn->bn_param().relu()) {
+      LayerParameter relu;
+      relu.set_name(bn->name());
+      relu.set_type("ReLU");
+      relu.add_bottom(bn->top(0));
+      relu.add_top(bn->top(0));
+      bn->Swap(&relu);
+      folded[i] = false;
+    }
+  }
+  remove_layers(folded, param);
+  vector<bool> folded_weights(weights->layer_size(), false);
+  for (int i = 0; i < weights->layer_size(); ++i) {
+    folded_weights[i] = folded_names.count(weights->layer(i).name()) > 0;
+  }
+  remove_layers(folded_weights, weights);
+  return num_folded;
+}
+
+int MergeBNReLU(NetParameter* param) {
+  CHECK_EQ(param->layers_size(), 0)
+    << "Upgrade the V1 net definition before merging.";
+  vector<bool> merged(param->layer_size(), false);
+  int num_merged = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    const LayerParameter& bn = param->layer(i);
+    if (bn.type() != "BN" || bn.bn_param().relu() || bn.top_size() != 1) {
+      continue;
+    }
+    // The first layer after the BN layer to use its output
+    const string& blob = bn.top(0);
+    int k = i + 1;
+    while (k < param->layer_size() && !has_blob(param->layer(k), blob, false)
+           && !has_blob(param->layer(k), blob, true)) {
+      ++k;
+    }
+    if (k == param->layer_size()) { continue; }
+    const LayerParameter& relu = param->layer(k);
+    if (relu.type() != "ReLU" || relu.bottom_size() != 1 ||
+        relu.top_size() != 1 || relu.bottom(0) != blob ||
+        relu.relu_param().negative_slope() != 0 ||
+        bn.include_size() > 0 || bn.exclude_size() > 0 ||
+        relu.include_size() > 0 || relu.exclude_size() > 0) {
+      continue;
+    }
+    // Unless in place, no other layer may read the output of the BN layer
+    bool shared = false;
+    if (relu.top(0) != blob) {
+      for (int j = k + 1; j < param->layer_size() && !shared; ++j) {
+        if (has_blob(param->layer(j), blob, true)) { break; }
+        shared = has_blob(param->layer(j), blob, false);
+      }
+    }
+    if (shared) { continue; }
+    LayerParameter* merged_bn = param->mutable_layer(i);
+    merged_bn->mutable_bn_param()->set_relu(true);
+    merged_bn->set_top(0, relu.top(0));
+    merged[k] = true;
+    ++num_merged;
+  }
+  remove_layers(merged, param);
+  return num_merged;
+}
+
+typedef std::map<string, shared_ptr<Blob<float> > > BlobValues;
+
+// name, or name followed by a number, whichever is not in names yet
+static string unique_name(const string& name, std::set<string>* names) {
+  string unique = name;
+  for (int i = 1; names->count(unique); ++i) {
+    std::ostringstream numbered;
+    numbered << name << "_" << i;
+    unique = numbered.str();
+  }
+  names->insert(unique);
+  return unique;
+}
+
+// Tops of a DummyData layer if all its fillers are constant
+static bool dummy_data_values(const LayerParameter& layer,
+    vector<shared_ptr<Blob<float> > >* tops) {
+  const DummyDataParameter& param = layer.dummy_data_param();
+  for (int t = 0; t < layer.top_size(); ++t) {
+    const FillerParameter filler = (param.data_filler_size() == 0) ?
+      FillerParameter() :
+      param.data_filler((param.data_filler_size() == 1) ? 0 : t);
+    if (filler.type() != "constant") { return false; }
+    shared_ptr<Blob<float> > top(new Blob<float>());
+    if (param.shape_size() > 0) {
+      top->Reshape(param.shape((param.shape_size() == 1) ? 0 : t));
+    } else {
+      // Legacy 4D sizes
+      const int i = (param.num_size() == 1) ? 0 : t;
+      top->Reshape(param.num(i), param.channels(i), param.height(i),
+          param.width(i));
+    }
+    caffe_set(top->count(), filler.value(), top->mutable_cpu_data());
+    tops->push_back(top);
+  }
+  return true;
+}
+
+// Runs the layer in the TEST phase, with its trained weights, on the
+// constant values of its bottoms
+static bool evaluate_layer(const LayerParameter& layer,
+    const BlobValues& values, NetParameter* weights,
+    vector<shared_ptr<Blob<float> > >* tops) {
+  LayerParameter layer_param(layer);
+  layer_param.set_phase(TEST);
+  shared_ptr<Layer<float> > evaluated =
+    LayerRegistry<float>::CreateLayer(layer_param);
+  vector<Blob<float>*> bottom_vec, top_vec;
+  for (int i = 0; i < layer.bottom_size(); ++i) {
+    bottom_vec.push_back(values.find(layer.bottom(i))->second.get());
+  }
+  // Out of place, so that the bottom values stay as they are
+  for (int i = 0; i < layer.top_size(); ++i) {
+    tops->push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+    top_vec.push_back(tops->back().get());
+  }
+  evaluated->SetUp(bottom_vec, top_vec);
+  const int num_blobs = evaluated->blobs().size();
+  if (num_blobs > 0) {
+    const LayerParameter* trained = find_layer(layer.name(), weights);
+    if (!trained || trained->blobs_size() != num_blobs) {
+      LOG(WARNING) << "No trained weights to evaluate " << layer.name();
+      return false;
+    }
+    for (int i = 0; i < num_blobs; ++i) {
+      evaluated->blobs()[i]->FromProto(trained->blobs(i), false);
+    }
+  }
+  evaluated->Forward(bottom_vec, top_vec);
+  return true;
+}
+
+int FoldConstantLayers(NetParameter* param, NetParameter* weights) {
+  CHECK_EQ(param->layers_size(), 0)
+    << "Upgrade the V1 net definition before folding.";
+  // Current constant blobs, the layer that computed them, and those already
+  // read by a constant layer
+  BlobValues values;
+  std::map<string, int> producer;
+  std::set<string> read;
+  // Constant blobs read by the rest of the net or left as outputs
+  BlobValues exported;
+  std::map<string, int> exported_producer;
+  vector<bool> constant(param->layer_size(), false);
+  for (int i = 0; i < param->layer_size(); ++i) {
+    const LayerParameter& layer = param->layer(i);
+    bool is_constant = (layer.include_size() == 0 &&
+        layer.exclude_size() == 0 && layer.loss_weight_size() == 0);
+    // A constant layer may not overwrite a blob the rest of the net reads
+    for (int j = 0; j < layer.top_size() && is_constant; ++j) {
+      is_constant = !exported.count(layer.top(j));
+    }
+    if (layer.type() != "DummyData") {
+      is_constant = is_constant && layer.bottom_size() > 0;
+      for (int j = 0; j < layer.bottom_size() && is_constant; ++j) {
+        is_constant = values.count(layer.bottom(j)) > 0;
+      }
+    }
+    vector<shared_ptr<Blob<float> > > tops;
+    if (is_constant) {
+      is_constant = (layer.type() == "DummyData") ?
+        dummy_data_values(layer, &tops) :
+        evaluate_layer(layer, values, weights, &tops);
+    }
+    if (is_constant) {
+      constant[i] = true;
+      for (int j = 0; j < layer.bottom_size(); ++j) {
+        read.insert(layer.bottom(j));
+      }
+      for (int j = 0; j < layer.top_size(); ++j) {
+        values[layer.top(j)] = tops[j];
+        producer[layer.top(j)] = i;
+        read.erase(layer.top(j));
+      }
+      continue;
+    }
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      const string& bottom = layer.bottom(j);
+      if (values.count(bottom) && !exported.count(bottom)) {
+        exported[bottom] = values[bottom];
+        exported_producer[bottom] = producer[bottom];
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      values.erase(layer.top(j));
+    }
+  }
+  for (BlobValues::iterator it = values.begin(); it != values.end(); ++it) {
+    if (!read.count(it->first) && !exported.count(it->first)) {
+      exported[it->first] = it->second;
+      exported_producer[it->first] = producer[it->first];
+    }
+  }
+  // Replace the constant layers by Parameter layers holding the values they
+  // export, except the DummyData layers, which are kept as they are. The
+  // Parameter layers are named after their top with a "_folded" suffix, and
+  // a number if another layer has this name already.
+  int num_folded = 0;
+  std::set<string> folded_names, names;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    names.insert(param->layer(i).name());
+  }
+  NetParameter folded, folded_weights;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    const LayerParameter& layer = param->layer(i);
+    bool keep = !constant[i];
+    for (int j = 0; j < layer.top_size() && !keep; ++j) {
+      const string& top = layer.top(j);
+      keep = (layer.type() == "DummyData" && exported.count(top) &&
+          exported_producer[top] == i);
+    }
+    if (keep) {
+      folded.add_layer()->CopyFrom(layer);
+      continue;
+    }
+    ++num_folded;
+    folded_names.insert(layer.name());
+    for (int j = 0; j < layer.top_size(); ++j) {
+      const string& top = layer.top(j);
+      if (!exported.count(top) || exported_producer[top] != i) { continue; }
+      const Blob<float>& value = *exported[top];
+      const string name = unique_name(top + "_folded", &names);
+      LayerParameter* parameter = folded.add_layer();
+      parameter->set_name(name);
+      parameter->set_type("Parameter");
+      parameter->add_top(top);
+      parameter->add_param()->set_lr_mult(0);
+      BlobShape* shape = parameter->mutable_parameter_param()->mutable_shape();
+      for (int k = 0; k < value.num_axes(); ++k) {
+        shape->add_dim(value.shape(k));
+      }
+      LayerParameter* parameter_weights = folded_weights.add_layer();
+      parameter_weights->set_name(name);
+      parameter_weights->set_type("Parameter");
+      value.ToProto(parameter_weights->add_blobs());
+    }
+  }
+  std::set<string> folded_layer_names;
+  for (int i = 0; i < folded.layer_size(); ++i) {
+    CHECK(folded_layer_names.insert(folded.layer(i).name()).second)
+      << "Duplicate layer name " << folded.layer(i).name()
+      << " after folding.";
+  }
+  param->mutable_layer()->Swap(folded.mutable_layer());
+  vector<bool> removed(weights->layer_size(), false);
+  for (int i = 0; i < weights->layer_size(); ++i) {
+    removed[i] = folded_names.count(weights->layer(i).name()) > 0;
+  }
+  remove_layers(removed, weights);
+  for (int i = 0; i < folded_weights.layer_size(); ++i) {
+    weights->add_layer()->CopyFrom(folded_weights.layer(i));
+  }
+  return num_folded;
+}
+
+}  // namespace caffe
@@ -0,0 +1,131 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+static int cpu_parallel_grain = 32768;
+
+int caffe_cpu_parallel_grain() {
+  return cpu_parallel_grain;
+}
+
+void caffe_cpu_set_parallel_grain(const int grain) {
+  CHECK_GT(grain, 0);
+  cpu_parallel_grain = grain;
+}
+
+// Worker threads waiting for the tasks of the thread that owns the pool.
+// Worker t runs chunk t of each task that has more than t + 1 chunks.
+class CpuThreadPool {
+ public:
+  CpuThreadPool()
+      : task_(NULL), chunks_(0), pending_(0), generation_(0), running_(false),
+        stop_(false) {}
+  ~CpuThreadPool() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    workers_.join_all();
+  }
+
+  void Run(const int chunks, const boost::function<void(int)>& task) {
+    if (running_) {
+      // A task of this pool runs this one: no worker is free
+      for (int t = 0; t < chunks; ++t) {
+        task(t);
+      }
+      return;
+    }
+    while (workers_.size() < chunks - 1) {
+      workers_.create_thread(boost::bind(&CpuThreadPool::Work, this,
+          static_cast<int>(workers_.size()), generation_));
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      task_ = &task;
+      chunks_ = chunks;
+      pending_ = chunks - 1;
+      ++generation_;
+      running_ = true;
+    }
+    start_.notify_all();
+    task(chunks - 1);
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending_ > 0) {
+      done_.wait(lock);
+    }
+    task_ = NULL;
+    running_ = false;
+  }
+
+  // Whether the calling thread is a worker of some pool
+  static bool InWorker() { return in_worker_.get() != NULL; }
+
+ private:
+  void Work(const int index, unsigned int generation) {
+    in_worker_.reset(new bool(true));
+    for (;;) {
+      const boost::function<void(int)>* task;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (!stop_ && generation_ == generation) {
+          start_.wait(lock);
+        }
+        if (stop_) {
+          return;
+        }
+        generation = generation_;
+        if (index >= chunks_ - 1) {
+          continue;
+        }
+        task = task_;
+      }
+      (*task)(index);
+      boost::mutex::scoped_lock lock(mutex_);
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  boost::thread_group workers_;
+  boost::mutex mutex_;
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+  const boost::function<void(int)>* task_;
+  int chunks_;
+  int pending_;
+  unsigned int generation_;
+  bool running_;
+  bool stop_;
+
+  static boost::thread_specific_ptr<bool> in_worker_;
+};
+
+boost::thread_specific_ptr<bool> CpuThreadPool::in_worker_;
+
+static boost::thread_specific_ptr<CpuThreadPool> cpu_thread_pool;
+
+void caffe_cpu_parallel_run(const int chunks,
+    const boost::function<void(int)>& task) {
+  if (chunks == 1 || CpuThreadPool::InWorker()) {
+    for (int t = 0; t < chunks; ++t) {
+      task(t);
+    }
+    return;
+  }
+  if (!cpu_thread_pool.get()) {
+    cpu_thread_pool.reset(new CpuThreadPool());
+  }
+  cpu_thread_pool->Run(chunks, task);
+}
+
+}  // namespace caffe
@@ -0,0 +1,65 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+static inline uint8_t quantize_u8(const Dtype x, const Dtype inv_scale,
+    const Dtype zero_point) {
+  Dtype q = x * inv_scale + zero_point;
+  // The cast is undefined outside [0, 256), so NaN, which fails every
+  // comparison of the clamp, is stored as the zero point
+  if (q != q) {
+    q = zero_point;
+  }
+  q = std::min(std::max(q, Dtype(0)), Dtype(255));
+  // After the clamp, adding 0.5 and truncating rounds to nearest
+  return static_cast<uint8_t>(q + Dtype(0.5));
+}
+
+template <typename Dtype>
+void caffe_cpu_quantize_u8(const int count, const Dtype scale,
+    const int zero_point, const Dtype *x, uint8_t *y) {
+  CHECK_GT(scale, 0);
+  const Dtype inv_scale = Dtype(1) / scale;
+  const Dtype zp = zero_point;
+  for (int i = 0; i < count; ++i) {
+    y[i] = quantize_u8(x[i], inv_scale, zp);
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_quantize_u8_packed(const int channels, const int count,
+    const Dtype *scale, const int *zero_point, const Dtype *x, uint8_t *y) {
+  std::vector<Dtype> inv_scale(channels);
+  std::vector<Dtype> zp(channels);
+  for (int c = 0; c < channels; ++c) {
+    CHECK_GT(scale[c], 0);
+    inv_scale[c] = Dtype(1) / scale[c];
+    zp[c] = zero_point[c];
+  }
+  for (int i = 0; i < count; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      y[i * channels + c] = quantize_u8(x[i * channels + c], inv_scale[c],
+                                        zp[c]);
+    }
+  }
+}
+
+template void caffe_cpu_quantize_u8<float>(const int, const float, const int,
+    const float *, uint8_t *);
+template void caffe_cpu_quantize_u8<double>(const int, const double,
+    const int, const double *, uint8_t *);
+template void caffe_cpu_quantize_u8_packed<float>(const int, const int,
+    const float *, const int *, const float *, uint8_t *);
+template void caffe_cpu_quantize_u8_packed<double>(const int, const int,
+    const double *, const int *, const double *, uint8_t *);
+
+}  // namespace caffe
@@ -0,0 +1,965 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/cpu_features.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/warp.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_WARP_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+// Bilinear sampling of pixel (h, w) displaced by (flow_y, flow_x)
+// OUT: o [4] source offsets, o[0] < 0 for a TRUNCATE outlier
+//      wgt [4] tap weights, theta_x, theta_y interpolation coordinates
+template <typename Dtype>
+static inline void warp_sample(const WarpParameter_WarpType outliers,
+    const int height, const int width, const int h, const int w,
+    const Dtype flow_y, const Dtype flow_x, int *o, Dtype *wgt,
+    Dtype *theta_x_out, Dtype *theta_y_out) {
+  const Dtype x_w = h + flow_x;
+  const Dtype y_w = w + flow_y;
+  int xw_floor = (int)std::floor(x_w);
+  int yw_floor = (int)std::floor(y_w);
+  int xw_ceil = (int)std::ceil(x_w);
+  int yw_ceil = (int)std::ceil(y_w);
+  Dtype theta_x = x_w - std::floor(x_w);
+  Dtype theta_y = y_w - std::floor(y_w);
+  if (outliers == WarpParameter_WarpType_NEAREST) {
+    if (x_w < 0) {
+      theta_x = x_w;
+      xw_floor = 0; xw_ceil = 0;
+    }
+    if (x_w >= height - 1) {
+      theta_x = x_w - height;
+      xw_floor = height - 1; xw_ceil = height - 1;
+    }
+    if (y_w < 0) {
+      theta_y = y_w;
+      yw_floor = 0; yw_ceil = 0;
+    }
+    if (y_w >= width - 1) {
+      theta_y = y_w - width;
+      yw_floor = width - 1; yw_ceil = width - 1;
+    }
+  }
+  *theta_x_out = theta_x;
+  *theta_y_out = theta_y;
+  if (outliers == WarpParameter_WarpType_TRUNCATE &&
+      (x_w < 0 || x_w > height - 1 || y_w < 0 || y_w > width - 1)) {
+    o[0] = -1;
+    o[1] = 0; o[2] = 0; o[3] = 0;
+    wgt[0] = 0; wgt[1] = 0; wgt[2] = 0; wgt[3] = 0;
+    return;
+  }
+  const Dtype theta_x_ = 1 - theta_x;
+  const Dtype theta_y_ = 1 - theta_y;
+  o[0] = xw_floor * width + yw_floor;
+  o[1] = xw_ceil  * width + yw_floor;
+  o[2] = xw_floor * width + yw_ceil;
+  o[3] = xw_ceil  * width + yw_ceil;
+  wgt[0] = theta_x_ * theta_y_;
+  wgt[1] = theta_x  * theta_y_;
+  wgt[2] = theta_x_ * theta_y;
+  wgt[3] = theta_x  * theta_y;
+}
+
+// Flow of pixel (h, w) of a [height width] image, resampled from a
+// [flow_height flow_width] field as caffe_cpu_interp2 does and scaled.
+template <typename Dtype>
+static inline void warp_flow_at(const int height, const int width,
+    const Dtype *flow, const int flow_height, const int flow_width,
+    const Dtype flow_scale, const int h, const int w,
+    Dtype *flow_y, Dtype *flow_x) {
+  const int flow_count = flow_height * flow_width;
+  if (flow_height == height && flow_width == width) {
+    const int index = h * width + w;
+    *flow_y = flow_scale * flow[index];
+    *flow_x = flow_scale * flow[flow_count + index];
+    return;
+  }
+  const float rheight = (height > 1) ?
+      static_cast<float>(flow_height - 1) / (height - 1) : 0.f;
+  const float rwidth = (width > 1) ?
+      static_cast<float>(flow_width - 1) / (width - 1) : 0.f;
+  const float h1r = rheight * h;
+  const int h1 = h1r;
+  const int h1p = (h1 < flow_height - 1) ? flow_width : 0;
+  const Dtype h1lambda = h1r - h1;
+  const Dtype h0lambda = Dtype(1.) - h1lambda;
+  const float w1r = rwidth * w;
+  const int w1 = w1r;
+  const int w1p = (w1 < flow_width - 1) ? 1 : 0;
+  const Dtype w1lambda = w1r - w1;
+  const Dtype w0lambda = Dtype(1.) - w1lambda;
+  const Dtype *pos = flow + h1 * flow_width + w1;
+  *flow_y = flow_scale *
+      (h0lambda * (w0lambda * pos[0]   + w1lambda * pos[w1p]) +
+       h1lambda * (w0lambda * pos[h1p] + w1lambda * pos[h1p + w1p]));
+  pos += flow_count;
+  *flow_x = flow_scale *
+      (h0lambda * (w0lambda * pos[0]   + w1lambda * pos[w1p]) +
+       h1lambda * (w0lambda * pos[h1p] + w1lambda * pos[h1p + w1p]));
+}
+
+// Bilinear sampling plan of an optical flow field
+// IN : flow [2 flow_height flow_width]
+// OUT: offset, weight [4 height width], theta [2 height width]
+template <typename Dtype>
+void caffe_cpu_warp_plan(const WarpParameter_WarpType outliers,
+    const int height, const int width, const Dtype *flow,
+    const int flow_height, const int flow_width, const Dtype flow_scale,
+    const int row_begin, const int row_end,
+    int *offset, Dtype *weight, Dtype *theta) {
+  CHECK(height > 0 && width > 0 && flow_height > 0 && flow_width > 0);
+  CHECK(row_begin >= 0 && row_begin <= row_end && row_end <= height);
+  const int count = height * width;
+  for (int h = row_begin; h < row_end; ++h) {
+    for (int w = 0; w < width; ++w) {
+      const int index = h * width + w;
+      int o[kWarpTaps];
+      Dtype wgt[kWarpTaps];
+      Dtype flow_y, flow_x;
+      warp_flow_at(height, width, flow, flow_height, flow_width, flow_scale,
+          h, w, &flow_y, &flow_x);
+      warp_sample(outliers, height, width, h, w, flow_y, flow_x, o, wgt,
+          &theta[count + index], &theta[index]);
+      for (int k = 0; k < kWarpTaps; ++k) {
+        offset[k * count + index] = o[k];
+        weight[k * count + index] = wgt[k];
+      }
+    }
+  }
+}
+
+// Sampling plan of one row of an optical flow field
+// IN : flow [2 flow_height flow_width]
+// OUT: offset, weight [4 width]
+template <typename Dtype>
+void caffe_cpu_warp_plan_row(const WarpParameter_WarpType outliers,
+    const int height, const int width, const Dtype *flow,
+    const int flow_height, const int flow_width, const Dtype flow_scale,
+    const int h, int *offset, Dtype *weight) {
+  CHECK(h >= 0 && h < height && flow_height > 0 && flow_width > 0);
+  for (int w = 0; w < width; ++w) {
+    int o[kWarpTaps];
+    Dtype wgt[kWarpTaps];
+    Dtype flow_y, flow_x, theta_x, theta_y;
+    warp_flow_at(height, width, flow, flow_height, flow_width, flow_scale,
+        h, w, &flow_y, &flow_x);
+    warp_sample(outliers, height, width, h, w, flow_y, flow_x, o, wgt,
+        &theta_x, &theta_y);
+    for (int k = 0; k < kWarpTaps; ++k) {
+      offset[k * width + w] = o[k];
+      weight[k * width + w] = wgt[k];
+    }
+  }
+}
+
+// Gathers and blends one channel plane according to a sampling plan
+// IN : data1 [height width]
+// OUT: data2 [count]
+template <typename Dtype>
+static void warp_blend_scalar(const int begin, const int count,
+    const Dtype *data1, const int *offset, const Dtype *weight,
+    Dtype *data2) {
+  const int *offset1 = offset + count;
+  const int *offset2 = offset + 2 * count;
+  const int *offset3 = offset + 3 * count;
+  const Dtype *weight1 = weight + count;
+  const Dtype *weight2 = weight + 2 * count;
+  const Dtype *weight3 = weight + 3 * count;
+  for (int i = begin; i < count; ++i) {
+    if (offset[i] < 0) {
+      data2[i] = 0;
+      continue;
+    }
+    data2[i] = weight[i]  * data1[offset[i]] +
+               weight1[i] * data1[offset1[i]] +
+               weight2[i] * data1[offset2[i]] +
+               weight3[i] * data1[offset3[i]];
+  }
+}
+
+#ifdef CAFFE_WARP_X86
+// Vectorized blends. Each kernel processes as many whole vectors as fit in
+// count and returns the index of the first pixel left for the scalar tail.
+// The products are summed in the same order as warp_blend_scalar. TRUNCATE
+// outliers have offset -1 in tap 0 and offset 0 in the other taps: tap 0 is
+// clamped to a valid address and the result is masked to zero.
+
+__attribute__((target("sse4.2")))
+static inline __m128 warp_gather_sse42(const float *data1, const __m128i idx) {
+  return _mm_setr_ps(data1[_mm_extract_epi32(idx, 0)],
+                     data1[_mm_extract_epi32(idx, 1)],
+                     data1[_mm_extract_epi32(idx, 2)],
+                     data1[_mm_extract_epi32(idx, 3)]);
+}
+
+__attribute__((target("sse4.2")))
+static int warp_blend_sse42(const int count, const float *data1,
+    const int *offset, const float *weight, float *data2) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i o0 = _mm_loadu_si128((const __m128i *)(offset + i));
+    const __m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(o0, minus_one));
+    __m128 sum = _mm_mul_ps(_mm_loadu_ps(weight + i),
+        warp_gather_sse42(data1, _mm_max_epi32(o0, zero)));
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const __m128i o = _mm_loadu_si128(
+          (const __m128i *)(offset + k * count + i));
+      sum = _mm_add_ps(sum, _mm_mul_ps(
+          _mm_loadu_ps(weight + k * count + i), warp_gather_sse42(data1, o)));
+    }
+    _mm_storeu_ps(data2 + i, _mm_and_ps(sum, valid));
+  }
+  return i;
+}
+
+__attribute__((target("sse4.2")))
+static int warp_blend_sse42(const int count, const double *data1,
+    const int *offset, const double *weight, double *data2) {
+  int i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const int v0 = offset[i] >= 0, v1 = offset[i + 1] >= 0;
+    const __m128d valid = _mm_castsi128_pd(_mm_set_epi64x(-v1, -v0));
+    __m128d sum = _mm_mul_pd(_mm_loadu_pd(weight + i),
+        _mm_setr_pd(data1[v0 ? offset[i] : 0],
+                    data1[v1 ? offset[i + 1] : 0]));
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const int *o = offset + k * count + i;
+      sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(weight + k * count + i),
+          _mm_setr_pd(data1[o[0]], data1[o[1]])));
+    }
+    _mm_storeu_pd(data2 + i, _mm_and_pd(sum, valid));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int warp_blend_avx2(const int count, const float *data1,
+    const int *offset, const float *weight, float *data2) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i o0 = _mm256_loadu_si256((const __m256i *)(offset + i));
+    const __m256 valid = _mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(o0, minus_one));
+    __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(weight + i),
+        _mm256_i32gather_ps(data1, _mm256_max_epi32(o0, zero), 4));
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const __m256i o = _mm256_loadu_si256(
+          (const __m256i *)(offset + k * count + i));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(
+          _mm256_loadu_ps(weight + k * count + i),
+          _mm256_i32gather_ps(data1, o, 4)));
+    }
+    _mm256_storeu_ps(data2 + i, _mm256_and_ps(sum, valid));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int warp_blend_avx2(const int count, const double *data1,
+    const int *offset, const double *weight, double *data2) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i o0 = _mm_loadu_si128((const __m128i *)(offset + i));
+    const __m256d valid = _mm256_castsi256_pd(
+        _mm256_cvtepi32_epi64(_mm_cmpgt_epi32(o0, minus_one)));
+    __m256d sum = _mm256_mul_pd(_mm256_loadu_pd(weight + i),
+        _mm256_i32gather_pd(data1, _mm_max_epi32(o0, zero), 8));
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const __m128i o = _mm_loadu_si128(
+          (const __m128i *)(offset + k * count + i));
+      sum = _mm256_add_pd(sum, _mm256_mul_pd(
+          _mm256_loadu_pd(weight + k * count + i),
+          _mm256_i32gather_pd(data1, o, 8)));
+    }
+    _mm256_storeu_pd(data2 + i, _mm256_and_pd(sum, valid));
+  }
+  return i;
+}
+
+// The AVX-512 target implies FMA: the products use the explicit rounding
+// form, which the compiler does not contract with the following add.
+#define WARP_ROUND (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+
+__attribute__((target("avx512f")))
+static int warp_blend_avx512(const int count, const float *data1,
+    const int *offset, const float *weight, float *data2) {
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512i minus_one = _mm512_set1_epi32(-1);
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512i o0 = _mm512_loadu_si512(offset + i);
+    const __mmask16 valid = _mm512_cmpgt_epi32_mask(o0, minus_one);
+    __m512 sum = _mm512_mul_round_ps(_mm512_loadu_ps(weight + i),
+        _mm512_mask_i32gather_ps(zero, valid, o0, data1, 4), WARP_ROUND);
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const __m512i o = _mm512_loadu_si512(offset + k * count + i);
+      sum = _mm512_add_ps(sum, _mm512_mul_round_ps(
+          _mm512_loadu_ps(weight + k * count + i),
+          _mm512_i32gather_ps(o, data1, 4), WARP_ROUND));
+    }
+    _mm512_storeu_ps(data2 + i, _mm512_maskz_mov_ps(valid, sum));
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+static int warp_blend_avx512(const int count, const double *data1,
+    const int *offset, const double *weight, double *data2) {
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512i minus_one = _mm512_set1_epi64(-1);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i o0 = _mm256_loadu_si256((const __m256i *)(offset + i));
+    const __mmask8 valid = _mm512_cmpgt_epi64_mask(
+        _mm512_cvtepi32_epi64(o0), minus_one);
+    __m512d sum = _mm512_mul_round_pd(_mm512_loadu_pd(weight + i),
+        _mm512_mask_i32gather_pd(zero, valid, o0, data1, 8), WARP_ROUND);
+    for (int k = 1; k < kWarpTaps; ++k) {
+      const __m256i o = _mm256_loadu_si256(
+          (const __m256i *)(offset + k * count + i));
+      sum = _mm512_add_pd(sum, _mm512_mul_round_pd(
+          _mm512_loadu_pd(weight + k * count + i),
+          _mm512_i32gather_pd(o, data1, 8), WARP_ROUND));
+    }
+    _mm512_storeu_pd(data2 + i, _mm512_maskz_mov_pd(valid, sum));
+  }
+  return i;
+}
+
+#undef WARP_ROUND
+#endif  // CAFFE_WARP_X86
+
+template <typename Dtype>
+void caffe_cpu_warp_blend(const CpuSimdLevel level, const int count,
+    const Dtype *data1, const int *offset, const Dtype *weight,
+    Dtype *data2) {
+  CHECK_LE(level, caffe_cpu_simd_level()) << "SIMD level not supported.";
+  int begin = 0;
+#ifdef CAFFE_WARP_X86
+  // No kernel is specific to AVX, whose integer vectors are 128 bits wide
+  if (level >= CPU_SIMD_AVX512) {
+    begin = warp_blend_avx512(count, data1, offset, weight, data2);
+  } else if (level >= CPU_SIMD_AVX2) {
+    begin = warp_blend_avx2(count, data1, offset, weight, data2);
+  } else if (level >= CPU_SIMD_SSE42) {
+    begin = warp_blend_sse42(count, data1, offset, weight, data2);
+  }
+#endif
+  warp_blend_scalar(begin, count, data1, offset, weight, data2);
+}
+
+template <typename Dtype>
+void caffe_cpu_warp_blend(const int count, const Dtype *data1,
+    const int *offset, const Dtype *weight, Dtype *data2) {
+  caffe_cpu_warp_blend(caffe_cpu_simd_level(), count, data1, offset, weight,
+                       data2);
+}
+
+// Channels-last gather and blend of the pixels [begin, end)
+// IN : data1 [height width channels]
+// OUT: data2 [count channels]
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed(const int channels, const int count,
+    const int begin, const int end, const Dtype *data1, const int *offset,
+    const Dtype *weight, Dtype *data2) {
+  CHECK(begin >= 0 && begin <= end && end <= count);
+  for (int i = begin; i < end; ++i) {
+    Dtype* dst = data2 + i * channels;
+    if (offset[i] < 0) {
+      for (int c = 0; c < channels; ++c) {
+        dst[c] = 0;
+      }
+      continue;
+    }
+    const Dtype* src0 = data1 + offset[i] * channels;
+    const Dtype* src1 = data1 + offset[count + i] * channels;
+    const Dtype* src2 = data1 + offset[2 * count + i] * channels;
+    const Dtype* src3 = data1 + offset[3 * count + i] * channels;
+    const Dtype w0 = weight[i];
+    const Dtype w1 = weight[count + i];
+    const Dtype w2 = weight[2 * count + i];
+    const Dtype w3 = weight[3 * count + i];
+    for (int c = 0; c < channels; ++c) {
+      dst[c] = w0 * src0[c] + w1 * src1[c] + w2 * src2[c] + w3 * src3[c];
+    }
+  }
+}
+
+// Gather and blend of one plane stored in 16 bits
+template <typename Dtype, StoragePrecision precision>
+static void warp_blend_stored(const int count, const uint16_t *data1,
+    const int *offset, const Dtype *weight, Dtype *data2) {
+  typedef StorageLoad<Dtype, precision> Load;
+  for (int i = 0; i < count; ++i) {
+    if (offset[i] < 0) {
+      data2[i] = 0;
+      continue;
+    }
+    data2[i] = weight[i] * Load::load(data1[offset[i]]) +
+        weight[count + i] * Load::load(data1[offset[count + i]]) +
+        weight[2 * count + i] * Load::load(data1[offset[2 * count + i]]) +
+        weight[3 * count + i] * Load::load(data1[offset[3 * count + i]]);
+  }
+}
+
+// Channels-last gather and blend of the pixels [begin, end) stored in 16
+// bits
+template <typename Dtype, StoragePrecision precision>
+static void warp_blend_packed_stored(const int channels, const int count,
+    const int begin, const int end, const uint16_t *data1, const int *offset,
+    const Dtype *weight, Dtype *data2) {
+  typedef StorageLoad<Dtype, precision> Load;
+  for (int i = begin; i < end; ++i) {
+    Dtype* dst = data2 + i * channels;
+    if (offset[i] < 0) {
+      for (int c = 0; c < channels; ++c) {
+        dst[c] = 0;
+      }
+      continue;
+    }
+    const uint16_t* src0 = data1 + offset[i] * channels;
+    const uint16_t* src1 = data1 + offset[count + i] * channels;
+    const uint16_t* src2 = data1 + offset[2 * count + i] * channels;
+    const uint16_t* src3 = data1 + offset[3 * count + i] * channels;
+    const Dtype w0 = weight[i];
+    const Dtype w1 = weight[count + i];
+    const Dtype w2 = weight[2 * count + i];
+    const Dtype w3 = weight[3 * count + i];
+    for (int c = 0; c < channels; ++c) {
+      dst[c] = w0 * Load::load(src0[c]) + w1 * Load::load(src1[c]) +
+               w2 * Load::load(src2[c]) + w3 * Load::load(src3[c]);
+    }
+  }
+}
+
+#ifdef CAFFE_WARP_X86
+// F16C versions of the float kernels above for IEEE half storage. Channels
+// are widened 8 at a time in the packed kernel. The sums keep the order of
+// the scalar code. The compiler may use AVX instructions in all of them.
+__attribute__((target("f16c")))
+static void warp_blend_fp16_f16c(const int count, const uint16_t *data1,
+    const int *offset, const float *weight, float *data2) {
+  for (int i = 0; i < count; ++i) {
+    if (offset[i] < 0) {
+      data2[i] = 0;
+      continue;
+    }
+    data2[i] = weight[i] * _cvtsh_ss(data1[offset[i]]) +
+        weight[count + i] * _cvtsh_ss(data1[offset[count + i]]) +
+        weight[2 * count + i] * _cvtsh_ss(data1[offset[2 * count + i]]) +
+        weight[3 * count + i] * _cvtsh_ss(data1[offset[3 * count + i]]);
+  }
+}
+
+__attribute__((target("avx,f16c")))
+static inline __m256 warp_load8_fp16(const uint16_t *x) {
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+}
+
+__attribute__((target("avx,f16c")))
+static void warp_blend_packed_fp16_f16c(const int channels, const int count,
+    const int begin, const int end, const uint16_t *data1, const int *offset,
+    const float *weight, float *data2) {
+  for (int i = begin; i < end; ++i) {
+    float* dst = data2 + i * channels;
+    if (offset[i] < 0) {
+      for (int c = 0; c < channels; ++c) {
+        dst[c] = 0;
+      }
+      continue;
+    }
+    const uint16_t* src0 = data1 + offset[i] * channels;
+    const uint16_t* src1 = data1 + offset[count + i] * channels;
+    const uint16_t* src2 = data1 + offset[2 * count + i] * channels;
+    const uint16_t* src3 = data1 + offset[3 * count + i] * channels;
+    const float w0 = weight[i];
+    const float w1 = weight[count + i];
+    const float w2 = weight[2 * count + i];
+    const float w3 = weight[3 * count + i];
+    const __m256 vw0 = _mm256_set1_ps(w0);
+    const __m256 vw1 = _mm256_set1_ps(w1);
+    const __m256 vw2 = _mm256_set1_ps(w2);
+    const __m256 vw3 = _mm256_set1_ps(w3);
+    int c = 0;
+    for (; c + 8 <= channels; c += 8) {
+      __m256 sum = _mm256_mul_ps(vw0, warp_load8_fp16(src0 + c));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(vw1, warp_load8_fp16(src1 + c)));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(vw2, warp_load8_fp16(src2 + c)));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(vw3, warp_load8_fp16(src3 + c)));
+      _mm256_storeu_ps(dst + c, sum);
+    }
+    for (; c < channels; ++c) {
+      dst[c] = w0 * _cvtsh_ss(src0[c]) + w1 * _cvtsh_ss(src1[c]) +
+               w2 * _cvtsh_ss(src2[c]) + w3 * _cvtsh_ss(src3[c]);
+    }
+  }
+}
+#endif  // CAFFE_WARP_X86
+
+// The F16C kernels only exist for float; they return false when they do
+// not apply.
+static bool warp_blend_half_f16c(const StoragePrecision precision,
+    const int count, const uint16_t *data1, const int *offset,
+    const float *weight, float *data2) {
+#ifdef CAFFE_WARP_X86
+  if (precision == FP16 && caffe_cpu_has_f16c() &&
+      caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+    warp_blend_fp16_f16c(count, data1, offset, weight, data2);
+    return true;
+  }
+#endif
+  return false;
+}
+
+static bool warp_blend_half_f16c(const StoragePrecision precision,
+    const int count, const uint16_t *data1, const int *offset,
+    const double *weight, double *data2) {
+  return false;
+}
+
+static bool warp_blend_packed_half_f16c(const StoragePrecision precision,
+    const int channels, const int count, const int begin, const int end,
+    const uint16_t *data1, const int *offset, const float *weight,
+    float *data2) {
+#ifdef CAFFE_WARP_X86
+  if (precision == FP16 && caffe_cpu_has_f16c() &&
+      caffe_cpu_simd_level() >= CPU_SIMD_AVX) {
+    warp_blend_packed_fp16_f16c(channels, count, begin, end, data1, offset,
+                                weight, data2);
+    return true;
+  }
+#endif
+  return false;
+}
+
+static bool warp_blend_packed_half_f16c(const StoragePrecision precision,
+    const int channels, const int count, const int begin, const int end,
+    const uint16_t *data1, const int *offset, const double *weight,
+    double *data2) {
+  return false;
+}
+
+template <typename Dtype>
+void caffe_cpu_warp_blend_half(const StoragePrecision precision,
+    const int count, const uint16_t *data1, const int *offset,
+    const Dtype *weight, Dtype *data2) {
+  if (warp_blend_half_f16c(precision, count, data1, offset, weight, data2)) {
+    return;
+  }
+  switch (precision) {
+  case FP16:
+    warp_blend_stored<Dtype, FP16>(count, data1, offset, weight, data2);
+    break;
+  case BF16:
+    warp_blend_stored<Dtype, BF16>(count, data1, offset, weight, data2);
+    break;
+  default:
+    LOG(FATAL) << "Not a 16-bit storage precision: " << precision;
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed_half(const StoragePrecision precision,
+    const int channels, const int count, const int begin, const int end,
+    const uint16_t *data1, const int *offset, const Dtype *weight,
+    Dtype *data2) {
+  CHECK(begin >= 0 && begin <= end && end <= count);
+  if (warp_blend_packed_half_f16c(precision, channels, count, begin, end,
+                                  data1, offset, weight, data2)) {
+    return;
+  }
+  switch (precision) {
+  case FP16:
+    warp_blend_packed_stored<Dtype, FP16>(channels, count, begin, end, data1,
+                                          offset, weight, data2);
+    break;
+  case BF16:
+    warp_blend_packed_stored<Dtype, BF16>(channels, count, begin, end, data1,
+                                          offset, weight, data2);
+    break;
+  default:
+    LOG(FATAL) << "Not a 16-bit storage precision: " << precision;
+  }
+}
+
+// Fixed-point weights of a sampling plan
+// IN : offset, weight [4 count], OUT: qweight [4 count]
+template <typename Dtype>
+void caffe_cpu_warp_plan_fixed(const int count, const int *offset,
+    const Dtype *weight, int *qweight) {
+  const int one = 1 << kWarpFixedBits;
+  for (int i = 0; i < count; ++i) {
+    if (offset[i] < 0) {
+      for (int k = 0; k < kWarpTaps; ++k) {
+        qweight[k * count + i] = 0;
+      }
+      continue;
+    }
+    int o[kWarpTaps];
+    Dtype w[kWarpTaps];
+    for (int k = 0; k < kWarpTaps; ++k) {
+      o[k] = offset[k * count + i];
+      w[k] = weight[k * count + i];
+    }
+    // Clamped NEAREST taps coincide and their weights may leave [0, 1]
+    for (int k = 1; k < kWarpTaps; ++k) {
+      for (int j = 0; j < k; ++j) {
+        if (o[j] == o[k]) {
+          w[j] += w[k];
+          w[k] = 0;
+          break;
+        }
+      }
+    }
+    // The rounding error goes to the largest weight
+    int q[kWarpTaps];
+    int sum = 0;
+    int largest = 0;
+    for (int k = 0; k < kWarpTaps; ++k) {
+      q[k] = static_cast<int>(std::floor(w[k] * one + Dtype(0.5)));
+      sum += q[k];
+      if (w[k] > w[largest]) {
+        largest = k;
+      }
+    }
+    q[largest] += one - sum;
+    for (int k = 0; k < kWarpTaps; ++k) {
+      qweight[k * count + i] = q[k];
+    }
+  }
+}
+
+// 8-bit gather and blend of one plane. The sum is exact in integers and
+// below 2^24, so the output is scale * sum, rounded once.
+template <typename Dtype>
+void caffe_cpu_warp_blend_u8(const int count, const uint8_t *data1,
+    const int *offset, const int *qweight, const Dtype scale,
+    const int zero_point, Dtype *data2) {
+  const Dtype step = scale / (1 << kWarpFixedBits);
+  const int bias = zero_point << kWarpFixedBits;
+  for (int i = 0; i < count; ++i) {
+    if (offset[i] < 0) {
+      data2[i] = 0;
+      continue;
+    }
+    const int sum = qweight[i] * data1[offset[i]] +
+        qweight[count + i] * data1[offset[count + i]] +
+        qweight[2 * count + i] * data1[offset[2 * count + i]] +
+        qweight[3 * count + i] * data1[offset[3 * count + i]];
+    data2[i] = static_cast<Dtype>(sum - bias) * step;
+  }
+}
+
+// Channels-last 8-bit gather and blend of the pixels [begin, end) from
+// channel `channel` on; step and bias are the per-channel dequantization.
+template <typename Dtype>
+static void warp_blend_packed_u8_scalar(const int channels,
+    const int channel, const int count, const int begin, const int end,
+    const uint8_t *data1, const int *offset, const int *qweight,
+    const Dtype *step, const int *bias, Dtype *data2) {
+  for (int i = begin; i < end; ++i) {
+    Dtype* dst = data2 + i * channels;
+    if (offset[i] < 0) {
+      for (int c = channel; c < channels; ++c) {
+        dst[c] = 0;
+      }
+      continue;
+    }
+    const uint8_t* src0 = data1 + offset[i] * channels;
+    const uint8_t* src1 = data1 + offset[count + i] * channels;
+    const uint8_t* src2 = data1 + offset[2 * count + i] * channels;
+    const uint8_t* src3 = data1 + offset[3 * count + i] * channels;
+    const int w0 = qweight[i];
+    const int w1 = qweight[count + i];
+    const int w2 = qweight[2 * count + i];
+    const int w3 = qweight[3 * count + i];
+    for (int c = channel; c < channels; ++c) {
+      const int sum = w0 * src0[c] + w1 * src1[c] + w2 * src2[c] +
+                      w3 * src3[c];
+      dst[c] = static_cast<Dtype>(sum - bias[c]) * step[c];
+    }
+  }
+}
+
+#ifdef CAFFE_WARP_X86
+// AVX2 version for 16 channels at a time, which returns the first channel
+// left for the scalar kernel. Bytes are widened to 16 bits and the taps
+// multiplied pairwise with their weights (< 2^15) by vpmaddwd. The sums are
+// the same integers as in the scalar kernel.
+__attribute__((target("avx2")))
+static int warp_blend_packed_u8_avx2(const int channels, const int count,
+    const int begin, const int end, const uint8_t *data1, const int *offset,
+    const int *qweight, const float *step, const int *bias, float *data2) {
+  const int channel_end = channels - channels % 16;
+  for (int i = begin; i < end; ++i) {
+    float* dst = data2 + i * channels;
+    if (offset[i] < 0) {
+      for (int c = 0; c < channel_end; ++c) {
+        dst[c] = 0;
+      }
+      continue;
+    }
+    const uint8_t* src0 = data1 + offset[i] * channels;
+    const uint8_t* src1 = data1 + offset[count + i] * channels;
+    const uint8_t* src2 = data1 + offset[2 * count + i] * channels;
+    const uint8_t* src3 = data1 + offset[3 * count + i] * channels;
+    // Pairs of 16-bit weights (w0, w1) and (w2, w3)
+    const __m256i w01 = _mm256_set1_epi32(
+        (qweight[count + i] << 16) | qweight[i]);
+    const __m256i w23 = _mm256_set1_epi32(
+        (qweight[3 * count + i] << 16) | qweight[2 * count + i]);
+    for (int c = 0; c < channel_end; c += 16) {
+      const __m256i a0 = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128((const __m128i *)(src0 + c)));
+      const __m256i a1 = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128((const __m128i *)(src1 + c)));
+      const __m256i a2 = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128((const __m128i *)(src2 + c)));
+      const __m256i a3 = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128((const __m128i *)(src3 + c)));
+      // The unpacks work within 128-bit lanes: lo holds the channels 0-3
+      // and 8-11, hi the channels 4-7 and 12-15
+      const __m256i lo = _mm256_add_epi32(
+          _mm256_madd_epi16(_mm256_unpacklo_epi16(a0, a1), w01),
+          _mm256_madd_epi16(_mm256_unpacklo_epi16(a2, a3), w23));
+      const __m256i hi = _mm256_add_epi32(
+          _mm256_madd_epi16(_mm256_unpackhi_epi16(a0, a1), w01),
+          _mm256_madd_epi16(_mm256_unpackhi_epi16(a2, a3), w23));
+      const __m256i sum0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+      const __m256i sum1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+      _mm256_storeu_ps(dst + c, _mm256_mul_ps(_mm256_cvtepi32_ps(
+          _mm256_sub_epi32(sum0, _mm256_loadu_si256(
+              (const __m256i *)(bias + c)))), _mm256_loadu_ps(step + c)));
+      _mm256_storeu_ps(dst + c + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(
+          _mm256_sub_epi32(sum1, _mm256_loadu_si256(
+              (const __m256i *)(bias + c + 8)))),
+          _mm256_loadu_ps(step + c + 8)));
+    }
+  }
+  return channel_end;
+}
+#endif  // CAFFE_WARP_X86
+
+static int warp_blend_packed_u8_simd(const int channels, const int count,
+    const int begin, const int end, const uint8_t *data1, const int *offset,
+    const int *qweight, const float *step, const int *bias, float *data2) {
+#ifdef CAFFE_WARP_X86
+  if (caffe_cpu_simd_level() >= CPU_SIMD_AVX2) {
+    return warp_blend_packed_u8_avx2(channels, count, begin, end, data1,
+        offset, qweight, step, bias, data2);
+  }
+#endif
+  return 0;
+}
+
+static int warp_blend_packed_u8_simd(const int channels, const int count,
+    const int begin, const int end, const uint8_t *data1, const int *offset,
+    const int *qweight, const double *step, const int *bias,
+    double *data2) {
+  return 0;
+}
+
+template <typename Dtype>
+void caffe_cpu_warp_blend_packed_u8(const int channels, const int count,
+    const int begin, const int end, const uint8_t *data1, const int *offset,
+    const int *qweight, const Dtype *scale, const int *zero_point,
+    Dtype *data2) {
+  CHECK(begin >= 0 && begin <= end && end <= count);
+  std::vector<Dtype> step(channels);
+  std::vector<int> bias(channels);
+  for (int c = 0; c < channels; ++c) {
+    step[c] = scale[c] / (1 << kWarpFixedBits);
+    bias[c] = zero_point[c] << kWarpFixedBits;
+  }
+  const int channel = warp_blend_packed_u8_simd(channels, count, begin, end,
+      data1, offset, qweight, &step[0], &bias[0], data2);
+  warp_blend_packed_u8_scalar(channels, channel, count, begin, end, data1,
+      offset, qweight, &step[0], &bias[0], data2);
+}
+
+// Backward (adjoint) operation 1 <- 2 (accumulates)
+// The planes are processed one after the other, which adds the flow
+// gradient of every pixel in increasing channel order.
+template <typename Dtype>
+void caffe_cpu_warp_blend_backward(const int channels, const int count,
+    const int *offset, const Dtype *weight, const Dtype *theta,
+    const Dtype *data1, const Dtype *data2_diff,
+    Dtype *data1_diff, Dtype *flow_diff) {
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* pos1 = data1 + c * count;
+    const Dtype* pos2_diff = data2_diff + c * count;
+    Dtype* pos1_diff = data1_diff ? data1_diff + c * count : NULL;
+    for (int i = 0; i < count; ++i) {
+      if (offset[i] < 0) {
+        continue;
+      }
+      const int o0 = offset[i];
+      const int o1 = offset[count + i];
+      const int o2 = offset[2 * count + i];
+      const int o3 = offset[3 * count + i];
+      const Dtype diff = pos2_diff[i];
+      if (flow_diff) {
+        const Dtype theta_y = theta[i];
+        const Dtype theta_x = theta[count + i];
+        const Dtype theta_y_ = 1 - theta_y;
+        const Dtype theta_x_ = 1 - theta_x;
+        const Dtype I0 = pos1[o0];
+        const Dtype I1 = pos1[o1];
+        const Dtype I2 = pos1[o2];
+        const Dtype I3 = pos1[o3];
+        flow_diff[count + i] += (-1 * theta_y_ * I0 + theta_y_ * I1 -
+                                 theta_y * I2 + theta_y * I3) * diff;
+        flow_diff[i] += (-1 * theta_x_ * I0 - theta_x * I1 +
+                         theta_x_ * I2 + theta_x * I3) * diff;
+      }
+      if (pos1_diff) {
+        pos1_diff[o0] += weight[i] * diff;
+        pos1_diff[o1] += weight[count + i] * diff;
+        pos1_diff[o2] += weight[2 * count + i] * diff;
+        pos1_diff[o3] += weight[3 * count + i] * diff;
+      }
+    }
+  }
+}
+
+// Channels-last backward (adjoint) operation 1 <- 2 (accumulates)
+template <typename Dtype>
+void caffe_cpu_warp_blend_backward_packed(const int channels,
+    const int channel_begin, const int channel_end,
+    const int count, const int *offset, const Dtype *weight,
+    const Dtype *theta, const Dtype *data1, const Dtype *data2_diff,
+    Dtype *data1_diff, Dtype *flow_diff) {
+  CHECK(channel_begin >= 0 && channel_begin <= channel_end &&
+        channel_end <= channels);
+  for (int i = 0; i < count; ++i) {
+    if (offset[i] < 0) {
+      continue;
+    }
+    const int o0 = offset[i] * channels;
+    const int o1 = offset[count + i] * channels;
+    const int o2 = offset[2 * count + i] * channels;
+    const int o3 = offset[3 * count + i] * channels;
+    const Dtype* diff = data2_diff + i * channels;
+    if (flow_diff) {
+      const Dtype theta_y = theta[i];
+      const Dtype theta_x = theta[count + i];
+      const Dtype theta_y_ = 1 - theta_y;
+      const Dtype theta_x_ = 1 - theta_x;
+      for (int c = channel_begin; c < channel_end; ++c) {
+        const Dtype I0 = data1[o0 + c];
+        const Dtype I1 = data1[o1 + c];
+        const Dtype I2 = data1[o2 + c];
+        const Dtype I3 = data1[o3 + c];
+        flow_diff[count + i] += (-1 * theta_y_ * I0 + theta_y_ * I1 -
+                                 theta_y * I2 + theta_y * I3) * diff[c];
+        flow_diff[i] += (-1 * theta_x_ * I0 - theta_x * I1 +
+                         theta_x_ * I2 + theta_x * I3) * diff[c];
+      }
+    }
+    if (data1_diff) {
+      const Dtype w0 = weight[i];
+      const Dtype w1 = weight[count + i];
+      const Dtype w2 = weight[2 * count + i];
+      const Dtype w3 = weight[3 * count + i];
+      for (int c = channel_begin; c < channel_end; ++c) {
+        data1_diff[o0 + c] += w0 * diff[c];
+        data1_diff[o1 + c] += w1 * diff[c];
+        data1_diff[o2 + c] += w2 * diff[c];
+        data1_diff[o3 + c] += w3 * diff[c];
+      }
+    }
+  }
+}
+
+// Explicit instances
+template void caffe_cpu_warp_plan<float>(const WarpParameter_WarpType,
+    const int, const int, const float *, const int, const int, const float,
+    const int, const int, int *, float *, float *);
+template void caffe_cpu_warp_plan<double>(const WarpParameter_WarpType,
+    const int, const int, const double *, const int, const int, const double,
+    const int, const int, int *, double *, double *);
+
+template void caffe_cpu_warp_plan_row<float>(const WarpParameter_WarpType,
+    const int, const int, const float *, const int, const int, const float,
+    const int, int *, float *);
+template void caffe_cpu_warp_plan_row<double>(const WarpParameter_WarpType,
+    const int, const int, const double *, const int, const int, const double,
+    const int, int *, double *);
+
+template void caffe_cpu_warp_blend<float>(const int, const float *, const int *,
+    const float *, float *);
+template void caffe_cpu_warp_blend<double>(const int, const double *,
+    const int *, const double *, double *);
+template void caffe_cpu_warp_blend<float>(const CpuSimdLevel, const int,
+    const float *, const int *, const float *, float *);
+template void caffe_cpu_warp_blend<double>(const CpuSimdLevel, const int,
+    const double *, const int *, const double *, double *);
+
+template void caffe_cpu_warp_blend_packed<float>(const int, const int,
+    const int, const int, const float *, const int *, const float *, float *);
+template void caffe_cpu_warp_blend_packed<double>(const int, const int,
+    const int, const int, const double *, const int *, const double *,
+    double *);
+
+template void caffe_cpu_warp_blend_half<float>(const StoragePrecision,
+    const int, const uint16_t *, const int *, const float *, float *);
+template void caffe_cpu_warp_blend_half<double>(const StoragePrecision,
+    const int, const uint16_t *, const int *, const double *, double *);
+
+template void caffe_cpu_warp_blend_packed_half<float>(const StoragePrecision,
+    const int, const int, const int, const int, const uint16_t *, const int *,
+    const float *, float *);
+template void caffe_cpu_warp_blend_packed_half<double>(const StoragePrecision,
+    const int, const int, const int, const int, const uint16_t *, const int *,
+    const double *, double *);
+
+template void caffe_cpu_warp_plan_fixed<float>(const int, const int *,
+    const float *, int *);
+template void caffe_cpu_warp_plan_fixed<double>(const int, const int *,
+    const double *, int *);
+
+template void caffe_cpu_warp_blend_u8<float>(const int, const uint8_t *,
+    const int *, const int *, const float, const int, float *);
+template void caffe_cpu_warp_blend_u8<double>(const int, const uint8_t *,
+    const int *, const int *, const double, const int, double *);
+
+template void caffe_cpu_warp_blend_packed_u8<float>(const int, const int,
+    const int, const int, const uint8_t *, const int *, const int *,
+    const float *, const int *, float *);
+template void caffe_cpu_warp_blend_packed_u8<double>(const int, const int,
+    const int, const int, const uint8_t *, const int *, const int *,
+    const double *, const int *, double *);
+
+template void caffe_cpu_warp_blend_backward<float>(const int, const int,
+    const int *, const float *, const float *, const float *, const float *,
+    float *, float *);
+template void caffe_cpu_warp_blend_backward<double>(const int, const int,
+    const int *, const double *, const double *, const double *, const double *,
+    double *, double *);
+
+template void caffe_cpu_warp_blend_backward_packed<float>(const int, const int,
+    const int, const int, const int *, const float *, const float *,
+    const float *, const float *, float *, float *);
+template void caffe_cpu_warp_blend_backward_packed<double>(const int, const int,
+    const int, const int, const int *, const double *, const double *,
+    const double *, const double *, double *, double *);
+
+}  // namespace caffe
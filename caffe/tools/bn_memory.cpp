@@ -0,0 +1,66 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+//
+// Usage:
+//    bn_memory net_prototxt [TRAIN|TEST]
+//
+// Reports the memory of the internal buffers of the BN layers of a net in
+// the given phase (TEST by default), next to the memory of its blobs and to
+// what the BN layers would take with the activation-sized buffers of the
+// training pass.
+
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/bn_layer.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+static double megabytes(const double count) {
+  return count * sizeof(float) / (1024. * 1024.);
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc < 2 || argc > 3) {
+    LOG(ERROR) << "Usage: bn_memory net_prototxt [TRAIN|TEST]";
+    return 1;
+  }
+  const string phase_name = (argc == 3) ? argv[2] : "TEST";
+  CHECK(phase_name == "TRAIN" || phase_name == "TEST")
+    << "Unknown phase " << phase_name;
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(argv[1], (phase_name == "TRAIN") ? TRAIN : TEST);
+
+  double blobs = 0;
+  for (int i = 0; i < net.blobs().size(); ++i) {
+    blobs += net.blobs()[i]->count();
+  }
+  int num_bn = 0;
+  double scratch = 0, training_scratch = 0;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const BNLayer<float>* bn =
+      dynamic_cast<const BNLayer<float>*>(net.layers()[i].get());
+    if (!bn) { continue; }
+    ++num_bn;
+    scratch += bn->scratch_count();
+    // x_norm, the broadcast buffer, the statistics and the multipliers
+    const Blob<float>& bottom = *net.bottom_vecs()[i][0];
+    const bool nhwc = (bn->layer_param().bn_param().layout() == NHWC);
+    const int num = nhwc ? bottom.count(0, 3) : bottom.shape(0);
+    const int channels = bottom.shape(nhwc ? 3 : 1);
+    const int spatial = nhwc ? 1 : bottom.count(2);
+    training_scratch += 2. * bottom.count() + num * channels + 2 * channels
+      + spatial + num;
+  }
+  LOG(INFO) << "Blobs of the net: " << megabytes(blobs) << " MB";
+  LOG(INFO) << "Buffers of the " << num_bn << " BN layers in " << phase_name
+            << ": " << megabytes(scratch) << " MB";
+  LOG(INFO) << "With the buffers of the training pass: "
+            << megabytes(training_scratch) << " MB";
+  return 0;
+}
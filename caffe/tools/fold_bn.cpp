@@ -0,0 +1,42 @@
+// Copyright 2017 Max Planck Society
+// Distributed under the BSD-3 Software license,
+// (See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/BSD-3-Clause)
+//
+// Usage:
+//    fold_bn deploy_prototxt in_caffemodel out_prototxt out_caffemodel
+//
+// Folds the BN layers that follow a Convolution into the convolution weights
+// for the TEST phase, merges the remaining BN and ReLU pairs into BN layers
+// with bn_param.relu, replaces the layers computed from constant DummyData
+// by their output, and writes the net definition and the weights without
+// the removed layers.
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/net_surgery.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fold_bn deploy_prototxt in_caffemodel "
+               << "out_prototxt out_caffemodel";
+    return 1;
+  }
+  NetParameter param, weights;
+  ReadNetParamsFromTextFileOrDie(argv[1], &param);
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &weights);
+  const int folded = FoldBNIntoConvolution(TEST, &param, &weights);
+  LOG(INFO) << "Folded " << folded << " BN layers.";
+  const int merged = MergeBNReLU(&param);
+  LOG(INFO) << "Merged " << merged << " ReLU layers into BN layers.";
+  const int constant = FoldConstantLayers(&param, &weights);
+  LOG(INFO) << "Folded " << constant << " constant layers.";
+  WriteProtoToTextFile(param, argv[3]);
+  WriteProtoToBinaryFile(weights, argv[4]);
+  return 0;
+}
@@ -0,0 +1,116 @@
+# Copyright 2017 Max Planck Society
+# Distributed under the BSD-3 Software license,
+# (See accompanying file LICENSE.txt or copy at
+# https://opensource.org/licenses/BSD-3-Clause)
+
+# Calibrates the 8-bit storage (warp_param.storage: UINT8) of the Warp layers
+# of a NetWarp deploy prototxt. The network is run in float over sample
+# frames, the range of every channel of the warped features is recorded and
+# the per-channel scale and zero point are written into a new prototxt.
+# python calibrate_warp_quantization.py VAL path_to_prototxt path_to_caffemodel path_to_output_prototxt [num_frames]
+
+from __future__ import print_function, division
+import os
+import sys
+
+from cityscapes_data import *
+from fetch_and_transform_data import *
+
+import numpy as np
+from google.protobuf import text_format
+
+STRIDE = 476
+
+def warp_layers(net_param):
+    """Warp layers of a NetParameter"""
+    return [layer for layer in net_param.layer if layer.type == 'Warp']
+
+def update_ranges(net, layers, ranges, nhwc):
+    """per-channel min and max of the images warped by the layers"""
+    for layer in layers:
+        data = net.blobs[layer.bottom[0]].data
+        axes = (0, 1, 2) if layer.warp_param.layout == nhwc else (0, 2, 3)
+        lo = np.amin(data, axis=axes)
+        hi = np.amax(data, axis=axes)
+        if layer.name in ranges:
+            lo = np.minimum(lo, ranges[layer.name][0])
+            hi = np.maximum(hi, ranges[layer.name][1])
+        ranges[layer.name] = (lo, hi)
+
+def quantization(lo, hi):
+    """scale and zero point of every channel, zero is exactly representable"""
+    lo = np.minimum(lo, 0)
+    hi = np.maximum(hi, 0)
+    scale = np.maximum(hi - lo, 1e-8) / 255
+    zero_point = np.clip(np.round(-lo / scale), 0, 255).astype(np.int64)
+    return scale, zero_point
+
+def calibrate(datatype, prototxt, caffemodel, out_prototxt, num_frames):
+    caffe_root = os.path.join(os.environ['NETWARP_BUILD_DIR'], 'tmp_caffe_clone/src/CaffeUpstream/')
+    sys.path.insert(0, caffe_root + 'python')
+    import caffe
+    from caffe.proto import caffe_pb2
+    caffe.set_mode_cpu()
+    net = caffe.Net(prototxt, caffemodel, caffe.TEST)
+
+    net_param = caffe_pb2.NetParameter()
+    with open(prototxt) as f:
+        text_format.Merge(f.read(), net_param)
+    layers = warp_layers(net_param)
+    if not layers:
+        print('No Warp layer in ' + prototxt)
+        return
+
+    ranges = {}
+    frames = 0
+    for vid_num in range(0, len(VID_NAMES[datatype])):
+        for frame_idx in GT_FRAMES[datatype][vid_num]:
+            if frames >= num_frames:
+                break
+            frames = frames + 1
+            print('Calibrating on frame ' + str(frames) + '/' + str(num_frames))
+            [img_array, flo_array, _, _] = get_scaled_img_flo_array(datatype, vid_num, frame_idx, 1.0, 2)
+            height, width = img_array[0].shape[2:]
+            h_grid = int(np.ceil((height-CROP_SIZE)/STRIDE) + 1)
+            w_grid = int(np.ceil((width-CROP_SIZE)/STRIDE) + 1)
+            for grid_yidx in range(0,h_grid):
+                for grid_xidx in range(0,w_grid):
+                    e_x = np.min([grid_xidx * STRIDE + CROP_SIZE, width])
+                    e_y = np.min([grid_yidx * STRIDE + CROP_SIZE, height])
+                    s_x = e_x - CROP_SIZE
+                    s_y = e_y - CROP_SIZE
+                    # The previous frame first, as in run_netwarp.py: the
+                    # second pass warps real features
+                    inputs = {}
+                    inputs['conv5_4_1'] = np.zeros(net.blobs['conv5_4_1'].data.shape)
+                    inputs['flo_1'] = np.zeros((1,2,CROP_SIZE,CROP_SIZE))
+                    inputs['data_1'] = np.zeros((1,3,CROP_SIZE,CROP_SIZE))
+                    inputs['data_0'] = img_array[0][:,:,s_y:e_y,s_x:e_x]
+                    net.forward_all(**inputs)
+                    inputs = {}
+                    inputs['conv5_4_1'] = net.blobs['conv5_4'].data[:,:,:,:]
+                    inputs['flo_1'] = flo_array[0][:,:,s_y:e_y,s_x:e_x]
+                    inputs['data_0'] = img_array[1][:,:,s_y:e_y,s_x:e_x]
+                    inputs['data_1'] = img_array[0][:,:,s_y:e_y,s_x:e_x]
+                    net.forward_all(**inputs)
+                    update_ranges(net, layers, ranges, caffe_pb2.NHWC)
+
+    for layer in layers:
+        scale, zero_point = quantization(*ranges[layer.name])
+        layer.warp_param.storage = caffe_pb2.UINT8
+        del layer.warp_param.quant_scale[:]
+        del layer.warp_param.quant_zero_point[:]
+        layer.warp_param.quant_scale.extend(scale.tolist())
+        layer.warp_param.quant_zero_point.extend(zero_point.tolist())
+        print(layer.name + ': scale in [' + str(scale.min()) + ', ' + str(scale.max()) + ']')
+    with open(out_prototxt, 'w') as f:
+        f.write(text_format.MessageToString(net_param))
+    print('Wrote ' + out_prototxt)
+
+if __name__ == '__main__':
+    if len(sys.argv)==5:
+        calibrate(sys.argv[1],sys.argv[2],sys.argv[3],sys.argv[4],20)
+    elif len(sys.argv)==6:
+        calibrate(sys.argv[1],sys.argv[2],sys.argv[3],sys.argv[4],int(sys.argv[5]))
+    else:
+        print('python calibrate_warp_quantization.py VAL path_to_prototxt path_to_caffemodel path_to_output_prototxt [num_frames]')